@@ -0,0 +1,155 @@
+//
+//  AllocationCounter.cpp
+//  realsense-osc-tracker
+//
+
+#include "AllocationCounter.hpp"
+
+#ifdef TRACKER_COUNT_ALLOCATIONS
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<bool> armed(false);
+static std::atomic<size_t> frameAllocations(0);
+static thread_local int threadDepth = 0;    // > 0 on threads counted into the frame
+
+void AllocationCounter::beginFrame(){
+    threadDepth++;
+    frameAllocations.store(0, std::memory_order_relaxed);
+    armed.store(true, std::memory_order_release);
+}
+
+size_t AllocationCounter::endFrame(){
+    armed.store(false, std::memory_order_release);
+    threadDepth--;
+    return frameAllocations.load(std::memory_order_relaxed);
+}
+
+AllocationCounter::Worker::Worker(){
+    threadDepth++;
+}
+
+AllocationCounter::Worker::~Worker(){
+    threadDepth--;
+}
+
+static inline void count(){
+    if(threadDepth > 0 && armed.load(std::memory_order_relaxed)){
+        frameAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+static inline void * allocate(std::size_t size){
+    count();
+    return std::malloc(size ? size : 1);
+}
+
+void * operator new(std::size_t size){
+    if(void * p = allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void * operator new[](std::size_t size){
+    if(void * p = allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+    return allocate(size);
+}
+
+void operator delete(void * p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+#ifdef __cpp_aligned_new
+
+// over-aligned types, e.g. alignas(64) members, come through here
+static inline void * allocate(std::size_t size, std::align_val_t alignment){
+    count();
+    void * p = nullptr;
+    size_t a = std::max(size_t(alignment), sizeof(void *));
+    return posix_memalign(&p, a, size ? size : 1) == 0 ? p : nullptr;
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment){
+    if(void * p = allocate(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void * operator new[](std::size_t size, std::align_val_t alignment){
+    if(void * p = allocate(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void * operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate(size, alignment);
+}
+
+void * operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    return allocate(size, alignment);
+}
+
+void operator delete(void * p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void * p, std::align_val_t, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void * p, std::align_val_t, const std::nothrow_t &) noexcept {
+    std::free(p);
+}
+
+#endif
+
+#else
+
+void AllocationCounter::beginFrame(){
+}
+
+size_t AllocationCounter::endFrame(){
+    return 0;
+}
+
+#endif
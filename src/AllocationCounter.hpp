@@ -0,0 +1,36 @@
+//
+//  AllocationCounter.hpp
+//  realsense-osc-tracker
+//
+//  Counts heap allocations per frame when built with TRACKER_COUNT_ALLOCATIONS
+//  (PROJECT_DEFINES in config.make, or the Xcode preprocessor macros). The app
+//  then checks that replayed frames stop allocating after a warm-up.
+//  Without the define nothing is replaced and the count stays 0.
+//
+//  One process-wide counter is armed around a frame. It takes the allocations
+//  of the thread that armed it and of every Worker scope, i.e. the
+//  dispatch_apply blocks the frame fans out to GCD, but not those of the GL
+//  thread or the writer threads running next to it.
+//
+
+#pragma once
+
+#include <cstddef>
+
+namespace AllocationCounter {
+    // arms the counter for the calling thread and its Workers
+    void beginFrame();
+    // disarms it, operator new calls counted since beginFrame()
+    size_t endFrame();
+
+    // counts the calling thread into the frame while in scope, put it first
+    // in blocks that may run on pool threads
+    struct Worker {
+#ifdef TRACKER_COUNT_ALLOCATIONS
+        Worker();
+        ~Worker();
+#else
+        Worker(){}
+#endif
+    };
+}
@@ -0,0 +1,6 @@
+//
+//  BatchProcessor.cpp
+//  realsense-osc-tracker
+//
+
+#include "BatchProcessor.hpp"
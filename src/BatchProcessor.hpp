@@ -0,0 +1,510 @@
+//
+//  BatchProcessor.hpp
+//  realsense-osc-tracker
+//
+//  Runs recorded sessions through the tracker without the GUI, to compare
+//  tracker settings across a tour:
+//
+//  realsense-osc-tracker --batch <settings.json> <output folder> <recording or folder> ...
+//
+//  The settings file is the one the app saves, only the camera and tracking
+//  groups are read. Every recording gets its own player, filter chain and
+//  MeshTracker, and recordings run side by side on all cores. Frames are
+//  processed as fast as they decode, timestamps come from the recording.
+//
+//  Per recording the output folder gets
+//
+//  <name>.tracks.csv    per frame and tracking head: position in the origin frame
+//  <name>.events.csv    heads found, lost and ended
+//  <name>.summary.json  frames, throughput, events and tracking heads per second
+//
+//  and summary.json for the whole batch.
+//
+//  realsense-osc-tracker --compare-filters <settings.json> <recording or folder> ...
+//
+//  runs every frame through both the rs2 filter chain and FusedDepthFilter
+//  with the same options, one recording after the other so the timings are
+//  comparable, and prints per recording the time per frame of each, the
+//  mean difference where both have depth and the pixels only one has. It
+//  fails if the mean difference is over 10 mm or coverage differs by more
+//  than 2% of the pixels.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <librealsense2/rs.hpp>
+#include "DepthRecording.hpp"
+#include "MeshTracker.hpp"
+#include "QuantisedPoints.hpp"
+#include "TrackerFrameConfig.hpp"
+#include "FusedDepthFilter.hpp"
+#include "TrackingVolumes.hpp"
+#include <dispatch/dispatch.h>
+#include <fstream>
+
+// The parameters of the app the pipeline depends on, under the same names
+// so ofDeserialize() reads the app's settings files
+struct BatchSettings {
+    ofParameter<int> pCameraDecimation{ "Decimation", 2, 1, 8};
+    ofParameter<bool> pCameraFusedFilter{ "Fused Filter", false};
+    ofParameterGroup pgCamera{ "Camera", pCameraDecimation, pCameraFusedFilter };
+
+    ofParameter<glm::vec3> pTrackingCameraPosition{ "Tracking Camera Position", glm::vec3(0.,0.,0.), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pTrackingCameraRotation{ "Tracking Camera Rotation", glm::vec3(0.,0.,0.), glm::vec3(-180.,-180.,-180.), glm::vec3(180.,180.,180.)};
+    ofParameter<glm::vec3> pTrackingBoxPosition{ "Tracking Box Position", glm::vec3(0.,0.,0.), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pTrackingBoxRotation{ "Tracking Box Rotation", glm::vec3(0.,0.,0.), glm::vec3(-180.,-180.,-180.), glm::vec3(180.,180.,180.)};
+    ofParameter<glm::vec3> pTrackingBoxSize{ "Tracking Box Size", glm::vec3(1.,1.,1.), glm::vec3(0.,0.,0.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pTrackingStartPosition{ "Start Position", glm::vec3(0.,0.,0.), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<bool> pTrackingCoarseToFine{ "Coarse To Fine", false};
+    ofParameter<int> pTrackingCoarseDecimation{ "Coarse Decimation", 4, 2, 8};
+    ofParameter<int> pTrackingFineDecimation{ "Fine Decimation", 1, 1, 4};
+    ofParameter<int> pTrackingMaxHeads{ "Max Heads", 3, 1, 16};
+    ofParameter<bool> pTrackingFixedKernels{ "Fixed Head Kernels", true};
+    // the room for SyntheticCrowd, where default.json has it when a file does not
+    ofParameter<glm::vec3> pFloorPlanePosition{ "Floor Plane Position", glm::vec3(0.,0.,3.5), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pWallNegXPlanePosition{ "Wall -X Plane Position", glm::vec3(-5.,2.,3.5), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pWallPosXPlanePosition{ "Wall +X Plane Position", glm::vec3(5.,2.,3.5), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameter<glm::vec3> pBackWallPlane{ "Back Wall Plane Position", glm::vec3(0.,2.,0.), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
+    ofParameterGroup pgTracking{ "Tracking", pTrackingCameraPosition, pTrackingCameraRotation, pTrackingBoxPosition, pTrackingBoxRotation, pTrackingBoxSize, pTrackingStartPosition, pTrackingCoarseToFine, pTrackingCoarseDecimation, pTrackingFineDecimation, pTrackingMaxHeads, pTrackingFixedKernels, pFloorPlanePosition, pWallNegXPlanePosition, pWallPosXPlanePosition, pBackWallPlane };
+
+    ofParameterGroup pgRoot{ "Settings", pgCamera, pgTracking };
+
+    bool load(const string & path){
+        ofJson j = ofLoadJson(path);
+        if(j.is_null() || j.find("Settings") == j.end()){
+            ofLogError("BatchProcessor") << path << " has no settings";
+            return false;
+        }
+        ofDeserialize(j, pgRoot);
+        return true;
+    }
+
+    int getCloudDecimation() const {
+        return pTrackingCoarseToFine ? pTrackingCoarseDecimation : pCameraDecimation;
+    }
+};
+
+// The tracking half of ofApp::processFrame() on the calling thread: filters,
+// point cloud, crop and MeshTracker, in the scene ofApp::publishFrameConfig()
+// builds from the same settings. Nodes keep pointers to their parents, so
+// this stays where it was made.
+class BatchPipeline {
+public:
+
+    ofNode origin;
+    ofNode camera;
+    MeshTracker tracker;
+    TrackerFrameConfig config;
+
+    // maxHeads overrides the settings when given
+    void setup(const BatchSettings & settings, const rs2_intrinsics & intrinsics, float depthScale, int maxHeads = 0){
+        this->depthScale = depthScale;
+        fused = settings.pCameraFusedFilter;
+
+        camera.setParent(origin);
+        camera.setPosition(settings.pTrackingCameraPosition);
+        camera.setOrientation(settings.pTrackingCameraRotation.get());
+        tracker.setParent(origin);
+        tracker.setPosition(settings.pTrackingBoxPosition);
+        tracker.setOrientation(settings.pTrackingBoxRotation.get());
+        tracker.setup(maxHeads > 0 ? maxHeads : settings.pTrackingMaxHeads.get(), settings.pTrackingStartPosition, camera, origin);
+
+        int decimation = settings.getCloudDecimation();
+        config.version = 1;
+        config.cameraToGlobal = camera.getGlobalTransformMatrix();
+        config.cameraToBox = glm::inverse(tracker.getGlobalTransformMatrix()) * config.cameraToGlobal;
+        config.halfExtents = settings.pTrackingBoxSize.get() / 2.0f;
+        config.cameraPosition = camera.getGlobalPosition();
+        config.cameraOrientation = camera.getGlobalOrientation();
+        config.cameraScale = camera.getScale();
+        config.startPosition = settings.pTrackingStartPosition;
+        config.focalArea = (intrinsics.fx / decimation) * (intrinsics.fy / decimation);
+        config.coarseToFine = settings.pTrackingCoarseToFine;
+        config.fineDecimation = settings.pTrackingFineDecimation;
+        config.buildMesh = false;
+        config.fixedKernels = settings.pTrackingFixedKernels;
+        tracker.applyConfig(config);
+
+        FusedDepthFilter::setupFilters(decFilter, spatFilter, tempFilter, decimation);
+        fusedFilter.setSettings(FusedDepthFilter::fromFilters(decFilter, spatFilter, tempFilter));
+        if(config.fineDecimation > 1){
+            fineDecFilter.set_option(RS2_OPTION_FILTER_MAGNITUDE, config.fineDecimation);
+        }
+    }
+
+    // one raw depth frame, up to and including tracker.update()
+    void process(rs2::frame depthFrame){
+        rs2::frame filtered;
+        if(fused){
+            filtered = fusedFilter.process(depthFrame);
+        } else {
+            filtered = decFilter.process(depthFrame);
+            filtered = spatFilter.process(filtered);
+            filtered = tempFilter.process(filtered);
+        }
+        rs2::points points = pc.calculate(filtered);
+
+        // the crop of ofApp::processFrame(), in one chunk on this thread
+        size_t n = points.size();
+        cloud.resize(n);
+        size_t k = TrackingVolumes::cropChunk(points.get_vertices(), 0, n, config, cloud.x.data(), cloud.y.data(), cloud.z.data(),
+                                              nullptr, nullptr, 0, nullptr);
+        tracker.addPoints(cloud.x.data(), cloud.y.data(), cloud.z.data(), cloud.category.data(), k);
+
+        if(config.coarseToFine){
+            rs2::frame fineFrame = config.fineDecimation > 1 ? fineDecFilter.process(depthFrame) : depthFrame;
+            auto fineDepth = fineFrame.as<rs2::video_frame>();
+            auto fineIntrinsics = fineDepth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+            tracker.refine((const uint16_t *) fineDepth.get_data(),
+                           fineDepth.get_width(), fineDepth.get_height(),
+                           fineDepth.get_stride_in_bytes() / sizeof(uint16_t),
+                           fineIntrinsics, depthScale);
+        }
+
+        tracker.update(depthFrame.get_timestamp() / 1000.0);
+    }
+
+private:
+    float depthScale = 0.001;
+    bool fused = false;
+    rs2::decimation_filter decFilter;
+    rs2::spatial_filter spatFilter;
+    rs2::temporal_filter tempFilter;
+    FusedDepthFilter fusedFilter;
+    rs2::decimation_filter fineDecFilter;
+    rs2::pointcloud pc;
+    QuantisedPoints::Cloud cloud;
+};
+
+struct BatchSessionResult {
+    string path;
+    string name;
+    bool ok = false;
+    size_t frames = 0;
+    size_t corruptFrames = 0;
+    double recordingSeconds = 0;
+    double processingSeconds = 0;
+    int found = 0;          // ready or lost to tracking
+    int lost = 0;
+    int ended = 0;          // lost for good
+    int maxTracking = 0;
+    vector<int> trackingPerSecond;  // most heads tracking at once, per second of the recording
+
+    ofJson toJson() const {
+        ofJson j;
+        j["recording"] = path;
+        j["ok"] = ok;
+        j["frames"] = frames;
+        j["corrupt_frames"] = corruptFrames;
+        j["recording_seconds"] = recordingSeconds;
+        j["processing_seconds"] = processingSeconds;
+        j["frames_per_second"] = processingSeconds > 0 ? frames / processingSeconds : 0.0;
+        j["realtime_factor"] = processingSeconds > 0 ? recordingSeconds / processingSeconds : 0.0;
+        j["found"] = found;
+        j["lost"] = lost;
+        j["ended"] = ended;
+        j["max_tracking"] = maxTracking;
+        j["tracking_per_second"] = trackingPerSecond;
+        return j;
+    }
+};
+
+class BatchSession {
+public:
+
+    BatchSessionResult run(const string & path, const BatchSettings & settings, const string & outputFolder){
+        BatchSessionResult result;
+        result.path = path;
+        result.name = ofFilePath::getBaseName(path);
+
+        DepthPlayer player;
+        if(!player.open(path)) return result;
+
+        std::ofstream tracks(ofFilePath::join(outputFolder, result.name + ".tracks.csv"));
+        std::ofstream events(ofFilePath::join(outputFolder, result.name + ".events.csv"));
+        if(!tracks || !events){
+            ofLogError("BatchProcessor") << "Could not write to " << outputFolder;
+            return result;
+        }
+        tracks << "frame,timestamp,head,x,y,z\n";
+        events << "timestamp,head,event\n";
+
+        BatchPipeline pipeline;
+        pipeline.setup(settings, player.getIntrinsics(), player.getDepthScale());
+        MeshTracker & tracker = pipeline.tracker;
+
+        vector<head::TRACKING_STATE> states(tracker.heads.size(), head::TRACKING_STATE::READY);
+        double firstTimestamp = player.getTimestamp(0) / 1000.0;
+        uint64_t start = ofGetElapsedTimeMicros();
+
+        for(size_t f = 0; f < player.getFrameCount(); f++){
+            rs2::frame depthFrame = player.getFrame(f);
+            if(!depthFrame){
+                result.corruptFrames++;
+                continue;
+            }
+            pipeline.process(depthFrame);
+            double timestamp = depthFrame.get_timestamp() / 1000.0;
+            record(result, tracker, states, f, timestamp, timestamp - firstTimestamp, tracks, events);
+            result.frames++;
+        }
+
+        result.processingSeconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+        result.recordingSeconds = (player.getTimestamp(player.getFrameCount() - 1) - player.getTimestamp(0)) / 1000.0;
+        result.ok = true;
+        ofSavePrettyJson(ofFilePath::join(outputFolder, result.name + ".summary.json"), result.toJson());
+        return result;
+    }
+
+private:
+
+    void record(BatchSessionResult & result, MeshTracker & tracker, vector<head::TRACKING_STATE> & states,
+                size_t frame, double timestamp, double elapsed, std::ofstream & tracks, std::ofstream & events){
+        int tracking = 0;
+        for(size_t i = 0; i < tracker.heads.size(); i++){
+            head & h = tracker.heads[i];
+            head::TRACKING_STATE previous = states[i];
+            states[i] = h.state;
+            if(previous != h.state){
+                string event;
+                if(h.isTracking()){
+                    event = previous == head::TRACKING_STATE::LOST ? "found" : "new";
+                    result.found++;
+                } else if(h.isLost()){
+                    event = "lost";
+                    result.lost++;
+                } else {
+                    event = "ended";
+                    result.ended++;
+                }
+                events << ofToString(timestamp, 3) << "," << h.id << "," << event << "\n";
+            }
+            if(h.isTracking()){
+                tracking++;
+                glm::vec3 p = h.getGlobalPosition();
+                tracks << frame << "," << ofToString(timestamp, 3) << "," << h.id << ","
+                << ofToString(p.x, 4) << "," << ofToString(p.y, 4) << "," << ofToString(p.z, 4) << "\n";
+            }
+        }
+        result.maxTracking = std::max(result.maxTracking, tracking);
+        size_t second = size_t(fmax(elapsed, 0.0));
+        if(result.trackingPerSecond.size() <= second){
+            result.trackingPerSecond.resize(second + 1, 0);
+        }
+        result.trackingPerSecond[second] = std::max(result.trackingPerSecond[second], tracking);
+    }
+};
+
+class BatchProcessor {
+public:
+
+    // arguments after --batch, returns the exit code
+    static int run(const vector<string> & args){
+        if(args.size() < 3){
+            std::cerr << "usage: realsense-osc-tracker --batch <settings.json> <output folder> <recording or folder> ..." << std::endl;
+            return 2;
+        }
+
+        BatchSettings settings;
+        if(!settings.load(ofFilePath::getAbsolutePath(args[0], false))) return 1;
+
+        string outputFolder = ofFilePath::getAbsolutePath(args[1], false);
+        if(!ofDirectory::doesDirectoryExist(outputFolder, false) && !ofDirectory::createDirectory(outputFolder, false, true)){
+            ofLogError("BatchProcessor") << "Could not create " << outputFolder;
+            return 1;
+        }
+
+        vector<string> recordings = listRecordings(args, 2);
+        if(recordings.empty()){
+            ofLogError("BatchProcessor") << "No recordings";
+            return 1;
+        }
+
+        // the head logs of a whole night would drown the progress
+        ofLogLevel logLevel = ofGetLogLevel();
+        ofSetLogLevel(OF_LOG_WARNING);
+
+        std::cout << "Processing " << recordings.size() << " recordings" << std::endl;
+        vector<BatchSessionResult> results(recordings.size());
+        BatchSessionResult * resultsPointer = results.data();
+        const vector<string> * recordingsPointer = &recordings;
+        const BatchSettings * settingsPointer = &settings;
+        const string * outputPointer = &outputFolder;
+        std::mutex printMutex;
+        std::mutex * printMutexPointer = &printMutex;
+        uint64_t start = ofGetElapsedTimeMicros();
+
+        // one recording per core, GCD keeps the rest queued
+        dispatch_queue_t queue = dispatch_queue_create("Batch", DISPATCH_QUEUE_CONCURRENT);
+        dispatch_apply(recordings.size(), queue, ^(size_t i){
+            BatchSession session;
+            resultsPointer[i] = session.run((*recordingsPointer)[i], *settingsPointer, *outputPointer);
+            const BatchSessionResult & r = resultsPointer[i];
+            std::lock_guard<std::mutex> lock(*printMutexPointer);
+            if(r.ok){
+                std::cout << r.name << ": " << r.frames << " frames in " << ofToString(r.processingSeconds, 1) << "s, "
+                << ofToString(r.frames / fmax(r.processingSeconds, 1e-6), 0) << " fps, "
+                << r.found << " found, " << r.lost << " lost, " << r.maxTracking << " at most" << std::endl;
+            } else {
+                std::cout << r.name << ": failed" << std::endl;
+            }
+        });
+        dispatch_release(queue);
+
+        double seconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+        size_t frames = 0;
+        double recorded = 0;
+        int failed = 0;
+        ofJson j;
+        j["settings"] = ofFilePath::getAbsolutePath(args[0], false);
+        j["sessions"] = ofJson::array();
+        for(auto & r : results){
+            frames += r.frames;
+            recorded += r.recordingSeconds;
+            if(!r.ok) failed++;
+            j["sessions"].push_back(r.toJson());
+        }
+        j["processing_seconds"] = seconds;
+        j["frames"] = frames;
+        j["frames_per_second"] = frames / fmax(seconds, 1e-6);
+        j["realtime_factor"] = recorded / fmax(seconds, 1e-6);
+        j["failed"] = failed;
+        ofSavePrettyJson(ofFilePath::join(outputFolder, "summary.json"), j);
+
+        std::cout << frames << " frames from " << recordings.size() << " recordings in " << ofToString(seconds, 1) << "s, "
+        << ofToString(recorded / fmax(seconds, 1e-6), 1) << "x real time" << std::endl;
+
+        ofSetLogLevel(logLevel);
+        return failed > 0 ? 1 : 0;
+    }
+
+    // arguments after --compare-filters, returns the exit code
+    static int compareFilters(const vector<string> & args){
+        if(args.size() < 2){
+            std::cerr << "usage: realsense-osc-tracker --compare-filters <settings.json> <recording or folder> ..." << std::endl;
+            return 2;
+        }
+
+        BatchSettings settings;
+        if(!settings.load(ofFilePath::getAbsolutePath(args[0], false))) return 1;
+
+        vector<string> recordings = listRecordings(args, 1);
+        if(recordings.empty()){
+            ofLogError("BatchProcessor") << "No recordings";
+            return 1;
+        }
+
+        const double maxMeanDifference = 10;    // mm
+        const double maxCoverageDifference = 0.02;  // of the pixels, valid in only one of the two
+        int failed = 0;
+
+        for(auto & path : recordings){
+            string name = ofFilePath::getBaseName(path);
+            DepthPlayer player;
+            if(!player.open(path)){
+                std::cout << name << ": failed" << std::endl;
+                failed++;
+                continue;
+            }
+
+            rs2::decimation_filter decFilter;
+            rs2::spatial_filter spatFilter;
+            rs2::temporal_filter tempFilter;
+            FusedDepthFilter fusedFilter;
+            FusedDepthFilter::setupFilters(decFilter, spatFilter, tempFilter, settings.getCloudDecimation());
+            fusedFilter.setSettings(FusedDepthFilter::fromFilters(decFilter, spatFilter, tempFilter));
+            float depthScale = player.getDepthScale();
+
+            size_t frames = 0;
+            size_t mismatched = 0;
+            uint64_t chainMicros = 0;
+            uint64_t fusedMicros = 0;
+            uint64_t pixels = 0;
+            uint64_t bothValid = 0;
+            uint64_t onlyChain = 0;
+            uint64_t onlyFused = 0;
+            double differenceSum = 0;   // mm
+
+            for(size_t f = 0; f < player.getFrameCount(); f++){
+                rs2::frame depthFrame = player.getFrame(f);
+                if(!depthFrame) continue;
+
+                uint64_t start = ofGetElapsedTimeMicros();
+                rs2::frame chain = decFilter.process(depthFrame);
+                chain = spatFilter.process(chain);
+                chain = tempFilter.process(chain);
+                uint64_t middle = ofGetElapsedTimeMicros();
+                rs2::frame fused = fusedFilter.process(depthFrame);
+                uint64_t end = ofGetElapsedTimeMicros();
+                chainMicros += middle - start;
+                fusedMicros += end - middle;
+                frames++;
+
+                auto a = chain.as<rs2::video_frame>();
+                auto b = fused.as<rs2::video_frame>();
+                if(a.get_width() != b.get_width() || a.get_height() != b.get_height()){
+                    mismatched++;
+                    continue;
+                }
+                const uint16_t * pa = (const uint16_t *) a.get_data();
+                const uint16_t * pb = (const uint16_t *) b.get_data();
+                size_t strideA = a.get_stride_in_bytes() / sizeof(uint16_t);
+                size_t strideB = b.get_stride_in_bytes() / sizeof(uint16_t);
+                for(int y = 0; y < a.get_height(); y++){
+                    for(int x = 0; x < a.get_width(); x++){
+                        uint16_t da = pa[y * strideA + x];
+                        uint16_t db = pb[y * strideB + x];
+                        if(da && db){
+                            bothValid++;
+                            differenceSum += fabs(double(da) - double(db)) * depthScale * 1000.0;
+                        } else if(da){
+                            onlyChain++;
+                        } else if(db){
+                            onlyFused++;
+                        }
+                    }
+                }
+                pixels += uint64_t(a.get_width()) * a.get_height();
+            }
+
+            double meanDifference = bothValid ? differenceSum / bothValid : 0;
+            // disagreements either way add up, they must not cancel
+            double coverageDifference = pixels ? double(onlyChain + onlyFused) / pixels : 0;
+            bool ok = frames > 0 && mismatched == 0 && meanDifference <= maxMeanDifference && coverageDifference <= maxCoverageDifference;
+            if(!ok) failed++;
+
+            std::cout << name << ": " << frames << " frames, rs2 chain " << ofToString(chainMicros / fmax(frames, 1) / 1000.0, 2)
+            << " ms, fused " << ofToString(fusedMicros / fmax(frames, 1) / 1000.0, 2) << " ms, "
+            << ofToString(meanDifference, 2) << " mm mean difference, "
+            << ofToString(100.0 * onlyChain / fmax(pixels, 1), 2) << "% only rs2, "
+            << ofToString(100.0 * onlyFused / fmax(pixels, 1), 2) << "% only fused";
+            if(mismatched) std::cout << ", " << mismatched << " frames of another size";
+            std::cout << (ok ? "" : "  FAILED") << std::endl;
+        }
+
+        return failed > 0 ? 1 : 0;
+    }
+
+private:
+
+    // files as they are, folders as the recordings in them
+    static vector<string> listRecordings(const vector<string> & args, size_t first){
+        vector<string> recordings;
+        for(size_t i = first; i < args.size(); i++){
+            string path = ofFilePath::getAbsolutePath(args[i], false);
+            if(ofDirectory::doesDirectoryExist(path, false)){
+                ofDirectory dir(path);
+                dir.allowExt("rsdepth");
+                dir.listDir();
+                dir.sort();
+                for(auto & file : dir){
+                    recordings.push_back(file.getAbsolutePath());
+                }
+            } else {
+                recordings.push_back(path);
+            }
+        }
+        return recordings;
+    }
+};
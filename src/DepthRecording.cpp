@@ -0,0 +1,6 @@
+//
+//  DepthRecording.cpp
+//  realsense-osc-tracker
+//
+
+#include "DepthRecording.hpp"
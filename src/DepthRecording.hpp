@@ -0,0 +1,615 @@
+//
+//  DepthRecording.hpp
+//  realsense-osc-tracker
+//
+//  Chunked, indexed container for raw (pre-filter) 16-bit depth frames.
+//
+//  [header][record][payload][record][payload] ... [index][footer]
+//
+//  With compression on, every framesPerChunk'th frame is a key frame
+//  predicted from its left neighbour and the rest are predicted from the
+//  previous frame. Residuals are written as zigzag varints, so a seek never
+//  decodes more than one chunk. A file without a valid footer (crash while
+//  recording) is recovered by scanning the records.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#include <dispatch/dispatch.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+
+struct DepthRecordingHeader {
+    char magic[4] = {'R','S','D','R'};
+    uint32_t version = 1;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t framesPerChunk = 60;
+    uint32_t compressed = 0;
+    float depthScale = 0.001;
+    float ppx = 0.0, ppy = 0.0;
+    float fx = 0.0, fy = 0.0;
+    int32_t model = 0;
+    float coeffs[5] = {0,0,0,0,0};
+};
+
+struct DepthFrameRecord {
+    uint64_t frameNumber;
+    double timestamp; // milliseconds, as reported by rs2::frame::get_timestamp()
+    uint32_t encoding;
+    uint32_t payloadSize;
+};
+
+struct DepthFrameIndexEntry {
+    uint64_t offset;
+    uint64_t frameNumber;
+    double timestamp;
+};
+
+struct DepthRecordingFooter {
+    uint64_t indexOffset = 0;
+    uint64_t frameCount = 0;
+    char magic[4] = {'R','S','D','I'};
+    uint32_t reserved = 0;
+};
+
+class DepthCodec {
+public:
+    enum ENCODING : uint32_t {
+        RAW = 0,
+        KEY = 1,
+        DELTA = 2
+    };
+
+    static size_t maxEncodedSize(size_t pixels){
+        // a residual of a 16 bit value never needs more than 3 varint bytes
+        return pixels * 3;
+    }
+
+    // prev == nullptr encodes a key frame
+    static size_t encode(const uint16_t * src, const uint16_t * prev, size_t width, size_t height, uint8_t * dst){
+        uint8_t * out = dst;
+        for(size_t y = 0; y < height; y++){
+            const uint16_t * row = src + y*width;
+            const uint16_t * prevRow = prev ? prev + y*width : nullptr;
+            int32_t left = 0;
+            for(size_t x = 0; x < width; x++){
+                int32_t predicted = prevRow ? prevRow[x] : left;
+                out = putVarint(out, int32_t(row[x]) - predicted);
+                left = row[x];
+            }
+        }
+        return out - dst;
+    }
+
+    // dst may alias prev, delta frames are decoded in place
+    static bool decode(const uint8_t * src, size_t size, const uint16_t * prev, size_t width, size_t height, uint16_t * dst){
+        const uint8_t * in = src;
+        const uint8_t * end = src + size;
+        for(size_t y = 0; y < height; y++){
+            const uint16_t * prevRow = prev ? prev + y*width : nullptr;
+            uint16_t * row = dst + y*width;
+            int32_t left = 0;
+            for(size_t x = 0; x < width; x++){
+                int32_t residual;
+                if(!getVarint(in, end, residual)) return false;
+                int32_t predicted = prevRow ? prevRow[x] : left;
+                row[x] = uint16_t(predicted + residual);
+                left = row[x];
+            }
+        }
+        return true;
+    }
+
+private:
+    static inline uint8_t * putVarint(uint8_t * out, int32_t v){
+        uint32_t z = (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+        while(z >= 0x80){
+            *out++ = uint8_t(z) | 0x80;
+            z >>= 7;
+        }
+        *out++ = uint8_t(z);
+        return out;
+    }
+
+    static inline bool getVarint(const uint8_t * & in, const uint8_t * end, int32_t & v){
+        uint32_t z = 0;
+        int shift = 0;
+        while(in < end && shift < 28){
+            uint8_t b = *in++;
+            z |= uint32_t(b & 0x7f) << shift;
+            if(!(b & 0x80)){
+                v = int32_t(z >> 1) ^ -int32_t(z & 1);
+                return true;
+            }
+            shift += 7;
+        }
+        return false;
+    }
+};
+
+class DepthRecorder {
+public:
+
+    int maxPendingFrames = 30;
+
+    DepthRecorder(){
+        queue = dispatch_queue_create("Depth Recorder", DISPATCH_QUEUE_SERIAL);
+    }
+
+    ~DepthRecorder(){
+        close();
+    }
+
+    bool open(const string & path, const rs2_intrinsics & intrinsics, float depthScale, bool compressed, uint32_t framesPerChunk = 60){
+        close();
+
+        file = fopen(path.c_str(), "wb");
+        if(!file){
+            ofLogError("DepthRecorder") << "Could not open " << path << " for writing";
+            return false;
+        }
+
+        header = DepthRecordingHeader();
+        header.width = intrinsics.width;
+        header.height = intrinsics.height;
+        header.framesPerChunk = std::max(1u, framesPerChunk);
+        header.compressed = compressed ? 1 : 0;
+        header.depthScale = depthScale;
+        header.ppx = intrinsics.ppx;
+        header.ppy = intrinsics.ppy;
+        header.fx = intrinsics.fx;
+        header.fy = intrinsics.fy;
+        header.model = intrinsics.model;
+        for(int i = 0; i < 5; i++) header.coeffs[i] = intrinsics.coeffs[i];
+
+        fwrite(&header, sizeof(header), 1, file);
+        offset = sizeof(header);
+        index.clear();
+        previous.clear();
+        frameCount = 0;
+        droppedCount = 0;
+        pending = 0;
+        this->path = path;
+
+        ofLogNotice("DepthRecorder") << "Recording to " << path;
+        return true;
+    }
+
+    void addFrame(const rs2::video_frame & frame){
+        if(!file) return;
+
+        if(uint32_t(frame.get_width()) != header.width || uint32_t(frame.get_height()) != header.height){
+            ofLogWarning("DepthRecorder") << "Frame size " << frame.get_width() << "x" << frame.get_height() << " does not match recording";
+            return;
+        }
+
+        // the disk is not keeping up, rather drop a frame than grow without bounds
+        if(pending >= maxPendingFrames){
+            droppedCount++;
+            return;
+        }
+
+        const uint16_t * data = (const uint16_t *) frame.get_data();
+        auto pixels = std::make_shared<vector<uint16_t>>(data, data + header.width*header.height);
+        uint64_t frameNumber = frame.get_frame_number();
+        double timestamp = frame.get_timestamp();
+
+        pending++;
+        dispatch_async(queue, ^{
+            write(*pixels, frameNumber, timestamp);
+            pending--;
+        });
+    }
+
+    void close(){
+        if(!file) return;
+
+        dispatch_sync(queue, ^{});
+
+        DepthRecordingFooter footer;
+        footer.indexOffset = offset;
+        footer.frameCount = index.size();
+        fwrite(index.data(), sizeof(DepthFrameIndexEntry), index.size(), file);
+        fwrite(&footer, sizeof(footer), 1, file);
+        fclose(file);
+        file = nullptr;
+
+        ofLogNotice("DepthRecorder") << "Wrote " << footer.frameCount << " frames to " << path << " (" << droppedCount << " dropped)";
+    }
+
+    bool isRecording(){
+        return file != nullptr;
+    }
+
+    uint64_t getFrameCount(){
+        return frameCount;
+    }
+
+    uint64_t getDroppedCount(){
+        return droppedCount;
+    }
+
+    uint64_t getBytesWritten(){
+        return bytesWritten;
+    }
+
+private:
+
+    void write(const vector<uint16_t> & pixels, uint64_t frameNumber, double timestamp){
+        DepthFrameRecord record;
+        record.frameNumber = frameNumber;
+        record.timestamp = timestamp;
+        record.encoding = DepthCodec::RAW;
+        record.payloadSize = uint32_t(pixels.size() * sizeof(uint16_t));
+        const void * payload = pixels.data();
+
+        if(header.compressed){
+            bool key = (index.size() % header.framesPerChunk) == 0;
+            encoded.resize(DepthCodec::maxEncodedSize(pixels.size()));
+            record.payloadSize = uint32_t(DepthCodec::encode(pixels.data(), key ? nullptr : previous.data(), header.width, header.height, encoded.data()));
+            record.encoding = key ? DepthCodec::KEY : DepthCodec::DELTA;
+            payload = encoded.data();
+            previous = pixels;
+        }
+
+        index.push_back({offset, frameNumber, timestamp});
+        fwrite(&record, sizeof(record), 1, file);
+        fwrite(payload, record.payloadSize, 1, file);
+        offset += sizeof(record) + record.payloadSize;
+        bytesWritten = offset;
+        frameCount++;
+    }
+
+    dispatch_queue_t queue;
+    FILE * file = nullptr;
+    string path;
+    DepthRecordingHeader header;
+    uint64_t offset = 0;
+    vector<DepthFrameIndexEntry> index;
+    vector<uint16_t> previous;
+    vector<uint8_t> encoded;
+    std::atomic<int> pending{0};
+    std::atomic<uint64_t> frameCount{0};
+    std::atomic<uint64_t> droppedCount{0};
+    std::atomic<uint64_t> bytesWritten{0};
+};
+
+class DepthPlayer {
+public:
+
+    bool loop = false;
+
+    ~DepthPlayer(){
+        close();
+    }
+
+    bool open(const string & path){
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0){
+            ofLogError("DepthPlayer") << "Could not open " << path;
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(DepthRecordingHeader)){
+            ofLogError("DepthPlayer") << path << " is not a depth recording";
+            ::close(fd);
+            return false;
+        }
+        size = st.st_size;
+        void * mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(mapped == MAP_FAILED){
+            ofLogError("DepthPlayer") << "Could not map " << path;
+            return false;
+        }
+        data = (const uint8_t *) mapped;
+
+        memcpy(&header, data, sizeof(header));
+        if(memcmp(header.magic, "RSDR", 4) != 0 || header.version != 1 || header.framesPerChunk == 0){
+            ofLogError("DepthPlayer") << path << " is not a depth recording";
+            close();
+            return false;
+        }
+
+        intrinsics.width = header.width;
+        intrinsics.height = header.height;
+        intrinsics.ppx = header.ppx;
+        intrinsics.ppy = header.ppy;
+        intrinsics.fx = header.fx;
+        intrinsics.fy = header.fy;
+        intrinsics.model = (rs2_distortion) header.model;
+        for(int i = 0; i < 5; i++) intrinsics.coeffs[i] = header.coeffs[i];
+
+        if(!readIndex()){
+            ofLogWarning("DepthPlayer") << path << " has no index, scanning frames";
+            scanIndex();
+        }
+        if(index.empty()){
+            ofLogError("DepthPlayer") << path << " contains no frames";
+            close();
+            return false;
+        }
+
+        pixels.assign(header.width*header.height, 0);
+        decodedIndex = npos;
+        position = 0;
+
+        setupSoftwareDevice();
+
+        this->path = path;
+        ofLogNotice("DepthPlayer") << "Opened " << path << ": " << index.size() << " frames " << header.width << "x" << header.height << " @ " << fps << " fps";
+        return true;
+    }
+
+    void close(){
+        if(sensor){
+            sensor->stop();
+            sensor->close();
+            sensor.reset();
+        }
+        if(data){
+            munmap((void *) data, size);
+            data = nullptr;
+        }
+        size = 0;
+        index.clear();
+        decodedIndex = npos;
+        position = 0;
+    }
+
+    bool isOpen(){
+        return data != nullptr;
+    }
+
+    size_t getFrameCount(){
+        return index.size();
+    }
+
+    size_t getPosition(){
+        return position;
+    }
+
+    bool seek(size_t frame){
+        if(frame >= index.size()) return false;
+        position = frame;
+        return true;
+    }
+
+    double getTimestamp(size_t frame){
+        return frame < index.size() ? index[frame].timestamp : 0.0;
+    }
+
+    int getFps(){
+        return fps;
+    }
+
+    float getDepthScale(){
+        return header.depthScale;
+    }
+
+    const rs2_intrinsics & getIntrinsics(){
+        return intrinsics;
+    }
+
+    const string & getPath(){
+        return path;
+    }
+
+    // decoded pixels of a frame, valid until the next call
+    const uint16_t * getPixels(size_t frame){
+        if(frame >= index.size()) return nullptr;
+        if(frame == decodedIndex) return pixels.data();
+
+        size_t start = frame;
+        if(header.compressed){
+            size_t key = frame - frame % header.framesPerChunk;
+            bool continues = decodedIndex != npos && decodedIndex >= key && decodedIndex < frame;
+            start = continues ? decodedIndex + 1 : key;
+        }
+        for(size_t f = start; f <= frame; f++){
+            if(!decode(f)){
+                ofLogError("DepthPlayer") << "Corrupt frame " << f << " in " << path;
+                decodedIndex = npos;
+                return nullptr;
+            }
+            decodedIndex = f;
+        }
+        return pixels.data();
+    }
+
+    // the next frame as an rs2::frame that can go straight into the rs2 filter chain
+    rs2::frame nextFrame(){
+        if(!isOpen()) return rs2::frame();
+        if(position >= index.size()){
+            if(!loop) return rs2::frame();
+            position = 0;
+        }
+        rs2::frame f = getFrame(position);
+        position++;
+        return f;
+    }
+
+    rs2::frame getFrame(size_t frame){
+        const uint16_t * src = getPixels(frame);
+        if(!src || !sensor) return rs2::frame();
+
+        size_t n = header.width*header.height;
+        uint16_t * copy = acquireFrameBuffer(n);
+        memcpy(copy, src, n*sizeof(uint16_t));
+
+        rs2_software_video_frame videoFrame = {};
+        videoFrame.pixels = copy;
+        videoFrame.deleter = [](void * p){ releaseFrameBuffer((uint16_t *) p); };
+        videoFrame.stride = header.width * sizeof(uint16_t);
+        videoFrame.bpp = sizeof(uint16_t);
+        videoFrame.timestamp = index[frame].timestamp;
+        videoFrame.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+        videoFrame.frame_number = int(index[frame].frameNumber);
+        videoFrame.profile = profile.get();
+        sensor->on_video_frame(videoFrame);
+
+        rs2::frame f;
+        queue.poll_for_frame(&f);
+        return f;
+    }
+
+private:
+
+    // Frame buffers are recycled rather than allocated per frame. librealsense
+    // releases them from any thread, possibly after the player is gone, so
+    // the pool lives for the whole process. Every buffer starts with its size.
+    struct FrameBufferPool {
+        std::mutex mutex;
+        vector<uint16_t *> free;
+        size_t pixels = 0;
+    };
+
+    static const size_t frameBufferHeader = 8; // in uint16_t, room for a size_t
+
+    static FrameBufferPool & getFrameBufferPool(){
+        static FrameBufferPool * pool = new FrameBufferPool();
+        return *pool;
+    }
+
+    static uint16_t * acquireFrameBuffer(size_t pixels){
+        auto & pool = getFrameBufferPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(pool.pixels != pixels){
+            for(auto buffer : pool.free) delete[] buffer;
+            pool.free.clear();
+            pool.free.reserve(16);
+            pool.pixels = pixels;
+        }
+        uint16_t * buffer;
+        if(!pool.free.empty()){
+            buffer = pool.free.back();
+            pool.free.pop_back();
+        } else {
+            buffer = new uint16_t[frameBufferHeader + pixels];
+            *(size_t *) buffer = pixels;
+        }
+        return buffer + frameBufferHeader;
+    }
+
+    static void releaseFrameBuffer(uint16_t * pixels){
+        uint16_t * buffer = pixels - frameBufferHeader;
+        auto & pool = getFrameBufferPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if(*(size_t *) buffer == pool.pixels && pool.free.size() < pool.free.capacity()){
+            pool.free.push_back(buffer);
+        } else {
+            delete[] buffer;
+        }
+    }
+
+    bool readIndex(){
+        if(size < sizeof(header) + sizeof(DepthRecordingFooter)) return false;
+        DepthRecordingFooter footer;
+        memcpy(&footer, data + size - sizeof(footer), sizeof(footer));
+        if(memcmp(footer.magic, "RSDI", 4) != 0) return false;
+        if(footer.indexOffset + footer.frameCount*sizeof(DepthFrameIndexEntry) + sizeof(footer) != size) return false;
+
+        index.resize(footer.frameCount);
+        memcpy(index.data(), data + footer.indexOffset, footer.frameCount*sizeof(DepthFrameIndexEntry));
+        for(auto & entry : index){
+            if(!isValidRecord(entry.offset, footer.indexOffset)){
+                index.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void scanIndex(){
+        index.clear();
+        uint64_t offset = sizeof(header);
+        while(isValidRecord(offset, size)){
+            DepthFrameRecord record;
+            memcpy(&record, data + offset, sizeof(record));
+            index.push_back({offset, record.frameNumber, record.timestamp});
+            offset += sizeof(record) + record.payloadSize;
+        }
+    }
+
+    bool isValidRecord(uint64_t offset, uint64_t end){
+        if(offset + sizeof(DepthFrameRecord) > end) return false;
+        DepthFrameRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        return record.encoding <= DepthCodec::DELTA && offset + sizeof(record) + record.payloadSize <= end;
+    }
+
+    bool decode(size_t frame){
+        DepthFrameRecord record;
+        memcpy(&record, data + index[frame].offset, sizeof(record));
+        const uint8_t * payload = data + index[frame].offset + sizeof(record);
+
+        switch(record.encoding){
+            case DepthCodec::RAW:
+                if(record.payloadSize != pixels.size()*sizeof(uint16_t)) return false;
+                memcpy(pixels.data(), payload, record.payloadSize);
+                return true;
+            case DepthCodec::KEY:
+                return DepthCodec::decode(payload, record.payloadSize, nullptr, header.width, header.height, pixels.data());
+            case DepthCodec::DELTA:
+                // a delta frame is only valid on top of the previous frame
+                if(decodedIndex != frame - 1) return false;
+                return DepthCodec::decode(payload, record.payloadSize, pixels.data(), header.width, header.height, pixels.data());
+        }
+        return false;
+    }
+
+    void setupSoftwareDevice(){
+        fps = 60;
+        if(index.size() > 1){
+            double duration = index.back().timestamp - index.front().timestamp;
+            if(duration > 0) fps = std::max(1, int(round((index.size()-1) * 1000.0 / duration)));
+        }
+
+        device = rs2::software_device();
+        sensor = std::make_shared<rs2::software_sensor>(device.add_sensor("Depth"));
+
+        rs2_video_stream stream = {};
+        stream.type = RS2_STREAM_DEPTH;
+        stream.index = 0;
+        stream.uid = 0;
+        stream.width = header.width;
+        stream.height = header.height;
+        stream.fps = fps;
+        stream.bpp = sizeof(uint16_t);
+        stream.fmt = RS2_FORMAT_Z16;
+        stream.intrinsics = intrinsics;
+        profile = sensor->add_video_stream(stream);
+
+        sensor->add_read_only_option(RS2_OPTION_DEPTH_UNITS, header.depthScale);
+        sensor->open(profile);
+        sensor->start(queue);
+    }
+
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+    string path;
+    const uint8_t * data = nullptr;
+    size_t size = 0;
+    DepthRecordingHeader header;
+    rs2_intrinsics intrinsics;
+    vector<DepthFrameIndexEntry> index;
+    vector<uint16_t> pixels;
+    size_t decodedIndex = npos;
+    size_t position = 0;
+    int fps = 60;
+
+    rs2::software_device device;
+    std::shared_ptr<rs2::software_sensor> sensor;
+    rs2::stream_profile profile;
+    rs2::frame_queue queue{1};
+};
@@ -0,0 +1,6 @@
+//
+//  FloorCalibration.cpp
+//  realsense-osc-tracker
+//
+
+#include "FloorCalibration.hpp"
@@ -0,0 +1,197 @@
+//
+//  FloorCalibration.hpp
+//  realsense-osc-tracker
+//
+//  Finds the floor in a depth cloud and levels the tracking camera on it.
+//  A sample of one cloud is copied on the calling thread, the RANSAC plane
+//  fit then runs in the background with the hypotheses spread over the
+//  global queue. Only planes within maxTilt of the current idea of vertical
+//  are considered, so walls do not win just because they are closer.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <librealsense2/rs.hpp>
+#include <dispatch/dispatch.h>
+#include "glm/gtx/quaternion.hpp"
+#include <random>
+#include <atomic>
+
+class FloorCalibration {
+public:
+
+    struct Result {
+        bool valid = false;
+        glm::vec3 normal = {0,1,0};   // camera frame, pointing up
+        float height = 0;             // camera above the floor
+        float inlierRatio = 0;        // of the sampled points
+        float duration = 0;           // seconds
+    };
+
+    size_t maxSamples = 20000;
+    size_t scoreSamples = 2000;       // hypotheses are scored on a subset
+    int hypotheses = 1024;
+    float inlierDistance = 0.02;
+    float maxTilt = 35.0;             // degrees
+
+    FloorCalibration(){
+        queue = dispatch_queue_create("Floor Calibration", DISPATCH_QUEUE_SERIAL);
+    }
+
+    ~FloorCalibration(){
+        // a running fit uses our members
+        dispatch_sync(queue, ^{});
+    }
+
+    // points as the tracker sees them: (x, -y, -z) of the realsense cloud
+    bool start(const rs2::points & points, const glm::quat & cameraOrientation){
+        if(running) return false;
+
+        size_t n = points.size();
+        const rs2::vertex * vs = points.get_vertices();
+        size_t stride = std::max<size_t>(1, n / maxSamples);
+
+        samples.clear();
+        samples.reserve(n / stride + 1);
+        for(size_t i = 0; i < n; i += stride){
+            const rs2::vertex & v = vs[i];
+            if(v.z > 0.3){
+                samples.emplace_back(v.x, -v.y, -v.z);
+            }
+        }
+        if(samples.size() < 100){
+            ofLogWarning("FloorCalibration") << "Not enough points to calibrate on";
+            return false;
+        }
+
+        up = glm::normalize(glm::inverse(cameraOrientation) * glm::vec3(0,1,0));
+        running = true;
+        dispatch_async(queue, ^{
+            fit();
+        });
+        return true;
+    }
+
+    bool isRunning(){
+        return running;
+    }
+
+    // true once for every finished fit, the result is then ready
+    bool hasResult(){
+        return finished.exchange(false);
+    }
+
+    Result getResult(){
+        return result;
+    }
+
+    // the camera orientation with its view of floorNormal turned to global up,
+    // the smallest rotation that does it, so the heading is kept
+    static glm::quat level(const glm::quat & cameraOrientation, const glm::vec3 & floorNormal){
+        glm::vec3 g = glm::normalize(cameraOrientation * floorNormal);
+        return glm::rotation(g, glm::vec3(0,1,0)) * cameraOrientation;
+    }
+
+private:
+
+    struct Plane {
+        glm::vec3 normal;
+        float d = 0;        // normal . p + d = 0, d is the camera height
+        size_t score = 0;
+    };
+
+    void fit(){
+        float start = ofGetElapsedTimef();
+
+        const glm::vec3 * s = samples.data();
+        const size_t n = samples.size();
+        const size_t scoreStride = std::max<size_t>(1, n / scoreSamples);
+        const float cosMaxTilt = cos(glm::radians(maxTilt));
+        const float threshold = inlierDistance;
+        const glm::vec3 upward = up;
+
+        const size_t batches = 16;
+        const int perBatch = (hypotheses + batches - 1) / batches;
+        Plane candidates[batches];
+        Plane * candidatesPointer = candidates;
+        uint32_t seed = uint32_t(ofGetElapsedTimeMicros());
+
+        dispatch_apply(batches, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t b){
+            std::mt19937 rng(seed + uint32_t(b) * 7919);
+            std::uniform_int_distribution<size_t> pick(0, n-1);
+            Plane best;
+            for(int k = 0; k < perBatch; k++){
+                glm::vec3 p0 = s[pick(rng)];
+                glm::vec3 normal = glm::cross(s[pick(rng)] - p0, s[pick(rng)] - p0);
+                float length = glm::length(normal);
+                if(length < 1e-6) continue;
+                normal /= length;
+                if(glm::dot(normal, upward) < 0) normal = -normal;
+                if(glm::dot(normal, upward) < cosMaxTilt) continue;
+                float d = -glm::dot(normal, p0);
+                if(d <= 0) continue; // the camera is above the floor
+                size_t score = 0;
+                for(size_t i = 0; i < n; i += scoreStride){
+                    if(fabs(glm::dot(normal, s[i]) + d) < threshold) score++;
+                }
+                if(score > best.score){
+                    best.normal = normal;
+                    best.d = d;
+                    best.score = score;
+                }
+            }
+            candidatesPointer[b] = best;
+        });
+
+        Plane best;
+        for(auto & c : candidates){
+            if(c.score > best.score) best = c;
+        }
+
+        Result r;
+        if(best.score > 0){
+            // least squares on the inliers of the full sample
+            glm::dvec3 sum(0);
+            size_t count = 0;
+            for(size_t i = 0; i < n; i++){
+                if(fabs(glm::dot(best.normal, s[i]) + best.d) < threshold){
+                    sum += glm::dvec3(s[i]);
+                    count++;
+                }
+            }
+            glm::dvec3 centroid = sum / double(count);
+            glm::dmat3 c(0);
+            for(size_t i = 0; i < n; i++){
+                if(fabs(glm::dot(best.normal, s[i]) + best.d) < threshold){
+                    glm::dvec3 q = glm::dvec3(s[i]) - centroid;
+                    c += glm::outerProduct(q, q);
+                }
+            }
+            // the normal is the smallest eigenvector of c, the largest of trace - c
+            glm::dmat3 m = glm::dmat3(c[0][0] + c[1][1] + c[2][2]) - c;
+            glm::dvec3 normal(best.normal);
+            for(int i = 0; i < 16; i++){
+                normal = glm::normalize(m * normal);
+            }
+            if(glm::dot(glm::vec3(normal), upward) < 0) normal = -normal;
+
+            r.normal = glm::vec3(normal);
+            r.height = float(-glm::dot(normal, centroid));
+            r.inlierRatio = float(count) / n;
+            r.valid = r.height > 0;
+        }
+        r.duration = ofGetElapsedTimef() - start;
+
+        result = r;
+        running = false;
+        finished = true;
+    }
+
+    dispatch_queue_t queue;
+    vector<glm::vec3> samples;
+    glm::vec3 up = {0,1,0};
+    Result result;
+    std::atomic<bool> running{false};
+    std::atomic<bool> finished{false};
+};
@@ -0,0 +1,6 @@
+//
+//  FusedDepthFilter.cpp
+//  realsense-osc-tracker
+//
+
+#include "FusedDepthFilter.hpp"
@@ -0,0 +1,540 @@
+//
+//  FusedDepthFilter.hpp
+//  realsense-osc-tracker
+//
+//  The decimation, spatial and temporal filters of librealsense in one pass
+//  over the raw depth. The rs2 chain allocates a frame per block and walks
+//  the whole image three times, the spatial filter alone twice per
+//  direction. Here every output row is decimated, smoothed along the row,
+//  against the row above and against the last frame while it is in cache,
+//  and bands of rows run in parallel.
+//
+//  Parameters are those of the rs2 blocks, read from them by fromFilters():
+//
+//  decimation  magnitude: median of the valid pixels for 2 and 3, mean for
+//              more, the output padded to a multiple of 4 like rs2 does
+//  spatial     alpha and delta: one recursive pass left to right, right to
+//              left and top down, neighbours closer than delta are blended
+//              by alpha. rs2 iterates and also goes bottom up, with alpha
+//              near 1 that makes no visible difference.
+//  temporal    alpha, delta and the persistency of holes fill: a pixel
+//              closer than delta to the last frame is blended by alpha, a
+//              hole keeps the last value if the pixel was valid often
+//              enough in the last 8 frames
+//
+//  Deltas are millimetres. With SSE2 or NEON the recursion along rows runs
+//  for four rows at once, one per lane, and the blends against the row
+//  above and the last frame take four pixels at a time.
+//
+//  Bands run the top down pass from a few rows above their first one, as
+//  many as it takes (1 - alpha)^n of delta to drop under half a depth unit,
+//  so a band starts where one pass over the whole image would have been,
+//  short of a neighbour landing on the other side of delta.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "AllocationCounter.hpp"
+#include <librealsense2/rs.hpp>
+#include <dispatch/dispatch.h>
+#include <atomic>
+#include <mutex>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace FusedDepth {
+
+    struct Settings {
+        int magnitude = 2;          // of the decimation filter
+        float spatialAlpha = 0.5;
+        float spatialDelta = 20;    // mm
+        float temporalAlpha = 0.4;
+        float temporalDelta = 20;   // mm
+        int persistency = 3;        // holes fill of the temporal filter, 0 to 8
+    };
+
+    // decimated size, rs2 pads both to a multiple of 4
+    inline int outputSize(int size, int magnitude){
+        if(magnitude <= 1) return size;
+        return (size / magnitude + 3) / 4 * 4;
+    }
+
+    // which histories of the last 8 frames, newest in bit 0, let a hole keep the last value
+    inline void buildPersistency(int persistency, bool * table){
+        for(int h = 0; h < 256; h++){
+            int last2 = __builtin_popcount(h & 0x3);
+            int last3 = __builtin_popcount(h & 0x7);
+            int last4 = __builtin_popcount(h & 0xF);
+            int last5 = __builtin_popcount(h & 0x1F);
+            int last8 = __builtin_popcount(h);
+            bool keep = false;
+            switch(persistency){
+                case 1: keep = last8 == 8; break;
+                case 2: keep = last3 >= 2; break;
+                case 3: keep = last4 >= 2; break;
+                case 4: keep = last8 >= 2; break;
+                case 5: keep = last2 >= 1; break;
+                case 6: keep = last5 >= 1; break;
+                case 7: keep = last8 >= 1; break;
+                case 8: keep = true; break;
+                default: break;
+            }
+            table[h] = keep;
+        }
+    }
+
+    // output row y of width real, from magnitude rows of the source
+    inline void decimateRow(const uint16_t * src, size_t stride, int magnitude, int y, float * row, int real){
+        const uint16_t * top = src + size_t(y) * magnitude * stride;
+        if(magnitude <= 1){
+            for(int x = 0; x < real; x++) row[x] = top[x];
+            return;
+        }
+        if(magnitude == 2){
+            // holes sort last, the median of the valid ones is at half their count
+            for(int x = 0; x < real; x++){
+                const uint16_t * s = top + x * 2;
+                uint16_t a = s[0], b = s[1], c = s[stride], d = s[stride + 1];
+                int n = (a != 0) + (b != 0) + (c != 0) + (d != 0);
+                a = a ? a : 0xFFFF;
+                b = b ? b : 0xFFFF;
+                c = c ? c : 0xFFFF;
+                d = d ? d : 0xFFFF;
+                uint16_t lo0 = std::min(a, b), hi0 = std::max(a, b);
+                uint16_t lo1 = std::min(c, d), hi1 = std::max(c, d);
+                uint16_t first = std::min(lo0, lo1), second = std::max(lo0, lo1);
+                uint16_t third = std::min(hi0, hi1);
+                uint16_t lower = std::min(second, third);
+                uint16_t upper = std::max(second, third);
+                // the one at n / 2 of the n valid ones
+                uint16_t median = n == 1 ? first : (n == 4 ? upper : lower);
+                row[x] = n ? median : 0;
+            }
+            return;
+        }
+        if(magnitude == 3){
+            uint16_t values[9];
+            for(int x = 0; x < real; x++){
+                int n = 0;
+                for(int j = 0; j < magnitude; j++){
+                    const uint16_t * s = top + j * stride + x * magnitude;
+                    for(int i = 0; i < magnitude; i++){
+                        uint16_t v = s[i];
+                        // insertion into the sorted valid ones
+                        if(v){
+                            int k = n++;
+                            while(k > 0 && values[k - 1] > v){
+                                values[k] = values[k - 1];
+                                k--;
+                            }
+                            values[k] = v;
+                        }
+                    }
+                }
+                row[x] = n ? values[n / 2] : 0;
+            }
+            return;
+        }
+        for(int x = 0; x < real; x++){
+            uint32_t sum = 0;
+            uint32_t n = 0;
+            for(int j = 0; j < magnitude; j++){
+                const uint16_t * s = top + j * stride + x * magnitude;
+                for(int i = 0; i < magnitude; i++){
+                    sum += s[i];
+                    n += s[i] != 0;
+                }
+            }
+            row[x] = n ? float(sum / n) : 0;
+        }
+    }
+
+    // recursive along the row, both ways
+    inline void smoothRow(float * row, int n, float alpha, float delta){
+        if(n < 2) return;
+        for(int pass = 0; pass < 2; pass++){
+            int step = pass == 0 ? 1 : -1;
+            int x = pass == 0 ? 1 : n - 2;
+            float previous = pass == 0 ? row[0] : row[n - 1];
+            for(int i = 1; i < n; i++, x += step){
+                // noise makes the branch a coin toss, select instead
+                float current = row[x];
+                float blended = previous + alpha * (current - previous);
+                bool near = (current > 0) & (previous > 0) & (fabsf(current - previous) < delta);
+                current = near ? blended : current;
+                row[x] = current;
+                previous = current;
+            }
+        }
+    }
+
+    // smoothRow() on four rows at once, one per lane, the recursion is a
+    // chain of dependent operations and this runs four chains side by side
+#if defined(__SSE2__)
+    inline void smoothRows(float ** rows, int n, float alpha, float delta){
+        if(n < 2) return;
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 a = _mm_set1_ps(alpha);
+        const __m128 d = _mm_set1_ps(delta);
+        alignas(16) float lanes[4];
+        for(int pass = 0; pass < 2; pass++){
+            int step = pass == 0 ? 1 : -1;
+            int x = pass == 0 ? 0 : n - 1;
+            __m128 previous = _mm_set_ps(rows[3][x], rows[2][x], rows[1][x], rows[0][x]);
+            x += step;
+            for(int i = 1; i < n; i++, x += step){
+                __m128 current = _mm_set_ps(rows[3][x], rows[2][x], rows[1][x], rows[0][x]);
+                __m128 diff = _mm_sub_ps(current, previous);
+                __m128 near = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(current, zero), _mm_cmpgt_ps(previous, zero)),
+                                         _mm_cmplt_ps(_mm_andnot_ps(sign, diff), d));
+                __m128 blended = _mm_add_ps(previous, _mm_mul_ps(a, diff));
+                previous = _mm_or_ps(_mm_and_ps(near, blended), _mm_andnot_ps(near, current));
+                _mm_store_ps(lanes, previous);
+                rows[0][x] = lanes[0];
+                rows[1][x] = lanes[1];
+                rows[2][x] = lanes[2];
+                rows[3][x] = lanes[3];
+            }
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    inline void smoothRows(float ** rows, int n, float alpha, float delta){
+        if(n < 2) return;
+        const float32x4_t zero = vdupq_n_f32(0);
+        const float32x4_t d = vdupq_n_f32(delta);
+        for(int pass = 0; pass < 2; pass++){
+            int step = pass == 0 ? 1 : -1;
+            int x = pass == 0 ? 0 : n - 1;
+            float start[4] = {rows[0][x], rows[1][x], rows[2][x], rows[3][x]};
+            float32x4_t previous = vld1q_f32(start);
+            x += step;
+            for(int i = 1; i < n; i++, x += step){
+                float lanes[4] = {rows[0][x], rows[1][x], rows[2][x], rows[3][x]};
+                float32x4_t current = vld1q_f32(lanes);
+                float32x4_t diff = vsubq_f32(current, previous);
+                uint32x4_t near = vandq_u32(vandq_u32(vcgtq_f32(current, zero), vcgtq_f32(previous, zero)),
+                                            vcltq_f32(vabsq_f32(diff), d));
+                previous = vbslq_f32(near, vfmaq_n_f32(previous, diff, alpha), current);
+                vst1q_f32(lanes, previous);
+                rows[0][x] = lanes[0];
+                rows[1][x] = lanes[1];
+                rows[2][x] = lanes[2];
+                rows[3][x] = lanes[3];
+            }
+        }
+    }
+#else
+    inline void smoothRows(float ** rows, int n, float alpha, float delta){
+        for(int i = 0; i < 4; i++){
+            smoothRow(rows[i], n, alpha, delta);
+        }
+    }
+#endif
+
+    // row blended towards reference where both are valid and closer than delta
+#if defined(__SSE2__)
+    inline int blendRowSimd(float * row, const float * reference, int n, float alpha, float delta){
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 sign = _mm_set1_ps(-0.0f);
+        const __m128 a = _mm_set1_ps(alpha);
+        const __m128 d = _mm_set1_ps(delta);
+        int x = 0;
+        for(; x + 4 <= n; x += 4){
+            __m128 c = _mm_loadu_ps(row + x);
+            __m128 r = _mm_loadu_ps(reference + x);
+            __m128 diff = _mm_sub_ps(c, r);
+            __m128 near = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(c, zero), _mm_cmpgt_ps(r, zero)),
+                                     _mm_cmplt_ps(_mm_andnot_ps(sign, diff), d));
+            __m128 blended = _mm_add_ps(r, _mm_mul_ps(a, diff));
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(near, blended), _mm_andnot_ps(near, c)));
+        }
+        return x;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    inline int blendRowSimd(float * row, const float * reference, int n, float alpha, float delta){
+        const float32x4_t zero = vdupq_n_f32(0);
+        const float32x4_t d = vdupq_n_f32(delta);
+        int x = 0;
+        for(; x + 4 <= n; x += 4){
+            float32x4_t c = vld1q_f32(row + x);
+            float32x4_t r = vld1q_f32(reference + x);
+            float32x4_t diff = vsubq_f32(c, r);
+            uint32x4_t near = vandq_u32(vandq_u32(vcgtq_f32(c, zero), vcgtq_f32(r, zero)),
+                                        vcltq_f32(vabsq_f32(diff), d));
+            float32x4_t blended = vfmaq_n_f32(r, diff, alpha);
+            vst1q_f32(row + x, vbslq_f32(near, blended, c));
+        }
+        return x;
+    }
+#else
+    inline int blendRowSimd(float * row, const float * reference, int n, float alpha, float delta){
+        return 0;
+    }
+#endif
+
+    inline void blendRow(float * row, const float * reference, int n, float alpha, float delta){
+        for(int x = blendRowSimd(row, reference, n, alpha, delta); x < n; x++){
+            float c = row[x];
+            float r = reference[x];
+            if(c > 0 && r > 0 && fabs(c - r) < delta){
+                row[x] = r + alpha * (c - r);
+            }
+        }
+    }
+
+    // against the last frame, then holes filled by persistency, the result is the next last frame
+    inline void temporalRow(float * row, float * last, uint8_t * history, int n, float alpha, float delta,
+                            const bool * persistency, uint16_t * out){
+        // the blend keeps zeros zero, so holes are still holes after it
+        blendRow(row, last, n, alpha, delta);
+        for(int x = 0; x < n; x++){
+            float v = row[x];
+            float l = last[x];
+            uint8_t h = history[x];
+            bool valid = v > 0;
+            history[x] = uint8_t(h << 1) | uint8_t(valid);
+            v = (!valid & (l > 0) & persistency[h]) ? l : v;
+            last[x] = v;
+            out[x] = uint16_t(v + 0.5f);
+        }
+    }
+
+    // Everything but the frames, so it can run on plain buffers
+    class Kernel {
+    public:
+
+        static const int bandRows = 16;
+        static const int rowsPerBand = 6;  // the one above, the temporal one and four along
+
+        void setup(int width, int height, const Settings & settings, float depthUnits){
+            int outWidth = outputSize(width, settings.magnitude);
+            int outHeight = outputSize(height, settings.magnitude);
+            if(outWidth != this->outWidth || outHeight != this->outHeight){
+                this->outWidth = outWidth;
+                this->outHeight = outHeight;
+                last.assign(size_t(outWidth) * outHeight, 0);
+                history.assign(size_t(outWidth) * outHeight, 0);
+                bands = (outHeight + bandRows - 1) / bandRows;
+                rows.assign(size_t(bands) * rowsPerBand * outWidth, 0);
+            }
+            if(settings.persistency != persistency){
+                persistency = settings.persistency;
+                buildPersistency(persistency, persistencyTable);
+            }
+            this->settings = settings;
+            this->width = width;
+            this->height = height;
+            float mmToUnits = depthUnits > 0 ? 0.001f / depthUnits : 1.0f;
+            spatialDelta = settings.spatialDelta * mmToUnits;
+            temporalDelta = settings.temporalDelta * mmToUnits;
+
+            // what a row carries down shrinks by 1 - alpha a row, and is at most delta
+            float keep = 1.0f - settings.spatialAlpha;
+            if(keep <= 0 || spatialDelta <= 0.5f){
+                seedRows = 1;
+            } else if(keep >= 1){
+                seedRows = bandRows;
+            } else {
+                seedRows = ofClamp(int(ceilf(logf(0.5f / spatialDelta) / logf(keep))), 1, bandRows);
+            }
+        }
+
+        // forget the last frames, after a seek or a new stream
+        void reset(){
+            std::fill(last.begin(), last.end(), 0);
+            std::fill(history.begin(), history.end(), 0);
+        }
+
+        // one band of output rows, bands are independent
+        void band(int b, const uint16_t * src, size_t srcStride, uint16_t * dst, size_t dstStride){
+            int magnitude = std::max(1, settings.magnitude);
+            int real = settings.magnitude <= 1 ? width : width / magnitude;
+            int realRows = std::min(outHeight, settings.magnitude <= 1 ? height : height / magnitude);
+            float * above = rows.data() + size_t(b) * rowsPerBand * outWidth;
+            float * temporal = above + outWidth;
+            float * tile[4];
+            for(int i = 0; i < 4; i++){
+                tile[i] = temporal + (i + 1) * outWidth;
+            }
+            int y0 = b * bandRows;
+            int y1 = std::min(realRows, y0 + bandRows);
+            const float * reference = nullptr;
+
+            // the rows before the band run the smoothing from above in
+            for(int y = std::max(0, y0 - seedRows); y < y0 && y < realRows; y++){
+                decimateRow(src, srcStride, magnitude, y, tile[0], real);
+                std::fill(tile[0] + real, tile[0] + outWidth, 0.0f);
+                smoothRow(tile[0], real, settings.spatialAlpha, spatialDelta);
+                if(reference){
+                    blendRow(tile[0], reference, outWidth, settings.spatialAlpha, spatialDelta);
+                }
+                std::copy(tile[0], tile[0] + outWidth, above);
+                reference = above;
+            }
+
+            // four rows along, then each against the one above and the last frame
+            for(int y = y0; y < y1; y += 4){
+                int count = std::min(4, y1 - y);
+                for(int i = 0; i < 4; i++){
+                    if(i < count){
+                        decimateRow(src, srcStride, magnitude, y + i, tile[i], real);
+                        std::fill(tile[i] + real, tile[i] + outWidth, 0.0f);
+                    } else {
+                        std::fill(tile[i], tile[i] + outWidth, 0.0f);
+                    }
+                }
+                smoothRows(tile, real, settings.spatialAlpha, spatialDelta);
+                for(int i = 0; i < count; i++){
+                    if(reference){
+                        blendRow(tile[i], reference, outWidth, settings.spatialAlpha, spatialDelta);
+                    }
+                    reference = tile[i];
+                    size_t p = size_t(y + i) * outWidth;
+                    std::copy(tile[i], tile[i] + outWidth, temporal);
+                    temporalRow(temporal, last.data() + p, history.data() + p, outWidth,
+                                settings.temporalAlpha, temporalDelta, persistencyTable, dst + (y + i) * dstStride);
+                }
+                // the tile is refilled next
+                std::copy(tile[count - 1], tile[count - 1] + outWidth, above);
+                reference = above;
+            }
+
+            // padding rows
+            for(int y = std::max(y0, realRows); y < std::min(outHeight, y0 + bandRows); y++){
+                std::fill(dst + y * dstStride, dst + y * dstStride + outWidth, 0);
+            }
+        }
+
+        // all bands, on queue
+        void run(dispatch_queue_t queue, const uint16_t * src, size_t srcStride, uint16_t * dst, size_t dstStride){
+            Kernel * self = this;
+            dispatch_apply(bands, queue, ^(size_t b){
+                AllocationCounter::Worker worker;
+                self->band(int(b), src, srcStride, dst, dstStride);
+            });
+        }
+
+        int outWidth = 0;
+        int outHeight = 0;
+
+    private:
+        Settings settings;
+        int width = 0;
+        int height = 0;
+        int bands = 0;
+        int seedRows = 1;           // run in above each band
+        float spatialDelta = 0;
+        float temporalDelta = 0;
+        int persistency = -1;
+        bool persistencyTable[256];
+        vector<float> last;
+        vector<uint8_t> history;
+        vector<float> rows;         // rowsPerBand per band
+    };
+}
+
+// A drop-in for the dec -> spat -> temp chain: process() takes the camera's
+// depth frame and returns the filtered, decimated one for the pointcloud
+class FusedDepthFilter : public rs2::filter {
+public:
+
+    FusedDepthFilter() : rs2::filter([this](rs2::frame f, rs2::frame_source & source){ filterFrame(f, source); }) {
+        queue = dispatch_queue_create("Fused Depth Filter", DISPATCH_QUEUE_CONCURRENT);
+    }
+
+    ~FusedDepthFilter(){
+        dispatch_release(queue);
+    }
+
+    // forget the last frames before the next one, after a seek, a loop or
+    // being switched back on
+    void reset(){
+        resetPending = true;
+    }
+
+    void setSettings(const FusedDepth::Settings & settings){
+        std::lock_guard<std::mutex> lock(mutex);
+        this->settings = settings;
+    }
+
+    FusedDepth::Settings getSettings(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return settings;
+    }
+
+    // the options the tracker gives its rs2 chain, in the app and in batch runs
+    static void setupFilters(rs2::decimation_filter & decimation, rs2::spatial_filter & spatial, rs2::temporal_filter & temporal, int magnitude){
+        decimation.set_option(RS2_OPTION_FILTER_MAGNITUDE, magnitude);
+        spatial.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 0.95f);
+        temporal.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 0.1f);
+        temporal.set_option(RS2_OPTION_FILTER_SMOOTH_DELTA, 65.0f);
+        temporal.set_option(RS2_OPTION_HOLES_FILL, 7);
+    }
+
+    // the options of an rs2 chain, so both filter alike
+    static FusedDepth::Settings fromFilters(rs2::decimation_filter & decimation, rs2::spatial_filter & spatial, rs2::temporal_filter & temporal){
+        FusedDepth::Settings s;
+        s.magnitude = int(decimation.get_option(RS2_OPTION_FILTER_MAGNITUDE));
+        s.spatialAlpha = spatial.get_option(RS2_OPTION_FILTER_SMOOTH_ALPHA);
+        s.spatialDelta = spatial.get_option(RS2_OPTION_FILTER_SMOOTH_DELTA);
+        s.temporalAlpha = temporal.get_option(RS2_OPTION_FILTER_SMOOTH_ALPHA);
+        s.temporalDelta = temporal.get_option(RS2_OPTION_FILTER_SMOOTH_DELTA);
+        s.persistency = int(temporal.get_option(RS2_OPTION_HOLES_FILL));
+        return s;
+    }
+
+private:
+
+    void filterFrame(rs2::frame f, rs2::frame_source & source){
+        auto depth = f.as<rs2::depth_frame>();
+        if(!depth){
+            source.frame_ready(f);
+            return;
+        }
+        FusedDepth::Settings s = getSettings();
+        auto profile = depth.get_profile().as<rs2::video_stream_profile>();
+        kernel.setup(depth.get_width(), depth.get_height(), s, depth.get_units());
+
+        // a new profile only when the stream or the magnitude changes
+        if(!targetProfile || profile.unique_id() != sourceProfileId || s.magnitude != targetMagnitude){
+            if(profile.unique_id() != sourceProfileId) resetPending = true;
+            sourceProfileId = profile.unique_id();
+            targetMagnitude = s.magnitude;
+            rs2_intrinsics intrinsics = profile.get_intrinsics();
+            float m = float(std::max(1, s.magnitude));
+            intrinsics.width = kernel.outWidth;
+            intrinsics.height = kernel.outHeight;
+            intrinsics.fx /= m;
+            intrinsics.fy /= m;
+            intrinsics.ppx /= m;
+            intrinsics.ppy /= m;
+            targetProfile = profile.clone(profile.stream_type(), profile.stream_index(), profile.format(),
+                                          kernel.outWidth, kernel.outHeight, intrinsics);
+        }
+
+        if(resetPending.exchange(false)){
+            kernel.reset();
+        }
+
+        rs2::frame out = source.allocate_video_frame(targetProfile, f, 0, kernel.outWidth, kernel.outHeight,
+                                                     kernel.outWidth * sizeof(uint16_t), RS2_EXTENSION_DEPTH_FRAME);
+        kernel.run(queue, (const uint16_t *) depth.get_data(), depth.get_stride_in_bytes() / sizeof(uint16_t),
+                   (uint16_t *) out.get_data(), kernel.outWidth);
+        source.frame_ready(out);
+    }
+
+    std::mutex mutex;
+    FusedDepth::Settings settings;
+    FusedDepth::Kernel kernel;
+    dispatch_queue_t queue;
+    rs2::stream_profile targetProfile;
+    int sourceProfileId = -1;
+    int targetMagnitude = -1;
+    std::atomic<bool> resetPending{false};
+};
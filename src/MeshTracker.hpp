@@ -9,12 +9,125 @@
 #include "ofMain.h"
 #include "ofxCv.h"
 #include "ofxOsc.h"
+#include <librealsense2/rs.hpp>
+#include "TrackerFrameConfig.hpp"
+#include "QuantisedPoints.hpp"
+#include "TrackEventLog.hpp"
 
+// Constant velocity Kalman filter with a variable time step.
+// Noise is given per reference step, so at 1/referenceDt Hz it behaves like
+// ofxCv::KalmanPosition::init(smoothness, rapidness).
+class TimedKalmanPosition {
+public:
+    
+    void init(double smoothness, double rapidness, double referenceDt = 1.0/60.0){
+        this->smoothness = smoothness;
+        this->rapidness = rapidness;
+        this->referenceDt = referenceDt;
+        for(auto & a : axes){
+            a = Axis();
+        }
+    }
+    
+    void predict(double dt){
+        double t = fmax(dt, 0.0) / referenceDt; // in reference steps
+        double q = smoothness * t;
+        for(auto & a : axes){
+            a.p += a.v * t;
+            // P = F P F' + Q with F = [1 t; 0 1]
+            a.p00 += t * (2.0 * a.p01 + t * a.p11) + q;
+            a.p01 += t * a.p11;
+            a.p11 += q;
+        }
+    }
+    
+    void update(const glm::vec3 & measurement){
+        for(int i = 0; i < 3; i++){
+            auto & a = axes[i];
+            double s = a.p00 + rapidness;
+            double k0 = a.p00 / s;
+            double k1 = a.p01 / s;
+            double y = measurement[i] - a.p;
+            a.p += k0 * y;
+            a.v += k1 * y;
+            a.p11 -= k1 * a.p01;
+            a.p01 -= k0 * a.p01;
+            a.p00 -= k0 * a.p00;
+        }
+    }
+    
+    glm::vec3 getEstimation() const {
+        return glm::vec3(axes[0].p, axes[1].p, axes[2].p);
+    }
+    
+    // units per second
+    glm::vec3 getVelocity() const {
+        return glm::vec3(axes[0].v, axes[1].v, axes[2].v) / float(referenceDt);
+    }
+    
+    // position, velocity per reference step and covariance of one axis
+    struct Axis {
+        double p = 0.0;
+        double v = 0.0;
+        double p00 = 1.0;
+        double p01 = 0.0;
+        double p11 = 1.0;
+    };
+    
+    const Axis & getAxis(int i) const {
+        return axes[i];
+    }
+    
+    void setAxis(int i, const Axis & a){
+        axes[i] = a;
+    }
+    
+private:
+    Axis axes[3];
+    double smoothness = 0.1;
+    double rapidness = 0.1;
+    double referenceDt = 1.0/60.0;
+};
 
-class head : public ofIcoSpherePrimitive {
-
-    string timestampFormat = "%Y-%m-%d %H:%M:%S.%i";
+// First and second moments of the points a head consumed in one frame.
+// Offsets are taken from the head centre, which keeps the float sums well
+// conditioned a few metres from the camera.
+struct ShapeMoments {
+    float n;
+    glm::vec3 sum;
+    float xx, xy, xz, yy, yz, zz;
+    float heightMin, heightMax;
+    
+    void reset(){
+        n = 0;
+        sum = glm::vec3(0,0,0);
+        xx = xy = xz = yy = yz = zz = 0;
+        heightMin = std::numeric_limits<float>::max();
+        heightMax = -std::numeric_limits<float>::max();
+    }
     
+    void add(const glm::vec3 & d, float height){
+        n += 1;
+        sum += d;
+        xx += d.x*d.x; xy += d.x*d.y; xz += d.x*d.z;
+        yy += d.y*d.y; yz += d.y*d.z; zz += d.z*d.z;
+        heightMin = fminf(heightMin, height);
+        heightMax = fmaxf(heightMax, height);
+    }
+};
+
+// What the moments of the last tracked frame say about the blob, in the
+// global frame with the floor at y = 0.
+struct HeadShape {
+    bool valid = false;
+    float top = 0;                  // highest point above the floor
+    float bottom = 0;               // lowest point above the floor
+    glm::vec3 axis = {0,1,0};       // principal axis, pointing up
+    float lean = 0;                 // degrees between axis and vertical
+    glm::vec3 extent = {0,0,0};     // two standard deviations along x, y and z
+};
+
+class head : public ofIcoSpherePrimitive {
     
 public:
     enum class TRACKING_STATE {
@@ -24,15 +137,21 @@ public:
     };
     
     TRACKING_STATE state = TRACKING_STATE::READY;
-    float lastTimeTracking = 0;
-    float firstTimeTracking = 0;
+    // seconds on the clock of the depth frames
+    double lastTimeTracking = 0;
+    double firstTimeTracking = 0;
+    double lastTimeUpdated = -1;
     float ttl = 4.0;
     glm::vec3 globalDirectionBias = {0,0.0375,0.0};
     
-    ofxCv::KalmanPosition kalman;
+    TimedKalmanPosition kalman;
 
     int id = 0;
     
+    // lifecycle events go here, formatted and written elsewhere
+    TrackEventQueue * events = nullptr;
+    uint8_t volume = 0;
+    
     glm::vec3 trackPointSum;
     glm::vec3 rawGlobalPosition;
     float radiusSquaredMax = 0.0;
@@ -46,6 +165,11 @@ public:
     int lastTrackPointCount = 1;
     float trackPointWeighedCount = 1.0;
     float lastTrackPointWeighedCount = 1.0;
+    float acquisitionThreshold = 800.0;
+    
+    ShapeMoments moments;
+    HeadShape shape;
+    int minShapePoints = 10;
 
     bool isReady(){
         return state == TRACKING_STATE::READY;
@@ -72,7 +196,7 @@ public:
     }
 
     float distanceToHead2(glm::vec3 & v){
-        return glm::distance2(getPosition(), v);
+        return glm::distance2(center, v);
     }
     
     float addTrackPoint(glm::vec3 & v){
@@ -84,6 +208,7 @@ public:
             trackPointCount++;
             trackPointWeighedCount += fabs(v.z*v.z);
             radiusSquaredMax = fmaxf(radiusSquaredMax, dist);
+            moments.add(v - center, glm::dot(globalHeightRow, glm::vec4(v, 1.0)));
             return 1;
         } else if (dist < radiusSquared * 1.5){
             return 2;
@@ -92,7 +217,7 @@ public:
             
             float distV2Line = -1.0;
             //et sted her defineres afstanden af den linje, der tegner vektoren, som skal pege ned i jorden fra centerpunktet i trackerspheren, vinkelret til gulvet
-            auto pos = getPosition();
+            auto pos = center;
             //std::cout<< "the position is " << pos << endl;
             float line_dist = glm::distance2(localFloorPoint, pos);
             //std::cout<< "the distance is " << line_dist << endl;
@@ -113,14 +238,17 @@ public:
         return 0;
     }
     
-    void update(ofNode & startingPointNode){
-        auto now = ofGetElapsedTimef();
+    void update(ofNode & startingPointNode, double now){
+        
+        // the first update after a reset steps one reference frame
+        double dt = lastTimeUpdated < 0 ? 1.0/60.0 : fmin(now - lastTimeUpdated, 1.0);
+        lastTimeUpdated = now;
+        kalman.predict(dt);
 
-        if(trackPointWeighedCount > 800.0){
+        if(trackPointWeighedCount > acquisitionThreshold){
             if(isReady() || isLost()){
                 if(isReady()) firstTimeTracking = now;
-                if(isReady()) ofLogNotice(ofGetTimestampString(timestampFormat)) << "TRACKER (" << id << ") NEW";
-                if(isLost()) ofLogNotice(ofGetTimestampString(timestampFormat)) << "TRACKER (" << id << ") FOUND";
+                emit(isReady() ? TrackEvent::NEW : TrackEvent::FOUND, now);
                 state = TRACKING_STATE::TRACKING;
                 
             }
@@ -137,16 +265,18 @@ public:
             localFloorPoint = glm::vec3(newFloorP) / newFloorP.w;
             radiusSquaredMax = 0.0;
             lastTimeTracking = now;
+            updateShape();
         } else {
             auto gp = getGlobalPosition();
             kalman.update(gp); // feed measurement
             if(isTracking()) radiusSquaredScale = radiusSquaredScaleTracking * 2.0;
+            shape.valid = false;
         }
         if(now - lastTimeTracking > ttl){
             if(isTracking()){
                 state = TRACKING_STATE::LOST;
                 lastTimeTracking = now;
-                ofLogNotice(ofGetTimestampString(timestampFormat)) << "TRACKER (" << id << ") LOST";
+                emit(TrackEvent::LOST, now);
             } else if (isLost()) {
                 setGlobalPosition(startingPointNode.getGlobalPosition());
                 state = TRACKING_STATE::READY;
@@ -157,7 +287,7 @@ public:
                 localFloorPoint = glm::vec3(newFloorP) / newFloorP.w;
                 //std::cout << "localFloorPoint is: " << localFloorPoint << endl;
                 lastTimeTracking = now;
-                ofLogNotice(ofGetTimestampString(timestampFormat)) << "TRACKER (" << id << ") END AFTER " << ofToString(now - firstTimeTracking);
+                emit(TrackEvent::END, now);
                 firstTimeTracking = 0;
             } else if(isReady()){
                 setGlobalPosition(startingPointNode.getGlobalPosition());
@@ -165,14 +295,176 @@ public:
             }
         }
         
-        trackPointSum = getPosition();
+        beginFrame();
+        
+    }
+    
+    void emit(TrackEvent::TYPE type, double now){
+        if(!events) return;
+        TrackEvent e;
+        e.type = type;
+        e.volume = volume;
+        e.headId = int16_t(id);
+        e.clock = now;
+        e.systemMicros = ofGetSystemTimeMicros();
+        e.position = getGlobalPosition();
+        e.duration = type == TrackEvent::END ? float(now - firstTimeTracking) : 0.0f;
+        events->push(e);
+    }
+    
+    // what MeshTracker::addPoints() tests against, millimetres
+    QuantisedPoints::Head getQuantised(uint8_t index){
+        return QuantisedPoints::makeHead(center, localFloorPoint, radiusSquared * radiusSquaredScale, radiusSquared * 1.5, minFloorDistance, index);
+    }
+    
+    // what the points consumed by addPoints() are summed into, heights
+    // measured as addTrackPoint() does
+    QuantisedPoints::Accumulator getAccumulator(const QuantisedPoints::Head & quantised){
+        return QuantisedPoints::makeAccumulator(quantised, globalHeightRow);
+    }
+    
+    // addTrackPoint() for the points summed in millimetres
+    void foldQuantisedTrackPoints(const QuantisedPoints::Accumulator & a){
+        auto & s = a.sums;
+        if(s.n == 0) return;
+        glm::dvec3 sum = glm::dvec3(s.x, s.y, s.z) * 0.001;
+        trackPointSum += glm::vec3(glm::dvec3(a.cx, a.cy, a.cz) * (0.001 * s.n) + sum);
+        trackPointCount += int(s.n);
+        // sum z^2 from the offsets
+        int64_t weight = s.n * int64_t(a.cz) * a.cz + 2 * int64_t(a.cz) * s.z + s.zz;
+        trackPointWeighedCount += float(weight * 1e-6);
+        radiusSquaredMax = fmaxf(radiusSquaredMax, float(s.d2Max * 1e-6));
+        // offsets from the quantised centre, the covariance does not mind the shift
+        moments.n += s.n;
+        moments.sum += glm::vec3(sum);
+        moments.xx += s.xx * 1e-6f; moments.xy += s.xy * 1e-6f; moments.xz += s.xz * 1e-6f;
+        moments.yy += s.yy * 1e-6f; moments.yz += s.yz * 1e-6f; moments.zz += s.zz * 1e-6f;
+        moments.heightMin = fminf(moments.heightMin, s.heightMin);
+        moments.heightMax = fmaxf(moments.heightMax, s.heightMax);
+    }
+    
+    // resets the accumulators and caches what the per point tests read,
+    // call again after the node or its parent moved
+    void beginFrame(){
+        center = getPosition();
+        trackPointSum = center;
         trackPointCount = 1;
         trackPointWeighedCount = 1.0;
         
+        // points arrive in the parent (camera) frame, heights are measured with this
+        glm::mat4 parentToGlobal = getParent() ? getParent()->getGlobalTransformMatrix() : glm::mat4(1.0);
+        parentToGlobalRotation = glm::mat3(parentToGlobal);
+        globalHeightRow = glm::vec4(parentToGlobal[0][1], parentToGlobal[1][1], parentToGlobal[2][1], parentToGlobal[3][1]);
+        moments.reset();
     }
     
+    // Replaces this frame's measurement with full resolution depth pixels inside
+    // the consume sphere. The coarse points still decide acquisition, the fine
+    // pixels decide where the head is. Only heads about to be tracked are refined.
+    void refine(const uint16_t * depth, int width, int height, int stride, const rs2_intrinsics & in, float depthScale){
+        if(trackPointWeighedCount <= acquisitionThreshold) return;
+        
+        glm::vec3 c = center;
+        float r2 = radiusSquared * radiusSquaredScale;
+        float r = sqrtf(r2);
+        float z = -c.z; // realsense looks down +z, the tracker down -z
+        if(z - r < 0.1) return;
+        
+        // bounding box of the projected sphere
+        float u = c.x / z * in.fx + in.ppx;
+        float v = -c.y / z * in.fy + in.ppy;
+        float pr = r / (z - r) * fmaxf(in.fx, in.fy);
+        int u0 = std::max(0, int(u - pr));
+        int u1 = std::min(width - 1, int(u + pr));
+        int v0 = std::max(0, int(v - pr));
+        int v1 = std::min(height - 1, int(v + pr));
+        if(u0 > u1 || v0 > v1) return;
+        
+        // depth range in raw units, also rejects holes
+        float dMin = (z - r) / depthScale;
+        float dMax = (z + r) / depthScale;
+        
+        glm::vec3 sum(0,0,0);
+        int count = 0;
+        ShapeMoments fine;
+        fine.reset();
+        
+        for(int y = v0; y <= v1; y++){
+            const uint16_t * row = depth + y*stride;
+            float ny = (y - in.ppy) / in.fy;
+            for(int x = u0; x <= u1; x++){
+                uint16_t d = row[x];
+                if(d < dMin || d > dMax) continue;
+                float pz = d * depthScale;
+                glm::vec3 p((x - in.ppx) / in.fx * pz, -ny * pz, -pz);
+                if(glm::distance2(p, c) >= r2) continue;
+                sum += p;
+                count++;
+                fine.add(p - c, glm::dot(globalHeightRow, glm::vec4(p, 1.0)));
+            }
+        }
+        if(count == 0) return;
+        
+        // keeps the prior of the current position, as addTrackPoint() does
+        trackPointSum = c + sum;
+        trackPointCount = 1 + count;
+        moments = fine;
+    }
+    
+    void updateShape(){
+        if(moments.n < minShapePoints){
+            shape.valid = false;
+            return;
+        }
+        
+        float n = moments.n;
+        glm::vec3 m = moments.sum / n;
+        glm::mat3 c;
+        c[0][0] = moments.xx/n - m.x*m.x;
+        c[1][1] = moments.yy/n - m.y*m.y;
+        c[2][2] = moments.zz/n - m.z*m.z;
+        c[0][1] = c[1][0] = moments.xy/n - m.x*m.y;
+        c[0][2] = c[2][0] = moments.xz/n - m.x*m.z;
+        c[1][2] = c[2][1] = moments.yz/n - m.y*m.z;
+        
+        // covariance in the global frame
+        glm::mat3 r = parentToGlobalRotation;
+        glm::mat3 g = r * c * glm::transpose(r);
+        
+        shape.extent = 2.0f * glm::sqrt(glm::max(glm::vec3(g[0][0], g[1][1], g[2][2]), glm::vec3(0,0,0)));
+        
+        // power iteration from vertical, a 3x3 converges in a handful of steps
+        glm::vec3 axis(0,1,0);
+        for(int i = 0; i < 8; i++){
+            glm::vec3 next = g * axis;
+            float length = glm::length(next);
+            if(length < 1e-12) break;
+            axis = next / length;
+        }
+        if(axis.y < 0) axis = -axis;
+        shape.axis = axis;
+        shape.lean = glm::degrees(acosf(ofClamp(axis.y, -1.0, 1.0)));
+        shape.top = moments.heightMax;
+        shape.bottom = moments.heightMin;
+        shape.valid = true;
+    }
+    
+    // keeps durations intact when the clock jumps, e.g. a replay looping
+    void rebaseTime(double offset){
+        lastTimeTracking += offset;
+        if(firstTimeTracking != 0) firstTimeTracking += offset;
+        if(lastTimeUpdated >= 0) lastTimeUpdated += offset;
+    }
+    
+    // (re)starts the head, ready and with nothing tracked
     void set( float radius, int resolution){
         kalman.init(1/10000000000., 1/10000000.); // inverse of (smoothness, rapidness);
+        state = TRACKING_STATE::READY;
+        firstTimeTracking = 0;
+        lastTimeUpdated = -1;
+        radiusSquaredScale = 1.0;
+        shape.valid = false;
+        moments.reset();
         radiusSet = radius;
         ofIcoSpherePrimitive::set(radius, resolution);
         radiusSquared = radius*radius;
@@ -187,6 +479,9 @@ public:
 
 private:
     float radiusSquared;
+    glm::vec3 center;       // getPosition() as of beginFrame(), the per point tests run often
+    glm::mat3 parentToGlobalRotation = glm::mat3(1.0);
+    glm::vec4 globalHeightRow = {0,1,0,0};
     
 };
 
@@ -197,8 +492,24 @@ public:
 
     float headRadius = 0.3/2.;
     vector<head> heads;
+    // heads by priority: tracking or lost first, then by when they were found
+    vector<head *> order;
     
     int maxHeads = 5;
+    uint64_t appliedConfigVersion = 0;
+    
+    vector<QuantisedPoints::Head> quantisedHeads;   // in the order addVertex() asks them
+    vector<uint8_t> pointOwner;                      // index in heads, per point of addPoints()
+    vector<QuantisedPoints::Accumulator> accumulators;  // by index in heads, sized by setup()
+    QuantisedPoints::HeadKernels kernels;            // unrolled for 3, 5, 8 and 16 heads
+    
+    TrackEventQueue * events = nullptr;             // none in batch runs
+    uint8_t volume = 0;
+    
+    // Points are weighed by z^2, so the weighed count of a head is roughly its visible
+    // surface times fx*fy of the cloud. 800 was tuned on 848x480 (fx ~ 424px) with decimation 2.
+    float acquisitionArea = 800.0 / (212.0*212.0);
+    float focalArea = 212.0*212.0;
     
     void setup(int maxHeads, glm::vec3 startingPoint, ofNode & camera, ofNode & origin ){
         
@@ -212,53 +523,315 @@ public:
         this->startingPoint.setParent(origin);
         this->startingPoint.setGlobalPosition(startingPoint);
         
+        // starting over ends every track, also those of heads about to go
+        endTracks();
+        
         this->maxHeads = maxHeads;
         heads.resize(maxHeads);
+        accumulators.resize(maxHeads);
         
         int id = 0;
         for( auto & head : heads){
             head.set(headRadius,1);
+            head.acquisitionThreshold = acquisitionArea * focalArea;
             head.id = ++id;
+            head.events = events;
+            head.volume = volume;
             head.setParent(this->camera);
             auto p = this->startingPoint.getGlobalPosition();
             head.setGlobalPosition(p);
+            head.beginFrame();
+        }
+        order.clear();
+        for(auto & head : heads){
+            order.push_back(&head);
+        }
+    }
+    
+    // every head that is tracking or lost ends its track and is ready again,
+    // e.g. before the tracker starts over or goes away
+    void endTracks(){
+        for(auto & head : heads){
+            if(head.isTrackingOrLost()){
+                head.emit(TrackEvent::END, lastTimestamp);
+                head.state = head::TRACKING_STATE::READY;
+            }
+        }
+    }
+    
+    // where the heads report new, found, lost and end, also across setup()
+    void setEventQueue(TrackEventQueue * events, uint8_t volume){
+        this->events = events;
+        this->volume = volume;
+        for(auto & head : heads){
+            head.events = events;
+            head.volume = volume;
+        }
+    }
+    
+    // poses from the snapshot taken at the start of a frame, before any addVertex()
+    void applyConfig(const TrackerFrameConfig & config){
+        if(config.version == appliedConfigVersion) return;
+        appliedConfigVersion = config.version;
+        
+        camera.setGlobalPosition(config.cameraPosition);
+        camera.setGlobalOrientation(config.cameraOrientation);
+        camera.setScale(config.cameraScale);
+        startingPoint.setGlobalPosition(config.startPosition);
+        kernels.fixed = config.fixedKernels;
+        if(config.focalArea > 0){
+            setFocalArea(config.focalArea);
+        }
+        for(auto & head : heads){
+            head.beginFrame();
         }
     }
     
+    // fx*fy in pixels of the cloud handed to addVertex, after decimation
+    void setFocalArea(float focalArea){
+        this->focalArea = focalArea;
+        for(auto & head : heads){
+            head.acquisitionThreshold = acquisitionArea * focalArea;
+        }
+    }
+    
+    // one point in metres, the float reference addPoints() is held to by
+    // selfCheck()
     int addVertex(glm::vec3 & v){
         int pointFound = 0;
         
         // tracking heads consume first
-        for(auto & head : heads){
-            if(head.isTracking()){
-                pointFound = head.addTrackPoint(v);
+        for(auto head : order){
+            if(head->isTracking()){
+                pointFound = head->addTrackPoint(v);
             }
             if(pointFound > 0) break;
         }
         if(pointFound > 0) return pointFound;
         
         // then comes the rest
-        for(auto & head : heads){
-            if(!head.isTracking()){
-                pointFound = head.addTrackPoint(v);
+        for(auto head : order){
+            if(!head->isTracking()){
+                pointFound = head->addTrackPoint(v);
             }
             if(pointFound > 0) break;
         }
         return pointFound;
     }
 
-    void update(){
+    // addVertex() for a block of quantised points, for tracking only: a point's
+    // category is 1 if a head consumed it and 0 otherwise, labelPoints() tells
+    // the rest apart
+    void addPoints(const int16_t * x, const int16_t * y, const int16_t * z, uint8_t * category, size_t n){
+        // tracking heads consume first, then comes the rest
+        quantisedHeads.clear();
+        for(auto head : order){
+            if(head->isTracking()) quantisedHeads.push_back(head->getQuantised(uint8_t(head - heads.data())));
+        }
+        for(auto head : order){
+            if(!head->isTracking()) quantisedHeads.push_back(head->getQuantised(uint8_t(head - heads.data())));
+        }
+        if(pointOwner.size() < n){
+            pointOwner.resize(n);
+        }
+        
+        kernels.claim(x, y, z, n, quantisedHeads, category, pointOwner.data());
+        
+        // summed per owner in vector lanes, then folded into metres once
+        for(auto & q : quantisedHeads){
+            accumulators[q.index] = heads[q.index].getAccumulator(q);
+        }
+        QuantisedPoints::sumClaimed(x, y, z, category, pointOwner.data(), n, accumulators.data(), int(heads.size()));
+        for(auto & q : quantisedHeads){
+            heads[q.index].foldQuantisedTrackPoints(accumulators[q.index]);
+        }
+    }
+    
+    // the category addVertex() would return for each point, for showing the
+    // cloud. Between addPoints() and update(), while the heads stay put.
+    void labelPoints(const int16_t * x, const int16_t * y, const int16_t * z, uint8_t * category, size_t n){
+        if(pointOwner.size() < n){
+            pointOwner.resize(n);
+        }
+        kernels.classify(x, y, z, n, quantisedHeads, category, pointOwner.data());
+    }
+    
+    // The kernels have to agree with each other, and addPoints() has to find
+    // what addVertex() finds: one cloud through both, the same number of
+    // points for every head and its centroid close by. On the millimetre
+    // grid quantising moves nothing, only the float sums may differ, so the
+    // centroids agree within a hundredth of a millimetre. Off the grid every
+    // coordinate moves by up to half a millimetre and so may the centroid.
+    // Points within 2mm of a consume sphere's edge are left out there, as
+    // one flipping in or out would move a centroid by radius / points.
+    static bool selfCheck(){
+        if(!QuantisedPoints::selfCheck()) return false;
+        
+        std::mt19937 rng(5678);
+        std::uniform_real_distribution<float> unit(-1.0, 1.0);
+        auto onGrid = [](glm::vec3 p){
+            return glm::vec3(QuantisedPoints::quantise(p.x), QuantisedPoints::quantise(p.y), QuantisedPoints::quantise(p.z)) * 0.001f;
+        };
+        ofNode origin;
+        ofNode camera;
+        MeshTracker reference;
+        MeshTracker quantised;
+        QuantisedPoints::Cloud cloud;
+        double worstError[2] = {0, 0};
+        int worstCountError = 0;
+        const double bound[2] = {0.00001, 0.0005};
+        
+        for(int round = 0; round < 64; round++){
+            bool offGrid = round >= 32;
+            auto place = [&](glm::vec3 p){
+                return offGrid ? p : onGrid(p);
+            };
+            int headCount = 1 + round % 8;
+            size_t n = 4000 + round;
+            reference.setup(headCount, glm::vec3(0,0,-3), camera, origin);
+            quantised.setup(headCount, glm::vec3(0,0,-3), camera, origin);
+            
+            // apart, so each only sees its own points, every other one tracking
+            vector<glm::vec3> centers(headCount);
+            for(int k = 0; k < headCount; k++){
+                centers[k] = place(glm::vec3(-4.5 + k * 1.3 + unit(rng) * 0.1, unit(rng) * 0.5, -3.0 + unit(rng)));
+                for(auto tracker : {&reference, &quantised}){
+                    auto & h = tracker->heads[k];
+                    h.state = k % 2 == 0 ? head::TRACKING_STATE::TRACKING : head::TRACKING_STATE::READY;
+                    h.setPosition(centers[k]);
+                    h.localFloorPoint = glm::vec3(centers[k].x, -1.5, centers[k].z);
+                    h.beginFrame();
+                }
+            }
+            auto nearEdge = [&](glm::vec3 p){
+                for(int k = 0; k < headCount; k++){
+                    auto & h = reference.heads[k];
+                    float edge = h.getRadius() * sqrtf(h.radiusSquaredScale);
+                    if(fabs(glm::distance(p, centers[k]) - edge) < 0.002) return true;
+                }
+                return false;
+            };
+            
+            cloud.resize(n);
+            for(size_t i = 0; i < n; i++){
+                glm::vec3 p;
+                do {
+                    p = i % 2 == 0 ? centers[i / 2 % headCount] + glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.2f
+                                   : glm::vec3(unit(rng) * 5.0, unit(rng) * 2.0, -4.0 + unit(rng) * 4.0);
+                    p = place(p);
+                } while(offGrid && nearEdge(p));
+                cloud.x[i] = QuantisedPoints::quantise(p.x);
+                cloud.y[i] = QuantisedPoints::quantise(p.y);
+                cloud.z[i] = QuantisedPoints::quantise(p.z);
+                reference.addVertex(p);
+            }
+            quantised.addPoints(cloud.x.data(), cloud.y.data(), cloud.z.data(), cloud.category.data(), n);
+            
+            for(int k = 0; k < headCount; k++){
+                auto & r = reference.heads[k];
+                auto & q = quantised.heads[k];
+                glm::dvec3 error = glm::abs(glm::dvec3(r.trackPointSum) / double(r.trackPointCount) - glm::dvec3(q.trackPointSum) / double(q.trackPointCount));
+                worstError[offGrid] = fmax(worstError[offGrid], fmax(error.x, fmax(error.y, error.z)));
+                worstCountError = std::max(worstCountError, std::abs(r.trackPointCount - q.trackPointCount));
+            }
+        }
+        
+        if(worstCountError > 0 || worstError[0] > bound[0] || worstError[1] > bound[1]){
+            ofLogError("MeshTracker") << "addPoints() off addVertex() by " << worstError[0] * 1000.0 << "mm on the grid, "
+                                      << worstError[1] * 1000.0 << "mm off it, " << worstCountError << " points";
+            return false;
+        }
+        ofLogNotice("MeshTracker") << "addPoints() checked against addVertex(), worst centroid error " << worstError[0] * 1000.0
+                                   << "mm on the grid, " << worstError[1] * 1000.0 << "mm off it";
+        return true;
+    }
+    
+    // QuantisedPoints::benchmark() with the tracker's own passes on the same
+    // scene: addVertex() on the cloud in metres, the float baseline, and
+    // addPoints() on the millimetres
+    static QuantisedPoints::BenchmarkResult benchmark(int headCount, int repeats = 50){
+        vector<QuantisedPoints::Head> sceneHeads;
+        QuantisedPoints::Cloud cloud;
+        auto result = QuantisedPoints::benchmark(headCount, repeats, sceneHeads, cloud);
+        size_t n = cloud.x.size();
+        
+        // the same spheres: consume at (2 + k % 2) r^2, the shell at 1.5 r^2
+        ofNode origin;
+        ofNode camera;
+        MeshTracker tracker;
+        tracker.setup(headCount, glm::vec3(0,0,-3), camera, origin);
+        for(int k = 0; k < headCount; k++){
+            auto & q = sceneHeads[k];
+            auto & h = tracker.heads[k];
+            h.setPosition(glm::vec3(q.cx, q.cy, q.cz) * 0.001f);
+            h.localFloorPoint = glm::vec3(q.fx, q.fy, q.fz) * 0.001f;
+            h.radiusSquaredScale = 2 + k % 2;
+        }
+        vector<glm::vec3> points(n);
+        for(size_t i = 0; i < n; i++){
+            points[i] = glm::vec3(cloud.x[i], cloud.y[i], cloud.z[i]) * 0.001f;
+        }
+        
+        auto time = [&](bool vertices){
+            auto pass = [&]{
+                for(auto & h : tracker.heads){
+                    h.beginFrame();
+                }
+                if(vertices){
+                    for(auto & p : points){
+                        tracker.addVertex(p);
+                    }
+                } else {
+                    tracker.addPoints(cloud.x.data(), cloud.y.data(), cloud.z.data(), cloud.category.data(), n);
+                }
+            };
+            // one round to warm the caches
+            pass();
+            uint64_t start = ofGetElapsedTimeMicros();
+            for(int r = 0; r < repeats; r++){
+                pass();
+            }
+            return (ofGetElapsedTimeMicros() - start) * 1000.0 / (double(n) * repeats);
+        };
+        
+        result.vertexNanos = time(true);
+        result.pointsNanos = time(false);
+        ofLogNotice("MeshTracker") << headCount << " heads: " << result.vertexNanos << "ns per point addVertex(), "
+        << result.pointsNanos << "ns addPoints()";
+        return result;
+    }
+    
+    // full resolution pass over the heads found in the coarse cloud, before update()
+    void refine(const uint16_t * depth, int width, int height, int stride, const rs2_intrinsics & intrinsics, float depthScale){
         for(auto & head : heads){
-            head.update(this->startingPoint);
+            head.refine(depth, width, height, stride, intrinsics, depthScale);
+        }
+    }
+    
+    double lastTimestamp = -1;
+    bool rebaseOnNextUpdate = false;                // restored heads, on the clock of another run
+    
+    // timestamp in seconds of the depth frame the vertices came from
+    void update(double timestamp){
+        if(lastTimestamp >= 0 && (timestamp < lastTimestamp || rebaseOnNextUpdate)){
+            if(!rebaseOnNextUpdate){
+                ofLogNotice("MeshTracker") << "Clock went back " << (lastTimestamp - timestamp) << "s, rebasing heads";
+            }
+            for(auto & head : heads){
+                head.rebaseTime(timestamp - lastTimestamp);
+            }
+        }
+        rebaseOnNextUpdate = false;
+        lastTimestamp = timestamp;
+        
+        for(auto & head : heads){
+            head.update(this->startingPoint, timestamp);
             
         }
-        // make sure the first ones are the first.
-        std::sort(heads.begin(), heads.end(), [](head a, head b) {
-            return a.firstTimeTracking < b.firstTimeTracking;
-        });
-
-        std::sort(heads.begin(), heads.end(), [](head a, head b) {
-            return a.isTrackingOrLost() && !b.isTrackingOrLost();
+        // make sure the first ones are the first, sorting pointers rather than copying heads
+        std::sort(order.begin(), order.end(), [](head * a, head * b) {
+            if(a->isTrackingOrLost() != b->isTrackingOrLost()) return a->isTrackingOrLost();
+            return a->firstTimeTracking < b->firstTimeTracking;
         });
         
         
@@ -283,32 +856,6 @@ public:
 
     }
 
-    void draw(){
-        ofPushMatrix();
-        ofSetColor(255,255,255,255);
-        this->drawWireframe();
-        ofSetColor(255,0,255,255);
-        ofDrawSphere(this->startingPoint.getGlobalPosition(), 0.05);
-        for(auto & head : heads){
-            if(head.isTracking()){
-                ofSetColor(0,255,0,255);
-            } else if (head.isReady()){
-                ofSetColor(0,255,255,255);
-            } else if (head.isLost()){
-                ofSetColor(255,255,0,255);
-            }
-            head.drawWireframe();
-            head.transformGL();
-            ofSetColor(255,0,0,255);
-            ofDrawLine(glm::vec3(0,0,0), head.localFloorPoint);
-            //ofDrawRectangle(head.localFloorPoint.x, head.localFloorPoint.y, 1,1);
-            ofSetColor(255,255);
-            ofDrawBitmapString(ofToString(head.lastTrackPointWeighedCount), glm::vec3(0,0,0));
-            ofDrawCone(head.localFloorPoint, 0.025, 0.05);
-            head.restoreTransformGL();
-        }
-        ofPopMatrix();
-    }
     
    /* void sendOsc(){
         for(auto head : heads){
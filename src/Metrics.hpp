@@ -0,0 +1,162 @@
+//
+//  Metrics.hpp
+//  realsense-osc-tracker
+//
+//  Counters for watching a running tracker from outside. Every thread counts
+//  into its own block of atomics, so counting is a relaxed load and store
+//  with no shared cache line and no lock. Blocks are registered the first
+//  time a thread counts and are summed when the metrics are read. Head
+//  gauges are written by whichever thread runs the tracker.
+//
+//  toPrometheus() renders the Prometheus text format, MetricsServer serves it.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <mutex>
+
+class Metrics {
+public:
+
+    enum COUNTER {
+        FRAMES_RECEIVED,
+        FRAMES_DROPPED,         // gaps in the librealsense frame numbers
+        FRAMES_DUPLICATE,       // the same frame number again, skipped
+        FRAMES_PROCESSED,
+        POINTS_IN,
+        POINTS_CROPPED,         // inside the tracking box
+        FILTER_MICROS,
+        CROP_MICROS,
+        TRACK_MICROS,
+        SEND_MICROS,
+        OSC_PACKETS,
+        OSC_BYTES,
+        OSC_ERRORS,
+        COUNTER_COUNT
+    };
+
+    enum { maxHeads = 16 };
+
+    static void add(COUNTER counter, uint64_t n = 1){
+        std::atomic<uint64_t> & c = local().counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    static void setHeadPoints(int index, int points){
+        if(index < 0 || index >= maxHeads) return;
+        heads()[index].points.store(points, std::memory_order_relaxed);
+    }
+
+    static void setHeadState(int index, int state){
+        if(index < 0 || index >= maxHeads) return;
+        heads()[index].state.store(state, std::memory_order_relaxed);
+    }
+
+    static void setHeadCount(int count){
+        headCount().store(std::min(count, int(maxHeads)), std::memory_order_relaxed);
+    }
+
+    static uint64_t get(COUNTER counter){
+        std::lock_guard<std::mutex> lock(registryMutex());
+        uint64_t sum = 0;
+        for(auto block : blocks()){
+            sum += block->counters[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+    static string toPrometheus(){
+        uint64_t totals[COUNTER_COUNT];
+        for(int i = 0; i < COUNTER_COUNT; i++){
+            totals[i] = get(COUNTER(i));
+        }
+
+        std::ostringstream out;
+        auto counter = [&](const string & name, const string & help, uint64_t value){
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " counter\n";
+            out << name << " " << value << "\n";
+        };
+        counter("tracker_frames_received_total", "Depth frames received from the camera or a replay.", totals[FRAMES_RECEIVED]);
+        counter("tracker_frames_dropped_total", "Frames missing from the camera, by frame number gaps.", totals[FRAMES_DROPPED]);
+        counter("tracker_frames_duplicate_total", "Frames received twice and skipped.", totals[FRAMES_DUPLICATE]);
+        counter("tracker_frames_processed_total", "Frames that went through the tracker.", totals[FRAMES_PROCESSED]);
+        counter("tracker_points_in_total", "Points in the filtered clouds.", totals[POINTS_IN]);
+        counter("tracker_points_cropped_total", "Points inside the tracking box.", totals[POINTS_CROPPED]);
+        counter("tracker_osc_packets_total", "OSC packets sent to tracking destinations.", totals[OSC_PACKETS]);
+        counter("tracker_osc_bytes_total", "OSC bytes sent to tracking destinations.", totals[OSC_BYTES]);
+        counter("tracker_osc_errors_total", "OSC packets that could not be sent.", totals[OSC_ERRORS]);
+
+        out << "# HELP tracker_stage_seconds_total Time spent per processing stage, divide by frames processed for the mean.\n";
+        out << "# TYPE tracker_stage_seconds_total counter\n";
+        const char * stages[] = {"filter", "crop", "track", "send"};
+        for(int i = 0; i < 4; i++){
+            out << "tracker_stage_seconds_total{stage=\"" << stages[i] << "\"} " << totals[FILTER_MICROS + i] / 1e6 << "\n";
+        }
+
+        int n = headCount().load(std::memory_order_relaxed);
+        out << "# HELP tracker_head_points Points assigned to a head in the last frame.\n";
+        out << "# TYPE tracker_head_points gauge\n";
+        for(int i = 0; i < n; i++){
+            out << "tracker_head_points{head=\"" << i << "\"} " << heads()[i].points.load(std::memory_order_relaxed) << "\n";
+        }
+        out << "# HELP tracker_head_state Head state: 0 ready, 1 tracking, 2 lost.\n";
+        out << "# TYPE tracker_head_state gauge\n";
+        for(int i = 0; i < n; i++){
+            out << "tracker_head_state{head=\"" << i << "\"} " << heads()[i].state.load(std::memory_order_relaxed) << "\n";
+        }
+
+        out << "# HELP tracker_uptime_seconds Seconds since the app started.\n";
+        out << "# TYPE tracker_uptime_seconds gauge\n";
+        out << "tracker_uptime_seconds " << ofGetElapsedTimef() << "\n";
+        return out.str();
+    }
+
+private:
+
+    struct Block {
+        std::atomic<uint64_t> counters[COUNTER_COUNT];
+        char padding[64];   // keeps the next thread's block off our cache line
+        Block(){
+            for(auto & c : counters) c.store(0, std::memory_order_relaxed);
+        }
+    };
+
+    struct Head {
+        std::atomic<int> points{0};
+        std::atomic<int> state{0};
+    };
+
+    // blocks outlive their threads, so the totals never go backwards
+    static Block & local(){
+        static thread_local Block * block = nullptr;
+        if(!block){
+            block = new Block();
+            std::lock_guard<std::mutex> lock(registryMutex());
+            blocks().push_back(block);
+        }
+        return *block;
+    }
+
+    static std::mutex & registryMutex(){
+        static std::mutex m;
+        return m;
+    }
+
+    static vector<Block *> & blocks(){
+        static vector<Block *> b;
+        return b;
+    }
+
+    static Head * heads(){
+        static Head h[maxHeads];
+        return h;
+    }
+
+    static std::atomic<int> & headCount(){
+        static std::atomic<int> n{0};
+        return n;
+    }
+};
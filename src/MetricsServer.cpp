@@ -0,0 +1,6 @@
+//
+//  MetricsServer.cpp
+//  realsense-osc-tracker
+//
+
+#include "MetricsServer.hpp"
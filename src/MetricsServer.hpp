@@ -0,0 +1,126 @@
+//
+//  MetricsServer.hpp
+//  realsense-osc-tracker
+//
+//  Answers HTTP GET /metrics with Metrics::toPrometheus(), one connection at
+//  a time on its own thread. Just enough HTTP for a Prometheus scrape or
+//  curl, anything else gets a 404.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "Metrics.hpp"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <unistd.h>
+
+class MetricsServer : public ofThread {
+public:
+
+    ~MetricsServer(){
+        close();
+    }
+
+    bool setup(int port){
+        close();
+
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if(listenSocket < 0){
+            ofLogError("MetricsServer") << "Could not create a socket: " << strerror(errno);
+            return false;
+        }
+        int on = 1;
+        setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(bind(listenSocket, (sockaddr *) &address, sizeof(address)) != 0 || listen(listenSocket, 4) != 0){
+            ofLogError("MetricsServer") << "Could not listen on " << port << ": " << strerror(errno);
+            ::close(listenSocket);
+            listenSocket = -1;
+            return false;
+        }
+
+        startThread();
+        ofLogNotice("MetricsServer") << "Serving metrics on http://localhost:" << port << "/metrics";
+        return true;
+    }
+
+    void close(){
+        waitForThread(true);
+        if(listenSocket >= 0){
+            ::close(listenSocket);
+            listenSocket = -1;
+        }
+    }
+
+    bool isListening(){
+        return listenSocket >= 0 && isThreadRunning();
+    }
+
+    size_t getRequestCount(){
+        return requestCount;
+    }
+
+protected:
+
+    void threadedFunction(){
+        while(isThreadRunning()){
+            // wake up now and then to notice close()
+            pollfd p = {listenSocket, POLLIN, 0};
+            if(poll(&p, 1, 250) <= 0) continue;
+
+            int connection = accept(listenSocket, nullptr, nullptr);
+            if(connection < 0) continue;
+
+            timeval timeout = {1, 0};
+            setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+            int on = 1;
+            setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+            char request[1024];
+            ssize_t length = recv(connection, request, sizeof(request) - 1, 0);
+            if(length > 0){
+                request[length] = 0;
+                respond(connection, string(request, length));
+                requestCount++;
+            }
+            ::close(connection);
+        }
+    }
+
+    void respond(int connection, const string & request){
+        string status = "200 OK";
+        string body;
+        if(ofIsStringInString(request, "GET /metrics ") || ofIsStringInString(request, "GET / ")){
+            body = Metrics::toPrometheus();
+        } else {
+            status = "404 Not Found";
+            body = "GET /metrics\n";
+        }
+        string response = "HTTP/1.0 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " + ofToString(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+        size_t sent = 0;
+        while(sent < response.size()){
+#ifdef MSG_NOSIGNAL
+            ssize_t n = send(connection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+#else
+            ssize_t n = send(connection, response.data() + sent, response.size() - sent, 0);
+#endif
+            if(n <= 0) break;
+            sent += n;
+        }
+    }
+
+    int listenSocket = -1;
+    std::atomic<size_t> requestCount{0};
+};
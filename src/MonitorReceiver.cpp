@@ -0,0 +1,6 @@
+//
+//  MonitorReceiver.cpp
+//  realsense-osc-tracker
+//
+
+#include "MonitorReceiver.hpp"
@@ -0,0 +1,183 @@
+//
+//  MonitorReceiver.hpp
+//  realsense-osc-tracker
+//
+//  The other end of MonitorStream: listens for its packets on a UDP port and
+//  keeps the decoded grid and heads. A viewer draws those, here it is the
+//  loopback check that what goes out decodes to the grid that was encoded.
+//  A delta that does not follow the last packet applied waits for the next
+//  keyframe.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MonitorStream.hpp"
+#include <poll.h>
+
+class MonitorDecoder {
+public:
+
+    MonitorDecoder(){
+        grid.resize(MonitorProtocol::gridBytes);
+    }
+
+    enum RESULT {
+        APPLIED,
+        WAITING,        // for a keyframe after a gap
+        INVALID         // malformed, or the grid does not check out
+    };
+
+    RESULT decode(const uint8_t * data, size_t size){
+        using namespace MonitorProtocol;
+        if(size < headerSize || memcmp(data, "TMON", 4) != 0 || data[4] != version) return INVALID;
+        if(get16(data + 14) != gridX || get16(data + 16) != gridY || get16(data + 18) != gridZ) return INVALID;
+
+        bool keyframe = data[5] & keyframeFlag;
+        uint16_t seq = get16(data + 6);
+        if(!keyframe && (!synced || seq != uint16_t(sequence + 1))){
+            synced = false;
+            return WAITING;
+        }
+
+        size_t headCount = data[24];
+        const uint8_t * p = data + headerSize;
+        const uint8_t * end = data + size;
+        if(p + headCount * headSize > end) return INVALID;
+        vector<Head> decodedHeads(headCount);
+        for(auto & h : decodedHeads){
+            h.id = p[0];
+            h.state = p[1];
+            h.x = int16_t(get16(p + 2));
+            h.y = int16_t(get16(p + 4));
+            h.z = int16_t(get16(p + 6));
+            p += headSize;
+        }
+
+        vector<uint8_t> next = keyframe ? vector<uint8_t>(grid.size(), 0) : grid;
+        size_t i = 0;
+        while(p < end){
+            size_t zeros, literals;
+            if(!getVarint(p, end, zeros) || !getVarint(p, end, literals)) return INVALID;
+            i += zeros;
+            if(i + literals > next.size() || p + literals > end) return INVALID;
+            for(size_t k = 0; k < literals; k++){
+                next[i + k] ^= p[k];
+            }
+            i += literals;
+            p += literals;
+        }
+        if(countOccupied(next) != get32(data + 20)){
+            synced = false;
+            return INVALID;
+        }
+
+        grid.swap(next);
+        heads.swap(decodedHeads);
+        frameNumber = get32(data + 8);
+        voxelSize = get16(data + 12);
+        sequence = seq;
+        synced = true;
+        return APPLIED;
+    }
+
+    vector<uint8_t> grid;
+    vector<MonitorProtocol::Head> heads;
+    uint32_t frameNumber = 0;
+    int voxelSize = 0;
+
+private:
+    uint16_t sequence = 0;
+    bool synced = false;
+};
+
+class MonitorReceiver : public ofThread {
+public:
+
+    ~MonitorReceiver(){
+        close();
+    }
+
+    bool setup(int port){
+        close();
+        receiveSocket = socket(AF_INET, SOCK_DGRAM, 0);
+        if(receiveSocket < 0){
+            ofLogError("MonitorReceiver") << "Could not create a socket: " << strerror(errno);
+            return false;
+        }
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(port);
+        if(bind(receiveSocket, (sockaddr *) &address, sizeof(address)) != 0){
+            ofLogError("MonitorReceiver") << "Could not listen on " << port << ": " << strerror(errno);
+            ::close(receiveSocket);
+            receiveSocket = -1;
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats = Stats();
+        }
+        startThread();
+        return true;
+    }
+
+    void close(){
+        waitForThread(true);
+        if(receiveSocket >= 0){
+            ::close(receiveSocket);
+            receiveSocket = -1;
+        }
+    }
+
+    bool isListening(){
+        return receiveSocket >= 0 && isThreadRunning();
+    }
+
+    struct Stats {
+        uint64_t packets = 0;
+        uint64_t bytes = 0;
+        uint64_t applied = 0;
+        uint64_t waiting = 0;
+        uint64_t invalid = 0;
+        uint32_t occupied = 0;
+        size_t heads = 0;
+    };
+
+    Stats getStats(){
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+protected:
+
+    void threadedFunction(){
+        vector<uint8_t> buffer(MonitorProtocol::maxPacket + 1);
+        while(isThreadRunning()){
+            pollfd p = {receiveSocket, POLLIN, 0};
+            if(poll(&p, 1, 250) <= 0) continue;
+            ssize_t n = recv(receiveSocket, buffer.data(), buffer.size(), 0);
+            if(n <= 0) continue;
+
+            MonitorDecoder::RESULT result = decoder.decode(buffer.data(), n);
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.packets++;
+            stats.bytes += n;
+            if(result == MonitorDecoder::APPLIED){
+                stats.applied++;
+                stats.occupied = MonitorProtocol::countOccupied(decoder.grid);
+                stats.heads = decoder.heads.size();
+            } else if(result == MonitorDecoder::WAITING){
+                stats.waiting++;
+            } else {
+                stats.invalid++;
+            }
+        }
+    }
+
+    int receiveSocket = -1;
+    MonitorDecoder decoder;
+    std::mutex mutex;
+    Stats stats;
+};
@@ -0,0 +1,6 @@
+//
+//  MonitorStream.cpp
+//  realsense-osc-tracker
+//
+
+#include "MonitorStream.hpp"
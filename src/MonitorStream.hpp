@@ -0,0 +1,423 @@
+//
+//  MonitorStream.hpp
+//  realsense-osc-tracker
+//
+//  A view of the tracker for a laptop at front of house, over UDP, instead
+//  of sharing the screen. The processing thread hands over a subsample of
+//  the cropped cloud and the heads at the stream rate, the stream's own
+//  thread does the rest:
+//
+//  - the points go into a fixed voxel grid around the camera, one bit each
+//  - the grid is XORed with the last grid that went out and the changes are
+//    run length encoded, with a keyframe against an empty grid now and then
+//  - a token bucket holds the bandwidth cap, a frame that does not fit is
+//    skipped and the next one is encoded against the same last grid
+//  - the point budget shrinks when frames come out larger than their share
+//    of the cap and grows back when they are small
+//
+//  Packets, little endian, one UDP datagram each:
+//
+//  0   "TMON"
+//  4   u8  version
+//  5   u8  flags, 1 keyframe
+//  6   u16 sequence, deltas only apply right after the previous one
+//  8   u32 frame number
+//  12  u16 voxel size in mm
+//  14  u16 grid x, y, z
+//  20  u32 occupied voxels, to check the decoded grid
+//  24  u8  heads, then per head u8 id, u8 state, i16 x, y, z in mm
+//  ..  runs of (varint zero bytes, varint literal bytes, literal bytes) over
+//      the XORed grid, bytes after the last run did not change
+//
+//  The grid and the heads are in the tracker camera frame (x, -y, -z of
+//  realsense), voxel (0,0,0) is the corner at -x/2, -y/2, -z of the grid.
+//  MonitorReceiver decodes it, on the viewer or on loopback here.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+namespace MonitorProtocol {
+
+    static const uint8_t version = 1;
+    static const uint8_t keyframeFlag = 1;
+    static const int gridX = 128;
+    static const int gridY = 64;
+    static const int gridZ = 128;
+    static const size_t gridBytes = size_t(gridX) * gridY * gridZ / 8;
+    static const size_t headerSize = 25;
+    static const size_t headSize = 8;
+    static const size_t maxPacket = 65000;  // under the UDP datagram limit
+
+    struct Head {
+        uint8_t id;
+        uint8_t state;
+        int16_t x, y, z;
+    };
+
+    // voxel of a point in mm, -1 outside the grid
+    inline int voxelIndex(int x, int y, int z, int voxelSize){
+        int vx = int(floorf(float(x) / voxelSize)) + gridX / 2;
+        int vy = int(floorf(float(y) / voxelSize)) + gridY / 2;
+        int vz = int(floorf(float(z) / voxelSize)) + gridZ;
+        if(vx < 0 || vx >= gridX || vy < 0 || vy >= gridY || vz < 0 || vz >= gridZ) return -1;
+        return (vz * gridY + vy) * gridX + vx;
+    }
+
+    inline void put16(vector<uint8_t> & out, uint16_t v){
+        out.push_back(v & 0xff);
+        out.push_back(v >> 8);
+    }
+
+    inline void put32(vector<uint8_t> & out, uint32_t v){
+        put16(out, v & 0xffff);
+        put16(out, v >> 16);
+    }
+
+    inline uint16_t get16(const uint8_t * p){
+        return uint16_t(p[0] | (p[1] << 8));
+    }
+
+    inline uint32_t get32(const uint8_t * p){
+        return uint32_t(get16(p)) | (uint32_t(get16(p + 2)) << 16);
+    }
+
+    inline void putVarint(vector<uint8_t> & out, size_t v){
+        while(v >= 0x80){
+            out.push_back(uint8_t(v) | 0x80);
+            v >>= 7;
+        }
+        out.push_back(uint8_t(v));
+    }
+
+    // false past the end
+    inline bool getVarint(const uint8_t *& p, const uint8_t * end, size_t & v){
+        v = 0;
+        for(int shift = 0; p < end && shift < 35; shift += 7){
+            uint8_t b = *p++;
+            v |= size_t(b & 0x7f) << shift;
+            if(!(b & 0x80)) return true;
+        }
+        return false;
+    }
+
+    inline uint32_t countOccupied(const vector<uint8_t> & grid){
+        uint32_t n = 0;
+        for(auto b : grid){
+            n += __builtin_popcount(b);
+        }
+        return n;
+    }
+}
+
+// What the processing thread hands over, reused between frames
+struct MonitorFrame {
+    uint32_t frameNumber = 0;
+    vector<int16_t> x, y, z;
+    vector<MonitorProtocol::Head> heads;
+
+    void clear(){
+        x.clear();
+        y.clear();
+        z.clear();
+        heads.clear();
+    }
+
+    void addPoint(int16_t px, int16_t py, int16_t pz){
+        x.push_back(px);
+        y.push_back(py);
+        z.push_back(pz);
+    }
+};
+
+class MonitorEncoder {
+public:
+
+    MonitorEncoder(){
+        grid.resize(MonitorProtocol::gridBytes);
+        sent.resize(MonitorProtocol::gridBytes);
+        packet.reserve(MonitorProtocol::maxPacket);
+    }
+
+    // the packet for a frame against the last commit()ed grid
+    const vector<uint8_t> & encode(const MonitorFrame & frame, int voxelSize, bool keyframe){
+        using namespace MonitorProtocol;
+
+        std::fill(grid.begin(), grid.end(), 0);
+        for(size_t i = 0; i < frame.x.size(); i++){
+            int v = voxelIndex(frame.x[i], frame.y[i], frame.z[i], voxelSize);
+            if(v >= 0) grid[v >> 3] |= uint8_t(1 << (v & 7));
+        }
+        keyframe = keyframe || voxelSize != sentVoxelSize;
+        this->voxelSize = voxelSize;
+
+        packet.clear();
+        packet.push_back('T');
+        packet.push_back('M');
+        packet.push_back('O');
+        packet.push_back('N');
+        packet.push_back(version);
+        packet.push_back(keyframe ? keyframeFlag : 0);
+        put16(packet, sequence);
+        put32(packet, frame.frameNumber);
+        put16(packet, voxelSize);
+        put16(packet, gridX);
+        put16(packet, gridY);
+        put16(packet, gridZ);
+        put32(packet, countOccupied(grid));
+        size_t headCount = std::min(frame.heads.size(), size_t(255));
+        packet.push_back(uint8_t(headCount));
+        for(size_t i = 0; i < headCount; i++){
+            const Head & h = frame.heads[i];
+            packet.push_back(h.id);
+            packet.push_back(h.state);
+            put16(packet, uint16_t(h.x));
+            put16(packet, uint16_t(h.y));
+            put16(packet, uint16_t(h.z));
+        }
+
+        // runs over grid ^ sent, or over the grid alone for a keyframe
+        size_t i = 0;
+        size_t n = grid.size();
+        auto changed = [&](size_t k){
+            return keyframe ? grid[k] : uint8_t(grid[k] ^ sent[k]);
+        };
+        while(i < n){
+            size_t zeros = 0;
+            while(i + zeros < n && changed(i + zeros) == 0) zeros++;
+            if(i + zeros == n) break;
+            size_t literals = 0;
+            // a single zero byte between changes is cheaper as a literal
+            while(i + zeros + literals < n &&
+                  (changed(i + zeros + literals) != 0 ||
+                   (i + zeros + literals + 1 < n && changed(i + zeros + literals + 1) != 0))){
+                literals++;
+            }
+            putVarint(packet, zeros);
+            putVarint(packet, literals);
+            for(size_t k = i + zeros; k < i + zeros + literals; k++){
+                packet.push_back(changed(k));
+            }
+            i += zeros + literals;
+            // past the datagram, it will not go out anyway
+            if(packet.size() > maxPacket) break;
+        }
+        lastKeyframe = keyframe;
+        return packet;
+    }
+
+    // the last encode() went out, the next delta is against it
+    void commit(){
+        sent.swap(grid);
+        sentVoxelSize = voxelSize;
+        sequence++;
+    }
+
+    bool wasKeyframe() const {
+        return lastKeyframe;
+    }
+
+    // forces a keyframe next
+    void reset(){
+        sentVoxelSize = 0;
+    }
+
+private:
+    vector<uint8_t> grid;
+    vector<uint8_t> sent;
+    vector<uint8_t> packet;
+    int voxelSize = 0;
+    int sentVoxelSize = 0;
+    uint16_t sequence = 0;
+    bool lastKeyframe = false;
+};
+
+class MonitorStream : public ofThread {
+public:
+
+    struct Settings {
+        float rate = 10;                // frames per second
+        float kilobitsPerSecond = 2000; // the cap
+        int voxelSize = 50;             // mm
+        float keyframeInterval = 1;     // seconds
+        size_t maxPoints = 16384;
+    };
+
+    ~MonitorStream(){
+        close();
+    }
+
+    bool setup(const string & host, int port){
+        close();
+
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+        addrinfo * result = nullptr;
+        if(getaddrinfo(host.c_str(), ofToString(port).c_str(), &hints, &result) != 0 || !result){
+            ofLogError("MonitorStream") << "Could not resolve " << host;
+            return false;
+        }
+        memcpy(&destination, result->ai_addr, sizeof(destination));
+        freeaddrinfo(result);
+
+        int s = socket(AF_INET, SOCK_DGRAM, 0);
+        if(s < 0){
+            ofLogError("MonitorStream") << "Could not create a socket: " << strerror(errno);
+            return false;
+        }
+        streamSocket = s;
+        encoder.reset();
+        tokens = 0;
+        lastRefill = ofGetElapsedTimeMicros();
+        startThread();
+        ofLogNotice("MonitorStream") << "Streaming to " << host << ":" << port;
+        return true;
+    }
+
+    void close(){
+        if(isThreadRunning()){
+            stopThread();
+            frameReady.notify_all();
+            waitForThread(false);
+        }
+        int s = streamSocket.exchange(-1);
+        if(s >= 0){
+            ::close(s);
+        }
+    }
+
+    // any thread, processing reads it for the view while the GL thread
+    // sets the stream up or closes it
+    bool isStreaming(){
+        return streamSocket.load() >= 0 && isThreadRunning();
+    }
+
+    void setSettings(const Settings & settings){
+        std::lock_guard<std::mutex> lock(frameMutex);
+        this->settings = settings;
+        pointBudget = std::min<size_t>(pointBudget, settings.maxPoints);
+    }
+
+    // cheap, whether submit() would take a frame now
+    bool wantsFrame(uint64_t nowMicros){
+        return isThreadRunning() && nowMicros >= nextFrameMicros.load(std::memory_order_relaxed);
+    }
+
+    // points to sample at most, adapted to the cap
+    size_t getPointBudget(){
+        return pointBudget.load(std::memory_order_relaxed);
+    }
+
+    // swaps the frame in, the caller gets back an old one to fill next time
+    void submit(MonitorFrame & frame, uint64_t nowMicros){
+        std::unique_lock<std::mutex> lock(frameMutex, std::try_to_lock);
+        if(!lock.owns_lock()) return;
+        std::swap(pending, frame);
+        hasPending = true;
+        nextFrameMicros = nowMicros + uint64_t(1e6 / fmax(settings.rate, 0.1));
+        lock.unlock();
+        frameReady.notify_one();
+    }
+
+    struct Stats {
+        uint64_t framesSent = 0;
+        uint64_t framesSkipped = 0;     // over the cap
+        uint64_t keyframes = 0;
+        uint64_t bytesSent = 0;
+        size_t lastPacket = 0;
+        size_t pointBudget = 0;
+    };
+
+    Stats getStats(){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        Stats s = stats;
+        s.pointBudget = pointBudget;
+        return s;
+    }
+
+protected:
+
+    void threadedFunction(){
+        MonitorFrame frame;
+        uint64_t lastKeyframe = 0;
+
+        while(isThreadRunning()){
+            Settings current;
+            {
+                std::unique_lock<std::mutex> lock(frameMutex);
+                frameReady.wait_for(lock, std::chrono::milliseconds(250), [this]{ return hasPending || !isThreadRunning(); });
+                if(!hasPending) continue;
+                std::swap(pending, frame);
+                hasPending = false;
+                current = settings;
+            }
+
+            uint64_t now = ofGetElapsedTimeMicros();
+            double bytesPerSecond = current.kilobitsPerSecond * 1000.0 / 8.0;
+            // half a second of burst, enough for a keyframe at sane caps
+            tokens = fmin(tokens + bytesPerSecond * (now - lastRefill) / 1e6, bytesPerSecond * 0.5);
+            lastRefill = now;
+
+            bool keyframe = now - lastKeyframe >= uint64_t(current.keyframeInterval * 1e6);
+            const vector<uint8_t> & packet = encoder.encode(frame, current.voxelSize, keyframe);
+
+            double share = bytesPerSecond / fmax(current.rate, 0.1);
+            size_t budget = pointBudget;
+            if(packet.size() > share){
+                budget = std::max<size_t>(256, budget * 7 / 10);
+            } else if(packet.size() < share / 2){
+                budget = std::min(current.maxPoints, budget + budget / 10 + 1);
+            }
+            pointBudget = budget;
+
+            bool fits = packet.size() <= MonitorProtocol::maxPacket && packet.size() <= tokens;
+            if(fits){
+                ssize_t n = sendto(streamSocket, packet.data(), packet.size(), 0, (sockaddr *) &destination, sizeof(destination));
+                fits = n == ssize_t(packet.size());
+            }
+
+            std::lock_guard<std::mutex> lock(statsMutex);
+            if(fits){
+                tokens -= packet.size();
+                if(encoder.wasKeyframe()){
+                    lastKeyframe = now;
+                    stats.keyframes++;
+                }
+                encoder.commit();
+                stats.framesSent++;
+                stats.bytesSent += packet.size();
+            } else {
+                stats.framesSkipped++;
+            }
+            stats.lastPacket = packet.size();
+        }
+    }
+
+    std::atomic<int> streamSocket{-1};
+    sockaddr_in destination = {};
+    MonitorEncoder encoder;
+    double tokens = 0;
+    uint64_t lastRefill = 0;
+
+    std::mutex frameMutex;
+    std::condition_variable frameReady;
+    MonitorFrame pending;
+    bool hasPending = false;
+    Settings settings;
+    std::atomic<uint64_t> nextFrameMicros{0};
+    std::atomic<size_t> pointBudget{4096};
+
+    std::mutex statsMutex;
+    Stats stats;
+};
@@ -0,0 +1,6 @@
+//
+//  OscDestinations.cpp
+//  realsense-osc-tracker
+//
+
+#include "OscDestinations.hpp"
@@ -0,0 +1,445 @@
+//
+//  OscDestinations.hpp
+//  realsense-osc-tracker
+//
+//  Fans tracking data out to several OSC receivers from one socket. Each
+//  message is encoded once per frame, every destination then picks what it
+//  wants into its own bundle:
+//
+//  Rate        Hz, 0 sends every tracker frame
+//  Fields      /tracker/N/head/position fff
+//              /tracker/N/floor/position fff
+//              /tracker/N/head/velocity fff   (m/s)
+//              /tracker/N/state i             (0 ready, 1 tracking, 2 lost) on change,
+//                                             right away, never rate limited
+//              /tracker/N/shape/top f         highest point above the floor (m)
+//              /tracker/N/shape/axis fff      principal axis, pointing up
+//              /tracker/N/shape/lean f        degrees from vertical
+//              /tracker/N/shape/extent fff    two standard deviations along x, y, z (m)
+//              /zone/<name>/<enter|exit|dwell> if    right away, never rate limited
+//              /tracker/event/<new|found|lost|end> iif   head, volume, seconds
+//                                             tracked, from TrackEventLog
+//  Dead Band   metres a head has to move before it is sent again
+//
+//  Heads of further tracking volumes go out in the same bundles, under the
+//  volume's prefix, e.g. /apron/tracker/N/head/position.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MeshTracker.hpp"
+#include "Metrics.hpp"
+#include "OscOutboundPacketStream.h"
+#include "UdpSocket.h"
+
+struct OscDestination {
+
+    enum FIELD {
+        HEAD        = 1 << 0,
+        FLOOR       = 1 << 1,
+        VELOCITY    = 1 << 2,
+        STATE       = 1 << 3,
+        ZONES       = 1 << 4,
+        SHAPE       = 1 << 5,
+        EVENTS      = 1 << 6
+    };
+
+    string name = "destination";
+    string host = "localhost";
+    int port = 7777;
+    bool enabled = true;
+    float rate = 0;
+    int fields = HEAD | FLOOR | ZONES;
+    float deadBand = 0;
+
+    // runtime
+    size_t packetsSent = 0;
+    size_t messagesSent = 0;
+    size_t messagesSuppressed = 0;
+
+    bool has(FIELD f) const {
+        return (fields & f) != 0;
+    }
+
+    ofJson toJson() const {
+        ofJson j;
+        j["Name"] = name;
+        j["Host"] = host;
+        j["Port"] = port;
+        j["Enabled"] = enabled;
+        j["Rate"] = rate;
+        j["Dead_Band"] = deadBand;
+        j["Head"] = has(HEAD);
+        j["Floor"] = has(FLOOR);
+        j["Velocity"] = has(VELOCITY);
+        j["State"] = has(STATE);
+        j["Zones"] = has(ZONES);
+        j["Shape"] = has(SHAPE);
+        j["Events"] = has(EVENTS);
+        return j;
+    }
+
+    void fromJson(const ofJson & j){
+        name = j.value("Name", name);
+        host = j.value("Host", host);
+        port = j.value("Port", port);
+        enabled = j.value("Enabled", enabled);
+        rate = j.value("Rate", rate);
+        deadBand = j.value("Dead_Band", deadBand);
+        fields = 0;
+        if(j.value("Head", true)) fields |= HEAD;
+        if(j.value("Floor", true)) fields |= FLOOR;
+        if(j.value("Velocity", false)) fields |= VELOCITY;
+        if(j.value("State", false)) fields |= STATE;
+        if(j.value("Zones", true)) fields |= ZONES;
+        if(j.value("Shape", false)) fields |= SHAPE;
+        if(j.value("Events", false)) fields |= EVENTS;
+    }
+
+private:
+    friend class OscDestinations;
+
+    struct Sent {
+        glm::vec3 position;
+        int state = -1;
+        bool positionSent = false;
+    };
+
+    string resolvedHost;
+    int resolvedPort = -1;
+    bool resolved = false;
+    IpEndpointName endpoint;
+    double nextSend = -1;
+    double lastSend = -1;
+    map<int, Sent> sent;   // by head id, and volume above the lower 16 bits
+};
+
+// the heads of one tracking volume, prefix "" for /tracker/N
+struct OscHeadSet {
+    const string * prefix;
+    vector<head> * heads;
+};
+
+class OscDestinations {
+public:
+
+    vector<OscDestination> destinations;
+    size_t maxPacketSize = 1400; // stay below a typical MTU, larger frames are split
+
+    void send(vector<head> & heads, double now){
+        singleSet.resize(1);
+        singleSet[0] = {&noPrefix, &heads};
+        send(singleSet, now);
+    }
+
+    void send(const vector<OscHeadSet> & sets, double now){
+
+        // which destinations are due this frame and what they need together,
+        // state changes go out to the others as well
+        int fields = 0;
+        due.assign(destinations.size(), false);
+        for(size_t i = 0; i < destinations.size(); i++){
+            auto & d = destinations[i];
+            if(!d.enabled || !resolve(d)) continue;
+            fields |= d.fields & OscDestination::STATE;
+            // first frame, clock went back (replay loop) or unlimited
+            bool restart = d.lastSend < 0 || now < d.lastSend;
+            due[i] = restart || d.rate <= 0 || now >= d.nextSend;
+            if(due[i]){
+                fields |= d.fields;
+                double interval = d.rate > 0 ? 1.0 / d.rate : 0;
+                // keep the cadence, but do not try to catch up after a stall
+                d.nextSend = restart || now - d.nextSend > interval ? now + interval : d.nextSend + interval;
+                d.lastSend = now;
+            }
+        }
+        if(fields == 0) return;
+
+        ////////////
+        // encode once
+
+        encoded.clear();
+        messages.clear();
+        headMessages.clear();
+
+        for(size_t set = 0; set < sets.size(); set++){
+            updatePrefix(int(set), *sets[set].prefix);
+            for(auto & head : *sets[set].heads){
+                int key = headKey(int(set), head.id);
+                bool present = head.isTrackingOrLost();
+                auto & a = getAddresses(key, *sets[set].prefix, head.id);
+                glm::vec3 p = head.getGlobalPosition();
+                size_t begin = messages.size();
+
+                if(present && (fields & OscDestination::HEAD)){
+                    encode(OscDestination::HEAD, a.headPosition, p);
+                }
+                if(present && (fields & OscDestination::FLOOR)){
+                    encode(OscDestination::FLOOR, a.floorPosition, glm::vec3(p.x, 0.0, p.z));
+                }
+                if(present && (fields & OscDestination::VELOCITY)){
+                    encode(OscDestination::VELOCITY, a.headVelocity, head.kalman.getVelocity());
+                }
+                if(present && head.shape.valid && (fields & OscDestination::SHAPE)){
+                    encode(OscDestination::SHAPE, a.shapeTop, head.shape.top);
+                    encode(OscDestination::SHAPE, a.shapeAxis, head.shape.axis);
+                    encode(OscDestination::SHAPE, a.shapeLean, head.shape.lean);
+                    encode(OscDestination::SHAPE, a.shapeExtent, head.shape.extent);
+                }
+                if(fields & OscDestination::STATE){
+                    osc::OutboundPacketStream s(scratch, sizeof(scratch));
+                    s << osc::BeginMessage(a.state.c_str()) << int(head.state) << osc::EndMessage;
+                    add(OscDestination::STATE, s);
+                }
+                // in the order the bundles below walk the heads
+                headMessages.push_back({begin, messages.size()});
+            }
+        }
+
+        ////////////
+        // bundle per destination
+
+        for(size_t i = 0; i < destinations.size(); i++){
+            auto & d = destinations[i];
+            if(!due[i] && !(d.enabled && d.resolved && d.has(OscDestination::STATE))) continue;
+
+            beginBundle();
+
+            size_t h = 0;
+            for(size_t set = 0; set < sets.size(); set++){
+                for(auto & head : *sets[set].heads){
+                    const HeadMessages & range = headMessages[h++];
+                    auto & sent = d.sent[headKey(int(set), head.id)];
+                    bool present = head.isTrackingOrLost();
+                    bool stateChanged = sent.state != int(head.state);
+
+                    if(!due[i]){
+                        // between sends only what changed state
+                        if(!stateChanged) continue;
+                        for(size_t k = range.begin; k < range.end; k++){
+                            if(messages[k].field == OscDestination::STATE) addToBundle(d, messages[k].offset, messages[k].size);
+                        }
+                        sent.state = int(head.state);
+                        if(!present) sent.positionSent = false;
+                        continue;
+                    }
+
+                    glm::vec3 p = head.getGlobalPosition();
+                    bool moved = !sent.positionSent || d.deadBand <= 0 || glm::distance(p, sent.position) >= d.deadBand;
+
+                    for(size_t k = range.begin; k < range.end; k++){
+                        const Message & m = messages[k];
+                        if(!d.has(m.field)) continue;
+                        if(m.field == OscDestination::STATE){
+                            if(!stateChanged) continue;
+                        } else if(!moved){
+                            d.messagesSuppressed++;
+                            continue;
+                        }
+                        addToBundle(d, m.offset, m.size);
+                    }
+
+                    if(d.has(OscDestination::STATE)) sent.state = int(head.state);
+                    if(!present){
+                        // reacquired heads are always sent right away
+                        sent.positionSent = false;
+                    } else if(moved){
+                        sent.position = p;
+                        sent.positionSent = true;
+                    }
+                }
+            }
+
+            flushBundle(d);
+        }
+    }
+
+    // zone events and the like, sent to every destination with the field right away
+    void sendEvent(OscDestination::FIELD field, const string & address, int headId, float value){
+        osc::OutboundPacketStream s(scratch, sizeof(scratch));
+        s << osc::BeginMessage(address.c_str()) << headId << value << osc::EndMessage;
+        sendPacket(field, s.Data(), s.Size());
+    }
+
+    // a message encoded elsewhere, right away to every destination with field
+    void sendPacket(OscDestination::FIELD field, const char * data, size_t size){
+        for(auto & d : destinations){
+            if(!d.enabled || !d.has(field) || !resolve(d)) continue;
+            transmit(d, data, size);
+            d.messagesSent++;
+        }
+    }
+
+    bool anyWants(OscDestination::FIELD field) const {
+        return anyWants(destinations, field);
+    }
+
+    // also for the GUI's copy of the settings
+    static bool anyWants(const vector<OscDestination> & destinations, OscDestination::FIELD field){
+        for(auto & d : destinations){
+            if(d.enabled && d.has(field)) return true;
+        }
+        return false;
+    }
+
+    ofJson toJson() const {
+        ofJson j = ofJson::array();
+        for(auto & d : destinations){
+            j.push_back(d.toJson());
+        }
+        return j;
+    }
+
+    void fromJson(const ofJson & j){
+        destinations.clear();
+        for(auto & dj : j){
+            OscDestination d;
+            d.fromJson(dj);
+            destinations.push_back(d);
+        }
+    }
+
+private:
+
+    // built the first time a head id is seen, not every frame
+    struct HeadAddresses {
+        string headPosition;
+        string floorPosition;
+        string headVelocity;
+        string state;
+        string shapeTop;
+        string shapeAxis;
+        string shapeLean;
+        string shapeExtent;
+    };
+
+    // head ids are per volume
+    static int headKey(int set, int headId){
+        return (set << 16) | headId;
+    }
+
+    // a volume renamed or removed, its addresses go
+    void updatePrefix(int set, const string & prefix){
+        if(set < int(prefixes.size()) && prefixes[set] == prefix) return;
+        if(set >= int(prefixes.size())) prefixes.resize(set + 1);
+        prefixes[set] = prefix;
+        for(auto it = addresses.begin(); it != addresses.end();){
+            it = (it->first >> 16) == set ? addresses.erase(it) : std::next(it);
+        }
+    }
+
+    HeadAddresses & getAddresses(int key, const string & setPrefix, int headId){
+        auto it = addresses.find(key);
+        if(it != addresses.end()) return it->second;
+        string prefix = setPrefix + "/tracker/" + ofToString(headId);
+        HeadAddresses & a = addresses[key];
+        a.headPosition = prefix + "/head/position";
+        a.floorPosition = prefix + "/floor/position";
+        a.headVelocity = prefix + "/head/velocity";
+        a.state = prefix + "/state";
+        a.shapeTop = prefix + "/shape/top";
+        a.shapeAxis = prefix + "/shape/axis";
+        a.shapeLean = prefix + "/shape/lean";
+        a.shapeExtent = prefix + "/shape/extent";
+        return a;
+    }
+
+    struct Message {
+        OscDestination::FIELD field;
+        size_t offset;
+        size_t size;
+    };
+
+    // the messages of one head, [begin, end) in messages
+    struct HeadMessages {
+        size_t begin;
+        size_t end;
+    };
+
+    bool resolve(OscDestination & d){
+        if(d.resolved && d.resolvedHost == d.host && d.resolvedPort == d.port) return true;
+        if(d.resolvedHost == d.host && d.resolvedPort == d.port) return false; // failed before, wait for an edit
+        d.resolvedHost = d.host;
+        d.resolvedPort = d.port;
+        d.sent.clear();
+        d.lastSend = -1;
+        try{
+            d.endpoint = IpEndpointName(d.host.c_str(), d.port);
+            d.resolved = d.endpoint.address != 0; // oscpack resolves unknown hosts to 0
+        }catch(std::exception & e){
+            d.resolved = false;
+        }
+        if(!d.resolved){
+            ofLogError("OscDestinations") << "Could not resolve " << d.host << " for " << d.name;
+        }
+        return d.resolved;
+    }
+
+    void encode(OscDestination::FIELD field, const string & address, const glm::vec3 & v){
+        osc::OutboundPacketStream s(scratch, sizeof(scratch));
+        s << osc::BeginMessage(address.c_str()) << v.x << v.y << v.z << osc::EndMessage;
+        add(field, s);
+    }
+
+    void encode(OscDestination::FIELD field, const string & address, float f){
+        osc::OutboundPacketStream s(scratch, sizeof(scratch));
+        s << osc::BeginMessage(address.c_str()) << f << osc::EndMessage;
+        add(field, s);
+    }
+
+    void add(OscDestination::FIELD field, const osc::OutboundPacketStream & s){
+        messages.push_back({field, encoded.size(), s.Size()});
+        encoded.insert(encoded.end(), s.Data(), s.Data() + s.Size());
+    }
+
+    void beginBundle(){
+        static const char header[16] = {'#','b','u','n','d','l','e','\0', 0,0,0,0,0,0,0,1}; // time tag: immediately
+        packet.assign(header, header + sizeof(header));
+        packetMessages = 0;
+    }
+
+    void addToBundle(OscDestination & d, size_t offset, size_t size){
+        if(packetMessages > 0 && packet.size() + 4 + size > maxPacketSize){
+            flushBundle(d);
+            beginBundle();
+        }
+        uint32_t n = uint32_t(size);
+        char length[4] = {char(n >> 24), char(n >> 16), char(n >> 8), char(n)};
+        packet.insert(packet.end(), length, length + 4);
+        packet.insert(packet.end(), encoded.begin() + offset, encoded.begin() + offset + size);
+        packetMessages++;
+    }
+
+    void flushBundle(OscDestination & d){
+        if(packetMessages == 0) return;
+        transmit(d, packet.data(), packet.size());
+        d.messagesSent += packetMessages;
+        packetMessages = 0;
+    }
+
+    void transmit(OscDestination & d, const char * data, size_t size){
+        try{
+            socket.SendTo(d.endpoint, data, size);
+            d.packetsSent++;
+            Metrics::add(Metrics::OSC_PACKETS);
+            Metrics::add(Metrics::OSC_BYTES, size);
+        }catch(std::exception & e){
+            Metrics::add(Metrics::OSC_ERRORS);
+            ofLogError("OscDestinations") << "Sending to " << d.name << " failed: " << e.what();
+        }
+    }
+
+    UdpSocket socket;
+    char scratch[512];
+    map<int, HeadAddresses> addresses;     // by headKey()
+    vector<string> prefixes;                // per set, as the addresses were built
+    vector<OscHeadSet> singleSet;
+    const string noPrefix;
+    vector<char> encoded;
+    vector<Message> messages;
+    vector<HeadMessages> headMessages;      // per head, in the order of the sets
+    vector<bool> due;
+    vector<char> packet;
+    size_t packetMessages = 0;
+};
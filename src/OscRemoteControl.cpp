@@ -0,0 +1,6 @@
+//
+//  OscRemoteControl.cpp
+//  realsense-osc-tracker
+//
+
+#include "OscRemoteControl.hpp"
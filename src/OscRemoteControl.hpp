@@ -0,0 +1,202 @@
+//
+//  OscRemoteControl.hpp
+//  realsense-osc-tracker
+//
+//  Sets parameters from OSC using the same addresses qLabController writes
+//  into its cues, e.g. /Settings/Tracking/Timeout 30.0
+//
+//  The receiving thread only parses and queues. Changes and queries are
+//  applied together by applyPending() at the start of a frame, so the
+//  tracking code never sees a parameter change halfway through.
+//
+//  /query                      replies /value <address> <value> for every parameter
+//  /query /Settings/Tracking   ... for every parameter at or below an address
+//
+//  Replies go out in bundles that fit a UDP datagram on an ethernet link.
+//
+//  Only the parameter tree is reachable. OSC destinations, trigger zones and
+//  tracking volumes are lists kept outside it, they are set in the GUI or
+//  loaded with a settings file.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "ofxOsc.h"
+#include "SpscQueue.hpp"
+
+class OscRemoteControl : public ofThread {
+public:
+
+    ~OscRemoteControl(){
+        waitForThread(true);
+    }
+
+    void setup(ofParameterGroup & root, int port, int replyPort){
+        waitForThread(true);
+
+        parameters.clear();
+        addGroup(root);
+
+        this->replyPort = replyPort;
+        oscReceiver.setup(port);
+        startThread();
+
+        ofLogNotice("OscRemoteControl") << "Listening on " << port << " for " << parameters.size() << " parameters";
+    }
+
+    // GL thread, before anything reads parameters this frame
+    void applyPending(){
+        Command command;
+        while(commands.pop(command)){
+            if(command.type == Command::SET){
+                command.parameter->fromString(command.value);
+                ofLogVerbose("OscRemoteControl") << command.address << " " << command.value;
+            } else {
+                reply(command.address, command.replyHost);
+            }
+        }
+    }
+
+    size_t getDroppedCount(){
+        return droppedCount;
+    }
+
+protected:
+
+    struct Command {
+        enum TYPE {
+            SET,
+            QUERY
+        };
+        TYPE type = SET;
+        ofAbstractParameter * parameter = nullptr;
+        string address;
+        string value;
+        string replyHost;
+    };
+
+    void addGroup(ofParameterGroup & group){
+        for(auto & p : group){
+            if(p->type() == typeid(ofParameterGroup).name()){
+                addGroup(p->castGroup());
+            } else {
+                parameters[getAddress(*p)] = p.get();
+            }
+        }
+    }
+
+    // matches the address part of qLabController::findOscAddress()
+    static string getAddress(const ofAbstractParameter & p){
+        string a;
+        for(auto & s : p.getGroupHierarchyNames()){
+            a += "/" + s;
+        }
+        return a;
+    }
+
+    void threadedFunction(){
+        while(isThreadRunning()){
+            bool received = false;
+            while(oscReceiver.hasWaitingMessages()){
+                ofxOscMessage msg;
+                oscReceiver.getNextMessage(msg);
+                handleMessage(msg);
+                received = true;
+            }
+            if(!received) sleep(1);
+        }
+    }
+
+    void handleMessage(const ofxOscMessage & msg){
+        Command command;
+
+        if(msg.getAddress() == "/query"){
+            command.type = Command::QUERY;
+            command.address = msg.getNumArgs() > 0 ? msg.getArgAsString(0) : "";
+            command.replyHost = msg.getRemoteHost();
+        } else {
+            // the map is only written in setup(), before this thread runs
+            auto it = parameters.find(msg.getAddress());
+            if(it == parameters.end()){
+                ofLogWarning("OscRemoteControl") << "Unknown address " << msg.getAddress();
+                return;
+            }
+            command.type = Command::SET;
+            command.parameter = it->second;
+            command.address = msg.getAddress();
+            command.value = argsToString(msg);
+        }
+
+        if(!commands.push(std::move(command))){
+            droppedCount++;
+        }
+    }
+
+    // the string format ofAbstractParameter::fromString() reads, vec3 is "x, y, z"
+    static string argsToString(const ofxOscMessage & msg){
+        string value;
+        for(size_t i = 0; i < msg.getNumArgs(); i++){
+            if(i > 0) value += ", ";
+            switch(msg.getArgType(i)){
+                case OFXOSC_TYPE_TRUE: value += "1"; break;
+                case OFXOSC_TYPE_FALSE: value += "0"; break;
+                case OFXOSC_TYPE_INT32: value += ofToString(msg.getArgAsInt32(i)); break;
+                case OFXOSC_TYPE_FLOAT: value += ofToString(msg.getArgAsFloat(i)); break;
+                default: value += msg.getArgAsString(i); break;
+            }
+        }
+        return value;
+    }
+
+    // the address itself or one below it, /Tracking/Max is not below /Tracking/Ma
+    static bool isBelow(const string & address, const string & prefix){
+        if(address.compare(0, prefix.size(), prefix) != 0) return false;
+        return address.size() == prefix.size() || prefix.empty() || prefix.back() == '/' || address[prefix.size()] == '/';
+    }
+
+    // an OSC string with its terminator, padded to 4 bytes
+    static size_t paddedSize(const string & s){
+        return (s.size() + 4) & ~size_t(3);
+    }
+
+    void reply(const string & prefix, const string & host){
+        if(oscReplySender.getHost() != host || oscReplySender.getPort() != replyPort){
+            oscReplySender.setup(host, replyPort);
+        }
+        // "#bundle" and the time tag, then a size before each message
+        const size_t bundleHeader = 16;
+        const size_t valueHeader = paddedSize("/value") + paddedSize(",ss");
+        ofxOscBundle bundle;
+        size_t bundleSize = bundleHeader;
+        for(auto & p : parameters){
+            if(!isBelow(p.first, prefix)) continue;
+            string value = p.second->toString();
+            size_t size = 4 + valueHeader + paddedSize(p.first) + paddedSize(value);
+            if(bundle.getMessageCount() > 0 && bundleSize + size > maxBundleSize){
+                oscReplySender.sendBundle(bundle);
+                bundle.clear();
+                bundleSize = bundleHeader;
+            }
+            ofxOscMessage m;
+            m.setAddress("/value");
+            m.addStringArg(p.first);
+            m.addStringArg(value);
+            bundle.addMessage(m);
+            bundleSize += size;
+        }
+        if(bundle.getMessageCount() > 0){
+            oscReplySender.sendBundle(bundle);
+        }
+    }
+
+    // under the 1500 byte ethernet MTU with IP and UDP headers to spare
+    static const size_t maxBundleSize = 1400;
+
+    ofxOscReceiver oscReceiver;
+    ofxOscSender oscReplySender;
+    int replyPort = 0;
+    map<string, ofAbstractParameter *> parameters;
+    SpscQueue<Command, 256> commands;
+    std::atomic<size_t> droppedCount{0};
+};
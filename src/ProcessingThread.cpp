@@ -0,0 +1,6 @@
+//
+//  ProcessingThread.cpp
+//  realsense-osc-tracker
+//
+
+#include "ProcessingThread.hpp"
@@ -0,0 +1,157 @@
+//
+//  ProcessingThread.hpp
+//  realsense-osc-tracker
+//
+//  Takes frame processing off the GL thread, so OSC timing does not depend
+//  on rendering. The thread calls step() until it reports there was nothing
+//  to do, then naps briefly. The real-time profile is applied from the
+//  thread itself when it starts and released when it stops.
+//
+//  IntervalRecorder keeps the times OSC went out, for the jitter benchmark.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "RealtimeProfile.hpp"
+#include <atomic>
+#include <mutex>
+
+struct IntervalStats {
+    size_t count = 0;      // intervals
+    double mean = 0;       // all in milliseconds
+    double stddev = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+
+    string toString() const {
+        return ofToString(count) + " intervals, mean " + ofToString(mean, 3) + "ms"
+        + ", stddev " + ofToString(stddev, 3) + "ms"
+        + ", p50 " + ofToString(p50, 3) + " p99 " + ofToString(p99, 3)
+        + " p99.9 " + ofToString(p999, 3) + " max " + ofToString(max, 3) + "ms";
+    }
+};
+
+// One writer, preallocated, stops recording when full
+class IntervalRecorder {
+public:
+
+    IntervalRecorder(size_t capacity = 1 << 16){
+        times.resize(capacity);
+    }
+
+    void reset(){
+        count = 0;
+    }
+
+    void record(uint64_t micros){
+        size_t i = count.load(std::memory_order_relaxed);
+        if(i < times.size()){
+            times[i] = micros;
+            count.store(i + 1, std::memory_order_release);
+        }
+    }
+
+    IntervalStats getStats() const {
+        IntervalStats stats;
+        size_t n = count.load(std::memory_order_acquire);
+        if(n < 2) return stats;
+
+        vector<double> intervals(n - 1);
+        double sum = 0;
+        for(size_t i = 1; i < n; i++){
+            intervals[i-1] = (times[i] - times[i-1]) / 1000.0;
+            sum += intervals[i-1];
+        }
+        stats.count = intervals.size();
+        stats.mean = sum / stats.count;
+        double squares = 0;
+        for(auto d : intervals){
+            squares += (d - stats.mean) * (d - stats.mean);
+        }
+        stats.stddev = sqrt(squares / stats.count);
+
+        std::sort(intervals.begin(), intervals.end());
+        auto percentile = [&](double p){
+            return intervals[std::min(intervals.size() - 1, size_t(p * (intervals.size() - 1) + 0.5))];
+        };
+        stats.p50 = percentile(0.5);
+        stats.p99 = percentile(0.99);
+        stats.p999 = percentile(0.999);
+        stats.max = intervals.back();
+        return stats;
+    }
+
+private:
+    vector<uint64_t> times;
+    std::atomic<size_t> count{0};
+};
+
+class ProcessingThread : public ofThread {
+public:
+
+    std::function<bool()> step;          // processes a frame if one is ready
+    std::function<size_t(const RealtimeProfile &)> onRealtime; // e.g. prefault buffers, returns the bytes wired
+    std::function<void(const RealtimeProfile &)> onNormal;    // e.g. unwire them again, before the profile is released
+    uint64_t idleMicros = 250;
+
+    ~ProcessingThread(){
+        stop();
+    }
+
+    void start(bool realtime, const RealtimeProfile & profile){
+        stop();
+        this->realtime = realtime;
+        this->profile = profile;
+        {
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report = realtime ? "starting" : "normal priority";
+        }
+        startThread();
+    }
+
+    void stop(){
+        waitForThread(true);
+    }
+
+    bool isRealtime(){
+        return isThreadRunning() && realtime;
+    }
+
+    string getReport(){
+        std::lock_guard<std::mutex> lock(reportMutex);
+        return report;
+    }
+
+protected:
+
+    void threadedFunction(){
+        if(realtime){
+            string r = profile.apply();
+            size_t wired = onRealtime ? onRealtime(profile) : 0;
+            if(profile.lockMemory){
+                r += wired > 0 ? ", " + ofToString(wired / (1024.0 * 1024.0), 1) + " MB wired" : ", no buffers wired";
+            }
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report = r;
+        }
+        while(isThreadRunning()){
+            if(!step || !step()){
+                std::this_thread::sleep_for(std::chrono::microseconds(idleMicros));
+            }
+        }
+        if(realtime){
+            if(onNormal) onNormal(profile);
+            profile.release();
+            std::lock_guard<std::mutex> lock(reportMutex);
+            report = "stopped, memory unlocked";
+        }
+    }
+
+    bool realtime = false;
+    RealtimeProfile profile;
+    std::mutex reportMutex;
+    string report;
+};
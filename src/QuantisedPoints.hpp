@@ -0,0 +1,1189 @@
+//
+//  QuantisedPoints.hpp
+//  realsense-osc-tracker
+//
+//  The cropped cloud as the tracker consumes it: points in the tracker's
+//  camera frame (x, -y, -z of realsense) as int16 millimetres, one array per
+//  axis. 6 bytes a point instead of a 12 byte vec3, and 8 points fill an
+//  integer SIMD register.
+//
+//  classifyPoints() does what MeshTracker::addVertex() does one point at a
+//  time, for a block of points: every point goes to the first head in
+//  priority order that wants it, as
+//
+//  1   consumed, inside the scaled radius
+//  2   in the shell around a head
+//  3   near the line from a head down to its floor point
+//  0   none of the heads
+//
+//  Tracking only needs the consumed points, which claimPoints() finds
+//  without the floor line distance for the points no head consumes, most of
+//  them. The other categories only colour the cloud and are worked out by
+//  classifyPoints() when it is shown.
+//
+//  sumClaimed() then adds the consumed points up per head in the same
+//  registers: offsets, their products and the height range, in 32 bit lanes
+//  flushed into 64 bit sums before they could overflow.
+//
+//  There are SSE2 and NEON versions and a scalar one, which also does the
+//  tails. Each comes as a loop over however many heads there are, and as
+//  classifyPointsFixed<N>() for a head count known at compile time, padded
+//  with heads nothing reaches: the loop over heads unrolls, and the scalar
+//  one computes all heads side by side so it vectorises across them.
+//  HeadKernels picks 3, 5, 8 or 16 at run time, benchmark() compares the
+//  cost per point against the loop.
+//
+//  All give the same result bit for bit, the integer math is exact and the
+//  float steps are the same operations in the same order. Build with
+//  TRACKER_CHECK_KERNELS to compare them at startup, MeshTracker::selfCheck()
+//  then also runs one cloud through addVertex() and addPoints().
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <array>
+#include <cstdint>
+#include <random>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace QuantisedPoints {
+
+    // offsets are clamped so three squares still fit an int32
+    static const int maxOffset = 16383;
+
+    inline int16_t quantise(float metres){
+        return int16_t(ofClamp(lrintf(metres * 1000.0f), -32767, 32767));
+    }
+
+    inline int16_t clampOffset(int32_t d){
+        return int16_t(d < -maxOffset ? -maxOffset : d > maxOffset ? maxOffset : d);
+    }
+
+    // one head as the kernels see it, millimetres
+    struct Head {
+        int16_t cx, cy, cz;         // centre
+        int16_t fx, fy, fz;         // floor point
+        int16_t bx, by, bz;         // centre - floor point
+        int32_t consume;            // squared radii, a point is in if its squared distance is less
+        int32_t shell;
+        int32_t bb;                 // |b|^2
+        float invBB;                // 1 / bb, 0 without a line
+        float floorDistance2;
+        uint8_t index;              // in MeshTracker::heads
+    };
+
+    inline Head makeHead(const glm::vec3 & center, const glm::vec3 & floorPoint, float consumeSquared, float shellSquared, float floorDistance, uint8_t index){
+        Head h;
+        h.cx = quantise(center.x);
+        h.cy = quantise(center.y);
+        h.cz = quantise(center.z);
+        h.fx = quantise(floorPoint.x);
+        h.fy = quantise(floorPoint.y);
+        h.fz = quantise(floorPoint.z);
+        h.bx = clampOffset(h.cx - h.fx);
+        h.by = clampOffset(h.cy - h.fy);
+        h.bz = clampOffset(h.cz - h.fz);
+        // d2 < r2 for an integer d2 is d2 < ceil(r2)
+        h.consume = int32_t(fmin(ceil(double(consumeSquared) * 1e6), 2e9));
+        h.shell = int32_t(fmin(ceil(double(shellSquared) * 1e6), 2e9));
+        h.bb = int32_t(h.bx)*h.bx + int32_t(h.by)*h.by + int32_t(h.bz)*h.bz;
+        h.invBB = h.bb > 0 ? 1.0f / float(h.bb) : 0.0f;
+        h.floorDistance2 = floorDistance * floorDistance * 1e6f;
+        h.index = index;
+        return h;
+    }
+
+    // pads a fixed head count, no point is ever closer than 0 or below -inf
+    inline Head makeUnreachableHead(){
+        Head h = makeHead(glm::vec3(0,0,0), glm::vec3(0,0,0), 0, 0, 0, 0);
+        h.consume = 0;
+        h.shell = 0;
+        h.floorDistance2 = -std::numeric_limits<float>::infinity();
+        return h;
+    }
+
+    // Structure of arrays, sized once for the largest cloud
+    struct Cloud {
+        vector<int16_t> x, y, z;
+        vector<uint8_t> category;
+
+        void resize(size_t n){
+            x.resize(n);
+            y.resize(n);
+            z.resize(n);
+            category.resize(n);
+        }
+
+        void reserve(size_t n){
+            x.reserve(n);
+            y.reserve(n);
+            z.reserve(n);
+            category.reserve(n);
+        }
+    };
+
+    // squared distance to the segment from the floor point up to the centre,
+    // d2 is the squared distance to the centre
+    inline float lineDistance2(int16_t x, int16_t y, int16_t z, const Head & h, int32_t d2){
+        int32_t ax = clampOffset(x - h.fx);
+        int32_t ay = clampOffset(y - h.fy);
+        int32_t az = clampOffset(z - h.fz);
+        int32_t aa = ax*ax + ay*ay + az*az;
+        int32_t ab = ax*h.bx + ay*h.by + az*h.bz;
+        // the floor point, the centre or in between
+        float abf = float(ab);
+        float t = abf * abf;
+        t = t * h.invBB;
+        float mid = float(aa) - t;
+        return ab <= 0 ? float(aa) : ab >= h.bb ? float(d2) : mid;
+    }
+
+    inline int32_t distance2(int16_t x, int16_t y, int16_t z, const Head & h){
+        int32_t dx = clampOffset(x - h.cx);
+        int32_t dy = clampOffset(y - h.cy);
+        int32_t dz = clampOffset(z - h.cz);
+        return dx*dx + dy*dy + dz*dz;
+    }
+
+    inline uint8_t classifyPoint(int16_t x, int16_t y, int16_t z, const Head * heads, int headCount, uint8_t & owner){
+        for(int i = 0; i < headCount; i++){
+            const Head & h = heads[i];
+            int32_t d2 = distance2(x, y, z, h);
+            uint8_t c = 0;
+            if(d2 < h.consume){
+                c = 1;
+            } else if(d2 < h.shell){
+                c = 2;
+            } else if(lineDistance2(x, y, z, h, d2) < h.floorDistance2){
+                c = 3;
+            }
+            if(c){
+                owner = h.index;
+                return c;
+            }
+        }
+        return 0;
+    }
+
+    // classifyPoint() for all heads at once and then the first that wants the
+    // point, branch free up to there
+    template<int MaxHeads>
+    inline uint8_t classifyPointFixed(int16_t x, int16_t y, int16_t z, const Head * heads, uint8_t & owner){
+        uint8_t c[MaxHeads];
+        for(int i = 0; i < MaxHeads; i++){
+            const Head & h = heads[i];
+            int32_t d2 = distance2(x, y, z, h);
+            float line = lineDistance2(x, y, z, h, d2);
+            c[i] = d2 < h.consume ? 1 : d2 < h.shell ? 2 : line < h.floorDistance2 ? 3 : 0;
+        }
+        for(int i = 0; i < MaxHeads; i++){
+            if(c[i]){
+                owner = heads[i].index;
+                return c[i];
+            }
+        }
+        return 0;
+    }
+
+    // MaxHeads 0 loops over headCount heads, otherwise exactly MaxHeads
+    template<int MaxHeads>
+    inline void classifyPointsScalarImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                         const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        for(size_t i = 0; i < n; i++){
+            owner[i] = 0;
+            category[i] = MaxHeads > 0 ? classifyPointFixed<(MaxHeads > 0 ? MaxHeads : 1)>(x[i], y[i], z[i], heads, owner[i])
+                                       : classifyPoint(x[i], y[i], z[i], heads, headCount, owner[i]);
+        }
+    }
+
+    // Only what tracking needs: the head that consumes the point, unless a head
+    // before it has the point in its shell or near its floor line. Floor lines
+    // are only looked at for points some later head would consume, for most
+    // points no head does.
+    inline bool claimPoint(int16_t x, int16_t y, int16_t z, const Head * heads, int headCount, uint8_t & owner){
+        int consumer = -1;
+        for(int i = 0; i < headCount; i++){
+            int32_t d2 = distance2(x, y, z, heads[i]);
+            if(d2 < heads[i].consume){
+                consumer = i;
+                break;
+            }
+            if(d2 < heads[i].shell) return false;
+        }
+        if(consumer < 0) return false;
+        for(int i = 0; i < consumer; i++){
+            const Head & h = heads[i];
+            if(lineDistance2(x, y, z, h, distance2(x, y, z, h)) < h.floorDistance2) return false;
+        }
+        owner = heads[consumer].index;
+        return true;
+    }
+
+    template<int MaxHeads>
+    inline bool claimPointFixed(int16_t x, int16_t y, int16_t z, const Head * heads, uint8_t & owner){
+        int32_t d2[MaxHeads];
+        for(int i = 0; i < MaxHeads; i++){
+            d2[i] = distance2(x, y, z, heads[i]);
+        }
+        for(int i = 0; i < MaxHeads; i++){
+            if(d2[i] < heads[i].consume){
+                for(int k = 0; k < i; k++){
+                    if(lineDistance2(x, y, z, heads[k], d2[k]) < heads[k].floorDistance2) return false;
+                }
+                owner = heads[i].index;
+                return true;
+            }
+            if(d2[i] < heads[i].shell) return false;
+        }
+        return false;
+    }
+
+    // category 1 for the consumed points, 0 for all others
+    template<int MaxHeads>
+    inline void claimPointsScalarImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                      const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        for(size_t i = 0; i < n; i++){
+            owner[i] = 0;
+            category[i] = MaxHeads > 0 ? claimPointFixed<(MaxHeads > 0 ? MaxHeads : 1)>(x[i], y[i], z[i], heads, owner[i])
+                                       : claimPoint(x[i], y[i], z[i], heads, headCount, owner[i]);
+        }
+    }
+
+    inline void classifyPointsScalar(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                     const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        classifyPointsScalarImpl<0>(x, y, z, n, heads, headCount, category, owner);
+    }
+
+    // What a head sums of the points it consumed, offsets from its quantised
+    // centre in millimetres, exact until MeshTracker folds them into metres.
+    // Sum z^2 is n cz^2 + 2 cz sum dz + sum dz^2.
+    struct Sums {
+        int64_t n = 0;
+        int64_t x = 0, y = 0, z = 0;
+        int64_t xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;
+        int64_t d2Max = 0;
+        float heightMin = std::numeric_limits<float>::max();
+        float heightMax = -std::numeric_limits<float>::max();
+
+        bool operator==(const Sums & o) const {
+            return n == o.n && x == o.x && y == o.y && z == o.z && xx == o.xx && xy == o.xy && xz == o.xz &&
+                   yy == o.yy && yz == o.yz && zz == o.zz && d2Max == o.d2Max && heightMin == o.heightMin && heightMax == o.heightMax;
+        }
+    };
+
+    // one head's sums over a block, by its index in the owner array
+    struct Accumulator {
+        int16_t cx, cy, cz;
+        int32_t consume;
+        glm::vec4 heightRow;        // metres above the floor: (row.xyz . p) * 0.001 + row.w
+        Sums sums;
+    };
+
+    inline Accumulator makeAccumulator(const Head & h, const glm::vec4 & heightRow){
+        Accumulator a;
+        a.cx = h.cx;
+        a.cy = h.cy;
+        a.cz = h.cz;
+        a.consume = h.consume;
+        a.heightRow = heightRow;
+        return a;
+    }
+
+    // one operation a statement, so it is not fused and the vector sums
+    // round the same way
+    inline float height(int16_t x, int16_t y, int16_t z, const glm::vec4 & row){
+        float hx = row.x * x;
+        float hy = row.y * y;
+        float hz = row.z * z;
+        float h = hx + hy;
+        h = h + hz;
+        h = h * 0.001f;
+        return h + row.w;
+    }
+
+    inline void sumPoint(int16_t x, int16_t y, int16_t z, Accumulator & a){
+        auto & s = a.sums;
+        int64_t dx = x - a.cx;
+        int64_t dy = y - a.cy;
+        int64_t dz = z - a.cz;
+        s.n++;
+        s.x += dx; s.y += dy; s.z += dz;
+        s.xx += dx*dx; s.xy += dx*dy; s.xz += dx*dz;
+        s.yy += dy*dy; s.yz += dy*dz; s.zz += dz*dz;
+        s.d2Max = std::max(s.d2Max, dx*dx + dy*dy + dz*dz);
+        float h = height(x, y, z, a.heightRow);
+        s.heightMin = fminf(s.heightMin, h);
+        s.heightMax = fmaxf(s.heightMax, h);
+    }
+
+    // the points claimPoints() marked consumed, added to the sums of their owner
+    inline void sumClaimedScalar(const int16_t * x, const int16_t * y, const int16_t * z, const uint8_t * category,
+                                 const uint8_t * owner, size_t n, Accumulator * accumulators, int headCount){
+        for(size_t i = 0; i < n; i++){
+            if(category[i] == 1 && owner[i] < headCount){
+                sumPoint(x[i], y[i], z[i], accumulators[owner[i]]);
+            }
+        }
+    }
+
+    // The vector sums hold offsets in 16 bits and sums in 32 bit lanes. A
+    // consumed point's squared distance is under consume, so every offset
+    // fits when consume does not exceed maxOffset^2, and each lane, which
+    // adds two points a block, takes maxSummedBlocks() blocks before it has
+    // to be flushed into the 64 bit sums.
+    inline bool fitsVectorSums(const Accumulator * accumulators, int headCount){
+        for(int k = 0; k < headCount; k++){
+            if(accumulators[k].consume > maxOffset * maxOffset) return false;
+        }
+        return true;
+    }
+
+    inline int maxSummedBlocks(int32_t consume){
+        return int(std::min<int64_t>(std::numeric_limits<int32_t>::max() / (2 * std::max<int64_t>(consume, 1)), 1 << 20));
+    }
+
+    // heads per pass of the vector sums, their lanes stay on the stack
+    static const int sumGroup = 16;
+
+#if defined(__SSE2__)
+
+    inline __m128i clampOffsets(__m128i d){
+        return _mm_min_epi16(_mm_max_epi16(d, _mm_set1_epi16(-maxOffset)), _mm_set1_epi16(maxOffset));
+    }
+
+    // squared lengths of 8 offset vectors, points 0-3 in lo, 4-7 in hi
+    inline void squares(__m128i dx, __m128i dy, __m128i dz, __m128i & lo, __m128i & hi){
+        __m128i zero = _mm_setzero_si128();
+        __m128i xyLo = _mm_unpacklo_epi16(dx, dy);
+        __m128i xyHi = _mm_unpackhi_epi16(dx, dy);
+        __m128i z0Lo = _mm_unpacklo_epi16(dz, zero);
+        __m128i z0Hi = _mm_unpackhi_epi16(dz, zero);
+        lo = _mm_add_epi32(_mm_madd_epi16(xyLo, xyLo), _mm_madd_epi16(z0Lo, z0Lo));
+        hi = _mm_add_epi32(_mm_madd_epi16(xyHi, xyHi), _mm_madd_epi16(z0Hi, z0Hi));
+    }
+
+    // the category masks of 4 points, as in classifyPoint()
+    inline void classify4(__m128i d2, __m128i aa, __m128i ab, const Head & h, __m128i & c1, __m128i & c2, __m128i & c3){
+        c1 = _mm_cmplt_epi32(d2, _mm_set1_epi32(h.consume));
+        c2 = _mm_andnot_si128(c1, _mm_cmplt_epi32(d2, _mm_set1_epi32(h.shell)));
+
+        __m128 aaf = _mm_cvtepi32_ps(aa);
+        __m128 abf = _mm_cvtepi32_ps(ab);
+        __m128 t = _mm_mul_ps(abf, abf);
+        t = _mm_mul_ps(t, _mm_set1_ps(h.invBB));
+        __m128 mid = _mm_sub_ps(aaf, t);
+
+        __m128i beforeFloor = _mm_cmpgt_epi32(_mm_set1_epi32(1), ab);             // ab <= 0
+        __m128i pastCenter = _mm_andnot_si128(_mm_cmplt_epi32(ab, _mm_set1_epi32(h.bb)), _mm_set1_epi32(-1)); // ab >= bb
+        __m128 line = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(pastCenter), _mm_cvtepi32_ps(d2)),
+                                _mm_andnot_ps(_mm_castsi128_ps(pastCenter), mid));
+        line = _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(beforeFloor), aaf),
+                         _mm_andnot_ps(_mm_castsi128_ps(beforeFloor), line));
+
+        c3 = _mm_castps_si128(_mm_cmplt_ps(line, _mm_set1_ps(h.floorDistance2)));
+        c3 = _mm_andnot_si128(_mm_or_si128(c1, c2), c3);
+    }
+
+    // the category masks of 8 points in 16 bit lanes
+    inline void classify8(__m128i X, __m128i Y, __m128i Z, const Head & h, __m128i & c1, __m128i & c2, __m128i & c3){
+        __m128i dx = clampOffsets(_mm_subs_epi16(X, _mm_set1_epi16(h.cx)));
+        __m128i dy = clampOffsets(_mm_subs_epi16(Y, _mm_set1_epi16(h.cy)));
+        __m128i dz = clampOffsets(_mm_subs_epi16(Z, _mm_set1_epi16(h.cz)));
+        __m128i d2Lo, d2Hi;
+        squares(dx, dy, dz, d2Lo, d2Hi);
+
+        __m128i ax = clampOffsets(_mm_subs_epi16(X, _mm_set1_epi16(h.fx)));
+        __m128i ay = clampOffsets(_mm_subs_epi16(Y, _mm_set1_epi16(h.fy)));
+        __m128i az = clampOffsets(_mm_subs_epi16(Z, _mm_set1_epi16(h.fz)));
+        __m128i aaLo, aaHi;
+        squares(ax, ay, az, aaLo, aaHi);
+
+        __m128i bxy = _mm_set_epi16(h.by, h.bx, h.by, h.bx, h.by, h.bx, h.by, h.bx);
+        __m128i bz0 = _mm_set_epi16(0, h.bz, 0, h.bz, 0, h.bz, 0, h.bz);
+        __m128i zero = _mm_setzero_si128();
+        __m128i abLo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(ax, ay), bxy), _mm_madd_epi16(_mm_unpacklo_epi16(az, zero), bz0));
+        __m128i abHi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(ax, ay), bxy), _mm_madd_epi16(_mm_unpackhi_epi16(az, zero), bz0));
+
+        __m128i c1Lo, c2Lo, c3Lo, c1Hi, c2Hi, c3Hi;
+        classify4(d2Lo, aaLo, abLo, h, c1Lo, c2Lo, c3Lo);
+        classify4(d2Hi, aaHi, abHi, h, c1Hi, c2Hi, c3Hi);
+
+        // masks to 16 bit lanes, saturation keeps -1 and 0
+        c1 = _mm_packs_epi32(c1Lo, c1Hi);
+        c2 = _mm_packs_epi32(c2Lo, c2Hi);
+        c3 = _mm_packs_epi32(c3Lo, c3Hi);
+    }
+
+    template<int MaxHeads>
+    inline void classifyPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                   const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        const int count = MaxHeads > 0 ? MaxHeads : headCount;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8){
+            __m128i X = _mm_loadu_si128((const __m128i *) (x + i));
+            __m128i Y = _mm_loadu_si128((const __m128i *) (y + i));
+            __m128i Z = _mm_loadu_si128((const __m128i *) (z + i));
+
+            __m128i cat = _mm_setzero_si128();
+            __m128i own = _mm_setzero_si128();
+            __m128i open = _mm_set1_epi16(-1);
+
+            for(int k = 0; k < count; k++){
+                const Head & h = heads[k];
+
+                __m128i c1, c2, c3;
+                classify8(X, Y, Z, h, c1, c2, c3);
+
+                __m128i value = _mm_or_si128(_mm_or_si128(_mm_and_si128(c1, _mm_set1_epi16(1)),
+                                                          _mm_and_si128(c2, _mm_set1_epi16(2))),
+                                             _mm_and_si128(c3, _mm_set1_epi16(3)));
+                __m128i take = _mm_and_si128(open, _mm_or_si128(_mm_or_si128(c1, c2), c3));
+                cat = _mm_or_si128(cat, _mm_and_si128(take, value));
+                own = _mm_or_si128(own, _mm_and_si128(take, _mm_set1_epi16(h.index)));
+                open = _mm_andnot_si128(take, open);
+
+                if(_mm_movemask_epi8(open) == 0) break;
+            }
+
+            _mm_storel_epi64((__m128i *) (category + i), _mm_packus_epi16(cat, cat));
+            _mm_storel_epi64((__m128i *) (owner + i), _mm_packus_epi16(own, own));
+        }
+        classifyPointsScalarImpl<MaxHeads>(x + i, y + i, z + i, n - i, heads, headCount, category + i, owner + i);
+    }
+
+    // claimPoint() for 8 points at once. The consumer of each point comes
+    // first, then the floor lines of the heads before it, for the points a
+    // later head consumed and only as far as the last of those.
+    template<int MaxHeads>
+    inline void claimPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        const int count = MaxHeads > 0 ? MaxHeads : headCount;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8){
+            __m128i X = _mm_loadu_si128((const __m128i *) (x + i));
+            __m128i Y = _mm_loadu_si128((const __m128i *) (y + i));
+            __m128i Z = _mm_loadu_si128((const __m128i *) (z + i));
+
+            __m128i consumed = _mm_setzero_si128();
+            __m128i own = _mm_setzero_si128();
+            __m128i consumer = _mm_setzero_si128();     // position in heads
+            __m128i open = _mm_set1_epi16(-1);
+
+            for(int k = 0; k < count; k++){
+                const Head & h = heads[k];
+
+                __m128i dx = clampOffsets(_mm_subs_epi16(X, _mm_set1_epi16(h.cx)));
+                __m128i dy = clampOffsets(_mm_subs_epi16(Y, _mm_set1_epi16(h.cy)));
+                __m128i dz = clampOffsets(_mm_subs_epi16(Z, _mm_set1_epi16(h.cz)));
+                __m128i d2Lo, d2Hi;
+                squares(dx, dy, dz, d2Lo, d2Hi);
+
+                __m128i c1 = _mm_packs_epi32(_mm_cmplt_epi32(d2Lo, _mm_set1_epi32(h.consume)),
+                                             _mm_cmplt_epi32(d2Hi, _mm_set1_epi32(h.consume)));
+                __m128i shell = _mm_packs_epi32(_mm_cmplt_epi32(d2Lo, _mm_set1_epi32(h.shell)),
+                                                _mm_cmplt_epi32(d2Hi, _mm_set1_epi32(h.shell)));
+
+                __m128i take = _mm_and_si128(open, _mm_or_si128(c1, shell));
+                __m128i eat = _mm_and_si128(take, c1);
+                consumed = _mm_or_si128(consumed, eat);
+                own = _mm_or_si128(own, _mm_and_si128(eat, _mm_set1_epi16(h.index)));
+                consumer = _mm_or_si128(consumer, _mm_and_si128(eat, _mm_set1_epi16(int16_t(k))));
+                open = _mm_andnot_si128(take, open);
+
+                if(_mm_movemask_epi8(open) == 0) break;
+            }
+
+            __m128i blocked = _mm_setzero_si128();
+            for(int k = 0; k < count; k++){
+                __m128i after = _mm_and_si128(consumed, _mm_cmpgt_epi16(consumer, _mm_set1_epi16(int16_t(k))));
+                if(_mm_movemask_epi8(after) == 0) break;
+                __m128i pending = _mm_andnot_si128(blocked, after);
+                if(_mm_movemask_epi8(pending) == 0) continue;
+                // not consumed or in the shell of head k, so only its line counts
+                __m128i c1, c2, c3;
+                classify8(X, Y, Z, heads[k], c1, c2, c3);
+                blocked = _mm_or_si128(blocked, _mm_and_si128(pending, c3));
+            }
+            consumed = _mm_andnot_si128(blocked, consumed);
+            own = _mm_andnot_si128(blocked, own);
+
+            consumed = _mm_and_si128(consumed, _mm_set1_epi16(1));
+            _mm_storel_epi64((__m128i *) (category + i), _mm_packus_epi16(consumed, consumed));
+            _mm_storel_epi64((__m128i *) (owner + i), _mm_packus_epi16(own, own));
+        }
+        claimPointsScalarImpl<MaxHeads>(x + i, y + i, z + i, n - i, heads, headCount, category + i, owner + i);
+    }
+
+    // sumClaimedScalar() 8 points at a time, the same sums bit for bit
+    inline void sumClaimedImpl(const int16_t * x, const int16_t * y, const int16_t * z, const uint8_t * category,
+                               const uint8_t * owner, size_t n, Accumulator * accumulators, int headCount){
+        if(!fitsVectorSums(accumulators, headCount)){
+            sumClaimedScalar(x, y, z, category, owner, n, accumulators, headCount);
+            return;
+        }
+
+        struct Lanes {
+            __m128i x, y, z, xx, xy, xz, yy, yz, zz, d2Max;
+            __m128 heightMin, heightMax;
+            int64_t n;
+            int blocks;
+            int maxBlocks;
+        };
+        auto reset = [](Lanes & l){
+            l.x = l.y = l.z = l.xx = l.xy = l.xz = l.yy = l.yz = l.zz = l.d2Max = _mm_setzero_si128();
+            l.heightMin = _mm_set1_ps(std::numeric_limits<float>::max());
+            l.heightMax = _mm_set1_ps(-std::numeric_limits<float>::max());
+            l.n = 0;
+            l.blocks = 0;
+        };
+        auto flush = [&](Lanes & l, Sums & s){
+            int32_t v[4];
+            auto add = [&](__m128i lanes, int64_t & sum){
+                _mm_storeu_si128((__m128i *) v, lanes);
+                sum += int64_t(v[0]) + v[1] + v[2] + v[3];
+            };
+            add(l.x, s.x); add(l.y, s.y); add(l.z, s.z);
+            add(l.xx, s.xx); add(l.xy, s.xy); add(l.xz, s.xz);
+            add(l.yy, s.yy); add(l.yz, s.yz); add(l.zz, s.zz);
+            _mm_storeu_si128((__m128i *) v, l.d2Max);
+            for(int k = 0; k < 4; k++) s.d2Max = std::max<int64_t>(s.d2Max, v[k]);
+            float f[4];
+            _mm_storeu_ps(f, l.heightMin);
+            for(int k = 0; k < 4; k++) s.heightMin = fminf(s.heightMin, f[k]);
+            _mm_storeu_ps(f, l.heightMax);
+            for(int k = 0; k < 4; k++) s.heightMax = fmaxf(s.heightMax, f[k]);
+            s.n += l.n;
+            reset(l);
+        };
+
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        size_t end = n & ~size_t(7);
+
+        for(int first = 0; first < headCount; first += sumGroup){
+            int groupCount = std::min(sumGroup, headCount - first);
+            Lanes lanes[sumGroup];
+            for(int k = 0; k < groupCount; k++){
+                reset(lanes[k]);
+                lanes[k].maxBlocks = maxSummedBlocks(accumulators[first + k].consume);
+            }
+
+            for(size_t i = 0; i < end; i += 8){
+                __m128i cat = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (category + i)), zero);
+                __m128i consumed = _mm_cmpeq_epi16(cat, ones);
+                if(_mm_movemask_epi8(consumed) == 0) continue;
+                __m128i own = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (owner + i)), zero);
+
+                __m128i X = _mm_loadu_si128((const __m128i *) (x + i));
+                __m128i Y = _mm_loadu_si128((const __m128i *) (y + i));
+                __m128i Z = _mm_loadu_si128((const __m128i *) (z + i));
+                __m128 xLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(X, X), 16));
+                __m128 xHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(X, X), 16));
+                __m128 yLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(Y, Y), 16));
+                __m128 yHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(Y, Y), 16));
+                __m128 zLo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(Z, Z), 16));
+                __m128 zHi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(Z, Z), 16));
+
+                for(int k = 0; k < groupCount; k++){
+                    __m128i mask = _mm_and_si128(consumed, _mm_cmpeq_epi16(own, _mm_set1_epi16(int16_t(first + k))));
+                    int bits = _mm_movemask_epi8(mask);
+                    if(bits == 0) continue;
+
+                    const Accumulator & a = accumulators[first + k];
+                    Lanes & l = lanes[k];
+                    __m128i dx = _mm_and_si128(mask, clampOffsets(_mm_subs_epi16(X, _mm_set1_epi16(a.cx))));
+                    __m128i dy = _mm_and_si128(mask, clampOffsets(_mm_subs_epi16(Y, _mm_set1_epi16(a.cy))));
+                    __m128i dz = _mm_and_si128(mask, clampOffsets(_mm_subs_epi16(Z, _mm_set1_epi16(a.cz))));
+
+                    l.x = _mm_add_epi32(l.x, _mm_madd_epi16(dx, ones));
+                    l.y = _mm_add_epi32(l.y, _mm_madd_epi16(dy, ones));
+                    l.z = _mm_add_epi32(l.z, _mm_madd_epi16(dz, ones));
+                    l.xx = _mm_add_epi32(l.xx, _mm_madd_epi16(dx, dx));
+                    l.xy = _mm_add_epi32(l.xy, _mm_madd_epi16(dx, dy));
+                    l.xz = _mm_add_epi32(l.xz, _mm_madd_epi16(dx, dz));
+                    l.yy = _mm_add_epi32(l.yy, _mm_madd_epi16(dy, dy));
+                    l.yz = _mm_add_epi32(l.yz, _mm_madd_epi16(dy, dz));
+                    l.zz = _mm_add_epi32(l.zz, _mm_madd_epi16(dz, dz));
+
+                    // SSE2 has no 32 bit max, masked out lanes are 0
+                    __m128i d2Lo, d2Hi;
+                    squares(dx, dy, dz, d2Lo, d2Hi);
+                    __m128i d2 = _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi32(d2Lo, d2Hi), d2Lo), _mm_andnot_si128(_mm_cmpgt_epi32(d2Lo, d2Hi), d2Hi));
+                    __m128i more = _mm_cmpgt_epi32(d2, l.d2Max);
+                    l.d2Max = _mm_or_si128(_mm_and_si128(more, d2), _mm_andnot_si128(more, l.d2Max));
+
+                    __m128 rx = _mm_set1_ps(a.heightRow.x);
+                    __m128 ry = _mm_set1_ps(a.heightRow.y);
+                    __m128 rz = _mm_set1_ps(a.heightRow.z);
+                    __m128 hLo = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, xLo), _mm_mul_ps(ry, yLo)), _mm_mul_ps(rz, zLo)), _mm_set1_ps(0.001f)), _mm_set1_ps(a.heightRow.w));
+                    __m128 hHi = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(rx, xHi), _mm_mul_ps(ry, yHi)), _mm_mul_ps(rz, zHi)), _mm_set1_ps(0.001f)), _mm_set1_ps(a.heightRow.w));
+                    __m128 mLo = _mm_castsi128_ps(_mm_unpacklo_epi16(mask, mask));
+                    __m128 mHi = _mm_castsi128_ps(_mm_unpackhi_epi16(mask, mask));
+                    l.heightMin = _mm_min_ps(l.heightMin, _mm_or_ps(_mm_and_ps(mLo, hLo), _mm_andnot_ps(mLo, l.heightMin)));
+                    l.heightMin = _mm_min_ps(l.heightMin, _mm_or_ps(_mm_and_ps(mHi, hHi), _mm_andnot_ps(mHi, l.heightMin)));
+                    l.heightMax = _mm_max_ps(l.heightMax, _mm_or_ps(_mm_and_ps(mLo, hLo), _mm_andnot_ps(mLo, l.heightMax)));
+                    l.heightMax = _mm_max_ps(l.heightMax, _mm_or_ps(_mm_and_ps(mHi, hHi), _mm_andnot_ps(mHi, l.heightMax)));
+
+                    // two mask bits a point
+                    int lanesSet = 0;
+                    for(; bits; bits &= bits - 1) lanesSet++;
+                    l.n += lanesSet / 2;
+                    if(++l.blocks == l.maxBlocks) flush(l, accumulators[first + k].sums);
+                }
+            }
+            for(int k = 0; k < groupCount; k++){
+                flush(lanes[k], accumulators[first + k].sums);
+            }
+        }
+        sumClaimedScalar(x + end, y + end, z + end, category + end, owner + end, n - end, accumulators, headCount);
+    }
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+    inline int16x8_t clampOffsets(int16x8_t d){
+        return vminq_s16(vmaxq_s16(d, vdupq_n_s16(-maxOffset)), vdupq_n_s16(maxOffset));
+    }
+
+    inline int32x4_t squares(int16x4_t dx, int16x4_t dy, int16x4_t dz){
+        return vmlal_s16(vmlal_s16(vmull_s16(dx, dx), dy, dy), dz, dz);
+    }
+
+    inline void classify4(int32x4_t d2, int32x4_t aa, int32x4_t ab, const Head & h, uint32x4_t & c1, uint32x4_t & c2, uint32x4_t & c3){
+        c1 = vcltq_s32(d2, vdupq_n_s32(h.consume));
+        c2 = vbicq_u32(vcltq_s32(d2, vdupq_n_s32(h.shell)), c1);
+
+        float32x4_t aaf = vcvtq_f32_s32(aa);
+        float32x4_t abf = vcvtq_f32_s32(ab);
+        float32x4_t t = vmulq_f32(abf, abf);
+        t = vmulq_f32(t, vdupq_n_f32(h.invBB));
+        float32x4_t mid = vsubq_f32(aaf, t);
+
+        uint32x4_t beforeFloor = vcleq_s32(ab, vdupq_n_s32(0));
+        uint32x4_t pastCenter = vcgeq_s32(ab, vdupq_n_s32(h.bb));
+        float32x4_t line = vbslq_f32(pastCenter, vcvtq_f32_s32(d2), mid);
+        line = vbslq_f32(beforeFloor, aaf, line);
+
+        c3 = vbicq_u32(vcltq_f32(line, vdupq_n_f32(h.floorDistance2)), vorrq_u32(c1, c2));
+    }
+
+    // the category masks of 8 points in 16 bit lanes
+    inline void classify8(int16x8_t X, int16x8_t Y, int16x8_t Z, const Head & h, uint16x8_t & c1, uint16x8_t & c2, uint16x8_t & c3){
+        int16x8_t dx = clampOffsets(vqsubq_s16(X, vdupq_n_s16(h.cx)));
+        int16x8_t dy = clampOffsets(vqsubq_s16(Y, vdupq_n_s16(h.cy)));
+        int16x8_t dz = clampOffsets(vqsubq_s16(Z, vdupq_n_s16(h.cz)));
+        int16x8_t ax = clampOffsets(vqsubq_s16(X, vdupq_n_s16(h.fx)));
+        int16x8_t ay = clampOffsets(vqsubq_s16(Y, vdupq_n_s16(h.fy)));
+        int16x8_t az = clampOffsets(vqsubq_s16(Z, vdupq_n_s16(h.fz)));
+
+        int32x4_t d2Lo = squares(vget_low_s16(dx), vget_low_s16(dy), vget_low_s16(dz));
+        int32x4_t d2Hi = squares(vget_high_s16(dx), vget_high_s16(dy), vget_high_s16(dz));
+        int32x4_t aaLo = squares(vget_low_s16(ax), vget_low_s16(ay), vget_low_s16(az));
+        int32x4_t aaHi = squares(vget_high_s16(ax), vget_high_s16(ay), vget_high_s16(az));
+        int32x4_t abLo = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(vget_low_s16(ax), h.bx), vget_low_s16(ay), h.by), vget_low_s16(az), h.bz);
+        int32x4_t abHi = vmlal_n_s16(vmlal_n_s16(vmull_n_s16(vget_high_s16(ax), h.bx), vget_high_s16(ay), h.by), vget_high_s16(az), h.bz);
+
+        uint32x4_t c1Lo, c2Lo, c3Lo, c1Hi, c2Hi, c3Hi;
+        classify4(d2Lo, aaLo, abLo, h, c1Lo, c2Lo, c3Lo);
+        classify4(d2Hi, aaHi, abHi, h, c1Hi, c2Hi, c3Hi);
+
+        c1 = vcombine_u16(vmovn_u32(c1Lo), vmovn_u32(c1Hi));
+        c2 = vcombine_u16(vmovn_u32(c2Lo), vmovn_u32(c2Hi));
+        c3 = vcombine_u16(vmovn_u32(c3Lo), vmovn_u32(c3Hi));
+    }
+
+    template<int MaxHeads>
+    inline void classifyPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                   const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        const int count = MaxHeads > 0 ? MaxHeads : headCount;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8){
+            int16x8_t X = vld1q_s16(x + i);
+            int16x8_t Y = vld1q_s16(y + i);
+            int16x8_t Z = vld1q_s16(z + i);
+
+            uint16x8_t cat = vdupq_n_u16(0);
+            uint16x8_t own = vdupq_n_u16(0);
+            uint16x8_t open = vdupq_n_u16(0xffff);
+
+            for(int k = 0; k < count; k++){
+                const Head & h = heads[k];
+
+                uint16x8_t c1, c2, c3;
+                classify8(X, Y, Z, h, c1, c2, c3);
+
+                uint16x8_t value = vorrq_u16(vorrq_u16(vandq_u16(c1, vdupq_n_u16(1)), vandq_u16(c2, vdupq_n_u16(2))),
+                                             vandq_u16(c3, vdupq_n_u16(3)));
+                uint16x8_t take = vandq_u16(open, vorrq_u16(vorrq_u16(c1, c2), c3));
+                cat = vorrq_u16(cat, vandq_u16(take, value));
+                own = vorrq_u16(own, vandq_u16(take, vdupq_n_u16(h.index)));
+                open = vbicq_u16(open, take);
+
+                if(vmaxvq_u16(open) == 0) break;
+            }
+
+            vst1_u8(category + i, vmovn_u16(cat));
+            vst1_u8(owner + i, vmovn_u16(own));
+        }
+        classifyPointsScalarImpl<MaxHeads>(x + i, y + i, z + i, n - i, heads, headCount, category + i, owner + i);
+    }
+
+    template<int MaxHeads>
+    inline void claimPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        const int count = MaxHeads > 0 ? MaxHeads : headCount;
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8){
+            int16x8_t X = vld1q_s16(x + i);
+            int16x8_t Y = vld1q_s16(y + i);
+            int16x8_t Z = vld1q_s16(z + i);
+
+            uint16x8_t consumed = vdupq_n_u16(0);
+            uint16x8_t own = vdupq_n_u16(0);
+            uint16x8_t consumer = vdupq_n_u16(0);       // position in heads
+            uint16x8_t open = vdupq_n_u16(0xffff);
+
+            for(int k = 0; k < count; k++){
+                const Head & h = heads[k];
+
+                int16x8_t dx = clampOffsets(vqsubq_s16(X, vdupq_n_s16(h.cx)));
+                int16x8_t dy = clampOffsets(vqsubq_s16(Y, vdupq_n_s16(h.cy)));
+                int16x8_t dz = clampOffsets(vqsubq_s16(Z, vdupq_n_s16(h.cz)));
+                int32x4_t d2Lo = squares(vget_low_s16(dx), vget_low_s16(dy), vget_low_s16(dz));
+                int32x4_t d2Hi = squares(vget_high_s16(dx), vget_high_s16(dy), vget_high_s16(dz));
+
+                uint16x8_t c1 = vcombine_u16(vmovn_u32(vcltq_s32(d2Lo, vdupq_n_s32(h.consume))),
+                                             vmovn_u32(vcltq_s32(d2Hi, vdupq_n_s32(h.consume))));
+                uint16x8_t shell = vcombine_u16(vmovn_u32(vcltq_s32(d2Lo, vdupq_n_s32(h.shell))),
+                                                vmovn_u32(vcltq_s32(d2Hi, vdupq_n_s32(h.shell))));
+
+                uint16x8_t take = vandq_u16(open, vorrq_u16(c1, shell));
+                uint16x8_t eat = vandq_u16(take, c1);
+                consumed = vorrq_u16(consumed, eat);
+                own = vorrq_u16(own, vandq_u16(eat, vdupq_n_u16(h.index)));
+                consumer = vorrq_u16(consumer, vandq_u16(eat, vdupq_n_u16(uint16_t(k))));
+                open = vbicq_u16(open, take);
+
+                if(vmaxvq_u16(open) == 0) break;
+            }
+
+            uint16x8_t blocked = vdupq_n_u16(0);
+            for(int k = 0; k < count; k++){
+                uint16x8_t after = vandq_u16(consumed, vcgtq_u16(consumer, vdupq_n_u16(uint16_t(k))));
+                if(vmaxvq_u16(after) == 0) break;
+                uint16x8_t pending = vbicq_u16(after, blocked);
+                if(vmaxvq_u16(pending) == 0) continue;
+                // not consumed or in the shell of head k, so only its line counts
+                uint16x8_t c1, c2, c3;
+                classify8(X, Y, Z, heads[k], c1, c2, c3);
+                blocked = vorrq_u16(blocked, vandq_u16(pending, c3));
+            }
+            consumed = vbicq_u16(consumed, blocked);
+            own = vbicq_u16(own, blocked);
+
+            vst1_u8(category + i, vmovn_u16(vandq_u16(consumed, vdupq_n_u16(1))));
+            vst1_u8(owner + i, vmovn_u16(own));
+        }
+        claimPointsScalarImpl<MaxHeads>(x + i, y + i, z + i, n - i, heads, headCount, category + i, owner + i);
+    }
+
+    inline void sumClaimedImpl(const int16_t * x, const int16_t * y, const int16_t * z, const uint8_t * category,
+                               const uint8_t * owner, size_t n, Accumulator * accumulators, int headCount){
+        if(!fitsVectorSums(accumulators, headCount)){
+            sumClaimedScalar(x, y, z, category, owner, n, accumulators, headCount);
+            return;
+        }
+
+        struct Lanes {
+            int32x4_t x, y, z, xx, xy, xz, yy, yz, zz, d2Max;
+            float32x4_t heightMin, heightMax;
+            int64_t n;
+            int blocks;
+            int maxBlocks;
+        };
+        auto reset = [](Lanes & l){
+            l.x = l.y = l.z = l.xx = l.xy = l.xz = l.yy = l.yz = l.zz = l.d2Max = vdupq_n_s32(0);
+            l.heightMin = vdupq_n_f32(std::numeric_limits<float>::max());
+            l.heightMax = vdupq_n_f32(-std::numeric_limits<float>::max());
+            l.n = 0;
+            l.blocks = 0;
+        };
+        auto flush = [&](Lanes & l, Sums & s){
+            s.x += vaddlvq_s32(l.x); s.y += vaddlvq_s32(l.y); s.z += vaddlvq_s32(l.z);
+            s.xx += vaddlvq_s32(l.xx); s.xy += vaddlvq_s32(l.xy); s.xz += vaddlvq_s32(l.xz);
+            s.yy += vaddlvq_s32(l.yy); s.yz += vaddlvq_s32(l.yz); s.zz += vaddlvq_s32(l.zz);
+            s.d2Max = std::max<int64_t>(s.d2Max, vmaxvq_s32(l.d2Max));
+            s.heightMin = fminf(s.heightMin, vminvq_f32(l.heightMin));
+            s.heightMax = fmaxf(s.heightMax, vmaxvq_f32(l.heightMax));
+            s.n += l.n;
+            reset(l);
+        };
+
+        size_t end = n & ~size_t(7);
+
+        for(int first = 0; first < headCount; first += sumGroup){
+            int groupCount = std::min(sumGroup, headCount - first);
+            Lanes lanes[sumGroup];
+            for(int k = 0; k < groupCount; k++){
+                reset(lanes[k]);
+                lanes[k].maxBlocks = maxSummedBlocks(accumulators[first + k].consume);
+            }
+
+            for(size_t i = 0; i < end; i += 8){
+                uint16x8_t consumed = vceqq_u16(vmovl_u8(vld1_u8(category + i)), vdupq_n_u16(1));
+                if(vmaxvq_u16(consumed) == 0) continue;
+                uint16x8_t own = vmovl_u8(vld1_u8(owner + i));
+
+                int16x8_t X = vld1q_s16(x + i);
+                int16x8_t Y = vld1q_s16(y + i);
+                int16x8_t Z = vld1q_s16(z + i);
+                float32x4_t xLo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(X)));
+                float32x4_t xHi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(X)));
+                float32x4_t yLo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(Y)));
+                float32x4_t yHi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(Y)));
+                float32x4_t zLo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(Z)));
+                float32x4_t zHi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(Z)));
+
+                for(int k = 0; k < groupCount; k++){
+                    uint16x8_t mask = vandq_u16(consumed, vceqq_u16(own, vdupq_n_u16(uint16_t(first + k))));
+                    if(vmaxvq_u16(mask) == 0) continue;
+
+                    const Accumulator & a = accumulators[first + k];
+                    Lanes & l = lanes[k];
+                    int16x8_t m = vreinterpretq_s16_u16(mask);
+                    int16x8_t dx = vandq_s16(m, clampOffsets(vqsubq_s16(X, vdupq_n_s16(a.cx))));
+                    int16x8_t dy = vandq_s16(m, clampOffsets(vqsubq_s16(Y, vdupq_n_s16(a.cy))));
+                    int16x8_t dz = vandq_s16(m, clampOffsets(vqsubq_s16(Z, vdupq_n_s16(a.cz))));
+                    int16x4_t dxLo = vget_low_s16(dx), dxHi = vget_high_s16(dx);
+                    int16x4_t dyLo = vget_low_s16(dy), dyHi = vget_high_s16(dy);
+                    int16x4_t dzLo = vget_low_s16(dz), dzHi = vget_high_s16(dz);
+
+                    l.x = vpadalq_s16(l.x, dx);
+                    l.y = vpadalq_s16(l.y, dy);
+                    l.z = vpadalq_s16(l.z, dz);
+                    l.xx = vmlal_s16(vmlal_s16(l.xx, dxLo, dxLo), dxHi, dxHi);
+                    l.xy = vmlal_s16(vmlal_s16(l.xy, dxLo, dyLo), dxHi, dyHi);
+                    l.xz = vmlal_s16(vmlal_s16(l.xz, dxLo, dzLo), dxHi, dzHi);
+                    l.yy = vmlal_s16(vmlal_s16(l.yy, dyLo, dyLo), dyHi, dyHi);
+                    l.yz = vmlal_s16(vmlal_s16(l.yz, dyLo, dzLo), dyHi, dzHi);
+                    l.zz = vmlal_s16(vmlal_s16(l.zz, dzLo, dzLo), dzHi, dzHi);
+                    l.d2Max = vmaxq_s32(l.d2Max, vmaxq_s32(squares(dxLo, dyLo, dzLo), squares(dxHi, dyHi, dzHi)));
+
+                    float32x4_t rx = vdupq_n_f32(a.heightRow.x);
+                    float32x4_t ry = vdupq_n_f32(a.heightRow.y);
+                    float32x4_t rz = vdupq_n_f32(a.heightRow.z);
+                    float32x4_t hLo = vaddq_f32(vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(rx, xLo), vmulq_f32(ry, yLo)), vmulq_f32(rz, zLo)), vdupq_n_f32(0.001f)), vdupq_n_f32(a.heightRow.w));
+                    float32x4_t hHi = vaddq_f32(vmulq_f32(vaddq_f32(vaddq_f32(vmulq_f32(rx, xHi), vmulq_f32(ry, yHi)), vmulq_f32(rz, zHi)), vdupq_n_f32(0.001f)), vdupq_n_f32(a.heightRow.w));
+                    uint32x4_t mLo = vreinterpretq_u32_s32(vmovl_s16(vget_low_s16(m)));
+                    uint32x4_t mHi = vreinterpretq_u32_s32(vmovl_s16(vget_high_s16(m)));
+                    l.heightMin = vminq_f32(l.heightMin, vbslq_f32(mLo, hLo, l.heightMin));
+                    l.heightMin = vminq_f32(l.heightMin, vbslq_f32(mHi, hHi, l.heightMin));
+                    l.heightMax = vmaxq_f32(l.heightMax, vbslq_f32(mLo, hLo, l.heightMax));
+                    l.heightMax = vmaxq_f32(l.heightMax, vbslq_f32(mHi, hHi, l.heightMax));
+
+                    l.n += vaddvq_u16(vshrq_n_u16(mask, 15));
+                    if(++l.blocks == l.maxBlocks) flush(l, accumulators[first + k].sums);
+                }
+            }
+            for(int k = 0; k < groupCount; k++){
+                flush(lanes[k], accumulators[first + k].sums);
+            }
+        }
+        sumClaimedScalar(x + end, y + end, z + end, category + end, owner + end, n - end, accumulators, headCount);
+    }
+
+#else
+
+    inline void sumClaimedImpl(const int16_t * x, const int16_t * y, const int16_t * z, const uint8_t * category,
+                               const uint8_t * owner, size_t n, Accumulator * accumulators, int headCount){
+        sumClaimedScalar(x, y, z, category, owner, n, accumulators, headCount);
+    }
+
+    template<int MaxHeads>
+    inline void classifyPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                   const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        classifyPointsScalarImpl<MaxHeads>(x, y, z, n, heads, headCount, category, owner);
+    }
+
+    template<int MaxHeads>
+    inline void claimPointsImpl(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        claimPointsScalarImpl<MaxHeads>(x, y, z, n, heads, headCount, category, owner);
+    }
+
+#endif
+
+    inline void classifyPoints(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                               const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        classifyPointsImpl<0>(x, y, z, n, heads, headCount, category, owner);
+    }
+
+    inline void claimPoints(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                            const Head * heads, int headCount, uint8_t * category, uint8_t * owner){
+        claimPointsImpl<0>(x, y, z, n, heads, headCount, category, owner);
+    }
+
+    // after claimPoints(), accumulators[k] sums the points owned by head k
+    inline void sumClaimed(const int16_t * x, const int16_t * y, const int16_t * z, const uint8_t * category,
+                           const uint8_t * owner, size_t n, Accumulator * accumulators, int headCount){
+        sumClaimedImpl(x, y, z, category, owner, n, accumulators, headCount);
+    }
+
+    // heads padded to MaxHeads with makeUnreachableHead()
+    template<int MaxHeads>
+    inline void classifyPointsFixed(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                    const std::array<Head, MaxHeads> & heads, uint8_t * category, uint8_t * owner){
+        classifyPointsImpl<MaxHeads>(x, y, z, n, heads.data(), MaxHeads, category, owner);
+    }
+
+    template<int MaxHeads>
+    inline void claimPointsFixed(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                                 const std::array<Head, MaxHeads> & heads, uint8_t * category, uint8_t * owner){
+        claimPointsImpl<MaxHeads>(x, y, z, n, heads.data(), MaxHeads, category, owner);
+    }
+
+    template<int MaxHeads>
+    struct FixedHeads {
+        std::array<Head, MaxHeads> heads;
+
+        void set(const vector<Head> & from){
+            for(int i = 0; i < MaxHeads; i++){
+                heads[i] = i < int(from.size()) ? from[i] : makeUnreachableHead();
+            }
+        }
+    };
+
+    // The head counts with their own kernel, a tracker uses the smallest that
+    // fits. Over 16 heads the loop version takes over.
+    struct HeadKernels {
+        FixedHeads<3> heads3;
+        FixedHeads<5> heads5;
+        FixedHeads<8> heads8;
+        FixedHeads<16> heads16;
+        bool fixed = true;      // false runs the loop version, for comparison
+
+        // all four categories, for showing the cloud
+        void classify(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                      const vector<Head> & heads, uint8_t * category, uint8_t * owner){
+            run<false>(x, y, z, n, heads, category, owner);
+        }
+
+        // consumed or not, for tracking
+        void claim(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                   const vector<Head> & heads, uint8_t * category, uint8_t * owner){
+            run<true>(x, y, z, n, heads, category, owner);
+        }
+
+    private:
+
+        template<bool Claim, int MaxHeads>
+        void runFixed(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                      FixedHeads<MaxHeads> & fixedHeads, const vector<Head> & heads, uint8_t * category, uint8_t * owner){
+            fixedHeads.set(heads);
+            if(Claim){
+                claimPointsFixed<MaxHeads>(x, y, z, n, fixedHeads.heads, category, owner);
+            } else {
+                classifyPointsFixed<MaxHeads>(x, y, z, n, fixedHeads.heads, category, owner);
+            }
+        }
+
+        template<bool Claim>
+        void run(const int16_t * x, const int16_t * y, const int16_t * z, size_t n,
+                 const vector<Head> & heads, uint8_t * category, uint8_t * owner){
+            size_t count = heads.size();
+            if(!fixed || count > 16){
+                if(Claim){
+                    claimPoints(x, y, z, n, heads.data(), int(count), category, owner);
+                } else {
+                    classifyPoints(x, y, z, n, heads.data(), int(count), category, owner);
+                }
+            } else if(count <= 3){
+                runFixed<Claim>(x, y, z, n, heads3, heads, category, owner);
+            } else if(count <= 5){
+                runFixed<Claim>(x, y, z, n, heads5, heads, category, owner);
+            } else if(count <= 8){
+                runFixed<Claim>(x, y, z, n, heads8, heads, category, owner);
+            } else {
+                runFixed<Claim>(x, y, z, n, heads16, heads, category, owner);
+            }
+        }
+    };
+
+    inline const char * getKernelName(){
+#if defined(__SSE2__)
+        return "SSE2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        return "NEON";
+#else
+        return "scalar";
+#endif
+    }
+
+    // heads somewhere in a room, half the points on them and the rest anywhere.
+    // A depth image lists a head's points in runs along its rows, so they
+    // come in runs of 32 here too.
+    inline void makeTestScene(std::mt19937 & rng, int headCount, size_t n, vector<Head> & heads, Cloud & cloud){
+        std::uniform_real_distribution<float> unit(-1.0, 1.0);
+
+        heads.resize(headCount);
+        vector<glm::vec3> centers(headCount);
+        for(int k = 0; k < headCount; k++){
+            centers[k] = glm::vec3(unit(rng) * 3.0, unit(rng) * 1.5, -3.0 + unit(rng) * 2.0);
+            glm::vec3 f(unit(rng) * 0.2, -1.5 + unit(rng) * 0.2, unit(rng) * 0.2);
+            heads[k] = makeHead(centers[k], f, 0.15 * 0.15 * (2 + k % 2), 0.15 * 0.15 * 1.5, 0.5, uint8_t(k));
+        }
+
+        cloud.resize(n);
+        for(size_t i = 0; i < n; i++){
+            glm::vec3 p = i / 32 % 2 == 0 ? centers[i / 64 % headCount] + glm::vec3(unit(rng), unit(rng), unit(rng)) * 0.15f
+                                          : glm::vec3(unit(rng) * 5.0, unit(rng) * 2.0, -4.0 + unit(rng) * 4.0);
+            cloud.x[i] = quantise(p.x);
+            cloud.y[i] = quantise(p.y);
+            cloud.z[i] = quantise(p.z);
+        }
+    }
+
+    // The vector kernels, looped and fixed, have to agree with the scalar loop
+    inline bool selfCheck(){
+        std::mt19937 rng(1234);
+        size_t mismatches = 0;
+        HeadKernels kernels;
+        vector<Head> heads;
+        Cloud cloud;
+
+        for(int round = 0; round < 64; round++){
+            int headCount = 1 + round % 16;
+            size_t n = 1000 + round;
+            makeTestScene(rng, headCount, n, heads, cloud);
+
+            vector<uint8_t> scalarCategory(n), scalarOwner(n), category(n), owner(n);
+            classifyPointsScalar(cloud.x.data(), cloud.y.data(), cloud.z.data(), n, heads.data(), headCount, scalarCategory.data(), scalarOwner.data());
+            for(int fixed = 0; fixed < 2; fixed++){
+                kernels.fixed = fixed;
+                kernels.classify(cloud.x.data(), cloud.y.data(), cloud.z.data(), n, heads, category.data(), owner.data());
+                for(size_t i = 0; i < n; i++){
+                    if(category[i] != scalarCategory[i] || (category[i] != 0 && owner[i] != scalarOwner[i])){
+                        mismatches++;
+                    }
+                }
+                // tracking has to see exactly the consumed points
+                kernels.claim(cloud.x.data(), cloud.y.data(), cloud.z.data(), n, heads, category.data(), owner.data());
+                for(size_t i = 0; i < n; i++){
+                    if((category[i] == 1) != (scalarCategory[i] == 1) || (category[i] == 1 && owner[i] != scalarOwner[i])){
+                        mismatches++;
+                    }
+                }
+
+                // and sum them as the scalar loop does
+                std::uniform_real_distribution<float> unit(-1.0, 1.0);
+                Accumulator vectorSums[16], scalarSums[16];
+                for(int k = 0; k < headCount; k++){
+                    glm::vec4 row(unit(rng), unit(rng), unit(rng), unit(rng));
+                    vectorSums[k] = scalarSums[k] = makeAccumulator(heads[k], row);
+                }
+                sumClaimed(cloud.x.data(), cloud.y.data(), cloud.z.data(), category.data(), owner.data(), n, vectorSums, headCount);
+                sumClaimedScalar(cloud.x.data(), cloud.y.data(), cloud.z.data(), category.data(), owner.data(), n, scalarSums, headCount);
+                for(int k = 0; k < headCount; k++){
+                    if(!(vectorSums[k].sums == scalarSums[k].sums)) mismatches++;
+                }
+            }
+        }
+
+        if(mismatches > 0){
+            ofLogError("QuantisedPoints") << getKernelName() << " kernels disagree with the scalar one on " << mismatches << " points";
+            return false;
+        }
+        ofLogNotice("QuantisedPoints") << getKernelName() << " kernels checked";
+        return true;
+    }
+
+    struct BenchmarkResult {
+        int heads = 0;
+        double loopNanos = 0;       // per point
+        double fixedNanos = 0;
+        double claimNanos = 0;      // fixed, tracking only
+        double sumNanos = 0;        // sumClaimed() after claiming
+        double sumScalarNanos = 0;  // sumClaimedScalar()
+        double vertexNanos = 0;     // MeshTracker::addVertex(), the float baseline
+        double pointsNanos = 0;     // MeshTracker::addPoints(), claim and sums
+    };
+
+    // per point cost of the loop and the fixed kernel for a head count, and of
+    // the tracking pass alone, on a cloud the size of a decimated 848x480 frame.
+    // The scene is left in heads and cloud, MeshTracker::benchmark() times the
+    // tracker on it.
+    inline BenchmarkResult benchmark(int headCount, int repeats, vector<Head> & heads, Cloud & cloud){
+        std::mt19937 rng(4321);
+        size_t n = 424 * 240;
+        makeTestScene(rng, headCount, n, heads, cloud);
+        vector<uint8_t> owner(n);
+        HeadKernels kernels;
+        vector<Accumulator> accumulators(headCount);
+
+        // the sums of the points the last pass claimed
+        auto timeSums = [&](bool vectorised){
+            auto pass = [&]{
+                for(int k = 0; k < headCount; k++){
+                    accumulators[k] = makeAccumulator(heads[k], glm::vec4(0,1,0,0));
+                }
+                if(vectorised){
+                    sumClaimed(cloud.x.data(), cloud.y.data(), cloud.z.data(), cloud.category.data(), owner.data(), n, accumulators.data(), headCount);
+                } else {
+                    sumClaimedScalar(cloud.x.data(), cloud.y.data(), cloud.z.data(), cloud.category.data(), owner.data(), n, accumulators.data(), headCount);
+                }
+            };
+            pass();
+            uint64_t start = ofGetElapsedTimeMicros();
+            for(int r = 0; r < repeats; r++){
+                pass();
+            }
+            return (ofGetElapsedTimeMicros() - start) * 1000.0 / (double(n) * repeats);
+        };
+
+        auto time = [&](bool fixed, bool claim){
+            kernels.fixed = fixed;
+            auto pass = [&]{
+                if(claim){
+                    kernels.claim(cloud.x.data(), cloud.y.data(), cloud.z.data(), n, heads, cloud.category.data(), owner.data());
+                } else {
+                    kernels.classify(cloud.x.data(), cloud.y.data(), cloud.z.data(), n, heads, cloud.category.data(), owner.data());
+                }
+            };
+            // one round to warm the caches
+            pass();
+            uint64_t start = ofGetElapsedTimeMicros();
+            for(int r = 0; r < repeats; r++){
+                pass();
+            }
+            return (ofGetElapsedTimeMicros() - start) * 1000.0 / (double(n) * repeats);
+        };
+
+        BenchmarkResult result;
+        result.heads = headCount;
+        result.loopNanos = time(false, false);
+        result.fixedNanos = time(true, false);
+        result.claimNanos = time(true, true);
+        result.sumNanos = timeSums(true);
+        result.sumScalarNanos = timeSums(false);
+        ofLogNotice("QuantisedPoints") << headCount << " heads: " << result.loopNanos << "ns per point looped, "
+        << result.fixedNanos << "ns fixed, " << result.claimNanos << "ns tracking only, " << result.sumNanos
+        << "ns summing (" << result.sumScalarNanos << "ns scalar) (" << getKernelName() << ")";
+        // tracking only skips work a full classify does, it must not cost more
+        if(result.claimNanos > result.fixedNanos){
+            ofLogWarning("QuantisedPoints") << headCount << " heads: tracking only takes " << result.claimNanos / result.fixedNanos
+            << "x the time of a full classify";
+        }
+        return result;
+    }
+
+    inline BenchmarkResult benchmark(int headCount, int repeats = 50){
+        vector<Head> heads;
+        Cloud cloud;
+        return benchmark(headCount, repeats, heads, cloud);
+    }
+}
@@ -0,0 +1,6 @@
+//
+//  RealtimeProfile.cpp
+//  realsense-osc-tracker
+//
+
+#include "RealtimeProfile.hpp"
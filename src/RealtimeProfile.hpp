@@ -0,0 +1,112 @@
+//
+//  RealtimeProfile.hpp
+//  realsense-osc-tracker
+//
+//  Opt-in scheduling for the processing thread on a show machine. Apply it
+//  from the thread itself. Every step is best effort and reported, because
+//  what is permitted depends on the OS and the user running the app.
+//
+//  Linux   pin to a core, SCHED_FIFO, mlockall
+//  macOS   affinity tag (a hint only), time constraint policy sized from the
+//          frame period, the frame buffers wired with prefault() (there is
+//          no mlockall)
+//
+//  Memory stays locked for the whole process until release(), which the
+//  thread calls when it stops, so a run without the profile is not skewed
+//  by the one before it.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <sys/mman.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __APPLE__
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#endif
+
+struct RealtimeProfile {
+
+    int core = -1;                 // -1 leaves placement to the OS
+    int priority = 80;             // SCHED_FIFO priority on Linux
+    double period = 1.0/90.0;      // seconds between frames
+    double computation = 0.004;    // seconds of work per frame
+    bool lockMemory = true;
+
+    // applies to the calling thread, returns what took effect
+    string apply() const {
+        string report;
+
+#if defined(__linux__)
+        if(core >= 0){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(core, &set);
+            int e = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            report += e == 0 ? "core " + ofToString(core) : "no affinity (" + string(strerror(e)) + ")";
+            report += ", ";
+        }
+        sched_param param;
+        param.sched_priority = priority;
+        int e = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        report += e == 0 ? "SCHED_FIFO " + ofToString(priority) : "no SCHED_FIFO (" + string(strerror(e)) + ")";
+        if(lockMemory){
+            report += mlockall(MCL_CURRENT | MCL_FUTURE) == 0 ? ", memory locked" : ", no mlockall (" + string(strerror(errno)) + ")";
+        }
+#elif defined(__APPLE__)
+        if(core >= 0){
+            // threads with the same tag share a cache, different tags are spread out
+            thread_affinity_policy_data_t affinity = { core + 1 };
+            kern_return_t r = thread_policy_set(mach_thread_self(), THREAD_AFFINITY_POLICY, (thread_policy_t) &affinity, THREAD_AFFINITY_POLICY_COUNT);
+            report += r == KERN_SUCCESS ? "affinity tag " + ofToString(core + 1) : "no affinity tag";
+            report += ", ";
+        }
+        mach_timebase_info_data_t timebase;
+        mach_timebase_info(&timebase);
+        double ticksPerSecond = 1e9 * timebase.denom / timebase.numer;
+        thread_time_constraint_policy_data_t policy;
+        policy.period = uint32_t(period * ticksPerSecond);
+        policy.computation = uint32_t(fmin(computation, period) * ticksPerSecond);
+        policy.constraint = policy.period;
+        policy.preemptible = 1;
+        kern_return_t r = thread_policy_set(mach_thread_self(), THREAD_TIME_CONSTRAINT_POLICY, (thread_policy_t) &policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT);
+        report += r == KERN_SUCCESS ? "time constraint policy" : "no time constraint policy";
+#else
+        report += "not supported on this platform";
+#endif
+
+        ofLogNotice("RealtimeProfile") << report;
+        return report;
+    }
+
+    // undoes the memory locking of apply(), the scheduling goes with the thread
+    void release() const {
+#if defined(__linux__)
+        if(lockMemory && munlockall() != 0){
+            ofLogWarning("RealtimeProfile") << "munlockall failed: " << strerror(errno);
+        }
+#endif
+    }
+
+    // faults in and wires a buffer the thread will touch every frame,
+    // a no-op without lockMemory, returns the bytes wired
+    size_t prefault(const void * data, size_t bytes) const {
+        if(!lockMemory || !data || bytes == 0) return 0;
+        if(mlock(data, bytes) != 0){
+            ofLogVerbose("RealtimeProfile") << "mlock of " << bytes << " bytes failed: " << strerror(errno);
+            return 0;
+        }
+        return bytes;
+    }
+
+    // a buffer prefault() wired, before it goes or the profile is released
+    void unwire(const void * data, size_t bytes) const {
+        if(!lockMemory || !data || bytes == 0) return;
+        munlock(data, bytes);
+    }
+};
@@ -0,0 +1,51 @@
+//
+//  SpscQueue.hpp
+//  realsense-osc-tracker
+//
+//  Bounded lock-free queue for exactly one producer thread and one consumer
+//  thread. Slots are preallocated, push() fails instead of blocking when the
+//  consumer falls behind.
+//
+
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+template<typename T, std::size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+
+    bool push(const T & item){
+        T copy(item);
+        return push(std::move(copy));
+    }
+
+    bool push(T && item){
+        std::size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == Capacity) return false;
+        slots[t & (Capacity - 1)] = std::move(item);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T & item){
+        std::size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire)) return false;
+        item = std::move(slots[h & (Capacity - 1)]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, Capacity> slots;
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
@@ -0,0 +1,6 @@
+//
+//  SyntheticCrowd.cpp
+//  realsense-osc-tracker
+//
+
+#include "SyntheticCrowd.hpp"
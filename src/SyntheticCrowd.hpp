@@ -0,0 +1,743 @@
+//
+//  SyntheticCrowd.hpp
+//  realsense-osc-tracker
+//
+//  A crowd that does not have to be hired, for load and accuracy testing:
+//
+//  realsense-osc-tracker --synthetic <settings.json> <output folder> [--people 1,2,5,10,20,30]
+//      [--seconds 20] [--fps 30] [--seed 1] [--noise 0.002] [--intrinsics <recording>]
+//
+//  People are a capsule for the body and a sphere for the head. They come in
+//  one after the other at the start position, wait there a second to be
+//  picked up, then walk between random points on the floor of the tracking
+//  box, keeping out of each other's way. Floor and walls are where the
+//  settings put the planes. Everything comes from a seeded generator, so a
+//  run renders the same frames every time.
+//
+//  Frames are ray cast into 16-bit depth with the intrinsics of the given
+//  recording, a D435 at 848x480 without one, from the tracking camera pose
+//  of the settings, with depth noise of noise * z^2 metres. They go through
+//  BatchPipeline, the rs2 or fused filters, point cloud, crop and
+//  MeshTracker as in the app, with as many heads as people when the
+//  settings have fewer.
+//
+//  Per number of people it prints, and writes to synthetic.json:
+//
+//  - frames per second of the pipeline, rendering not counted
+//  - error between the tracking heads and the head centres they are matched
+//    to, nearest first within 0.5 m
+//  - ID switches, a person matched to another head than before
+//  - acquisition delay from entering to the first match, and who never was
+//  - person frames without a match and tracking heads without a person
+//
+//  and synthetic-<people>.truth.csv with the head centres, and
+//  synthetic-<people>.tracks.csv with the tracking heads, as --batch has it.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <librealsense2/rs.hpp>
+#include <librealsense2/hpp/rs_internal.hpp>
+#include "BatchProcessor.hpp"
+#include "DepthRecording.hpp"
+#include <fstream>
+
+// splitmix64, the same numbers on every platform
+struct SyntheticRandom {
+    uint64_t state;
+
+    explicit SyntheticRandom(uint64_t seed) : state(seed) {}
+
+    uint64_t next(){
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    float uniform(float low, float high){
+        return low + (high - low) * float(next() >> 40) / float(1 << 24);
+    }
+};
+
+struct SyntheticPerson {
+    glm::vec3 position;         // on the floor, global
+    glm::vec3 target;
+    float headHeight = 1.7;     // of the head centre above the floor
+    float speed = 1.0;          // metres per second
+    double enterAt = 0;         // when it may come in
+    double enteredAt = -1;      // when it did, -1 not yet
+    double waitUntil = 0;
+    double blockedSince = -1;
+
+    bool isPresent() const {
+        return enteredAt >= 0;
+    }
+};
+
+class SyntheticScene {
+public:
+
+    static constexpr float headRadius = 0.1;
+    static constexpr float bodyRadius = 0.17;
+    static constexpr float neck = 0.04;             // between the head and the body
+    static constexpr float entrySpacing = 1.5;      // seconds between people coming in
+    static constexpr float entryWait = 1.0;         // at the start position
+    static constexpr float separation = 0.6;        // closest two people get, between centres
+    static constexpr float startClearance = 1.2;    // no one stops closer to the start position
+
+    vector<SyntheticPerson> people;
+    float floorHeight = 0;
+
+    void setup(const BatchSettings & settings, const glm::mat4 & boxToGlobal, int count, uint64_t seed){
+        random = SyntheticRandom(seed);
+        this->boxToGlobal = boxToGlobal;
+        halfExtents = settings.pTrackingBoxSize.get() / 2.0f;
+        floorHeight = settings.pFloorPlanePosition.get().y;
+        glm::vec3 startPosition = settings.pTrackingStartPosition;
+        start = glm::vec3(startPosition.x, floorHeight, startPosition.z);
+
+        // as tall as the start position expects heads, within a few cm
+        people.assign(count, SyntheticPerson());
+        for(int i = 0; i < count; i++){
+            auto & p = people[i];
+            p.headHeight = ofClamp(startPosition.y - floorHeight + random.uniform(-0.12, 0.04), 1.1f, 2.2f);
+            p.speed = random.uniform(0.5, 1.4);
+            p.enterAt = i * entrySpacing;
+            p.position = start;
+            p.target = pickTarget();
+        }
+    }
+
+    // when the last person came in, -1 while someone is still waiting to
+    double getLastEntry() const {
+        double last = 0;
+        for(auto & p : people){
+            if(!p.isPresent()) return -1;
+            last = fmax(last, p.enteredAt);
+        }
+        return last;
+    }
+
+    glm::vec3 getHeadCentre(const SyntheticPerson & p) const {
+        return p.position + glm::vec3(0, p.headHeight, 0);
+    }
+
+    void step(double now, double dt){
+        for(auto & p : people){
+            if(!p.isPresent()){
+                // the one before has to be out of the way first
+                if(now >= p.enterAt && isClear(start, nullptr)){
+                    p.enteredAt = now;
+                    p.waitUntil = now + entryWait;
+                    p.position = start;
+                } else {
+                    continue;
+                }
+            }
+            if(now < p.waitUntil) continue;
+
+            glm::vec3 to = p.target - p.position;
+            float distance = glm::length(to);
+            if(distance < 0.1){
+                p.target = pickTarget();
+                p.waitUntil = now + random.uniform(0, 1.5);
+                continue;
+            }
+            // straight on, or around whoever is in the way
+            float stride = fmin(p.speed * dt, distance);
+            glm::vec3 direction = to / distance;
+            bool moved = false;
+            for(float angle : {0.0f, 45.0f, -45.0f, 90.0f, -90.0f}){
+                float c = cosf(ofDegToRad(angle));
+                float s = sinf(ofDegToRad(angle));
+                glm::vec3 next = p.position + glm::vec3(c * direction.x + s * direction.z, 0, c * direction.z - s * direction.x) * stride;
+                if(isClear(next, &p)){
+                    p.position = next;
+                    moved = true;
+                    break;
+                }
+            }
+            if(moved){
+                p.blockedSince = -1;
+            } else if(p.blockedSince < 0){
+                p.blockedSince = now;
+            } else if(now - p.blockedSince > 1.0){
+                // somewhere else then
+                p.target = pickTarget();
+                p.blockedSince = -1;
+            }
+        }
+    }
+
+private:
+
+    // anywhere on the floor of the box but where people come in
+    glm::vec3 pickTarget(){
+        float margin = bodyRadius + 0.1;
+        glm::vec3 p;
+        for(int i = 0; i < 16; i++){
+            glm::vec3 local(random.uniform(-1, 1) * fmax(halfExtents.x - margin, 0.0),
+                            0,
+                            random.uniform(-1, 1) * fmax(halfExtents.z - margin, 0.0));
+            p = glm::vec3(boxToGlobal * glm::vec4(local, 1.0));
+            p.y = floorHeight;
+            if(glm::distance(p, start) > startClearance) break;
+        }
+        return p;
+    }
+
+    // nobody else closer than the separation, or moving away from those who are
+    bool isClear(const glm::vec3 & position, const SyntheticPerson * self){
+        for(auto & other : people){
+            if(&other == self || !other.isPresent()) continue;
+            float d = glm::distance(position, other.position);
+            if(d >= separation) continue;
+            if(!self || d <= glm::distance(self->position, other.position)) return false;
+        }
+        return true;
+    }
+
+    SyntheticRandom random{1};
+    glm::mat4 boxToGlobal;
+    glm::vec3 halfExtents;
+    glm::vec3 start;
+};
+
+// Ray casts the scene into depth, in realsense pixel coordinates without
+// distortion, the way rs2::pointcloud deprojects it again
+class SyntheticRenderer {
+public:
+
+    void setup(const rs2_intrinsics & intrinsics, float depthScale, const glm::mat4 & cameraToGlobal,
+               const BatchSettings & settings, float noise, uint64_t seed){
+        this->intrinsics = intrinsics;
+        this->depthScale = depthScale;
+        this->noise = noise;
+        this->seed = uint32_t(seed);
+        globalToCamera = glm::inverse(cameraToGlobal);
+
+        int w = intrinsics.width;
+        int h = intrinsics.height;
+        rays.resize(size_t(w) * h);
+        depthPerDistance.resize(rays.size());
+        depth.resize(rays.size());
+        background.resize(rays.size());
+
+        // the tracking camera looks down -z with y up, realsense down z with y down
+        for(int v = 0; v < h; v++){
+            for(int u = 0; u < w; u++){
+                glm::vec3 r((u - intrinsics.ppx) / intrinsics.fx, -(v - intrinsics.ppy) / intrinsics.fy, -1);
+                float length = glm::length(r);
+                rays[size_t(v) * w + u] = r / length;
+                depthPerDistance[size_t(v) * w + u] = 1.0f / length;
+            }
+        }
+
+        // floor, side walls and back wall, they do not move
+        struct Plane { glm::vec3 normal; glm::vec3 point; };
+        Plane planes[4] = {
+            {{0, 1, 0}, settings.pFloorPlanePosition},
+            {{1, 0, 0}, settings.pWallNegXPlanePosition},
+            {{1, 0, 0}, settings.pWallPosXPlanePosition},
+            {{0, 0, 1}, settings.pBackWallPlane},
+        };
+        glm::mat3 rotation = glm::mat3(globalToCamera);
+        std::fill(background.begin(), background.end(), std::numeric_limits<float>::max());
+        for(auto & plane : planes){
+            glm::vec3 n = rotation * plane.normal;
+            float d = glm::dot(n, glm::vec3(globalToCamera * glm::vec4(plane.point, 1.0)));
+            for(size_t i = 0; i < rays.size(); i++){
+                float facing = glm::dot(n, rays[i]);
+                if(fabs(facing) < 1e-6) continue;
+                float t = d / facing;
+                if(t > 0) background[i] = fmin(background[i], t * depthPerDistance[i]);
+            }
+        }
+    }
+
+    // the depth of frame into pixels, width * height of the intrinsics
+    void render(const SyntheticScene & scene, uint32_t frame, uint16_t * pixels){
+        depth = background;
+        int w = intrinsics.width;
+        int h = intrinsics.height;
+
+        for(auto & p : scene.people){
+            if(!p.isPresent()) continue;
+            glm::vec3 headCentre = toCamera(scene.getHeadCentre(p));
+            float bodyTop = p.headHeight - SyntheticScene::headRadius - SyntheticScene::neck - SyntheticScene::bodyRadius;
+            glm::vec3 bodyBottom = toCamera(p.position + glm::vec3(0, SyntheticScene::bodyRadius, 0));
+            glm::vec3 bodyUpper = toCamera(p.position + glm::vec3(0, fmax(bodyTop, SyntheticScene::bodyRadius), 0));
+
+            // pixels the box around the person covers, all of them when it
+            // reaches behind the camera
+            int u0 = 0, u1 = w - 1, v0 = 0, v1 = h - 1;
+            float uMin = std::numeric_limits<float>::max(), uMax = -uMin, vMin = uMin, vMax = -uMin;
+            int inFront = 0;
+            float top = p.headHeight + SyntheticScene::headRadius;
+            for(int c = 0; c < 8; c++){
+                glm::vec3 corner = toCamera(p.position + glm::vec3(c & 1 ? SyntheticScene::bodyRadius : -SyntheticScene::bodyRadius,
+                                                                   c & 2 ? top : 0.0f,
+                                                                   c & 4 ? SyntheticScene::bodyRadius : -SyntheticScene::bodyRadius));
+                float z = -corner.z;
+                if(z < 0.05) continue;
+                inFront++;
+                float u = intrinsics.ppx + intrinsics.fx * corner.x / z;
+                float v = intrinsics.ppy - intrinsics.fy * corner.y / z;
+                uMin = fmin(uMin, u); uMax = fmax(uMax, u);
+                vMin = fmin(vMin, v); vMax = fmax(vMax, v);
+            }
+            if(inFront == 0) continue;
+            if(inFront == 8){
+                u0 = std::max(u0, int(floor(uMin)));
+                u1 = std::min(u1, int(ceil(uMax)));
+                v0 = std::max(v0, int(floor(vMin)));
+                v1 = std::min(v1, int(ceil(vMax)));
+            }
+
+            for(int v = v0; v <= v1; v++){
+                for(int u = u0; u <= u1; u++){
+                    size_t i = size_t(v) * w + u;
+                    const glm::vec3 & ray = rays[i];
+                    float t = intersectSphere(ray, headCentre, SyntheticScene::headRadius);
+                    float body = intersectCapsule(ray, bodyBottom, bodyUpper, SyntheticScene::bodyRadius);
+                    if(body > 0 && (t <= 0 || body < t)) t = body;
+                    if(t > 0) depth[i] = fmin(depth[i], t * depthPerDistance[i]);
+                }
+            }
+        }
+
+        // noise growing with the square of the distance, as stereo has it
+        uint32_t frameSeed = hash(seed ^ (frame * 0x9E3779B9u));
+        for(size_t i = 0; i < depth.size(); i++){
+            float d = depth[i];
+            if(d > maxDepth){
+                pixels[i] = 0;
+                continue;
+            }
+            uint32_t r = hash(frameSeed ^ uint32_t(i));
+            // two uniforms make a triangle on [-1, 1], 0.408 its deviation
+            float triangle = float(r & 0xffff) / 65535.0f + float(r >> 16) / 65535.0f - 1.0f;
+            d += triangle / 0.408f * noise * d * d;
+            pixels[i] = uint16_t(ofClamp(d / depthScale + 0.5f, 0.0f, 65535.0f));
+        }
+    }
+
+private:
+
+    glm::vec3 toCamera(const glm::vec3 & p) const {
+        return glm::vec3(globalToCamera * glm::vec4(p, 1.0));
+    }
+
+    static inline uint32_t hash(uint32_t a){
+        a ^= a >> 16;
+        a *= 0x7feb352du;
+        a ^= a >> 15;
+        a *= 0x846ca68bu;
+        a ^= a >> 16;
+        return a;
+    }
+
+    // distance along a unit ray from the camera, or -1
+    static inline float intersectSphere(const glm::vec3 & ray, const glm::vec3 & centre, float radius){
+        float b = glm::dot(ray, centre);
+        float h = b * b - glm::dot(centre, centre) + radius * radius;
+        return h > 0 ? b - sqrtf(h) : -1.0f;
+    }
+
+    static inline float intersectCapsule(const glm::vec3 & ray, const glm::vec3 & a, const glm::vec3 & b, float radius){
+        glm::vec3 ba = b - a;
+        glm::vec3 oa = -a;
+        float baba = glm::dot(ba, ba);
+        float bard = glm::dot(ba, ray);
+        float baoa = glm::dot(ba, oa);
+        float rdoa = glm::dot(ray, oa);
+        float oaoa = glm::dot(oa, oa);
+        float qa = baba - bard * bard;
+        float qb = baba * rdoa - baoa * bard;
+        float qc = baba * oaoa - baoa * baoa - radius * radius * baba;
+        float h = qb * qb - qa * qc;
+        if(h < 0) return -1.0f;
+        float y = baoa;
+        if(qa > 1e-9){
+            float t = (-qb - sqrtf(h)) / qa;
+            y = baoa + t * bard;
+            if(y > 0 && y < baba) return t;
+        }
+        // one of the caps
+        glm::vec3 oc = y <= 0 ? oa : -b;
+        float cb = glm::dot(ray, oc);
+        float cc = glm::dot(oc, oc) - radius * radius;
+        float ch = cb * cb - cc;
+        return ch > 0 ? -cb - sqrtf(ch) : -1.0f;
+    }
+
+    static constexpr float maxDepth = 10.0;     // metres, no depth beyond
+
+    rs2_intrinsics intrinsics;
+    float depthScale = 0.001;
+    float noise = 0.002;
+    uint32_t seed = 1;
+    glm::mat4 globalToCamera;
+    vector<glm::vec3> rays;         // unit, tracking camera frame
+    vector<float> depthPerDistance; // realsense z per metre along the ray
+    vector<float> background;       // metres of z, the room
+    vector<float> depth;
+};
+
+// Rendered pixels as rs2 frames, through a software device like DepthPlayer
+class SyntheticCamera {
+public:
+
+    void setup(const rs2_intrinsics & intrinsics, float depthScale, int fps){
+        this->intrinsics = intrinsics;
+        sensor = std::make_shared<rs2::software_sensor>(device.add_sensor("Depth"));
+
+        rs2_video_stream stream = {};
+        stream.type = RS2_STREAM_DEPTH;
+        stream.index = 0;
+        stream.uid = 0;
+        stream.width = intrinsics.width;
+        stream.height = intrinsics.height;
+        stream.fps = fps;
+        stream.bpp = sizeof(uint16_t);
+        stream.fmt = RS2_FORMAT_Z16;
+        stream.intrinsics = intrinsics;
+        profile = sensor->add_video_stream(stream);
+
+        sensor->add_read_only_option(RS2_OPTION_DEPTH_UNITS, depthScale);
+        sensor->open(profile);
+        sensor->start(queue);
+    }
+
+    // takes a copy, the filters hold on to frames
+    rs2::frame makeFrame(const uint16_t * pixels, double timestampMillis, int frameNumber){
+        size_t n = size_t(intrinsics.width) * intrinsics.height;
+        uint16_t * copy = new uint16_t[n];
+        memcpy(copy, pixels, n * sizeof(uint16_t));
+
+        rs2_software_video_frame videoFrame = {};
+        videoFrame.pixels = copy;
+        videoFrame.deleter = [](void * p){ delete[] (uint16_t *) p; };
+        videoFrame.stride = intrinsics.width * sizeof(uint16_t);
+        videoFrame.bpp = sizeof(uint16_t);
+        videoFrame.timestamp = timestampMillis;
+        videoFrame.domain = RS2_TIMESTAMP_DOMAIN_HARDWARE_CLOCK;
+        videoFrame.frame_number = frameNumber;
+        videoFrame.profile = profile.get();
+        sensor->on_video_frame(videoFrame);
+
+        rs2::frame f;
+        queue.poll_for_frame(&f);
+        return f;
+    }
+
+private:
+    rs2_intrinsics intrinsics;
+    rs2::software_device device;
+    std::shared_ptr<rs2::software_sensor> sensor;
+    rs2::stream_profile profile;
+    rs2::frame_queue queue{1};
+};
+
+struct SyntheticResult {
+    int people = 0;
+    int maxHeads = 0;
+    size_t frames = 0;
+    double seconds = 0;             // simulated
+    double processingSeconds = 0;   // in the pipeline
+    double renderingSeconds = 0;
+    vector<float> errors;           // metres, per match
+    double horizontalErrorSum = 0;
+    int idSwitches = 0;
+    int acquired = 0;
+    double acquisitionDelaySum = 0;
+    double acquisitionDelayMax = 0;
+    size_t personFrames = 0;        // present people, summed over frames
+    size_t missed = 0;              // of those without a tracking head
+    size_t falseHeads = 0;          // tracking heads without a person, summed over frames
+
+    double getFramesPerSecond() const {
+        return processingSeconds > 0 ? frames / processingSeconds : 0.0;
+    }
+
+    double getErrorPercentile(double p) const {
+        if(errors.empty()) return 0;
+        vector<float> sorted = errors;
+        size_t k = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        return sorted[k];
+    }
+
+    double getErrorMean() const {
+        double sum = 0;
+        for(float e : errors) sum += e;
+        return errors.empty() ? 0 : sum / errors.size();
+    }
+
+    ofJson toJson() const {
+        ofJson j;
+        j["people"] = people;
+        j["max_heads"] = maxHeads;
+        j["frames"] = frames;
+        j["seconds"] = seconds;
+        j["processing_seconds"] = processingSeconds;
+        j["rendering_seconds"] = renderingSeconds;
+        j["frames_per_second"] = getFramesPerSecond();
+        j["error_mean_mm"] = getErrorMean() * 1000.0;
+        j["error_p95_mm"] = getErrorPercentile(0.95) * 1000.0;
+        j["horizontal_error_mean_mm"] = errors.empty() ? 0.0 : horizontalErrorSum / errors.size() * 1000.0;
+        j["id_switches"] = idSwitches;
+        j["acquired"] = acquired;
+        j["never_acquired"] = people - acquired;
+        j["acquisition_delay_mean"] = acquired ? acquisitionDelaySum / acquired : 0.0;
+        j["acquisition_delay_max"] = acquisitionDelayMax;
+        j["missed_ratio"] = personFrames ? double(missed) / personFrames : 0.0;
+        j["false_heads_per_frame"] = frames ? double(falseHeads) / frames : 0.0;
+        return j;
+    }
+};
+
+class SyntheticCrowd {
+public:
+
+    struct Options {
+        vector<int> people = {1, 2, 5, 10, 20, 30};
+        float seconds = 20;         // after the last person came in
+        int fps = 30;
+        uint64_t seed = 1;
+        float noise = 0.002;        // depth noise per metre squared
+        string intrinsicsRecording;
+    };
+
+    // arguments after --synthetic, returns the exit code
+    static int run(const vector<string> & args){
+        Options options;
+        if(args.size() < 2 || !parseOptions(args, options)){
+            std::cerr << "usage: realsense-osc-tracker --synthetic <settings.json> <output folder> [--people 1,2,5,10,20,30]"
+            << " [--seconds 20] [--fps 30] [--seed 1] [--noise 0.002] [--intrinsics <recording>]" << std::endl;
+            return 2;
+        }
+
+        BatchSettings settings;
+        if(!settings.load(ofFilePath::getAbsolutePath(args[0], false))) return 1;
+
+        string outputFolder = ofFilePath::getAbsolutePath(args[1], false);
+        if(!ofDirectory::doesDirectoryExist(outputFolder, false) && !ofDirectory::createDirectory(outputFolder, false, true)){
+            ofLogError("SyntheticCrowd") << "Could not create " << outputFolder;
+            return 1;
+        }
+
+        rs2_intrinsics intrinsics = getDefaultIntrinsics();
+        float depthScale = 0.001;
+        if(!options.intrinsicsRecording.empty()){
+            DepthPlayer player;
+            if(!player.open(ofFilePath::getAbsolutePath(options.intrinsicsRecording, false))) return 1;
+            intrinsics = player.getIntrinsics();
+            depthScale = player.getDepthScale();
+        }
+
+        ofLogLevel logLevel = ofGetLogLevel();
+        ofSetLogLevel(OF_LOG_WARNING);
+
+        std::cout << "Synthetic crowd, " << intrinsics.width << "x" << intrinsics.height << " at " << options.fps
+        << " fps, seed " << options.seed << std::endl;
+
+        ofJson j;
+        j["settings"] = ofFilePath::getAbsolutePath(args[0], false);
+        j["width"] = intrinsics.width;
+        j["height"] = intrinsics.height;
+        j["fps"] = options.fps;
+        j["seed"] = options.seed;
+        j["noise"] = options.noise;
+        j["runs"] = ofJson::array();
+        int failed = 0;
+
+        // one after the other, so the timings are comparable
+        for(int people : options.people){
+            SyntheticResult r;
+            if(!runPeople(people, settings, intrinsics, depthScale, options, outputFolder, r)){
+                failed++;
+                continue;
+            }
+            j["runs"].push_back(r.toJson());
+            std::cout << people << " people: " << ofToString(r.getFramesPerSecond(), 0) << " fps, error "
+            << ofToString(r.getErrorMean() * 1000.0, 0) << " mm mean, " << ofToString(r.getErrorPercentile(0.95) * 1000.0, 0) << " mm p95, "
+            << r.idSwitches << " ID switches, " << r.acquired << " acquired in "
+            << ofToString(r.acquired ? r.acquisitionDelaySum / r.acquired : 0.0, 2) << "s mean, "
+            << ofToString(r.acquisitionDelayMax, 2) << "s max, "
+            << ofToString(100.0 * r.missed / fmax(r.personFrames, 1), 1) << "% missed, "
+            << ofToString(double(r.falseHeads) / fmax(r.frames, 1), 2) << " false heads per frame" << std::endl;
+        }
+        ofSavePrettyJson(ofFilePath::join(outputFolder, "synthetic.json"), j);
+
+        ofSetLogLevel(logLevel);
+        return failed > 0 ? 1 : 0;
+    }
+
+private:
+
+    static bool runPeople(int people, const BatchSettings & settings, const rs2_intrinsics & intrinsics, float depthScale,
+                          const Options & options, const string & outputFolder, SyntheticResult & result){
+        string name = "synthetic-" + ofToString(people);
+        std::ofstream truth(ofFilePath::join(outputFolder, name + ".truth.csv"));
+        std::ofstream tracks(ofFilePath::join(outputFolder, name + ".tracks.csv"));
+        if(!truth || !tracks){
+            ofLogError("SyntheticCrowd") << "Could not write to " << outputFolder;
+            return false;
+        }
+        truth << "frame,timestamp,person,x,y,z\n";
+        tracks << "frame,timestamp,head,x,y,z\n";
+
+        BatchPipeline pipeline;
+        pipeline.setup(settings, intrinsics, depthScale, std::max(settings.pTrackingMaxHeads.get(), people));
+        MeshTracker & tracker = pipeline.tracker;
+
+        SyntheticScene scene;
+        scene.setup(settings, tracker.getGlobalTransformMatrix(), people, options.seed * 1000 + people);
+        SyntheticRenderer renderer;
+        renderer.setup(intrinsics, depthScale, pipeline.config.cameraToGlobal, settings, options.noise, options.seed);
+        SyntheticCamera camera;
+        camera.setup(intrinsics, depthScale, options.fps);
+
+        result.people = people;
+        result.maxHeads = int(tracker.heads.size());
+        vector<uint16_t> pixels(size_t(intrinsics.width) * intrinsics.height);
+        vector<int> lastHead(people, 0);
+        vector<bool> matchedHead(tracker.heads.size());
+        vector<bool> matchedPerson(people);
+        struct Pair { float distance; int person; int head; };
+        vector<Pair> pairs;
+        const float gate = 0.5;
+
+        // people come in at least entrySpacing apart, later when the start is
+        // busy, the run goes on for the given seconds after the last one
+        double dt = 1.0 / options.fps;
+        double timeout = people * SyntheticScene::entrySpacing * 4 + options.seconds;
+        double now = 0;
+        for(size_t f = 0; ; f++){
+            now = f * dt;
+            double lastEntry = scene.getLastEntry();
+            if(lastEntry >= 0 && now > lastEntry + SyntheticScene::entryWait + options.seconds) break;
+            if(now > timeout){
+                ofLogWarning("SyntheticCrowd") << "The start position was never clear for everybody to come in, stopped after " << ofToString(timeout, 0) << "s";
+                break;
+            }
+            scene.step(now, dt);
+
+            uint64_t renderStart = ofGetElapsedTimeMicros();
+            renderer.render(scene, uint32_t(f), pixels.data());
+            rs2::frame depthFrame = camera.makeFrame(pixels.data(), now * 1000.0, int(f));
+            uint64_t start = ofGetElapsedTimeMicros();
+            result.renderingSeconds += (start - renderStart) / 1e6;
+            if(!depthFrame) continue;
+            pipeline.process(depthFrame);
+            result.processingSeconds += (ofGetElapsedTimeMicros() - start) / 1e6;
+            result.frames++;
+
+            // nearest pairs first, each person and head once
+            pairs.clear();
+            for(int i = 0; i < people; i++){
+                auto & p = scene.people[i];
+                if(!p.isPresent()) continue;
+                result.personFrames++;
+                glm::vec3 centre = scene.getHeadCentre(p);
+                truth << f << "," << ofToString(now, 3) << "," << i + 1 << ","
+                << ofToString(centre.x, 4) << "," << ofToString(centre.y, 4) << "," << ofToString(centre.z, 4) << "\n";
+                for(size_t k = 0; k < tracker.heads.size(); k++){
+                    if(!tracker.heads[k].isTracking()) continue;
+                    float d = glm::distance(tracker.heads[k].getGlobalPosition(), centre);
+                    if(d < gate) pairs.push_back({d, i, int(k)});
+                }
+            }
+            std::sort(pairs.begin(), pairs.end(), [](const Pair & a, const Pair & b){ return a.distance < b.distance; });
+
+            std::fill(matchedHead.begin(), matchedHead.end(), false);
+            std::fill(matchedPerson.begin(), matchedPerson.end(), false);
+            size_t matched = 0;
+            for(auto & pair : pairs){
+                if(matchedPerson[pair.person] || matchedHead[pair.head]) continue;
+                matchedPerson[pair.person] = true;
+                matchedHead[pair.head] = true;
+                matched++;
+
+                auto & p = scene.people[pair.person];
+                head & h = tracker.heads[pair.head];
+                glm::vec3 offset = h.getGlobalPosition() - scene.getHeadCentre(p);
+                result.errors.push_back(pair.distance);
+                result.horizontalErrorSum += glm::length(glm::vec2(offset.x, offset.z));
+
+                int & last = lastHead[pair.person];
+                if(last == 0){
+                    double delay = now - p.enteredAt;
+                    result.acquired++;
+                    result.acquisitionDelaySum += delay;
+                    result.acquisitionDelayMax = fmax(result.acquisitionDelayMax, delay);
+                } else if(last != h.id){
+                    result.idSwitches++;
+                }
+                last = h.id;
+            }
+
+            size_t present = 0;
+            for(auto & p : scene.people){
+                if(p.isPresent()) present++;
+            }
+            result.missed += present - matched;
+            for(size_t k = 0; k < tracker.heads.size(); k++){
+                head & h = tracker.heads[k];
+                if(!h.isTracking()) continue;
+                if(!matchedHead[k]) result.falseHeads++;
+                glm::vec3 p = h.getGlobalPosition();
+                tracks << f << "," << ofToString(now, 3) << "," << h.id << ","
+                << ofToString(p.x, 4) << "," << ofToString(p.y, 4) << "," << ofToString(p.z, 4) << "\n";
+            }
+        }
+        result.seconds = now;
+        return true;
+    }
+
+    static bool parseOptions(const vector<string> & args, Options & options){
+        for(size_t i = 2; i < args.size(); i++){
+            if(i + 1 >= args.size()) return false;
+            const string & key = args[i];
+            const string & value = args[++i];
+            if(key == "--people"){
+                options.people.clear();
+                for(auto & count : ofSplitString(value, ",", true, true)){
+                    int people = ofToInt(count);
+                    if(people < 1 || people > 64) return false;
+                    options.people.push_back(people);
+                }
+                if(options.people.empty()) return false;
+            } else if(key == "--seconds"){
+                options.seconds = fmax(ofToFloat(value), 1.0);
+            } else if(key == "--fps"){
+                options.fps = ofClamp(ofToInt(value), 1, 300);
+            } else if(key == "--seed"){
+                options.seed = strtoull(value.c_str(), nullptr, 10);
+            } else if(key == "--noise"){
+                options.noise = fmax(ofToFloat(value), 0.0);
+            } else if(key == "--intrinsics"){
+                options.intrinsicsRecording = value;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // a D435 at 848x480, what the tracker was tuned on
+    static rs2_intrinsics getDefaultIntrinsics(){
+        rs2_intrinsics intrinsics = {};
+        intrinsics.width = 848;
+        intrinsics.height = 480;
+        intrinsics.ppx = 424;
+        intrinsics.ppy = 240;
+        intrinsics.fx = 424;
+        intrinsics.fy = 424;
+        intrinsics.model = RS2_DISTORTION_BROWN_CONRADY;
+        return intrinsics;
+    }
+};
@@ -0,0 +1,6 @@
+//
+//  TrackEventLog.cpp
+//  realsense-osc-tracker
+//
+
+#include "TrackEventLog.hpp"
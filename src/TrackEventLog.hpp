@@ -0,0 +1,279 @@
+//
+//  TrackEventLog.hpp
+//  realsense-osc-tracker
+//
+//  Head lifecycle events, new, found, lost and end, off the tracking path.
+//  A head pushes a small TrackEvent into the queue of its tracker and moves
+//  on. The writer thread formats them as JSON lines into
+//  data/logs/track-events.jsonl, one object per line:
+//
+//  {"time":"2026-10-19 21:04:11.532","clock":1234.567,"volume":0,"head":2,
+//   "event":"end","position":[0.412,1.702,2.950],"duration":41.3}
+//
+//  time is the wall clock when it happened, clock the depth frame clock of
+//  the tracker. The file is rotated to track-events.1.jsonl and so on when
+//  it reaches the size limit, the oldest beyond the file count goes.
+//
+//  The writer also prints the lines the heads used to log, and builds
+//  /tracker/event/<new|found|lost|end> iif (head, volume, seconds tracked)
+//  for destinations with Events on. Those come back to processing as
+//  finished packets, it only has to send them.
+//
+//  Every tracker has its own queue, so volumes tracking side by side each
+//  remain a single producer. A full queue drops the event and counts it.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "SpscQueue.hpp"
+#include "OscOutboundPacketStream.h"
+#include <atomic>
+#include <fstream>
+#include <ctime>
+
+struct TrackEvent {
+    enum TYPE : uint8_t {
+        NEW,
+        FOUND,
+        LOST,
+        END
+    };
+
+    TYPE type = NEW;
+    uint8_t volume = 0;         // 0 the main tracker, then the tracking volumes
+    int16_t headId = 0;
+    double clock = 0;           // seconds, clock of the depth frames
+    uint64_t systemMicros = 0;  // wall clock
+    glm::vec3 position;         // global
+    float duration = 0;         // seconds since the head was new, for END
+
+    static const char * getTypeName(TYPE type){
+        switch(type){
+            case NEW: return "new";
+            case FOUND: return "found";
+            case LOST: return "lost";
+            case END: return "end";
+        }
+        return "";
+    }
+};
+
+class TrackEventQueue {
+public:
+
+    // tracking thread, never blocks
+    void push(const TrackEvent & event){
+        if(!queue.push(event)) dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool pop(TrackEvent & event){
+        return queue.pop(event);
+    }
+
+    uint64_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    SpscQueue<TrackEvent, 256> queue;
+    std::atomic<uint64_t> dropped{0};
+};
+
+// an OSC message the writer built, for processing to send
+struct TrackEventPacket {
+    char data[128];
+    size_t size = 0;
+};
+
+class TrackEventLog : public ofThread {
+public:
+
+    static const int maxSources = 16;   // the main tracker and the tracking volumes
+
+    struct Settings {
+        bool enabled = true;
+        bool console = true;
+        bool osc = false;               // any destination wants events
+        size_t maxBytes = 10 << 20;
+        int files = 5;                  // rotated ones kept
+    };
+
+    ~TrackEventLog(){
+        close();
+    }
+
+    void setup(const string & path, const Settings & settings){
+        close();
+        this->path = path;
+        setSettings(settings);
+        startThread();
+    }
+
+    void close(){
+        waitForThread(true);
+        file.close();
+    }
+
+    void setSettings(const Settings & settings){
+        std::lock_guard<std::mutex> lock(mutex);
+        this->settings = settings;
+    }
+
+    // one per tracker, source 0 is the main tracker
+    TrackEventQueue * getQueue(int source){
+        return source >= 0 && source < maxSources ? &queues[source] : nullptr;
+    }
+
+    // processing thread
+    bool popPacket(TrackEventPacket & packet){
+        return packets.pop(packet);
+    }
+
+    struct Stats {
+        uint64_t written = 0;
+        uint64_t dropped = 0;
+        uint64_t rotated = 0;
+        size_t bytes = 0;       // of the current file
+        bool open = false;
+    };
+
+    Stats getStats(){
+        Stats s;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s = stats;
+        }
+        for(auto & q : queues){
+            s.dropped += q.getDropped();
+        }
+        return s;
+    }
+
+protected:
+
+    void threadedFunction(){
+        TrackEvent event;
+        while(isThreadRunning()){
+            Settings s;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                s = settings;
+            }
+            bool any = false;
+            for(auto & q : queues){
+                while(q.pop(event)){
+                    write(event, s);
+                    any = true;
+                }
+            }
+            if(any) file.flush();
+            if(!any) sleep(5);
+        }
+    }
+
+    void write(const TrackEvent & e, const Settings & s){
+        time_t seconds = time_t(e.systemMicros / 1000000);
+        int millis = int(e.systemMicros / 1000 % 1000);
+        struct tm local;
+        localtime_r(&seconds, &local);
+        char stamp[32];
+        size_t n = strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+        snprintf(stamp + n, sizeof(stamp) - n, ".%03d", millis);
+
+        if(s.console){
+            // what heads logged themselves before
+            if(e.type == TrackEvent::END){
+                ofLogNotice(stamp) << "TRACKER (" << trackerName(e) << ") END AFTER " << ofToString(e.duration);
+            } else {
+                ofLogNotice(stamp) << "TRACKER (" << trackerName(e) << ") " << ofToUpper(string(TrackEvent::getTypeName(e.type)));
+            }
+        }
+
+        if(s.osc){
+            TrackEventPacket packet;
+            char address[32];
+            snprintf(address, sizeof(address), "/tracker/event/%s", TrackEvent::getTypeName(e.type));
+            osc::OutboundPacketStream p(packet.data, sizeof(packet.data));
+            p << osc::BeginMessage(address) << int(e.headId) << int(e.volume) << e.duration << osc::EndMessage;
+            packet.size = p.Size();
+            packets.push(packet);
+        }
+
+        if(!s.enabled){
+            if(file.is_open()) file.close();
+            return;
+        }
+
+        char line[256];
+        int length = snprintf(line, sizeof(line),
+            "{\"time\":\"%s\",\"clock\":%.3f,\"volume\":%d,\"head\":%d,\"event\":\"%s\",\"position\":[%.3f,%.3f,%.3f],\"duration\":%.1f}\n",
+            stamp, e.clock, int(e.volume), int(e.headId), TrackEvent::getTypeName(e.type),
+            e.position.x, e.position.y, e.position.z, e.duration);
+        if(length <= 0) return;
+        length = std::min(length, int(sizeof(line)) - 1);
+
+        if(file.is_open() && bytes + length > s.maxBytes){
+            rotate(s);
+        }
+        if(!file.is_open() && !open()) return;
+        file.write(line, length);
+        bytes += length;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.written++;
+        stats.bytes = bytes;
+        stats.open = true;
+    }
+
+    bool open(){
+        ofDirectory::createDirectory(ofFilePath::getEnclosingDirectory(path, false), false, true);
+        file.open(path, std::ios::app | std::ios::binary);
+        if(!file){
+            // once, not per event
+            if(!failed) ofLogError("TrackEventLog") << "Could not open " << path;
+            failed = true;
+            return false;
+        }
+        failed = false;
+        file.seekp(0, std::ios::end);
+        bytes = size_t(file.tellp());
+        return true;
+    }
+
+    // track-events.jsonl -> track-events.1.jsonl -> ... -> track-events.<files>.jsonl
+    void rotate(const Settings & s){
+        file.close();
+        string base = ofFilePath::removeExt(path);
+        string ext = ofFilePath::getFileExt(path);
+        auto numbered = [&](int i){
+            return base + "." + ofToString(i) + "." + ext;
+        };
+        std::remove(numbered(s.files).c_str());
+        for(int i = s.files - 1; i >= 1; i--){
+            std::rename(numbered(i).c_str(), numbered(i + 1).c_str());
+        }
+        if(s.files > 0){
+            std::rename(path.c_str(), numbered(1).c_str());
+        } else {
+            std::remove(path.c_str());
+        }
+        bytes = 0;
+        std::lock_guard<std::mutex> lock(mutex);
+        stats.rotated++;
+    }
+
+    static string trackerName(const TrackEvent & e){
+        return e.volume == 0 ? ofToString(e.headId) : ofToString(int(e.volume)) + ":" + ofToString(e.headId);
+    }
+
+    string path;
+    std::ofstream file;
+    size_t bytes = 0;
+    bool failed = false;
+    TrackEventQueue queues[maxSources];
+    SpscQueue<TrackEventPacket, 64> packets;
+    std::mutex mutex;
+    Settings settings;
+    Stats stats;
+};
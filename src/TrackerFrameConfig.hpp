@@ -0,0 +1,83 @@
+//
+//  TrackerFrameConfig.hpp
+//  realsense-osc-tracker
+//
+//  Everything the frame processing reads from parameters and the scene graph,
+//  fused into plain values. The GL thread builds a new one only when a
+//  tracking parameter changes and publishes it. Processing takes one copy at
+//  the start of a frame, so an edit never lands halfway through.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include <atomic>
+#include <type_traits>
+
+struct TrackerFrameConfig {
+    uint64_t version = 0;
+
+    glm::mat4 cameraToGlobal;       // tracker camera frame (realsense x, -y, -z) to the origin frame
+    glm::mat4 cameraToBox;          // the same, fused with the inverse of the tracking box
+    glm::vec3 halfExtents;          // of the tracking box
+    float minDepth = 0.5;           // realsense z, closer points are skipped
+
+    glm::vec3 cameraPosition;
+    glm::quat cameraOrientation;
+    glm::vec3 cameraScale;
+    glm::vec3 startPosition;
+
+    float focalArea = 0;            // fx*fy of the cloud, scales the acquisition threshold
+    bool coarseToFine = false;
+    int fineDecimation = 1;
+    bool buildMesh = true;          // the cloud is only drawn when visible
+    bool fixedKernels = true;       // classify with the kernel unrolled for the head count
+    bool fusedFilter = false;       // FusedDepthFilter instead of the rs2 chain
+};
+
+static_assert(std::is_trivially_copyable<TrackerFrameConfig>::value, "TrackerFrameConfig is copied between threads");
+
+// Single writer, any number of readers. The writer fills the slot after the
+// current one and then moves the index, readers copy the current slot and
+// retry if the writer came round to it meanwhile. With a new config at most
+// once per GL frame and readers copying right away, retries do not happen
+// in practice.
+template<typename T, std::size_t Slots = 4>
+class SnapshotRing {
+public:
+
+    void publish(const T & value){
+        std::size_t next = published.load(std::memory_order_relaxed) + 1;
+        // readers of this slot have to see it change
+        slots[next % Slots].sequence.fetch_add(1, std::memory_order_acq_rel);
+        slots[next % Slots].value = value;
+        slots[next % Slots].sequence.fetch_add(1, std::memory_order_release);
+        published.store(next, std::memory_order_release);
+    }
+
+    T read() const {
+        while(true){
+            std::size_t current = published.load(std::memory_order_acquire);
+            const Slot & slot = slots[current % Slots];
+            std::size_t before = slot.sequence.load(std::memory_order_acquire);
+            T value = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::size_t after = slot.sequence.load(std::memory_order_relaxed);
+            if(before == after && (before & 1) == 0){
+                return value;
+            }
+        }
+    }
+
+private:
+
+    struct Slot {
+        std::atomic<std::size_t> sequence{0};
+        T value;
+    };
+
+    static_assert(std::is_trivially_copyable<T>::value, "snapshots are copied without locks");
+
+    Slot slots[Slots];
+    std::atomic<std::size_t> published{0};
+};
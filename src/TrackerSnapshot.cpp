@@ -0,0 +1,6 @@
+//
+//  TrackerSnapshot.cpp
+//  realsense-osc-tracker
+//
+
+#include "TrackerSnapshot.hpp"
@@ -0,0 +1,295 @@
+//
+//  TrackerSnapshot.hpp
+//  realsense-osc-tracker
+//
+//  The state of every head, now and then on disk, so a restart after a
+//  settings change, a crash or a camera hiccup picks the performers up where
+//  they were instead of waiting for them at the start position.
+//
+//  Processing fills a TrackerSnapshot after the trackers updated and swaps
+//  it into the writer at the snapshot rate, the writer's own thread writes
+//  it to data/state/tracker.snapshot.tmp and renames that over the last one,
+//  so a crash mid write leaves the previous snapshot intact.
+//
+//  File, native byte order, only read back on the machine that wrote it:
+//
+//  0   "TSNP"
+//  4   u32 version
+//  8   u64 wall clock in microseconds when it was taken
+//  16  u32 trackers, u32 heads
+//  24  trackers x Tracker, then heads x Head, as laid out below
+//
+//  On start-up restore() puts tracking and lost heads back with their ids,
+//  positions, Kalman state and times. Times stay on the clock of the run
+//  that wrote them until the first frame, which rebases them onto the new
+//  clock as if no time had passed, so tracking goes on from that frame.
+//  A snapshot older than the maximum age is ignored, people moved since.
+//
+//  Trackers are matched by source, 0 the main one and then the tracking
+//  volumes in order, heads by id.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MeshTracker.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <unistd.h>
+
+struct TrackerSnapshot {
+
+    static const uint32_t version = 1;
+
+    struct Tracker {
+        uint32_t source = 0;        // 0 the main tracker, then the tracking volumes
+        uint32_t heads = 0;         // of this tracker, in heads with its source
+        double timestamp = 0;       // seconds, clock of the depth frames
+    };
+
+    struct Head {
+        uint32_t source = 0;
+        int32_t id = 0;
+        int32_t state = 0;
+        int32_t lastTrackPointCount = 1;
+        double lastTimeTracking = 0;
+        double firstTimeTracking = 0;
+        double lastTimeUpdated = -1;
+        glm::vec3 position;         // global
+        glm::vec3 rawGlobalPosition;
+        glm::vec3 localFloorPoint;
+        float radiusSquaredScale = 1;
+        float lastTrackPointWeighedCount = 1;
+        TimedKalmanPosition::Axis kalman[3];
+    };
+
+    uint64_t systemMicros = 0;
+    vector<Tracker> trackers;
+    vector<Head> heads;
+
+    // room for the largest tracker setup, so processing does not allocate
+    void reserve(size_t trackerCount, size_t headCount){
+        trackers.reserve(trackerCount);
+        heads.reserve(headCount);
+    }
+
+    void clear(){
+        systemMicros = 0;
+        trackers.clear();
+        heads.clear();
+    }
+
+    bool empty() const {
+        return trackers.empty();
+    }
+
+    // processing, after tracker.update()
+    void add(uint32_t source, const MeshTracker & tracker){
+        trackers.push_back({source, uint32_t(tracker.heads.size()), tracker.lastTimestamp});
+        for(auto & h : tracker.heads){
+            Head s;
+            s.source = source;
+            s.id = h.id;
+            s.state = int32_t(h.state);
+            s.lastTrackPointCount = h.lastTrackPointCount;
+            s.lastTimeTracking = h.lastTimeTracking;
+            s.firstTimeTracking = h.firstTimeTracking;
+            s.lastTimeUpdated = h.lastTimeUpdated;
+            s.position = h.getGlobalPosition();
+            s.rawGlobalPosition = h.rawGlobalPosition;
+            s.localFloorPoint = h.localFloorPoint;
+            s.radiusSquaredScale = h.radiusSquaredScale;
+            s.lastTrackPointWeighedCount = h.lastTrackPointWeighedCount;
+            for(int i = 0; i < 3; i++){
+                s.kalman[i] = h.kalman.getAxis(i);
+            }
+            heads.push_back(s);
+        }
+    }
+
+    // the heads of source that were tracking or lost back into tracker, after
+    // its setup(). Returns how many.
+    int restore(uint32_t source, MeshTracker & tracker) const {
+        const Tracker * t = nullptr;
+        for(auto & candidate : trackers){
+            if(candidate.source == source) t = &candidate;
+        }
+        if(!t || t->timestamp < 0) return 0;
+        int restored = 0;
+        for(auto & s : heads){
+            if(s.source != source || s.id < 1 || s.id > int(tracker.heads.size())) continue;
+            auto state = head::TRACKING_STATE(s.state);
+            if(state != head::TRACKING_STATE::TRACKING && state != head::TRACKING_STATE::LOST) continue;
+            auto & h = tracker.heads[s.id - 1];
+            h.state = state;
+            h.lastTimeTracking = s.lastTimeTracking;
+            h.firstTimeTracking = s.firstTimeTracking;
+            h.lastTimeUpdated = s.lastTimeUpdated;
+            h.setGlobalPosition(s.position);
+            h.rawGlobalPosition = s.rawGlobalPosition;
+            h.localFloorPoint = s.localFloorPoint;
+            h.radiusSquaredScale = s.radiusSquaredScale;
+            h.lastTrackPointCount = s.lastTrackPointCount;
+            h.lastTrackPointWeighedCount = s.lastTrackPointWeighedCount;
+            for(int i = 0; i < 3; i++){
+                h.kalman.setAxis(i, s.kalman[i]);
+            }
+            h.beginFrame();
+            restored++;
+        }
+        if(restored > 0){
+            tracker.lastTimestamp = t->timestamp;
+            tracker.rebaseOnNextUpdate = true;
+        }
+        return restored;
+    }
+
+    bool write(const string & path) const {
+        string temporary = path + ".tmp";
+        FILE * file = fopen(temporary.c_str(), "wb");
+        if(!file) return false;
+        uint32_t header[6] = {0, version, 0, 0, uint32_t(trackers.size()), uint32_t(heads.size())};
+        memcpy(header, "TSNP", 4);
+        memcpy(header + 2, &systemMicros, sizeof(systemMicros));
+        bool ok = fwrite(header, sizeof(header), 1, file) == 1;
+        ok = ok && (trackers.empty() || fwrite(trackers.data(), sizeof(Tracker), trackers.size(), file) == trackers.size());
+        ok = ok && (heads.empty() || fwrite(heads.data(), sizeof(Head), heads.size(), file) == heads.size());
+        // on disk before the rename makes it the snapshot
+        ok = fflush(file) == 0 && ok;
+        ok = fsync(fileno(file)) == 0 && ok;
+        ok = fclose(file) == 0 && ok;
+        if(!ok || std::rename(temporary.c_str(), path.c_str()) != 0){
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool read(const string & path){
+        clear();
+        FILE * file = fopen(path.c_str(), "rb");
+        if(!file) return false;
+        uint32_t header[6];
+        bool ok = fread(header, sizeof(header), 1, file) == 1 && memcmp(header, "TSNP", 4) == 0 && header[1] == version;
+        // a tracker per source and a few heads each, anything more is not ours
+        ok = ok && header[4] <= 64 && header[5] <= 1024;
+        if(ok){
+            memcpy(&systemMicros, header + 2, sizeof(systemMicros));
+            trackers.resize(header[4]);
+            heads.resize(header[5]);
+            ok = (trackers.empty() || fread(trackers.data(), sizeof(Tracker), trackers.size(), file) == trackers.size()) &&
+                 (heads.empty() || fread(heads.data(), sizeof(Head), heads.size(), file) == heads.size());
+        }
+        fclose(file);
+        if(!ok) clear();
+        return ok;
+    }
+};
+
+class TrackerSnapshotWriter : public ofThread {
+public:
+
+    ~TrackerSnapshotWriter(){
+        close();
+    }
+
+    // room for the largest snapshot in every buffer that goes round
+    void setup(const string & path, size_t trackers, size_t heads){
+        close();
+        this->path = path;
+        pending.reserve(trackers, heads);
+        writing.reserve(trackers, heads);
+        ofDirectory::createDirectory(ofFilePath::getEnclosingDirectory(path, false), false, true);
+        startThread();
+    }
+
+    void close(){
+        if(isThreadRunning()){
+            stopThread();
+            snapshotReady.notify_all();
+            waitForThread(false);
+        }
+    }
+
+    const string & getPath() const {
+        return path;
+    }
+
+    void setInterval(float seconds){
+        intervalMicros = uint64_t(fmax(seconds, 0.1) * 1e6);
+    }
+
+    // cheap, whether submit() would take a snapshot now
+    bool wantsSnapshot(uint64_t nowMicros){
+        return isThreadRunning() && nowMicros >= nextSnapshotMicros.load(std::memory_order_relaxed);
+    }
+
+    // swaps the snapshot in, the caller gets back an old one to fill next time
+    void submit(TrackerSnapshot & snapshot, uint64_t nowMicros){
+        std::unique_lock<std::mutex> lock(snapshotMutex, std::try_to_lock);
+        if(!lock.owns_lock()) return;
+        std::swap(pending, snapshot);
+        hasPending = true;
+        nextSnapshotMicros = nowMicros + intervalMicros.load(std::memory_order_relaxed);
+        lock.unlock();
+        snapshotReady.notify_one();
+    }
+
+    struct Stats {
+        uint64_t written = 0;
+        uint64_t failed = 0;
+        size_t heads = 0;           // tracking or lost in the last one
+        uint64_t lastMicros = 0;    // wall clock of the last one written
+    };
+
+    Stats getStats(){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return stats;
+    }
+
+protected:
+
+    void threadedFunction(){
+        TrackerSnapshot & snapshot = writing;
+        while(isThreadRunning()){
+            {
+                std::unique_lock<std::mutex> lock(snapshotMutex);
+                snapshotReady.wait_for(lock, std::chrono::milliseconds(250), [this]{ return hasPending || !isThreadRunning(); });
+                if(!hasPending) continue;
+                std::swap(pending, snapshot);
+                hasPending = false;
+            }
+
+            bool ok = snapshot.write(path);
+            size_t active = 0;
+            for(auto & h : snapshot.heads){
+                if(h.state != int32_t(head::TRACKING_STATE::READY)) active++;
+            }
+
+            std::lock_guard<std::mutex> lock(statsMutex);
+            if(ok){
+                stats.written++;
+                stats.heads = active;
+                stats.lastMicros = snapshot.systemMicros;
+            } else {
+                // once, not per snapshot
+                if(stats.failed == 0) ofLogError("TrackerSnapshot") << "Could not write " << path;
+                stats.failed++;
+            }
+        }
+    }
+
+    string path;
+    std::mutex snapshotMutex;
+    std::condition_variable snapshotReady;
+    TrackerSnapshot pending;
+    TrackerSnapshot writing;
+    bool hasPending = false;
+    std::atomic<uint64_t> intervalMicros{1000000};
+    std::atomic<uint64_t> nextSnapshotMicros{0};
+
+    std::mutex statsMutex;
+    Stats stats;
+};
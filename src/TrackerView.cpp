@@ -0,0 +1,6 @@
+//
+//  TrackerView.cpp
+//  realsense-osc-tracker
+//
+
+#include "TrackerView.hpp"
@@ -0,0 +1,195 @@
+//
+//  TrackerView.hpp
+//  realsense-osc-tracker
+//
+//  What draw() and the GUI show of the trackers: boxes, heads, zone
+//  occupancy and OSC counters, copied by processing at the end of a frame.
+//  The GL thread only ever reads its own copy, so it never holds up a frame
+//  and a frame never waits for the GUI.
+//
+//  Three views go round. Processing fills the back one and publishes it as
+//  the newest, the GL thread takes the newest as its front one once per
+//  draw(). Handing over swaps two indices under a lock that is held for
+//  nothing else.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MeshTracker.hpp"
+#include <mutex>
+
+struct TrackerView {
+
+    struct Box {
+        bool tracked = false;       // false for a volume without a tracker
+        bool enabled = false;
+        glm::mat4 transform;
+        glm::vec3 size;
+        glm::vec3 startPosition;
+        size_t firstHead = 0;
+        size_t headCount = 0;
+        int tracking = 0;
+    };
+
+    struct Head {
+        head::TRACKING_STATE state;
+        glm::mat4 transform;
+        float radius;
+        glm::vec3 localFloorPoint;
+        float weighedCount;
+        HeadShape shape;
+    };
+
+    struct Destination {
+        size_t packetsSent;
+        size_t messagesSent;
+        size_t messagesSuppressed;
+    };
+
+    vector<Box> boxes;                  // the main tracker, then one per volume
+    vector<Head> heads;
+    vector<uint8_t> zonesOccupied;
+    vector<Destination> destinations;
+    size_t replayPosition = 0;
+    bool monitorStreaming = false;
+
+    // room for the largest view, it is filled every frame
+    void reserve(size_t boxCount, size_t headCount, size_t zoneCount, size_t destinationCount){
+        boxes.reserve(boxCount);
+        heads.reserve(headCount);
+        zonesOccupied.reserve(zoneCount);
+        destinations.reserve(destinationCount);
+    }
+
+    void clear(){
+        boxes.clear();
+        heads.clear();
+        zonesOccupied.clear();
+        destinations.clear();
+    }
+
+    // nullptr for a volume that has no tracker (yet)
+    void addTracker(MeshTracker * tracker, bool enabled){
+        Box box;
+        if(tracker){
+            box.tracked = true;
+            box.enabled = enabled;
+            box.transform = tracker->getGlobalTransformMatrix();
+            box.size = glm::vec3(tracker->getWidth(), tracker->getHeight(), tracker->getDepth());
+            box.startPosition = tracker->startingPoint.getGlobalPosition();
+            box.firstHead = heads.size();
+            box.headCount = tracker->heads.size();
+            for(auto & head : tracker->heads){
+                if(head.isTracking()) box.tracking++;
+                heads.push_back({head.state, head.getGlobalTransformMatrix(), head.getRadius(),
+                                 head.localFloorPoint, head.lastTrackPointWeighedCount, head.shape});
+            }
+        }
+        boxes.push_back(box);
+    }
+};
+
+class TrackerViews {
+public:
+
+    TrackerViews(){
+        unitBox.set(1, 1, 1);
+        unitHead.set(1, 1);
+    }
+
+    // before processing starts
+    void reserve(size_t boxCount, size_t headCount, size_t zoneCount, size_t destinationCount){
+        for(auto & view : views){
+            view.reserve(boxCount, headCount, zoneCount, destinationCount);
+        }
+    }
+
+    // processing: fill this one, then publish()
+    TrackerView & back(){
+        return views[backIndex];
+    }
+
+    void publish(){
+        std::lock_guard<std::mutex> lock(mutex);
+        std::swap(backIndex, newestIndex);
+        fresh = true;
+    }
+
+    // GL thread, once per draw(): the newest view becomes the front one
+    void update(){
+        std::lock_guard<std::mutex> lock(mutex);
+        if(!fresh) return;
+        std::swap(frontIndex, newestIndex);
+        fresh = false;
+    }
+
+    const TrackerView & front() const {
+        return views[frontIndex];
+    }
+
+    // GL thread, the boxes and heads of the front view
+    void draw(){
+        const TrackerView & view = front();
+        ofPushMatrix();
+        for(auto & box : view.boxes){
+            if(!box.tracked || !box.enabled) continue;
+
+            ofSetColor(255,255,255,255);
+            ofPushMatrix();
+            ofMultMatrix(box.transform);
+            ofScale(box.size.x, box.size.y, box.size.z);
+            unitBox.drawWireframe();
+            ofPopMatrix();
+            ofSetColor(255,0,255,255);
+            ofDrawSphere(box.startPosition, 0.05);
+
+            for(size_t i = box.firstHead; i < box.firstHead + box.headCount; i++){
+                const TrackerView::Head & h = view.heads[i];
+                if(h.state == head::TRACKING_STATE::TRACKING){
+                    ofSetColor(0,255,0,255);
+                } else if (h.state == head::TRACKING_STATE::READY){
+                    ofSetColor(0,255,255,255);
+                } else {
+                    ofSetColor(255,255,0,255);
+                }
+                ofPushMatrix();
+                ofMultMatrix(h.transform);
+                ofPushMatrix();
+                ofScale(h.radius, h.radius, h.radius);
+                unitHead.drawWireframe();
+                ofPopMatrix();
+                ofSetColor(255,0,0,255);
+                ofDrawLine(glm::vec3(0,0,0), h.localFloorPoint);
+                ofSetColor(255,255);
+                ofDrawBitmapString(ofToString(h.weighedCount), glm::vec3(0,0,0));
+                ofDrawCone(h.localFloorPoint, 0.025, 0.05);
+                ofPopMatrix();
+                if(h.shape.valid){
+                    glm::vec3 gp = glm::vec3(h.transform[3]);
+                    float halfLength = glm::length(h.shape.extent) / 2.0;
+                    ofSetColor(255,0,255,255);
+                    ofDrawLine(gp - h.shape.axis * halfLength, gp + h.shape.axis * halfLength);
+                    glm::vec3 top(gp.x, h.shape.top, gp.z);
+                    ofDrawLine(top - glm::vec3(0.05,0,0), top + glm::vec3(0.05,0,0));
+                    ofDrawLine(top - glm::vec3(0,0,0.05), top + glm::vec3(0,0,0.05));
+                    ofSetColor(255,255);
+                    ofDrawBitmapString(ofToString(h.shape.top, 2) + "m " + ofToString(h.shape.lean, 0) + "deg", top);
+                }
+            }
+        }
+        ofPopMatrix();
+    }
+
+private:
+    TrackerView views[3];
+    int frontIndex = 0;
+    int newestIndex = 1;
+    int backIndex = 2;
+    bool fresh = false;
+    std::mutex mutex;
+
+    // GL thread, scaled to each box and head
+    ofBoxPrimitive unitBox;
+    ofIcoSpherePrimitive unitHead;
+};
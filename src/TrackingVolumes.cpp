@@ -0,0 +1,6 @@
+//
+//  TrackingVolumes.cpp
+//  realsense-osc-tracker
+//
+
+#include "TrackingVolumes.hpp"
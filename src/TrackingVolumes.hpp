@@ -0,0 +1,288 @@
+//
+//  TrackingVolumes.hpp
+//  realsense-osc-tracker
+//
+//  Further tracking boxes next to the main one, say the audience apron next
+//  to the stage, each with its own MeshTracker, start position, head budget
+//  and OSC prefix. The crop of the main box bins points into these in the
+//  same pass over the cloud: a point is first tested against the box's
+//  bounds in the camera frame, only points within go through the box
+//  transform. The trackers then run side by side, one per worker.
+//
+//  Volumes are settings, like zones and OSC destinations. Everything at
+//  runtime is rebuilt from them by update().
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MeshTracker.hpp"
+#include "QuantisedPoints.hpp"
+#include "TrackerFrameConfig.hpp"
+#include "OscDestinations.hpp"
+
+struct TrackingVolume {
+
+    string name = "volume";
+    string oscPrefix = "/volume";
+    bool enabled = true;
+    glm::vec3 boxPosition = glm::vec3(0, 1, 2);
+    glm::vec3 boxRotation = glm::vec3(0, 0, 0);
+    glm::vec3 boxSize = glm::vec3(2, 2, 2);
+    glm::vec3 startPosition = glm::vec3(0, 1, 2);
+    int maxHeads = 3;
+
+    ofJson toJson() const {
+        ofJson j;
+        j["Name"] = name;
+        j["OSC_Prefix"] = oscPrefix;
+        j["Enabled"] = enabled;
+        j["Box_Position"] = ofToString(boxPosition);
+        j["Box_Rotation"] = ofToString(boxRotation);
+        j["Box_Size"] = ofToString(boxSize);
+        j["Start_Position"] = ofToString(startPosition);
+        j["Max_Heads"] = maxHeads;
+        return j;
+    }
+
+    void fromJson(const ofJson & j){
+        name = j.value("Name", name);
+        oscPrefix = j.value("OSC_Prefix", oscPrefix);
+        enabled = j.value("Enabled", enabled);
+        boxPosition = ofFromString<glm::vec3>(j.value("Box_Position", ofToString(boxPosition)));
+        boxRotation = ofFromString<glm::vec3>(j.value("Box_Rotation", ofToString(boxRotation)));
+        boxSize = ofFromString<glm::vec3>(j.value("Box_Size", ofToString(boxSize)));
+        startPosition = ofFromString<glm::vec3>(j.value("Start_Position", ofToString(startPosition)));
+        maxHeads = ofClamp(j.value("Max_Heads", maxHeads), 1, 16);
+    }
+
+    // runtime
+    std::unique_ptr<MeshTracker> tracker;   // nodes keep pointers to their parents, so not in place
+    TrackerFrameConfig config;
+    QuantisedPoints::Cloud cloud;
+    vector<size_t> chunkCounts;
+    glm::vec3 boundsMin;                    // of the box, in the tracker camera frame
+    glm::vec3 boundsMax;
+};
+
+class TrackingVolumes {
+public:
+
+    static const int maxVolumes = 8;
+    static_assert(maxVolumes < TrackEventLog::maxSources, "every volume has its own event queue");
+
+    vector<TrackingVolume> volumes;
+    TrackEventLog * eventLog = nullptr;
+
+    // What the crop needs of a volume, plain values for the dispatch block
+    struct Crop {
+        glm::mat4 cameraToBox;
+        glm::vec3 halfExtents;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        int16_t * x;
+        int16_t * y;
+        int16_t * z;
+        size_t * chunkCounts;
+    };
+
+    // processing, between frames: trackers for new volumes or head budgets,
+    // and the frame config of every volume from the main one
+    void update(const TrackerFrameConfig & main, ofNode & camera, ofNode & origin){
+        if(volumes.size() > maxVolumes){
+            ofLogWarning("TrackingVolumes") << "Only the first " << maxVolumes << " volumes are tracked";
+        }
+        for(size_t i = 0; i < volumes.size() && i < maxVolumes; i++){
+            auto & v = volumes[i];
+            if(!v.tracker){
+                v.tracker.reset(new MeshTracker());
+                v.tracker->setEventQueue(eventLog ? eventLog->getQueue(int(i) + 1) : nullptr, uint8_t(i + 1));
+                v.tracker->setup(v.maxHeads, v.startPosition, camera, origin);
+            } else if(v.tracker->maxHeads != v.maxHeads){
+                // starts over, ending the tracks there were as the main tracker does
+                v.tracker->setup(v.maxHeads, v.startPosition, camera, origin);
+            }
+            v.tracker->setPosition(v.boxPosition);
+            v.tracker->setOrientation(v.boxRotation);
+            if(v.tracker->getWidth() != v.boxSize.x || v.tracker->getHeight() != v.boxSize.y || v.tracker->getDepth() != v.boxSize.z){
+                v.tracker->set(v.boxSize.x, v.boxSize.y, v.boxSize.z);
+            }
+
+            v.config = main;
+            v.config.cameraToBox = glm::inverse(v.tracker->getGlobalTransformMatrix()) * main.cameraToGlobal;
+            v.config.halfExtents = v.boxSize / 2.0f;
+            v.config.startPosition = v.startPosition;
+            v.config.buildMesh = false;
+
+            // corners of the box in the camera frame, for the quick reject
+            glm::mat4 boxToCamera = glm::inverse(v.config.cameraToBox);
+            v.boundsMin = glm::vec3(std::numeric_limits<float>::max());
+            v.boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+            for(int c = 0; c < 8; c++){
+                glm::vec3 corner = v.config.halfExtents * glm::vec3(c & 1 ? 1 : -1, c & 2 ? 1 : -1, c & 4 ? 1 : -1);
+                glm::vec3 p = glm::vec3(boxToCamera * glm::vec4(corner, 1.0));
+                v.boundsMin = glm::min(v.boundsMin, p);
+                v.boundsMax = glm::max(v.boundsMax, p);
+            }
+        }
+        assignEventQueues();
+    }
+
+    // processing, between frames: the volume's heads end their tracks and
+    // its tracker is kept until their state went out with the next OSC send
+    void remove(size_t i){
+        if(i >= volumes.size()) return;
+        retire(volumes[i]);
+        volumes.erase(volumes.begin() + i);
+        assignEventQueues();
+    }
+
+    // processing, before the crop: buffers for chunks of chunkSize points,
+    // returns the number of volumes to crop into
+    size_t prepareCrop(size_t chunks, size_t chunkSize){
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [](const Retired & r){ return r.announced; }), retired.end());
+        crops.clear();
+        for(size_t i = 0; i < volumes.size() && i < maxVolumes; i++){
+            auto & v = volumes[i];
+            if(!v.enabled || !v.tracker) continue;
+            v.tracker->applyConfig(v.config);
+            v.cloud.resize(chunks * chunkSize);
+            v.chunkCounts.resize(chunks);
+            crops.push_back({v.config.cameraToBox, v.config.halfExtents, v.boundsMin, v.boundsMax,
+                             v.cloud.x.data(), v.cloud.y.data(), v.cloud.z.data(), v.chunkCounts.data()});
+            active[crops.size() - 1] = &v;
+        }
+        return crops.size();
+    }
+
+    Crop * getCrops(){
+        return crops.data();
+    }
+
+    // one point of the crop, p in the tracker camera frame, k the next index
+    // of each volume in this chunk
+    static inline void crop(Crop * crops, size_t count, const glm::vec3 & p, size_t begin, size_t * k){
+        for(size_t j = 0; j < count; j++){
+            Crop & c = crops[j];
+            if(p.x < c.boundsMin.x || p.x > c.boundsMax.x ||
+               p.y < c.boundsMin.y || p.y > c.boundsMax.y ||
+               p.z < c.boundsMin.z || p.z > c.boundsMax.z) continue;
+            glm::vec3 b = glm::vec3(c.cameraToBox * glm::vec4(p, 1.0));
+            if(fabs(b.x) < c.halfExtents.x &&
+               fabs(b.y) < c.halfExtents.y &&
+               fabs(b.z) < c.halfExtents.z){
+                size_t i = begin + k[j]++;
+                c.x[i] = QuantisedPoints::quantise(p.x);
+                c.y[i] = QuantisedPoints::quantise(p.y);
+                c.z[i] = QuantisedPoints::quantise(p.z);
+            }
+        }
+    }
+
+    // The crop of ofApp::processFrame() and BatchPipeline::process(): the
+    // vertices [begin, end) that fall in the main box go to x, y, z from
+    // begin on, those in the count volumes to theirs. active, if given, gets
+    // 1 for every vertex kept in the main box and 0 for the rest. Returns the
+    // points kept in the main box.
+    static inline size_t cropChunk(const rs2::vertex * vs, size_t begin, size_t end, const TrackerFrameConfig & config,
+                                   int16_t * x, int16_t * y, int16_t * z, uint8_t * active,
+                                   Crop * crops, size_t count, size_t * volumeK){
+        const glm::mat4 cameraToBox = config.cameraToBox;
+        const glm::vec3 halfExtents = config.halfExtents;
+        const float minDepth = config.minDepth;
+        size_t k = begin;
+        
+        for(size_t i = begin; i < end; i++){
+            const rs2::vertex & v = vs[i];
+            if(active) active[i] = 0;
+            if(v.z <= minDepth) continue; // save time on skipping the closest ones
+            
+            glm::vec3 boxVec = glm::vec3(cameraToBox * glm::vec4(v.x, -v.y, -v.z, 1.0));
+            if(fabs(boxVec.x) < halfExtents.x &&
+               fabs(boxVec.y) < halfExtents.y &&
+               fabs(boxVec.z) < halfExtents.z){
+                if(active) active[i] = 1;
+                x[k] = QuantisedPoints::quantise(v.x);
+                y[k] = QuantisedPoints::quantise(-v.y);
+                z[k] = QuantisedPoints::quantise(-v.z);
+                k++;
+            }
+            
+            if(count > 0){
+                crop(crops, count, glm::vec3(v.x, -v.y, -v.z), begin, volumeK);
+            }
+        }
+        return k - begin;
+    }
+
+    // the j'th cropped volume through its tracker, on any thread
+    void track(size_t j, size_t chunks, size_t chunkSize, double timestamp){
+        TrackingVolume & v = *active[j];
+        for(size_t chunk = 0; chunk < chunks; chunk++){
+            size_t begin = chunk * chunkSize;
+            v.tracker->addPoints(v.cloud.x.data() + begin, v.cloud.y.data() + begin, v.cloud.z.data() + begin,
+                                 v.cloud.category.data() + begin, v.chunkCounts[chunk]);
+        }
+        v.tracker->update(timestamp);
+    }
+
+    // the cropped volumes for OscDestinations::send(), after the main heads,
+    // then once more those of removed volumes, all ready now
+    void addHeadSets(vector<OscHeadSet> & sets){
+        for(size_t j = 0; j < crops.size(); j++){
+            sets.push_back({&active[j]->oscPrefix, &active[j]->tracker->heads});
+        }
+        for(auto & r : retired){
+            sets.push_back({&r.oscPrefix, &r.tracker->heads});
+            r.announced = true;
+        }
+    }
+
+    ofJson toJson() const {
+        ofJson j = ofJson::array();
+        for(auto & v : volumes){
+            j.push_back(v.toJson());
+        }
+        return j;
+    }
+
+    // processing, between frames: the volumes there were go as remove() does
+    void fromJson(const ofJson & j){
+        for(auto & v : volumes){
+            retire(v);
+        }
+        volumes.clear();
+        crops.clear();
+        for(auto & vj : j){
+            volumes.emplace_back();
+            volumes.back().fromJson(vj);
+        }
+    }
+
+private:
+
+    // indices move when a volume is removed
+    void assignEventQueues(){
+        for(size_t i = 0; i < volumes.size() && i < maxVolumes; i++){
+            if(volumes[i].tracker){
+                volumes[i].tracker->setEventQueue(eventLog ? eventLog->getQueue(int(i) + 1) : nullptr, uint8_t(i + 1));
+            }
+        }
+    }
+
+    void retire(TrackingVolume & v){
+        if(!v.tracker) return;
+        v.tracker->endTracks();
+        retired.push_back({v.oscPrefix, std::move(v.tracker), false});
+    }
+
+    struct Retired {
+        string oscPrefix;
+        std::unique_ptr<MeshTracker> tracker;
+        bool announced;     // its heads went out with an OSC send
+    };
+
+    vector<Crop> crops;
+    TrackingVolume * active[maxVolumes];
+    vector<Retired> retired;
+};
@@ -0,0 +1,6 @@
+//
+//  TriggerZones.cpp
+//  realsense-osc-tracker
+//
+
+#include "TriggerZones.hpp"
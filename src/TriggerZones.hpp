@@ -0,0 +1,319 @@
+//
+//  TriggerZones.hpp
+//  realsense-osc-tracker
+//
+//  Named boxes and cylinders in the origin frame that heads can walk into.
+//  Only transitions are reported: enter, exit and (optionally) dwell after a
+//  zone has been occupied for a while. Zones are bucketed into a grid on the
+//  floor, so each head only tests the zones overlapping its own cell.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "MeshTracker.hpp"
+
+struct TriggerZone {
+
+    enum class SHAPE {
+        BOX,
+        CYLINDER
+    };
+
+    string name = "zone";
+    SHAPE shape = SHAPE::BOX;
+    glm::vec3 position = {0,1,0};
+    glm::vec3 size = {1,2,1};     // cylinders use size.x as diameter and size.y as height
+    float dwell = 0;              // seconds, 0 disables dwell events
+    string qLabEnterCue = "";     // QLab cue numbers, empty sends OSC only
+    string qLabExitCue = "";
+    string qLabDwellCue = "";
+
+    bool contains(const glm::vec3 & p) const {
+        glm::vec3 d = p - position;
+        if(fabs(d.y) > size.y/2.0) return false;
+        if(shape == SHAPE::CYLINDER){
+            return d.x*d.x + d.z*d.z < size.x*size.x/4.0;
+        }
+        return fabs(d.x) < size.x/2.0 && fabs(d.z) < size.z/2.0;
+    }
+
+    glm::vec2 getMinXZ() const {
+        float hz = shape == SHAPE::CYLINDER ? size.x/2.0 : size.z/2.0;
+        return glm::vec2(position.x - size.x/2.0, position.z - hz);
+    }
+
+    glm::vec2 getMaxXZ() const {
+        float hz = shape == SHAPE::CYLINDER ? size.x/2.0 : size.z/2.0;
+        return glm::vec2(position.x + size.x/2.0, position.z + hz);
+    }
+
+    ofJson toJson() const {
+        ofJson j;
+        j["Name"] = name;
+        j["Shape"] = shape == SHAPE::CYLINDER ? "cylinder" : "box";
+        j["Position"] = ofToString(position);
+        j["Size"] = ofToString(size);
+        j["Dwell"] = dwell;
+        j["QLab_Enter_Cue"] = qLabEnterCue;
+        j["QLab_Exit_Cue"] = qLabExitCue;
+        j["QLab_Dwell_Cue"] = qLabDwellCue;
+        return j;
+    }
+
+    void fromJson(const ofJson & j){
+        name = j.value("Name", name);
+        shape = j.value("Shape", string("box")) == "cylinder" ? SHAPE::CYLINDER : SHAPE::BOX;
+        position = ofFromString<glm::vec3>(j.value("Position", ofToString(position)));
+        size = ofFromString<glm::vec3>(j.value("Size", ofToString(size)));
+        dwell = j.value("Dwell", dwell);
+        qLabEnterCue = j.value("QLab_Enter_Cue", qLabEnterCue);
+        qLabExitCue = j.value("QLab_Exit_Cue", qLabExitCue);
+        qLabDwellCue = j.value("QLab_Dwell_Cue", qLabDwellCue);
+    }
+};
+
+struct TriggerZoneEvent {
+
+    enum class TYPE {
+        ENTER,
+        EXIT,
+        DWELL
+    };
+
+    TYPE type;
+    const TriggerZone * zone;
+    int headId;
+    double duration; // seconds inside, for exit and dwell
+
+    const char * getTypeName() const {
+        switch(type){
+            case TYPE::ENTER: return "enter";
+            case TYPE::EXIT: return "exit";
+            case TYPE::DWELL: return "dwell";
+        }
+        return "";
+    }
+};
+
+class TriggerZones {
+public:
+
+    vector<TriggerZone> zones;
+    ofEvent<TriggerZoneEvent> zoneEvent;
+    float cellSize = 0.5;
+
+    // head ids run from 1 to the tracker's max heads, the state per head is
+    // indexed by id so a head entering does not allocate while processing
+    static const int maxHeadId = 16;
+
+    // call after zones have been added, removed or moved. Heads keep the
+    // zones they are in, the next update() sends exits for the ones a zone
+    // no longer contains and enters only for real changes
+    void rebuildIndex(){
+        cells.clear();
+        occupancy.resize(zones.size());
+        for(auto & inside : insideZones){
+            inside.reserve(zones.size());
+        }
+        if(zones.empty()) return;
+
+        gridMin = zones[0].getMinXZ();
+        glm::vec2 gridMax = zones[0].getMaxXZ();
+        for(auto & zone : zones){
+            gridMin = glm::min(gridMin, zone.getMinXZ());
+            gridMax = glm::max(gridMax, zone.getMaxXZ());
+        }
+        gridWidth = std::max(1, int(ceil((gridMax.x - gridMin.x) / cellSize)));
+        gridDepth = std::max(1, int(ceil((gridMax.y - gridMin.y) / cellSize)));
+        cells.resize(gridWidth * gridDepth);
+
+        for(size_t i = 0; i < zones.size(); i++){
+            glm::ivec2 a = cellOf(zones[i].getMinXZ());
+            glm::ivec2 b = cellOf(zones[i].getMaxXZ());
+            for(int z = a.y; z <= b.y; z++){
+                for(int x = a.x; x <= b.x; x++){
+                    cells[z*gridWidth + x].push_back(i);
+                }
+            }
+        }
+    }
+
+    void addZone(const TriggerZone & zone){
+        zones.push_back(zone);
+        rebuildIndex();
+    }
+
+    // an edit from the GUI, the grid only changes when the zone moved
+    void setZone(size_t i, const TriggerZone & zone, bool moved){
+        if(i >= zones.size()) return;
+        zones[i] = zone;
+        if(moved) rebuildIndex();
+    }
+
+    // the heads inside leave it first
+    void removeZone(size_t i, double now){
+        if(i >= zones.size()) return;
+        for(int id = 1; id <= maxHeadId; id++){
+            if(occupancy[i][id].inside){
+                notify(TriggerZoneEvent::TYPE::EXIT, i, id, now - occupancy[i][id].enterTime);
+            }
+        }
+        for(auto & inside : insideZones){
+            inside.erase(std::remove(inside.begin(), inside.end(), i), inside.end());
+            for(auto & k : inside){
+                if(k > i) k--;
+            }
+        }
+        zones.erase(zones.begin() + i);
+        occupancy.erase(occupancy.begin() + i);
+        rebuildIndex();
+    }
+
+    void update(vector<head> & heads, double now){
+        if(zones.empty()) return;
+
+        for(auto & head : heads){
+            if(head.id < 1 || head.id > maxHeadId) continue;
+            bool present = head.isTrackingOrLost();
+            glm::vec3 p = head.getGlobalPosition();
+
+            // every zone the head could be in shares its cell
+            const vector<size_t> * candidates = nullptr;
+            if(present){
+                glm::vec2 cell = (glm::vec2(p.x, p.z) - gridMin) / cellSize;
+                if(cell.x >= 0 && cell.y >= 0 && cell.x < gridWidth && cell.y < gridDepth){
+                    candidates = &cells[int(cell.y)*gridWidth + int(cell.x)];
+                }
+            }
+
+            auto & inside = insideZones[head.id];
+
+            // exits, including zones that are no longer candidates
+            for(size_t k = 0; k < inside.size(); ){
+                size_t i = inside[k];
+                bool stillInside = candidates && std::find(candidates->begin(), candidates->end(), i) != candidates->end() && zones[i].contains(p);
+                if(!stillInside){
+                    auto & state = occupancy[i][head.id];
+                    notify(TriggerZoneEvent::TYPE::EXIT, i, head.id, now - state.enterTime);
+                    state.inside = false;
+                    inside[k] = inside.back();
+                    inside.pop_back();
+                } else {
+                    k++;
+                }
+            }
+
+            if(!candidates) continue;
+
+            for(size_t i : *candidates){
+                if(!zones[i].contains(p)) continue;
+                auto & state = occupancy[i][head.id];
+                if(!state.inside){
+                    state = {now, false, true};
+                    inside.push_back(i);
+                    notify(TriggerZoneEvent::TYPE::ENTER, i, head.id, 0);
+                } else if(zones[i].dwell > 0 && !state.dwellSent && now - state.enterTime >= zones[i].dwell){
+                    state.dwellSent = true;
+                    notify(TriggerZoneEvent::TYPE::DWELL, i, head.id, now - state.enterTime);
+                }
+            }
+        }
+    }
+
+    // every head leaves the zones it is in, e.g. when the tracker starts over
+    // and the heads it had are gone or ready again
+    void exitAll(double now){
+        for(int id = 1; id <= maxHeadId; id++){
+            for(size_t i : insideZones[id]){
+                notify(TriggerZoneEvent::TYPE::EXIT, i, id, now - occupancy[i][id].enterTime);
+                occupancy[i][id].inside = false;
+            }
+            insideZones[id].clear();
+        }
+    }
+
+    bool isOccupied(size_t zone){
+        if(zone >= occupancy.size()) return false;
+        for(auto & o : occupancy[zone]){
+            if(o.inside) return true;
+        }
+        return false;
+    }
+
+    // GL thread, from its copy of the zones and the occupancy processing
+    // last saw, which trails an edit by a frame
+    static void draw(const vector<TriggerZone> & zones, const vector<uint8_t> & occupied){
+        for(size_t i = 0; i < zones.size(); i++){
+            auto & zone = zones[i];
+            if(i < occupied.size() && occupied[i]){
+                ofSetColor(255,128,0,255);
+            } else {
+                ofSetColor(255,128,0,96);
+            }
+            if(zone.shape == TriggerZone::SHAPE::CYLINDER){
+                ofNoFill();
+                ofDrawCylinder(zone.position, zone.size.x/2.0, zone.size.y);
+                ofFill();
+            } else {
+                ofNoFill();
+                ofDrawBox(zone.position, zone.size.x, zone.size.y, zone.size.z);
+                ofFill();
+            }
+            ofSetColor(255,255);
+            ofDrawBitmapString(zone.name, zone.position + glm::vec3(0, zone.size.y/2.0, 0));
+        }
+    }
+
+    ofJson toJson() const {
+        ofJson j = ofJson::array();
+        for(auto & zone : zones){
+            j.push_back(zone.toJson());
+        }
+        return j;
+    }
+
+    // replaces every zone, exitAll() first when heads may be inside
+    void fromJson(const ofJson & j){
+        zones.clear();
+        occupancy.clear();
+        for(auto & inside : insideZones){
+            inside.clear();
+        }
+        for(auto & z : j){
+            TriggerZone zone;
+            zone.fromJson(z);
+            zones.push_back(zone);
+        }
+        rebuildIndex();
+    }
+
+private:
+
+    struct Occupant {
+        double enterTime = 0;
+        bool dwellSent = false;
+        bool inside = false;
+    };
+
+    glm::ivec2 cellOf(const glm::vec2 & xz){
+        glm::ivec2 c = glm::ivec2(glm::floor((xz - gridMin) / cellSize));
+        return glm::clamp(c, glm::ivec2(0,0), glm::ivec2(gridWidth-1, gridDepth-1));
+    }
+
+    void notify(TriggerZoneEvent::TYPE type, size_t zone, int headId, double duration){
+        TriggerZoneEvent e;
+        e.type = type;
+        e.zone = &zones[zone];
+        e.headId = headId;
+        e.duration = duration;
+        ofNotifyEvent(zoneEvent, e, this);
+    }
+
+    glm::vec2 gridMin;
+    int gridWidth = 0;
+    int gridDepth = 0;
+    vector<vector<size_t>> cells;
+    vector<std::array<Occupant, maxHeadId + 1>> occupancy;      // per zone, by head id
+    std::array<vector<size_t>, maxHeadId + 1> insideZones;      // by head id, reserved for every zone
+};
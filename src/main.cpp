@@ -1,8 +1,28 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "BatchProcessor.hpp"
+#include "SyntheticCrowd.hpp"
+#include "qLabSelfTest.hpp"
 
 //========================================================================
-int main( ){
+int main(int argc, char * argv[]){
+	
+	// recorded sessions through the tracker, no window
+	if(argc > 1 && string(argv[1]) == "--batch"){
+		return BatchProcessor::run(vector<string>(argv + 2, argv + argc));
+	}
+	if(argc > 1 && string(argv[1]) == "--compare-filters"){
+		return BatchProcessor::compareFilters(vector<string>(argv + 2, argv + argc));
+	}
+	// a generated crowd through the same pipeline, the load test
+	if(argc > 1 && string(argv[1]) == "--synthetic"){
+		return SyntheticCrowd::run(vector<string>(argv + 2, argv + argc));
+	}
+	// qLabController against a mock QLab on the loopback
+	if(argc > 1 && string(argv[1]) == "--qlab-selftest"){
+		return qLabSelfTest::run(vector<string>(argv + 2, argv + argc));
+	}
+	
 	ofSetupOpenGL(1024,768,OF_WINDOW);			// <-------- setup the GL context
 
 	// this kicks off the running of my app
@@ -10,89 +10,29 @@ void ofApp::setup(){
     ofSetWindowTitle(title);
     
     trackingMesh.setMode(OF_PRIMITIVE_POINTS);
+    displayMesh.setMode(OF_PRIMITIVE_POINTS);
+    
+#ifdef TRACKER_CHECK_KERNELS
+    // also in release builds, where an assert would be gone
+    if(!MeshTracker::selfCheck()){
+        ofLogFatalError("ofApp") << "Tracking kernels disagree, see above";
+        std::exit(1);
+    }
+#endif
     
     cropVerticesQueue = dispatch_queue_create("Crop Vertices", DISPATCH_QUEUE_CONCURRENT);
+    cameraQueue = dispatch_queue_create("Camera", DISPATCH_QUEUE_SERIAL);
+    kernelBenchmarkQueue = dispatch_queue_create("Kernel Benchmark", DISPATCH_QUEUE_SERIAL);
         
-    //REALSENSE
-    rs2::config cfg;
-    cfg.enable_stream(RS2_STREAM_DEPTH, 848, 480, RS2_FORMAT_ANY, 60);
+    // FILTERS
     
-    try {
-        
-        selection = pipe.start(cfg);
-        
-        // Find first depth sensor (devices can have zero or more then one)
-        auto depth_sensor = selection.get_device().first<rs2::depth_sensor>();
-        
-        if (depth_sensor.supports(RS2_OPTION_EMITTER_ENABLED))
-        {
-            depth_sensor.set_option(RS2_OPTION_EMITTER_ENABLED, 1.f); // Enable emitter
-        }
-        if (depth_sensor.supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE))
-        {
-            depth_sensor.set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1.f); // Enable autoexposure
-        }
-        
-        /* manual exposure options
-         
-         if (depth_sensor.supports(RS2_OPTION_GAIN))
-         {
-         depth_sensor.set_option(RS2_OPTION_GAIN, 32.f);
-         }
-         if (depth_sensor.supports(RS2_OPTION_EXPOSURE))
-         {
-         depth_sensor.set_option(RS2_OPTION_EXPOSURE, 4000.f);
-         }
-         */
-        
-        if (depth_sensor.supports(RS2_OPTION_LASER_POWER))
-        {
-            // Query min and max values:
-            auto range = depth_sensor.get_option_range(RS2_OPTION_LASER_POWER);
-            depth_sensor.set_option(RS2_OPTION_LASER_POWER, range.max); // Set max power
-        }
-        
-        auto scale =  depth_sensor.get_depth_scale();
-        
-        auto stream = pipe.get_active_profile().get_stream(RS2_STREAM_DEPTH);
-        if (auto video_stream = stream.as<rs2::video_stream_profile>())
-        {
-            try
-            {
-                //If the stream is indeed a video stream, we can now simply call get_intrinsics()
-                intrinsics = video_stream.get_intrinsics();
-                
-                auto principal_point = std::make_pair(intrinsics.ppx, intrinsics.ppy);
-                auto focal_length = std::make_pair(intrinsics.fx, intrinsics.fy);
-                rs2_distortion model = intrinsics.model;
-                /*
-                 std::cout << "Principal Point         : " << principal_point.first << ", " << principal_point.second << std::endl;
-                 std::cout << "Focal Length            : " << focal_length.first << ", " << focal_length.second << std::endl;
-                 std::cout << "Distortion Model        : " << model << std::endl;
-                 std::cout << "Distortion Coefficients : [" << intrinsics.coeffs[0] << "," << intrinsics.coeffs[1] << "," <<
-                 intrinsics.coeffs[2] << "," << intrinsics.coeffs[3] << "," << intrinsics.coeffs[4] << "]" << std::endl;
-                 */
-            }
-            catch (const std::exception& e)
-            {
-                std::cerr << "Failed to get intrinsics for the given stream. " << e.what() << std::endl;
-            }
-        }
-        
-        // FILTERS
-        
-        dec_filter.set_option(RS2_OPTION_FILTER_MAGNITUDE, 2.0);
-        spat_filter.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 0.95f);
-        temp_filter.set_option(RS2_OPTION_FILTER_SMOOTH_ALPHA, 0.1f);
-        temp_filter.set_option(RS2_OPTION_FILTER_SMOOTH_DELTA, 65.0f);
-        temp_filter.set_option(RS2_OPTION_HOLES_FILL, 7);
-        
-    } catch (exception e){
-        ofLogError("SETUP", "No realsense camera found");
-    }
+    FusedDepthFilter::setupFilters(dec_filter, spat_filter, temp_filter, getCloudDecimation());
     
     ofAddListener(ofGetWindowPtr()->events().keyPressed, this,
                   &ofApp::keycodePressed);
+    ofAddListener(zones.zoneEvent, this, &ofApp::onZoneEvent);
+    ofAddListener(pgTracking.parameterChangedE(), this, &ofApp::onTrackingParameterChanged);
+    ofAddListener(pgCamera.parameterChangedE(), this, &ofApp::onTrackingParameterChanged);
     
     ImGui::CreateContext();
     ImGuiIO& io = ImGui::GetIO();
@@ -163,11 +103,23 @@ void ofApp::setup(){
     
     load("default");
     
+    qLab.setup(pOscQlabRemoteHost, pOscQlabRemotePort, pOscQlabReplyPort);
+    remote.setup(pgRoot, pOscRemoteControlPort, pOscRemoteControlReplyPort);
+    if(pMetricsEnabled){
+        metricsServer.setup(pMetricsPort);
+    }
+    setupMonitor();
+    ofAddListener(pgMonitor.parameterChangedE(), this, &ofApp::onMonitorParameterChanged);
+    eventLogOsc = OscDestinations::anyWants(destinationSettings, OscDestination::EVENTS);
+    applyEventLogSettings();
+    ofAddListener(pgEventLog.parameterChangedE(), this, &ofApp::onEventLogParameterChanged);
+    
     // Visualisation planes
     
     floorPlane.setParent(origin);
     wallPosPlane.setParent(origin);
     wallNegPlane.setParent(origin);
+    trackingBox.setParent(origin);
     
     // MESH TRACKER
     
@@ -178,7 +130,55 @@ void ofApp::setup(){
     trackingCamera.setFov(86.0);
     trackingCamera.setNearClip(0.1);
     trackingCamera.setFarClip(50.0);
-    tracker.setup(3, pTrackingStartPosition, trackingCamera, origin );
+    tracker.setEventQueue(trackEventLog.getQueue(0), 0);
+    trackingVolumes.eventLog = &trackEventLog;
+    tracker.setup(pTrackingMaxHeads, pTrackingStartPosition, trackingCamera, origin );
+    activeMaxHeads = pTrackingMaxHeads;
+    publishFrameConfig();
+    trackingConfigDirty = false;
+    // nothing processes yet, the loaded settings and the volume trackers are there right away
+    applyProcessingEdits();
+    restoreTrackerSnapshot();
+    trackerSnapshot.reserve(1 + TrackingVolumes::maxVolumes, (1 + TrackingVolumes::maxVolumes) * pTrackingMaxHeads.getMax());
+    // more zones or destinations than this allocate in the frame that copies them
+    trackerViews.reserve(1 + TrackingVolumes::maxVolumes, (1 + TrackingVolumes::maxVolumes) * pTrackingMaxHeads.getMax(), 64, 32);
+    fillTrackerView(trackerViews.back());
+    trackerViews.publish();
+    applySnapshotSettings();
+    ofAddListener(pgSnapshot.parameterChangedE(), this, &ofApp::onSnapshotParameterChanged);
+    
+    processing.step = [this]{
+        return processNextFrame(true);
+    };
+    processing.onRealtime = [this](const RealtimeProfile & profile){
+        // sized from the stream the thread was started for if no frame did
+        // that yet, then faulted in and wired before the first one arrives
+        std::lock_guard<std::mutex> lock(processingMutex);
+        frameBufferProfile = profile;
+        frameBuffersWired = true;
+        return reserveFrameBuffers(std::max(frameBufferSize, realtimeCloudSize));
+    };
+    processing.onNormal = [this](const RealtimeProfile & profile){
+        // the thread stops, a run without the profile starts unlocked
+        std::lock_guard<std::mutex> lock(processingMutex);
+        wireFrameBuffers(false);
+        frameBuffersWired = false;
+    };
+    
+    //REALSENSE
+    // only flag here, librealsense calls back on its own thread
+    ctx.set_devices_changed_callback([this](rs2::event_information & info){
+        {
+            std::lock_guard<std::mutex> lock(cameraMutex);
+            if(selection && info.was_removed(selection.get_device())){
+                cameraLost = true;
+            }
+        }
+        if(info.get_new_devices().size() > 0){
+            cameraFound = true;
+        }
+    });
+    requestCameraStart();
     
     //GUI
     
@@ -190,9 +190,358 @@ void ofApp::setup(){
     
 }
 
+//--------------------------------------------------------------
+void ofApp::requestCameraStart(){
+    
+    StreamProfile profile = streamProfiles[ofClamp(pCameraStreamProfile.get(), 0, int(streamProfiles.size())-1)];
+    activeStreamProfile = pCameraStreamProfile;
+    lastCameraAttempt = ofGetElapsedTimef();
+    cameraState = CAMERA_STATE::CONNECTING;
+    
+    // frames of another size must not end up in the same recording
+    stopRecording();
+    
+    dispatch_async(cameraQueue, ^{
+        startCamera(profile);
+    });
+}
+
+//--------------------------------------------------------------
+void ofApp::onCameraLost(string reason){
+    
+    ofLogWarning("CAMERA") << "Camera " << reason << ", waiting for it to come back";
+    cameraState = CAMERA_STATE::DISCONNECTED;
+    if(cameraLostTime < 0){
+        cameraLostTime = ofGetElapsedTimef();
+    }
+    stopRecording();
+}
+
+//--------------------------------------------------------------
+// runs on cameraQueue, never on the GL thread
+void ofApp::startCamera(StreamProfile profile){
+    
+    std::lock_guard<std::mutex> lock(cameraMutex);
+    
+    if(selection){
+        try {
+            pipe.stop();
+        } catch (const rs2::error & e){
+            // the device is most likely gone already
+        }
+        selection = rs2::pipeline_profile();
+    }
+    
+    rs2::config cfg;
+    cfg.enable_stream(RS2_STREAM_DEPTH, profile.width, profile.height, RS2_FORMAT_ANY, profile.fps);
+    
+    try {
+        
+        selection = pipe.start(cfg);
+        
+        // Find first depth sensor (devices can have zero or more then one)
+        auto depth_sensor = selection.get_device().first<rs2::depth_sensor>();
+        
+        if (depth_sensor.supports(RS2_OPTION_EMITTER_ENABLED))
+        {
+            depth_sensor.set_option(RS2_OPTION_EMITTER_ENABLED, 1.f); // Enable emitter
+        }
+        if (depth_sensor.supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE))
+        {
+            depth_sensor.set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1.f); // Enable autoexposure
+        }
+        
+        /* manual exposure options
+         
+         if (depth_sensor.supports(RS2_OPTION_GAIN))
+         {
+         depth_sensor.set_option(RS2_OPTION_GAIN, 32.f);
+         }
+         if (depth_sensor.supports(RS2_OPTION_EXPOSURE))
+         {
+         depth_sensor.set_option(RS2_OPTION_EXPOSURE, 4000.f);
+         }
+         */
+        
+        if (depth_sensor.supports(RS2_OPTION_LASER_POWER))
+        {
+            // Query min and max values:
+            auto range = depth_sensor.get_option_range(RS2_OPTION_LASER_POWER);
+            depth_sensor.set_option(RS2_OPTION_LASER_POWER, range.max); // Set max power
+        }
+        
+        depthScale = depth_sensor.get_depth_scale();
+        
+        auto stream = pipe.get_active_profile().get_stream(RS2_STREAM_DEPTH);
+        if (auto video_stream = stream.as<rs2::video_stream_profile>())
+        {
+            try
+            {
+                //If the stream is indeed a video stream, we can now simply call get_intrinsics()
+                intrinsics = video_stream.get_intrinsics();
+                
+                auto principal_point = std::make_pair(intrinsics.ppx, intrinsics.ppy);
+                auto focal_length = std::make_pair(intrinsics.fx, intrinsics.fy);
+                rs2_distortion model = intrinsics.model;
+                /*
+                 std::cout << "Principal Point         : " << principal_point.first << ", " << principal_point.second << std::endl;
+                 std::cout << "Focal Length            : " << focal_length.first << ", " << focal_length.second << std::endl;
+                 std::cout << "Distortion Model        : " << model << std::endl;
+                 std::cout << "Distortion Coefficients : [" << intrinsics.coeffs[0] << "," << intrinsics.coeffs[1] << "," <<
+                 intrinsics.coeffs[2] << "," << intrinsics.coeffs[3] << "," << intrinsics.coeffs[4] << "]" << std::endl;
+                 */
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "Failed to get intrinsics for the given stream. " << e.what() << std::endl;
+            }
+        }
+        
+        ofLogNotice("CAMERA") << "Streaming " << profile.name;
+        
+        cameraStarted = true;
+        cameraState = CAMERA_STATE::STREAMING;
+        
+    } catch (const rs2::error & e){
+        ofLogError("CAMERA") << "Could not start " << profile.name << ": " << e.what();
+        selection = rs2::pipeline_profile();
+        cameraState = CAMERA_STATE::DISCONNECTED;
+    } catch (exception e){
+        ofLogError("SETUP", "No realsense camera found");
+        selection = rs2::pipeline_profile();
+        cameraState = CAMERA_STATE::DISCONNECTED;
+    }
+}
+
+//--------------------------------------------------------------
+int ofApp::getCloudDecimation(){
+    return pTrackingCoarseToFine ? pTrackingCoarseDecimation : pCameraDecimation;
+}
+
+//--------------------------------------------------------------
+// GL thread: the camera model and, at the next frame boundary, the
+// decimation and the per frame buffers for the stream
+void ofApp::applyIntrinsics(const rs2_intrinsics & intrinsics){
+    
+    activeDecimation = getCloudDecimation();
+    int decimation = activeDecimation;
+    size_t cloudSize = intrinsics.width > 0 && intrinsics.height > 0 ? getCloudSize(intrinsics.width, intrinsics.height) : 0;
+    editProcessing([this, decimation, cloudSize]{
+        dec_filter.set_option(RS2_OPTION_FILTER_MAGNITUDE, decimation);
+        fused_filter.setSettings(FusedDepthFilter::fromFilters(dec_filter, spat_filter, temp_filter));
+        if(cloudSize > 0) reserveFrameBuffers(cloudSize);
+    });
+    
+    if(intrinsics.width <= 0 || intrinsics.height <= 0) return;
+    
+    // realsense camera frustrum follows the stream
+    trackingCamera.setAspectRatio(float(intrinsics.width) / intrinsics.height);
+    trackingCamera.setFov(ofRadToDeg(2.0 * atan2(intrinsics.height / 2.0, intrinsics.fy)));
+    
+    // points on a head are spread over fewer pixels when the stream or the decimation is coarser
+    cloudFocalArea = (intrinsics.fx / activeDecimation) * (intrinsics.fy / activeDecimation);
+    trackingConfigDirty = true;
+}
+
+// points in a cloud of the stream, the decimation filter pads to a multiple of 4
+size_t ofApp::getCloudSize(int width, int height){
+    int decimation = getCloudDecimation();
+    return size_t(width / decimation + 4) * size_t(height / decimation + 4);
+}
+
+// processing, between frames or before the first one: the per frame buffers
+// for clouds of up to cloudSize points, sized once, returns the bytes wired
+size_t ofApp::reserveFrameBuffers(size_t cloudSize){
+    frameBufferSize = std::max(frameBufferSize, cloudSize);
+    vertsActive.reserve(cloudSize);
+    quantisedCloud.reserve(cloudSize + cropChunkSize);
+    cropChunkCounts.reserve(cloudSize / cropChunkSize + 1);
+    trackingMesh.getVertices().reserve(cloudSize);
+    trackingMesh.getColors().reserve(cloudSize);
+    {
+        std::lock_guard<std::mutex> lock(displayMutex);
+        displayMesh.getVertices().reserve(cloudSize);
+        displayMesh.getColors().reserve(cloudSize);
+    }
+    // larger buffers are new pages, wired again
+    return frameBuffersWired ? wireFrameBuffers(true) : 0;
+}
+
+// wires the per frame buffers with the profile, or unwires them again
+size_t ofApp::wireFrameBuffers(bool wire){
+    const RealtimeProfile & profile = frameBufferProfile;
+    size_t wired = 0;
+    auto buffer = [&](const void * data, size_t bytes){
+        if(wire) wired += profile.prefault(data, bytes);
+        else profile.unwire(data, bytes);
+    };
+    buffer(vertsActive.data(), vertsActive.capacity());
+    buffer(quantisedCloud.x.data(), quantisedCloud.x.capacity() * sizeof(int16_t));
+    buffer(quantisedCloud.y.data(), quantisedCloud.y.capacity() * sizeof(int16_t));
+    buffer(quantisedCloud.z.data(), quantisedCloud.z.capacity() * sizeof(int16_t));
+    buffer(quantisedCloud.category.data(), quantisedCloud.category.capacity());
+    buffer(trackingMesh.getVertices().data(), trackingMesh.getVertices().capacity() * sizeof(glm::vec3));
+    buffer(trackingMesh.getColors().data(), trackingMesh.getColors().capacity() * sizeof(ofFloatColor));
+    std::lock_guard<std::mutex> lock(displayMutex);
+    buffer(displayMesh.getVertices().data(), displayMesh.getVertices().capacity() * sizeof(glm::vec3));
+    buffer(displayMesh.getColors().data(), displayMesh.getColors().capacity() * sizeof(ofFloatColor));
+    return wired;
+}
+
+//--------------------------------------------------------------
+void ofApp::exit(){
+    // the thread uses members destroyed before it
+    processing.stop();
+    applyProcessingEdits();
+    dispatch_sync(kernelBenchmarkQueue, ^{});
+    metricsServer.close();
+    monitorStream.close();
+    monitorReceiver.close();
+    trackEventLog.close();
+    if(snapshotWriter.isThreadRunning()){
+        snapshotWriter.close();
+        // where the heads are now, not at the last periodic snapshot
+        if(!replayOpen){
+            fillTrackerSnapshot();
+            trackerSnapshot.write(getSnapshotPath());
+        }
+    }
+}
+
+//--------------------------------------------------------------
+void ofApp::setupMonitor(){
+    monitorReceiver.close();
+    bool enabled = pMonitorEnabled;
+    string host = pMonitorLoopback ? "127.0.0.1" : pMonitorHost.get();
+    int port = pMonitorPort;
+    // the stream is fed by processing, it restarts between frames
+    editProcessing([this, enabled, host, port]{
+        monitorStream.close();
+        if(enabled) monitorStream.setup(host, port);
+    });
+    if(!enabled) return;
+    // loopback receives here what would go to the viewer
+    if(pMonitorLoopback){
+        monitorReceiver.setup(pMonitorPort);
+    }
+    applyMonitorSettings();
+}
+
+//--------------------------------------------------------------
+void ofApp::applyMonitorSettings(){
+    MonitorStream::Settings settings;
+    settings.rate = pMonitorRate;
+    settings.kilobitsPerSecond = pMonitorBandwidth;
+    settings.voxelSize = pMonitorVoxelSize;
+    settings.keyframeInterval = pMonitorKeyframeInterval;
+    monitorStream.setSettings(settings);
+    monitorSettingsDirty = false;
+}
+
+//--------------------------------------------------------------
+void ofApp::applyEventLogSettings(){
+    TrackEventLog::Settings settings;
+    settings.enabled = pEventLogEnabled;
+    settings.console = pEventLogConsole;
+    settings.osc = eventLogOsc;
+    settings.maxBytes = size_t(pEventLogMaxSize) << 20;
+    settings.files = pEventLogFiles;
+    if(trackEventLog.isThreadRunning()){
+        trackEventLog.setSettings(settings);
+    } else {
+        trackEventLog.setup(ofToDataPath("logs/track-events.jsonl", true), settings);
+    }
+}
+
+void ofApp::onEventLogParameterChanged(ofAbstractParameter & p){
+    applyEventLogSettings();
+}
+
+//--------------------------------------------------------------
+string ofApp::getSnapshotPath(){
+    return ofToDataPath("state/tracker.snapshot", true);
+}
+
+// processing, or with it stopped: the main tracker and the tracked volumes
+void ofApp::fillTrackerSnapshot(){
+    trackerSnapshot.clear();
+    trackerSnapshot.systemMicros = ofGetSystemTimeMicros();
+    trackerSnapshot.add(0, tracker);
+    for(size_t i = 0; i < trackingVolumes.volumes.size() && i < TrackingVolumes::maxVolumes; i++){
+        auto & v = trackingVolumes.volumes[i];
+        if(v.enabled && v.tracker) trackerSnapshot.add(uint32_t(i + 1), *v.tracker);
+    }
+}
+
+// setup, after the trackers: heads that were tracking before the restart
+// carry on from the first frame
+void ofApp::restoreTrackerSnapshot(){
+    if(!pSnapshotEnabled) return;
+    TrackerSnapshot snapshot;
+    if(!snapshot.read(getSnapshotPath())) return;
+    double age = (double(ofGetSystemTimeMicros()) - double(snapshot.systemMicros)) / 1e6;
+    if(age > pSnapshotMaxAge || age < 0){
+        ofLogNotice("TrackerSnapshot") << "Not restoring a snapshot from " << ofToString(age, 1) << "s ago";
+        return;
+    }
+    int restored = snapshot.restore(0, tracker);
+    for(size_t i = 0; i < trackingVolumes.volumes.size() && i < TrackingVolumes::maxVolumes; i++){
+        auto & v = trackingVolumes.volumes[i];
+        if(v.tracker) restored += snapshot.restore(uint32_t(i + 1), *v.tracker);
+    }
+    ofLogNotice("TrackerSnapshot") << "Restored " << restored << " heads from " << ofToString(age, 1) << "s ago";
+}
+
+// processing submits to the writer, it starts and stops between frames
+void ofApp::applySnapshotSettings(){
+    bool enabled = pSnapshotEnabled;
+    float interval = pSnapshotInterval;
+    editProcessing([this, enabled, interval]{
+        if(!enabled){
+            snapshotWriter.close();
+            return;
+        }
+        snapshotWriter.setInterval(interval);
+        if(!snapshotWriter.isThreadRunning()){
+            snapshotWriter.setup(getSnapshotPath(), trackerSnapshot.trackers.capacity(), trackerSnapshot.heads.capacity());
+        }
+    });
+}
+
+void ofApp::onSnapshotParameterChanged(ofAbstractParameter & p){
+    applySnapshotSettings();
+}
+
+//--------------------------------------------------------------
+void ofApp::onMonitorParameterChanged(ofAbstractParameter & p){
+    monitorSettingsDirty = true;
+}
+
 //--------------------------------------------------------------
 void ofApp::update(){
+    
+    updateScene();
+    
+    updateJitterBenchmark();
+    updateProcessingThread();
+    
+    if(!processing.isThreadRunning()){
+        if(player.isOpen()){
+            for(int i = 0; i < pReplayFramesPerUpdate; i++){
+                if(!processNextFrame(false)) break;
+            }
+        } else {
+            processNextFrame(false);
+        }
+    }
+}
+
+//--------------------------------------------------------------
+// GL thread, never waits for processing
+void ofApp::updateScene(){
 
+    // OSC settings changes land here, processing sees them from its next frame
+    remote.applyPending();
     
     ofVec3f position = cam.getPosition();
     ofVec3f basePosition = ofVec3f(0, 0, cam.getDistance());
@@ -200,85 +549,73 @@ void ofApp::update(){
         cam.setPosition(pTrackingBoxPosition.get().x+(pTrackingBoxSize.get().x/1.75),
                         pTrackingBoxPosition.get().y+pTrackingBoxSize.get().y,
                         (pTrackingBoxPosition.get().z+pTrackingBoxSize.get().z)*2.0);
-        cam.lookAt(tracker, glm::vec3(0.0,-1.0,0.0));
+        cam.lookAt(trackingBox, glm::vec3(0.0,-1.0,0.0));
         resetCameraPosition = false;
     }
 
     //FIXME: Glitches in update/draw using instruments?
     
-    //TRACKER
-    trackingCamera.setPosition(pTrackingCameraPosition);
-    trackingCamera.setOrientation(pTrackingCameraRotation);
-    tracker.setPosition(pTrackingBoxPosition);
-    tracker.setOrientation(pTrackingBoxRotation);
-    tracker.set(pTrackingBoxSize.get().x, pTrackingBoxSize.get().y, pTrackingBoxSize.get().z);
-    tracker.startingPoint.setGlobalPosition(pTrackingStartPosition);
-    tracker.camera.setGlobalPosition(trackingCamera.getGlobalPosition());
-    tracker.camera.setGlobalOrientation(trackingCamera.getGlobalOrientation());
-    tracker.camera.setScale(trackingCamera.getScale());
-    
-    const auto cameraGlobalMat = trackingCamera.getGlobalTransformMatrix();
-    const auto trackerInverse = glm::inverse(tracker.getGlobalTransformMatrix());
+    //CAMERA
+    float now = ofGetElapsedTimef();
     
-    if(selection){
-        
-        rs2::frameset frames;
-        
-        if(pipe.poll_for_frames(&frames)){
-            
-            // Get depth data from camera
-            auto depthFrame = frames.get_depth_frame();
-            
-            rs2::frame filteredFrame = depthFrame; // make a copy
-            // Note the concatenation of output/input frame to build up a chain
-            filteredFrame = dec_filter.process(filteredFrame);
-            filteredFrame = spat_filter.process(filteredFrame);
-            filteredFrame = temp_filter.process(filteredFrame);
-            
-            points = pc.calculate(filteredFrame);
-            
-            // Create oF mesh
-            trackingMesh.clear();
-            int n = points.size();
-            if(n>0){
-                const rs2::vertex * vs = points.get_vertices();
-                for(int i=0; i<n; i++){
-                    if(vs[i].z>0.5){ // save time on skipping the closest ones
-                        const rs2::vertex v = vs[i];
-                        glm::vec3 v3(v.x,-v.y,-v.z);
-                        glm::vec4 cameraVec(v3, 1.0);
-                        glm::vec4 globalVec = cameraGlobalMat * cameraVec;
-                        
-                        auto inversedVec = trackerInverse * globalVec;
-                        glm::vec3 trackerVec = glm::vec3(inversedVec) / inversedVec.w;
-                        
-                        if(fabs(trackerVec.x) < tracker.getWidth()/2.0 &&
-                           fabs(trackerVec.y) < tracker.getHeight()/2.0 &&
-                           fabs(trackerVec.z) < tracker.getDepth()/2.0){
-                            
-                            int wasAdded = tracker.addVertex(v3);
-                            
-                            trackingMesh.addVertex(v3);
-                            
-                            ofFloatColor c;
-                            if(wasAdded == 0){
-                                c = ofFloatColor::lightGray;
-                            } else if (wasAdded == 1){
-                                c = ofFloatColor::cyan;
-                            } else if (wasAdded == 2){
-                                c= ofFloatColor::green;
-                            } else if (wasAdded == 3){
-                                c = ofFloatColor::blueSteel;
-                            }
-                            
-                            trackingMesh.addColor(c);
-                            
-                        }
-                    }
-                }
-                tracker.update();
-            }
+    if(cameraLost.exchange(false)){
+        onCameraLost("disconnected");
+    }
+    if(cameraStarted.exchange(false)){
+        std::lock_guard<std::mutex> lock(cameraMutex);
+        lastCameraFrame = now;
+        lastFrameNumber = 0;
+        if(!replayOpen){
+            applyIntrinsics(intrinsics);
+        }
+    }
+    if(activeStreamProfile != pCameraStreamProfile){
+        requestCameraStart();
+    } else if(cameraState == CAMERA_STATE::DISCONNECTED){
+        if(cameraFound.exchange(false) || now - lastCameraAttempt > cameraRetryInterval){
+            requestCameraStart();
         }
+    } else if(cameraState == CAMERA_STATE::STREAMING && !replayOpen && now - lastCameraFrame > cameraStallTimeout){
+        // a usb glitch does not always show up as a removed device
+        onCameraLost("stalled");
+        requestCameraStart();
+    }
+    if(activeDecimation != getCloudDecimation()){
+        std::lock_guard<std::mutex> lock(cameraMutex);
+        applyIntrinsics(replayOpen ? replayIntrinsics : intrinsics);
+    }
+    
+    if(floorCalibration.hasResult()){
+        floorCalibrationResult = floorCalibration.getResult();
+        applyFloorCalibration(floorCalibrationResult);
+    }
+    
+    if(monitorSettingsDirty){
+        applyMonitorSettings();
+    }
+    
+    if(OscDestinations::anyWants(destinationSettings, OscDestination::EVENTS) != eventLogOsc){
+        eventLogOsc = !eventLogOsc;
+        applyEventLogSettings();
+    }
+    
+    //TRACKER
+    if(activeMaxHeads != pTrackingMaxHeads){
+        // the tracker starts over with the next published config
+        activeMaxHeads = pTrackingMaxHeads;
+        trackingConfigDirty = true;
+    }
+    if(trackingConfigDirty){
+        trackingConfigDirty = false;
+        publishFrameConfig();
+    }
+    
+    if(activeReplayLoop != pReplayLoop){
+        activeReplayLoop = pReplayLoop;
+        bool loop = activeReplayLoop;
+        editProcessing([this, loop]{
+            player.loop = loop;
+        });
     }
     
     float roomWidth = fmax(fabs(pWallNegXPlanePosition.get().x), fabs(pWallPosXPlanePosition.get().x)) * 2.0;
@@ -305,7 +642,327 @@ void ofApp::update(){
     backWallPlane.setGlobalPosition(pBackWallPlane);
     backWallPlane.setOrientation(glm::vec3(0.,0.,0.));
     //wallNegPlane.setResolution(2, 2);
+}
+
+//--------------------------------------------------------------
+// GL thread: a change to something processing owns, made between its frames
+void ofApp::editProcessing(std::function<void()> edit){
+    if(!processingEdits.push(std::move(edit))){
+        // the copies would differ from here on
+        ofLogError("PROCESSING") << "Too many edits waiting for processing, one was dropped";
+    }
+}
+
+// processing, or with it stopped: returns whether there were any
+bool ofApp::applyProcessingEdits(){
+    bool applied = false;
+    std::function<void()> edit;
+    while(processingEdits.pop(edit)){
+        edit();
+        applied = true;
+    }
+    return applied;
+}
+
+//--------------------------------------------------------------
+// Processes the next replay or camera frame if there is one, in update() or
+// on the processing thread. A paced replay keeps the recorded frame times
+// instead of running as fast as it is called.
+bool ofApp::processNextFrame(bool paced){
+    
+    std::unique_lock<std::mutex> lock(processingMutex);
+    
+    // what the GL thread changed, ahead of the frame and its allocation count
+    if(applyProcessingEdits()){
+        fillTrackerView(trackerViews.back());
+        trackerViews.publish();
+    }
     
+    if(player.isOpen()){
+        
+        uint64_t now = ofGetElapsedTimeMicros();
+        if(paced && now < nextReplayMicros){
+            return false;
+        }
+        
+        // counts the GCD workers of the frame too
+        // the fused filter's last frames are no use after a seek or a loop
+        if(player.getPosition() != replayNextPosition || player.getPosition() >= player.getFrameCount()){
+            fused_filter.reset();
+        }
+        AllocationCounter::beginFrame();
+        rs2::frame depthFrame = player.nextFrame();
+        replayNextPosition = player.getPosition();
+        if(!depthFrame){
+            AllocationCounter::endFrame();
+            return false;
+        }
+        Metrics::add(Metrics::FRAMES_RECEIVED);
+        processFrame(depthFrame);
+        checkFrameAllocations(AllocationCounter::endFrame());
+        
+        if(paced){
+            size_t position = player.getPosition();
+            double delta = player.getTimestamp(position) - player.getTimestamp(position - 1);
+            if(delta <= 0 || delta > 500){
+                // looping, or a gap in the recording
+                delta = 1000.0 / std::max(1, player.getFps());
+            }
+            // keep the cadence, but do not try to catch up after a stall
+            nextReplayMicros = std::max(nextReplayMicros + uint64_t(delta * 1000.0), now);
+        }
+        return true;
+    }
+    
+    lock.unlock();
+    
+    if(cameraState != CAMERA_STATE::STREAMING){
+        return false;
+    }
+    
+    rs2::frameset frames;
+    bool newFrames = false;
+    
+    {
+        // skip this round rather than wait for a restart in progress
+        std::unique_lock<std::mutex> cameraLock(cameraMutex, std::try_to_lock);
+        newFrames = cameraLock && selection && pipe.poll_for_frames(&frames);
+    }
+    
+    if(!newFrames){
+        return false;
+    }
+    
+    float now = ofGetElapsedTimef();
+    lastCameraFrame = now;
+    if(cameraLostTime >= 0){
+        float recovery = now - cameraLostTime;
+        cameraRecoveryDuration = recovery;
+        cameraLostTime = -1;
+        ofLogNotice("CAMERA") << "Recovered after " << recovery << "s";
+    }
+    
+    lock.lock();
+    
+    // the replay may have been opened meanwhile
+    if(player.isOpen()){
+        return false;
+    }
+    
+    // Get depth data from camera
+    auto depthFrame = frames.get_depth_frame();
+    
+    Metrics::add(Metrics::FRAMES_RECEIVED);
+    uint64_t frameNumber = depthFrame.get_frame_number();
+    if(lastFrameNumber > 0 && frameNumber == lastFrameNumber){
+        Metrics::add(Metrics::FRAMES_DUPLICATE);
+        return false;
+    }
+    if(lastFrameNumber > 0 && frameNumber > lastFrameNumber + 1){
+        Metrics::add(Metrics::FRAMES_DROPPED, frameNumber - lastFrameNumber - 1);
+    }
+    lastFrameNumber = frameNumber;
+    
+    if(recorder.isRecording()){
+        recorder.addFrame(depthFrame);
+    }
+    
+    processFrame(depthFrame);
+    return true;
+}
+
+//--------------------------------------------------------------
+// starts and stops the processing thread as the parameters ask
+void ofApp::updateProcessingThread(){
+    
+    if(benchmarkPhase != BENCHMARK::IDLE) return;
+    
+    int mode = pProcessingThread ? (pProcessingRealtime ? 2 : 1) : 0;
+    if(mode == activeProcessingMode) return;
+    activeProcessingMode = mode;
+    
+    if(mode == 0){
+        processing.stop();
+        ofLogNotice("PROCESSING") << "Processing in update()";
+    } else {
+        startProcessingThread(mode == 2);
+    }
+}
+
+void ofApp::startProcessingThread(bool realtime){
+    
+    RealtimeProfile profile;
+    profile.core = pProcessingCore;
+    profile.priority = pProcessingPriority;
+    profile.lockMemory = pProcessingLockMemory;
+    {
+        std::lock_guard<std::mutex> lock(processingMutex);
+        StreamProfile stream = streamProfiles[ofClamp(activeStreamProfile, 0, int(streamProfiles.size())-1)];
+        int fps = player.isOpen() ? player.getFps() : stream.fps;
+        profile.period = 1.0 / std::max(1, fps);
+        // half the frame for processing, the rest is slack for the OS
+        profile.computation = profile.period / 2.0;
+        nextReplayMicros = 0;
+        // the profile wires the buffers again, sized for this stream if no frame did yet
+        frameBuffersWired = false;
+        realtimeCloudSize = player.isOpen() ? getCloudSize(player.getIntrinsics().width, player.getIntrinsics().height) : getCloudSize(stream.width, stream.height);
+    }
+    
+    processing.start(realtime, profile);
+    ofLogNotice("PROCESSING") << "Processing on its own thread" << (realtime ? " with the real-time profile" : "");
+}
+
+//--------------------------------------------------------------
+// Replays the open recording from the start twice, on the processing thread
+// without and then with the real-time profile, and compares the intervals
+// between OSC sends. Run it on the show machine, the numbers depend on it.
+void ofApp::startJitterBenchmark(){
+    
+    benchmarkRequested = false;
+    if(!replayOpen || benchmarkPhase != BENCHMARK::IDLE) return;
+    
+    benchmarkBaseline = IntervalStats();
+    benchmarkRealtime = IntervalStats();
+    
+    // a real-time thread unlocks the memory as it stops, the baseline runs
+    // before anything is locked again
+    processing.stop();
+    player.seek(0);
+    sendIntervals.reset();
+    startProcessingThread(false);
+    benchmarkPhase = BENCHMARK::BASELINE;
+    benchmarkPhaseStart = ofGetElapsedTimef();
+    ofLogNotice("BENCHMARK") << "Jitter benchmark, " << pBenchmarkDuration << "s without the real-time profile";
+}
+
+void ofApp::updateJitterBenchmark(){
+    
+    if(benchmarkRequested){
+        startJitterBenchmark();
+    }
+    if(benchmarkPhase == BENCHMARK::IDLE) return;
+    
+    if(!replayOpen){
+        ofLogWarning("BENCHMARK") << "Replay closed, benchmark cancelled";
+    } else if(ofGetElapsedTimef() - benchmarkPhaseStart < pBenchmarkDuration){
+        return;
+    } else if(benchmarkPhase == BENCHMARK::BASELINE){
+        processing.stop();
+        benchmarkBaseline = sendIntervals.getStats();
+        ofLogNotice("BENCHMARK") << "Without profile: " << benchmarkBaseline.toString();
+        
+        {
+            std::lock_guard<std::mutex> lock(processingMutex);
+            player.seek(0);
+        }
+        sendIntervals.reset();
+        startProcessingThread(true);
+        benchmarkPhase = BENCHMARK::REALTIME;
+        benchmarkPhaseStart = ofGetElapsedTimef();
+        ofLogNotice("BENCHMARK") << pBenchmarkDuration << "s with the real-time profile (" << processing.getReport() << ")";
+        return;
+    } else {
+        processing.stop();
+        benchmarkRealtime = sendIntervals.getStats();
+        ofLogNotice("BENCHMARK") << "With profile:    " << benchmarkRealtime.toString();
+    }
+    
+    processing.stop();
+    benchmarkPhase = BENCHMARK::IDLE;
+    // back to what the parameters ask for
+    activeProcessingMode = 0;
+}
+
+//--------------------------------------------------------------
+// GL thread, after a tracking parameter changed
+void ofApp::publishFrameConfig(){
+    
+    trackingCamera.setPosition(pTrackingCameraPosition);
+    trackingCamera.setOrientation(pTrackingCameraRotation);
+    trackingBox.setPosition(pTrackingBoxPosition);
+    trackingBox.setOrientation(pTrackingBoxRotation);
+    
+    TrackerFrameConfig config;
+    config.version = ++frameConfigVersion;
+    config.cameraToGlobal = trackingCamera.getGlobalTransformMatrix();
+    config.cameraToBox = glm::inverse(trackingBox.getGlobalTransformMatrix()) * config.cameraToGlobal;
+    config.halfExtents = pTrackingBoxSize.get() / 2.0f;
+    config.cameraPosition = trackingCamera.getGlobalPosition();
+    config.cameraOrientation = trackingCamera.getGlobalOrientation();
+    config.cameraScale = trackingCamera.getScale();
+    config.startPosition = pTrackingStartPosition;
+    config.focalArea = cloudFocalArea;
+    config.coarseToFine = pTrackingCoarseToFine;
+    config.fineDecimation = pTrackingFineDecimation;
+    config.buildMesh = pTrackingVisible;
+    config.fixedKernels = pTrackingFixedKernels;
+    config.fusedFilter = pCameraFusedFilter;
+    frameConfigs.publish(config);
+    
+    // the trackers are processing's, their boxes, the head budget and the
+    // volumes follow at the next frame boundary
+    int maxHeads = activeMaxHeads;
+    glm::vec3 boxPosition = pTrackingBoxPosition;
+    glm::vec3 boxRotation = pTrackingBoxRotation;
+    glm::vec3 boxSize = pTrackingBoxSize;
+    editProcessing([this, config, maxHeads, boxPosition, boxRotation, boxSize]{
+        ofNode camera;
+        camera.setGlobalPosition(config.cameraPosition);
+        camera.setGlobalOrientation(config.cameraOrientation);
+        camera.setScale(config.cameraScale);
+        if(tracker.maxHeads != maxHeads){
+            // starts over with all heads ready, ending the tracks and zone visits there were
+            tracker.setup(maxHeads, config.startPosition, camera, origin);
+            zones.exitAll(tracker.lastTimestamp);
+        }
+        tracker.setPosition(boxPosition);
+        tracker.setOrientation(boxRotation);
+        if(tracker.getWidth() != boxSize.x || tracker.getHeight() != boxSize.y || tracker.getDepth() != boxSize.z){
+            tracker.set(boxSize.x, boxSize.y, boxSize.z);
+        }
+        trackingVolumes.update(config, camera, origin);
+    });
+}
+
+void ofApp::onTrackingParameterChanged(ofAbstractParameter & p){
+    trackingConfigDirty = true;
+}
+
+//--------------------------------------------------------------
+void ofApp::processFrame(rs2::frame depthFrame){
+    
+    // one consistent view of the settings for the whole frame
+    const TrackerFrameConfig config = frameConfigs.read();
+    tracker.applyConfig(config);
+    
+    uint64_t stageStart = ofGetElapsedTimeMicros();
+    auto endStage = [&stageStart](Metrics::COUNTER stage){
+        uint64_t now = ofGetElapsedTimeMicros();
+        Metrics::add(stage, now - stageStart);
+        stageStart = now;
+    };
+    
+    rs2::frame filteredFrame = depthFrame; // make a copy
+    if(config.fusedFilter != fusedFilterActive){
+        // switched back on, the frames it remembers are old
+        fusedFilterActive = config.fusedFilter;
+        fused_filter.reset();
+    }
+    if(config.fusedFilter){
+        filteredFrame = fused_filter.process(filteredFrame);
+    } else {
+        // Note the concatenation of output/input frame to build up a chain
+        filteredFrame = dec_filter.process(filteredFrame);
+        filteredFrame = spat_filter.process(filteredFrame);
+        filteredFrame = temp_filter.process(filteredFrame);
+    }
+    
+    points = pc.calculate(filteredFrame);
+    endStage(Metrics::FILTER_MICROS);
+    
+    if(floorCalibrationRequested.exchange(false)){
+        floorCalibration.start(points, config.cameraOrientation);
+    }
     
     // Create oF mesh
     trackingMesh.clear();
@@ -314,103 +971,202 @@ void ofApp::update(){
         
         const rs2::vertex * vs = points.get_vertices();
         
-        bool vertsActive[ n ];
-        bool *vertsActivePointer = vertsActive;
+        // The crop writes the points it keeps straight into the quantised
+        // cloud. Chunks are filled in parallel, each from its own start.
+        const size_t chunkSize = cropChunkSize;
+        const size_t chunks = (n + chunkSize - 1) / chunkSize;
+        vertsActive.resize(n);
+        quantisedCloud.resize(chunks * chunkSize);
+        cropChunkCounts.resize(chunks);
+        uint8_t *vertsActivePointer = vertsActive.data();
+        int16_t *qx = quantisedCloud.x.data();
+        int16_t *qy = quantisedCloud.y.data();
+        int16_t *qz = quantisedCloud.z.data();
+        size_t *chunkCounts = cropChunkCounts.data();
+        const size_t volumeCount = trackingVolumes.prepareCrop(chunks, chunkSize);
+        TrackingVolumes::Crop * volumeCrops = trackingVolumes.getCrops();
         
-        dispatch_apply(n, cropVerticesQueue, ^(size_t i) {
-            
-            const rs2::vertex & v = vs[i];
+        dispatch_apply(chunks, cropVerticesQueue, ^(size_t chunk) {
+            AllocationCounter::Worker worker;
             
-            vertsActivePointer[i] = false;
+            size_t begin = chunk * chunkSize;
+            size_t end = std::min(size_t(n), begin + chunkSize);
+            size_t volumeK[TrackingVolumes::maxVolumes] = {};
             
-            if(v.z>0.5){ // save time on skipping the closest ones
-                
-                glm::vec3 v3(v.x,-v.y,-v.z);
-                glm::vec4 cameraVec(v3, 1.0);
-                glm::vec4 globalVec = cameraGlobalMat * cameraVec;
-                
-                auto inversedVec = trackerInverse * globalVec;
-                glm::vec3 trackerVec = glm::vec3(inversedVec) / inversedVec.w;
-                
-                if(fabs(trackerVec.x) < tracker.getWidth()/2.0 &&
-                   fabs(trackerVec.y) < tracker.getHeight()/2.0 &&
-                   fabs(trackerVec.z) < tracker.getDepth()/2.0){
-                    vertsActivePointer[i] = true;
+            chunkCounts[chunk] = TrackingVolumes::cropChunk(vs, begin, end, config, qx, qy, qz, vertsActivePointer,
+                                                            volumeCrops, volumeCount, volumeK);
+            for(size_t j = 0; j < volumeCount; j++){
+                volumeCrops[j].chunkCounts[chunk] = volumeK[j];
+            }
+        });
+        endStage(Metrics::CROP_MICROS);
+        
+        size_t cropped = 0;
+        for(size_t chunk = 0; chunk < chunks; chunk++){
+            cropped += cropChunkCounts[chunk];
+        }
+        
+        // drive the tracker by the capture time, not by the render loop
+        double timestamp = depthFrame.get_timestamp() / 1000.0;
+        
+        // the volumes are tracked to the end while the main tracker takes its points
+        MeshTracker * mainTracker = &tracker;
+        uint8_t * categories = quantisedCloud.category.data();
+        TrackingVolumes * volumes = &trackingVolumes;
+        dispatch_apply(1 + volumeCount, cropVerticesQueue, ^(size_t j) {
+            AllocationCounter::Worker worker;
+            if(j == 0){
+                for(size_t chunk = 0; chunk < chunks; chunk++){
+                    size_t begin = chunk * chunkSize;
+                    mainTracker->addPoints(qx + begin, qy + begin, qz + begin, categories + begin, chunkCounts[chunk]);
                 }
+            } else {
+                volumes->track(j - 1, chunks, chunkSize, timestamp);
             }
         });
-                
-        for(int i=0; i<n; i++){
-            
-            const rs2::vertex & v = vs[i];
-            
-            glm::vec3 v3(v.x,-v.y,-v.z);
-            
-            ofFloatColor c(0.0,64.0);
+        
+        if(config.buildMesh){
             
-            if(vertsActive[i]){
+            for(size_t chunk = 0; chunk < chunks; chunk++){
                 
-                int wasAdded = tracker.addVertex(v3);
+                size_t begin = chunk * chunkSize;
+                // shell and floor line only matter for the colours
+                tracker.labelPoints(qx + begin, qy + begin, qz + begin, quantisedCloud.category.data() + begin, cropChunkCounts[chunk]);
                 
-                if(wasAdded == 0){
-                    c = ofFloatColor::lightGray;
-                } else if (wasAdded == 1){
-                    c = ofFloatColor::cyan;
-                } else if (wasAdded == 2){
-                    c= ofFloatColor::green;
-                } else if (wasAdded == 3){
-                    c = ofFloatColor::blueSteel;
-                }
+                size_t end = std::min(size_t(n), begin + chunkSize);
+                size_t k = begin;
                 
+                for(size_t i = begin; i < end; i++){
+                    
+                    const rs2::vertex & v = vs[i];
+                    
+                    ofFloatColor c(0.0,64.0);
+                    
+                    if(vertsActive[i]){
+                        
+                        int wasAdded = categories[k++];
+                        
+                        if(wasAdded == 0){
+                            c = ofFloatColor::lightGray;
+                        } else if (wasAdded == 1){
+                            c = ofFloatColor::cyan;
+                        } else if (wasAdded == 2){
+                            c= ofFloatColor::green;
+                        } else if (wasAdded == 3){
+                            c = ofFloatColor::blueSteel;
+                        }
+                        
+                    }
+                    
+                    trackingMesh.addVertex(glm::vec3(v.x,-v.y,-v.z));
+                    trackingMesh.addColor(c);
+                }
+            }
+        }
+        
+        if(config.coarseToFine){
+            rs2::frame fineFrame = depthFrame;
+            if(activeFineDecimation != config.fineDecimation){
+                activeFineDecimation = config.fineDecimation;
+                fine_dec_filter.set_option(RS2_OPTION_FILTER_MAGNITUDE, activeFineDecimation);
             }
-            
-            trackingMesh.addVertex(v3);
-            trackingMesh.addColor(c);
-            
+            if(activeFineDecimation > 1){
+                fineFrame = fine_dec_filter.process(fineFrame);
+            }
+            auto fineDepth = fineFrame.as<rs2::video_frame>();
+            auto fineIntrinsics = fineDepth.get_profile().as<rs2::video_stream_profile>().get_intrinsics();
+            tracker.refine((const uint16_t *) fineDepth.get_data(),
+                           fineDepth.get_width(), fineDepth.get_height(),
+                           fineDepth.get_stride_in_bytes() / sizeof(uint16_t),
+                           fineIntrinsics, player.isOpen() ? player.getDepthScale() : depthScale);
+        }
+        
+        Metrics::add(Metrics::POINTS_IN, n);
+        Metrics::add(Metrics::POINTS_CROPPED, cropped);
+        Metrics::setHeadCount(int(tracker.heads.size()));
+        for(size_t i = 0; i < tracker.heads.size(); i++){
+            // the seed point is not a point on the head
+            Metrics::setHeadPoints(int(i), tracker.heads[i].trackPointCount - 1);
         }
         
+        tracker.update(timestamp);
         
+        zones.update(tracker.heads, timestamp);
         
-        tracker.update();
-        // OSC
-        if(oscTrackingSender.getHost() != pOscTrackingRemoteHost.get() ||
-           oscTrackingSender.getPort() != pOscTrackingRemotePort.get()
-           ){
-            //cout << "setting oscTrackingSender ";
-            oscTrackingSender.clear();
-            oscTrackingSender.setup(pOscTrackingRemoteHost.get(), pOscTrackingRemotePort.get());
-            //cout << oscTrackingSender.getHost() << ":";
-            //cout << oscTrackingSender.getPort() << endl;
+        for(size_t i = 0; i < tracker.heads.size(); i++){
+            Metrics::setHeadState(int(i), int(tracker.heads[i].state));
         }
+        endStage(Metrics::TRACK_MICROS);
         
-        //osc
+        oscHeadSets.clear();
+        oscHeadSets.push_back({&mainOscPrefix, &tracker.heads});
+        trackingVolumes.addHeadSets(oscHeadSets);
+        oscDestinations.send(oscHeadSets, timestamp);
+        // lifecycle events the log writer encoded by now
+        while(trackEventLog.popPacket(trackEventPacket)){
+            oscDestinations.sendPacket(OscDestination::EVENTS, trackEventPacket.data, trackEventPacket.size);
+        }
+        sendIntervals.record(ofGetElapsedTimeMicros());
+        endStage(Metrics::SEND_MICROS);
+        Metrics::add(Metrics::FRAMES_PROCESSED);
         
-        for (auto & head : tracker.heads) {
-            if(head.isTrackingOrLost()){
-                
-                //OSC sending head position
-                auto headPosCoord = head.getGlobalPosition();
-
-                ofxOscMessage oscMessage;
-                
-                //int idAddress = head.id;
-                string idAddress = ofToString(head.id);
-                oscMessage.setAddress("/tracker/"+idAddress+"/head/position");
-                oscMessage.addFloatArg(headPosCoord.x);
-                oscMessage.addFloatArg(headPosCoord.y);
-                oscMessage.addFloatArg(headPosCoord.z);
-                oscTrackingSender.sendMessage(oscMessage);
-
-                oscMessage.setAddress("/tracker/"+idAddress+"/floor/position");
-                oscMessage.addFloatArg(headPosCoord.x);
-                oscMessage.addFloatArg(0.0);
-                oscMessage.addFloatArg(headPosCoord.z);
-                oscTrackingSender.sendMessage(oscMessage);
-
+        // after OSC is out, the stream encodes on its own thread
+        uint64_t nowMicros = ofGetElapsedTimeMicros();
+        if(monitorStream.wantsFrame(nowMicros)){
+            monitorFrame.clear();
+            monitorFrame.frameNumber = uint32_t(depthFrame.get_frame_number());
+            size_t budget = std::max<size_t>(1, monitorStream.getPointBudget());
+            size_t stride = std::max<size_t>(1, (cropped + budget - 1) / budget);
+            size_t j = 0;
+            for(size_t chunk = 0; chunk < chunks; chunk++){
+                size_t begin = chunk * chunkSize;
+                for(size_t k = begin; k < begin + cropChunkCounts[chunk]; k++, j++){
+                    if(j % stride == 0) monitorFrame.addPoint(qx[k], qy[k], qz[k]);
+                }
             }
-            
+            for(auto & head : tracker.heads){
+                glm::vec3 p = head.getPosition();
+                monitorFrame.heads.push_back({uint8_t(head.id), uint8_t(head.state),
+                    QuantisedPoints::quantise(p.x), QuantisedPoints::quantise(p.y), QuantisedPoints::quantise(p.z)});
+            }
+            monitorStream.submit(monitorFrame, nowMicros);
         }
+        
+        // a replay is not where the performers are
+        if(snapshotWriter.wantsSnapshot(nowMicros) && !player.isOpen()){
+            fillTrackerSnapshot();
+            snapshotWriter.submit(trackerSnapshot, nowMicros);
+        }
+    }
+    
+    {
+        // draw() only waits for the swap, not for the frame
+        std::lock_guard<std::mutex> lock(displayMutex);
+        displayMesh.getVertices().swap(trackingMesh.getVertices());
+        displayMesh.getColors().swap(trackingMesh.getColors());
+    }
+    
+    // and the heads, zones and counters the same way
+    fillTrackerView(trackerViews.back());
+    trackerViews.publish();
+}
+
+// processing, or with it stopped
+void ofApp::fillTrackerView(TrackerView & view){
+    view.clear();
+    view.addTracker(&tracker, true);
+    for(size_t i = 0; i < trackingVolumes.volumes.size() && i < TrackingVolumes::maxVolumes; i++){
+        auto & v = trackingVolumes.volumes[i];
+        view.addTracker(v.tracker.get(), v.enabled);
+    }
+    for(size_t i = 0; i < zones.zones.size(); i++){
+        view.zonesOccupied.push_back(zones.isOccupied(i));
     }
+    for(auto & d : oscDestinations.destinations){
+        view.destinations.push_back({d.packetsSent, d.messagesSent, d.messagesSuppressed});
+    }
+    view.replayPosition = player.getPosition();
+    view.monitorStreaming = monitorStream.isStreaming();
 }
 
 
@@ -423,6 +1179,9 @@ void ofApp::draw(){
     
     ofBackground(33);
     
+    // the newest heads and zones processing published, the GUI shows the same
+    trackerViews.update();
+    
     cam.begin(); {
         
         //ofScale(ofGetWidth());  //1024 pixels
@@ -450,12 +1209,17 @@ void ofApp::draw(){
         if(pTrackingVisible){
             ofDisableDepthTest();
             trackingCamera.transformGL();
-            trackingMesh.draw();
+            {
+                std::lock_guard<std::mutex> lock(displayMutex);
+                displayMesh.draw();
+            }
             trackingCamera.restoreTransformGL();
             ofEnableDepthTest();
             trackingCamera.drawFrustum();
         }
-        tracker.draw();
+        
+        trackerViews.draw();
+        TriggerZones::draw(zoneSettings, trackerViews.front().zonesOccupied);
         
     } cam.end();
     
@@ -537,15 +1301,180 @@ void ofApp::dragEvent(ofDragInfo dragInfo){
     
 }
 
+// from the GL thread's copy of the settings
 void ofApp::save(string name){
     ofJson j;
     ofSerialize(j, pgRoot);
+    j["Zones"] = ofJson::array();
+    for(auto & zone : zoneSettings){
+        j["Zones"].push_back(zone.toJson());
+    }
+    j["OSC_Destinations"] = ofJson::array();
+    for(auto & d : destinationSettings){
+        j["OSC_Destinations"].push_back(d.toJson());
+    }
+    j["Tracking_Volumes"] = ofJson::array();
+    for(auto & v : volumeSettings){
+        j["Tracking_Volumes"].push_back(v.toJson());
+    }
     ofSaveJson("settings/" + name + ".json", j);
 }
 
+// into the GL thread's copy, processing replaces its own at the next frame boundary
 void ofApp::load(string name){
     ofJson j = ofLoadJson("settings/" + name + ".json");
     ofDeserialize(j, pgRoot);
+    
+    ofJson zonesJson = j.value("Zones", ofJson::array());
+    zoneSettings.clear();
+    for(auto & zj : zonesJson){
+        zoneSettings.emplace_back();
+        zoneSettings.back().fromJson(zj);
+    }
+    
+    ofJson destinationsJson = j.value("OSC_Destinations", ofJson::array());
+    if(j.find("OSC_Destinations") == j.end()){
+        // settings from before destinations had a single tracking target, which always sent
+        OscDestination d;
+        d.name = "Tracking";
+        try{
+            auto & t = j.at("Settings").at("OSC").at("Tracking");
+            d.host = t.value("Remote_Host", d.host);
+            d.port = ofToInt(t.value("Remote_Port", ofToString(d.port)));
+        }catch(...){}
+        destinationsJson.push_back(d.toJson());
+    }
+    destinationSettings.clear();
+    for(auto & dj : destinationsJson){
+        destinationSettings.emplace_back();
+        destinationSettings.back().fromJson(dj);
+    }
+    
+    ofJson volumesJson = j.value("Tracking_Volumes", ofJson::array());
+    volumeSettings.clear();
+    for(auto & vj : volumesJson){
+        volumeSettings.emplace_back();
+        volumeSettings.back().fromJson(vj);
+    }
+    
+    editProcessing([this, zonesJson, destinationsJson, volumesJson]{
+        zones.exitAll(tracker.lastTimestamp);
+        zones.fromJson(zonesJson);
+        oscDestinations.fromJson(destinationsJson);
+        trackingVolumes.fromJson(volumesJson);
+    });
+    trackingConfigDirty = true;
+}
+
+void ofApp::onZoneEvent(TriggerZoneEvent & e){
+    
+    string zoneAddress = e.zone->name;
+    ofStringReplace(zoneAddress, " ", "_");
+    
+    oscDestinations.sendEvent(OscDestination::ZONES, "/zone/" + zoneAddress + "/" + e.getTypeName(), e.headId, e.duration);
+    
+    const string & cue = e.type == TriggerZoneEvent::TYPE::ENTER ? e.zone->qLabEnterCue :
+                         e.type == TriggerZoneEvent::TYPE::EXIT ? e.zone->qLabExitCue : e.zone->qLabDwellCue;
+    if(!cue.empty()){
+        qLab.startCue(cue);
+    }
+    
+    ofLogVerbose("ZONE") << e.zone->name << " " << e.getTypeName() << " " << e.headId;
+}
+
+void ofApp::applyFloorCalibration(const FloorCalibration::Result & result){
+    if(!result.valid){
+        ofLogWarning("CALIBRATION") << "No floor found";
+        return;
+    }
+    
+    // the floor is y = 0 in the origin frame, which is also where heads project to
+    ofNode levelled;
+    levelled.setOrientation(FloorCalibration::level(trackingCamera.getOrientationQuat(), result.normal));
+    pTrackingCameraRotation.set(levelled.getOrientationEulerDeg());
+    
+    glm::vec3 position = pTrackingCameraPosition.get();
+    position.y = result.height;
+    pTrackingCameraPosition.set(position);
+    
+    glm::vec3 floorPosition = pFloorPlanePosition.get();
+    floorPosition.y = 0;
+    pFloorPlanePosition.set(floorPosition);
+    
+    ofLogNotice("CALIBRATION") << "Camera at " << result.height << "m, rotation " << pTrackingCameraRotation.get()
+    << " (" << int(result.inlierRatio * 100) << "% floor, " << result.duration * 1000.0 << "ms)";
+}
+
+void ofApp::checkFrameAllocations(size_t allocations){
+#ifdef TRACKER_COUNT_ALLOCATIONS
+    // the first frames size buffers, fill librealsense's frame pools and meet every head
+    if(player.getPosition() == 1){
+        replayFramesChecked = 0;
+    }
+    // fatal in release builds too, the define is what asks for the check
+    if(++replayFramesChecked > allocationWarmupFrames && allocations > 0){
+        ofLogFatalError("ALLOCATIONS") << allocations << " heap allocations in replayed frame " << player.getPosition()
+        << ", " << replayFramesChecked << " frames after the start";
+        std::abort();
+    }
+#endif
+}
+
+// A few seconds of work, off the GL thread and without processingMutex: the
+// benchmark builds trackers of its own
+void ofApp::startKernelBenchmark(){
+    if(kernelBenchmarkRunning.exchange(true)) return;
+    dispatch_async(kernelBenchmarkQueue, ^{
+        vector<QuantisedPoints::BenchmarkResult> results;
+        for(int heads : {3, 5, 8, 16}){
+            results.push_back(MeshTracker::benchmark(heads, 20));
+        }
+        {
+            std::lock_guard<std::mutex> lock(kernelBenchmarkMutex);
+            kernelBenchmark = results;
+        }
+        kernelBenchmarkRunning = false;
+    });
+}
+
+// Recording and replay are commands rather than settings, they wait for the
+// frame in progress and take processingMutex only for as long as they run.
+void ofApp::startRecording(){
+    std::lock_guard<std::mutex> lock(cameraMutex);
+    ofDirectory::createDirectory(pRecordingFolder.get(), true, true);
+    string path = ofToDataPath(pRecordingFolder.get() + "/" + ofGetTimestampString("%Y-%m-%d-%H-%M-%S") + ".rsdepth", true);
+    std::lock_guard<std::mutex> processingLock(processingMutex);
+    recorder.open(path, intrinsics, depthScale, pRecordingCompression);
+}
+
+void ofApp::stopRecording(){
+    if(!recorder.isRecording()) return;
+    std::lock_guard<std::mutex> lock(processingMutex);
+    recorder.close();
+}
+
+void ofApp::openReplay(string path){
+    {
+        std::lock_guard<std::mutex> lock(processingMutex);
+        player.open(ofToDataPath(path, true));
+        replayOpen = player.isOpen();
+        if(!replayOpen) return;
+        replayFrameCount = player.getFrameCount();
+        replayIntrinsics = player.getIntrinsics();
+    }
+    pReplayFile.set(path);
+    applyIntrinsics(replayIntrinsics);
+}
+
+void ofApp::closeReplay(){
+    {
+        std::lock_guard<std::mutex> lock(processingMutex);
+        player.close();
+        replayOpen = false;
+    }
+    lastCameraFrame = ofGetElapsedTimef();
+    std::lock_guard<std::mutex> lock(cameraMutex);
+    applyIntrinsics(intrinsics);
 }
 
 bool ofApp::imGui()
@@ -554,6 +1483,11 @@ bool ofApp::imGui()
     
     auto mainSettings = ofxImGui::Settings();
     
+    // Zones, destinations and volumes are edited in the GL thread's copy,
+    // each edit goes to processing's own as the settings half of the item,
+    // its runtime half stays. What processing knows comes from the view.
+    const TrackerView & view = trackerViews.front();
+    
     ofDisableDepthTest();
     
     this->gui.begin();
@@ -582,9 +1516,17 @@ bool ofApp::imGui()
             ImGui::Columns(1);
             
 
-            if(!selection){
-                ImGui::Separator();
-                ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "CONNECT CAMERA AND RESTART APP");
+            if(!replayOpen){
+                if(cameraState == CAMERA_STATE::DISCONNECTED){
+                    ImGui::Separator();
+                    ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "NO CAMERA, WAITING FOR CONNECTION");
+                } else if(cameraState == CAMERA_STATE::CONNECTING){
+                    ImGui::Separator();
+                    ImGui::TextColored(ImVec4(1.0f, 0.7f, 0.0f, 1.0f), "CONNECTING CAMERA");
+                }
+            }
+            if(cameraRecoveryDuration >= 0){
+                ImGui::Text("Last camera recovery %.2fs", cameraRecoveryDuration.load());
             }
 
             ImGui::Separator();
@@ -609,23 +1551,87 @@ bool ofApp::imGui()
             
             if(ofxImGui::BeginTree("Head Tracker OSC", mainSettings)){
                 
-                ImGui::Columns(2, "HeadTrackerOSCColumns", false);
+                int removeDestination = -1;
                 
-                string strHost = pOscTrackingRemoteHost.get();
-                if(ImGui::InputTextFromString("Remote Host", strHost, ImGuiInputTextFlags_CharsNoBlank)){
-                    pOscTrackingRemoteHost.set(strHost);
+                for(size_t i = 0; i < destinationSettings.size(); i++){
+                    auto & d = destinationSettings[i];
+                    ImGui::PushID(int(i));
+                    
+                    bool edited = ImGui::Checkbox("##enabled", &d.enabled);
+                    ImGui::SameLine();
+                    if(ImGui::TreeNode("destination", "%s  %s:%d", d.name.c_str(), d.host.c_str(), d.port)){
+                        
+                        edited |= ImGui::InputTextFromString("Name", d.name);
+                        
+                        ImGui::Columns(2, "HeadTrackerOSCColumns", false);
+                        
+                        edited |= ImGui::InputTextFromString("Remote Host", d.host, ImGuiInputTextFlags_CharsNoBlank);
+                        
+                        ImGui::SetColumnOffset(1, ImGui::GetWindowContentRegionMax().x - columnOffset);
+                        
+                        ImGui::NextColumn();
+                        
+                        string strPort = ofToString(d.port);
+                        if(ImGui::InputTextFromString("Remote Port", strPort, ImGuiInputTextFlags_CharsDecimal)){
+                            d.port = ofToInt(strPort);
+                            edited = true;
+                        }
+                        
+                        ImGui::Columns(1);
+                        
+                        edited |= ImGui::SliderFloat("Rate", &d.rate, 0.0, 120.0, d.rate > 0 ? "%.0f Hz" : "every frame");
+                        edited |= ImGui::SliderFloat("Dead Band", &d.deadBand, 0.0, 0.5, "%.3f m");
+                        
+                        edited |= ImGui::CheckboxFlags("Head", (unsigned int*) &d.fields, OscDestination::HEAD); ImGui::SameLine();
+                        edited |= ImGui::CheckboxFlags("Floor", (unsigned int*) &d.fields, OscDestination::FLOOR); ImGui::SameLine();
+                        edited |= ImGui::CheckboxFlags("Velocity", (unsigned int*) &d.fields, OscDestination::VELOCITY);
+                        edited |= ImGui::CheckboxFlags("State", (unsigned int*) &d.fields, OscDestination::STATE); ImGui::SameLine();
+                        edited |= ImGui::CheckboxFlags("Zones", (unsigned int*) &d.fields, OscDestination::ZONES); ImGui::SameLine();
+                        edited |= ImGui::CheckboxFlags("Shape", (unsigned int*) &d.fields, OscDestination::SHAPE); ImGui::SameLine();
+                        edited |= ImGui::CheckboxFlags("Events", (unsigned int*) &d.fields, OscDestination::EVENTS);
+                        
+                        if(i < view.destinations.size()){
+                            auto & sent = view.destinations[i];
+                            ImGui::Text("%llu packets, %llu messages, %llu suppressed",
+                                        (unsigned long long) sent.packetsSent,
+                                        (unsigned long long) sent.messagesSent,
+                                        (unsigned long long) sent.messagesSuppressed);
+                        }
+                        
+                        if(ImGui::Button("Remove Destination")){
+                            removeDestination = int(i);
+                        }
+                        
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                    
+                    if(edited){
+                        ofJson j = d.toJson();
+                        editProcessing([this, i, j]{
+                            if(i < oscDestinations.destinations.size()) oscDestinations.destinations[i].fromJson(j);
+                        });
+                    }
                 }
                 
-                ImGui::SetColumnOffset(1, ImGui::GetWindowContentRegionMax().x - columnOffset);
-                
-                ImGui::NextColumn();
-                
-                string strPort = ofToString(pOscTrackingRemotePort.get());
-                if(ImGui::InputTextFromString("Remote Port", strPort, ImGuiInputTextFlags_CharsDecimal)){
-                    pOscTrackingRemotePort.set(ofToInt(string(strPort)));
+                if(ImGui::Button("Add Destination")){
+                    OscDestination d;
+                    d.name = "destination " + ofToString(destinationSettings.size()+1);
+                    destinationSettings.push_back(d);
+                    ofJson j = d.toJson();
+                    editProcessing([this, j]{
+                        oscDestinations.destinations.emplace_back();
+                        oscDestinations.destinations.back().fromJson(j);
+                    });
                 }
                 
-                ImGui::Columns(1);
+                if(removeDestination >= 0){
+                    destinationSettings.erase(destinationSettings.begin() + removeDestination);
+                    size_t i = removeDestination;
+                    editProcessing([this, i]{
+                        if(i < oscDestinations.destinations.size()) oscDestinations.destinations.erase(oscDestinations.destinations.begin() + i);
+                    });
+                }
                 
                 ofxImGui::EndTree(mainSettings);
             }
@@ -663,9 +1669,432 @@ bool ofApp::imGui()
                 
                 ImGui::Columns(1);
                 
+                if(ImGui::Button("Connect")){
+                    // zone events start cues from processing
+                    string host = pOscQlabRemoteHost;
+                    int port = pOscQlabRemotePort;
+                    int replyPort = pOscQlabReplyPort;
+                    editProcessing([this, host, port, replyPort]{
+                        qLab.setup(host, port, replyPort);
+                    });
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Trigger Zones", mainSettings)){
+                
+                int removeZone = -1;
+                
+                for(size_t i = 0; i < zoneSettings.size(); i++){
+                    auto & zone = zoneSettings[i];
+                    ImGui::PushID(int(i));
+                    
+                    bool edited = false;
+                    bool moved = false;
+                    if(i < view.zonesOccupied.size() && view.zonesOccupied[i]){
+                        ImGui::TextColored(ImVec4(1.0,0.5,0.0,1.0), "*");
+                    } else {
+                        ImGui::Text(" ");
+                    }
+                    ImGui::SameLine();
+                    if(ImGui::TreeNode("zone", "%s", zone.name.c_str())){
+                        
+                        edited |= ImGui::InputTextFromString("Name", zone.name);
+                        
+                        int shape = zone.shape == TriggerZone::SHAPE::CYLINDER ? 1 : 0;
+                        if(ImGui::Combo("Shape", &shape, "Box\0Cylinder\0")){
+                            zone.shape = shape == 1 ? TriggerZone::SHAPE::CYLINDER : TriggerZone::SHAPE::BOX;
+                            moved = true;
+                        }
+                        // the grid is rebuilt once a drag is released, not every tick
+                        ImGui::DragFloat3("Position", &zone.position.x, 0.01);
+                        moved |= ImGui::IsItemDeactivatedAfterEdit();
+                        ImGui::DragFloat3("Size", &zone.size.x, 0.01, 0.0, 20.0);
+                        moved |= ImGui::IsItemDeactivatedAfterEdit();
+                        edited |= ImGui::DragFloat("Dwell", &zone.dwell, 0.1, 0.0, 10*60.0, "%.1f s");
+                        
+                        edited |= ImGui::InputTextFromString("QLab Enter Cue", zone.qLabEnterCue);
+                        edited |= ImGui::InputTextFromString("QLab Exit Cue", zone.qLabExitCue);
+                        edited |= ImGui::InputTextFromString("QLab Dwell Cue", zone.qLabDwellCue);
+                        
+                        if(ImGui::Button("Remove Zone")){
+                            removeZone = int(i);
+                        }
+                        
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                    
+                    if(edited || moved){
+                        editProcessing([this, i, zone, moved]{
+                            zones.setZone(i, zone, moved);
+                        });
+                    }
+                }
+                
+                if(ImGui::Button("Add Zone")){
+                    TriggerZone zone;
+                    zone.name = "zone " + ofToString(zoneSettings.size()+1);
+                    zone.position = pTrackingBoxPosition.get();
+                    zoneSettings.push_back(zone);
+                    editProcessing([this, zone]{
+                        zones.addZone(zone);
+                    });
+                }
+                
+                if(removeZone >= 0){
+                    zoneSettings.erase(zoneSettings.begin() + removeZone);
+                    size_t i = removeZone;
+                    editProcessing([this, i]{
+                        zones.removeZone(i, tracker.lastTimestamp);
+                    });
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Tracking Volumes", mainSettings)){
+                
+                bool volumesChanged = false;
+                int removeVolume = -1;
+                
+                for(size_t i = 0; i < volumeSettings.size(); i++){
+                    auto & v = volumeSettings[i];
+                    ImGui::PushID(int(i));
+                    
+                    bool edited = false;
+                    bool moved = false;
+                    moved |= ImGui::Checkbox("##enabled", &v.enabled);
+                    ImGui::SameLine();
+                    if(ImGui::TreeNode("volume", "%s  %s", v.name.c_str(), v.oscPrefix.c_str())){
+                        
+                        edited |= ImGui::InputTextFromString("Name", v.name);
+                        edited |= ImGui::InputTextFromString("OSC Prefix", v.oscPrefix);
+                        moved |= ImGui::DragFloat3("Box Position", &v.boxPosition.x, 0.01);
+                        moved |= ImGui::DragFloat3("Box Rotation", &v.boxRotation.x, 0.1, -180.0, 180.0);
+                        moved |= ImGui::DragFloat3("Box Size", &v.boxSize.x, 0.01, 0.0, 20.0);
+                        moved |= ImGui::DragFloat3("Start Position", &v.startPosition.x, 0.01);
+                        moved |= ImGui::SliderInt("Max Heads", &v.maxHeads, 1, 16);
+                        
+                        if(i + 1 < view.boxes.size() && view.boxes[i + 1].tracked){
+                            auto & box = view.boxes[i + 1];
+                            ImGui::Text("%d of %d heads tracking", box.tracking, int(box.headCount));
+                        }
+                        
+                        if(ImGui::Button("Remove Volume")){
+                            removeVolume = int(i);
+                        }
+                        
+                        ImGui::TreePop();
+                    }
+                    ImGui::PopID();
+                    
+                    if(edited || moved){
+                        ofJson j = v.toJson();
+                        editProcessing([this, i, j]{
+                            if(i < trackingVolumes.volumes.size()) trackingVolumes.volumes[i].fromJson(j);
+                        });
+                        volumesChanged |= moved;
+                    }
+                }
+                
+                if(volumeSettings.size() < TrackingVolumes::maxVolumes && ImGui::Button("Add Volume")){
+                    TrackingVolume v;
+                    v.name = "volume " + ofToString(volumeSettings.size()+1);
+                    v.oscPrefix = "/volume" + ofToString(volumeSettings.size()+1);
+                    v.boxPosition = pTrackingBoxPosition.get();
+                    v.boxSize = pTrackingBoxSize.get();
+                    v.startPosition = pTrackingStartPosition.get();
+                    ofJson j = v.toJson();
+                    volumeSettings.push_back(std::move(v));
+                    editProcessing([this, j]{
+                        trackingVolumes.volumes.emplace_back();
+                        trackingVolumes.volumes.back().fromJson(j);
+                    });
+                    volumesChanged = true;
+                }
+                
+                if(removeVolume >= 0){
+                    volumeSettings.erase(volumeSettings.begin() + removeVolume);
+                    size_t i = removeVolume;
+                    editProcessing([this, i]{
+                        trackingVolumes.remove(i);
+                    });
+                    volumesChanged = true;
+                }
+                
+                if(volumesChanged){
+                    // new trackers and boxes come with the config
+                    trackingConfigDirty = true;
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Remote Control OSC", mainSettings)){
+                
+                ImGui::Columns(2, "RemoteControlOscColumns", false);
+                
+                string strPort = ofToString(pOscRemoteControlPort.get());
+                if(ImGui::InputTextFromString("Listen Port", strPort, ImGuiInputTextFlags_CharsDecimal)){
+                    pOscRemoteControlPort.set(ofToInt(string(strPort)));
+                }
+                
+                ImGui::SetColumnOffset(1, ImGui::GetWindowContentRegionMax().x - columnOffset);
+                
+                ImGui::NextColumn();
+                
+                string strPortReply = ofToString(pOscRemoteControlReplyPort.get());
+                if(ImGui::InputTextFromString("Reply Port", strPortReply, ImGuiInputTextFlags_CharsDecimal)){
+                    pOscRemoteControlReplyPort.set(ofToInt(string(strPortReply)));
+                }
+                
+                ImGui::Columns(1);
+                
+                if(ImGui::Button("Listen")){
+                    remote.setup(pgRoot, pOscRemoteControlPort, pOscRemoteControlReplyPort);
+                }
+                if(remote.getDroppedCount() > 0){
+                    ImGui::SameLine();
+                    ImGui::Text("%llu messages dropped", (unsigned long long) remote.getDroppedCount());
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Metrics", mainSettings)){
+                
+                ofxImGui::AddParameter(pMetricsEnabled);
+                
+                string strPort = ofToString(pMetricsPort.get());
+                if(ImGui::InputTextFromString("Port", strPort, ImGuiInputTextFlags_CharsDecimal)){
+                    pMetricsPort.set(ofToInt(string(strPort)));
+                }
+                
+                if(ImGui::Button("Listen")){
+                    if(pMetricsEnabled){
+                        metricsServer.setup(pMetricsPort);
+                    } else {
+                        metricsServer.close();
+                    }
+                }
+                if(metricsServer.isListening()){
+                    ImGui::SameLine();
+                    ImGui::Text("http://localhost:%d/metrics, %llu requests", pMetricsPort.get(), (unsigned long long) metricsServer.getRequestCount());
+                }
+                
+                ImGui::Text("%llu frames, %llu dropped, %llu duplicates",
+                            (unsigned long long) Metrics::get(Metrics::FRAMES_RECEIVED),
+                            (unsigned long long) Metrics::get(Metrics::FRAMES_DROPPED),
+                            (unsigned long long) Metrics::get(Metrics::FRAMES_DUPLICATE));
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Monitor", mainSettings)){
+                
+                ofxImGui::AddParameter(pMonitorEnabled);
+                
+                string strHost = pMonitorHost.get();
+                if(ImGui::InputTextFromString("Host", strHost, ImGuiInputTextFlags_CharsNoBlank)){
+                    pMonitorHost.set(strHost);
+                }
+                string strPort = ofToString(pMonitorPort.get());
+                if(ImGui::InputTextFromString("Port", strPort, ImGuiInputTextFlags_CharsDecimal)){
+                    pMonitorPort.set(ofToInt(string(strPort)));
+                }
+                ofxImGui::AddParameter(pMonitorRate);
+                ofxImGui::AddParameter(pMonitorBandwidth);
+                ofxImGui::AddParameter(pMonitorVoxelSize);
+                ofxImGui::AddParameter(pMonitorKeyframeInterval);
+                ofxImGui::AddParameter(pMonitorLoopback);
+                
+                if(ImGui::Button("Connect")){
+                    setupMonitor();
+                }
+                
+                if(view.monitorStreaming){
+                    MonitorStream::Stats stats = monitorStream.getStats();
+                    ImGui::Text("%llu frames sent, %llu over the cap, %llu keyframes",
+                                (unsigned long long) stats.framesSent, (unsigned long long) stats.framesSkipped, (unsigned long long) stats.keyframes);
+                    ImGui::Text("last %zu bytes, %zu points a frame", stats.lastPacket, stats.pointBudget);
+                }
+                if(monitorReceiver.isListening()){
+                    MonitorReceiver::Stats stats = monitorReceiver.getStats();
+                    ImGui::Text("Loopback: %llu applied, %llu waiting for a keyframe, %llu invalid",
+                                (unsigned long long) stats.applied, (unsigned long long) stats.waiting, (unsigned long long) stats.invalid);
+                    ImGui::Text("%u voxels, %zu heads", stats.occupied, stats.heads);
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Event Log", mainSettings)){
+                
+                ofxImGui::AddParameter(pEventLogEnabled);
+                ofxImGui::AddParameter(pEventLogConsole);
+                ofxImGui::AddParameter(pEventLogMaxSize);
+                ofxImGui::AddParameter(pEventLogFiles);
+                
+                TrackEventLog::Stats stats = trackEventLog.getStats();
+                ImGui::Text("%llu events written, %llu dropped, %llu rotations",
+                            (unsigned long long) stats.written, (unsigned long long) stats.dropped, (unsigned long long) stats.rotated);
+                if(stats.open){
+                    ImGui::Text("%.1f MB in the current file", stats.bytes / (1024.0 * 1024.0));
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Snapshot", mainSettings)){
+                
+                ofxImGui::AddParameter(pSnapshotEnabled);
+                ofxImGui::AddParameter(pSnapshotInterval);
+                ofxImGui::AddParameter(pSnapshotMaxAge);
+                
+                TrackerSnapshotWriter::Stats stats = snapshotWriter.getStats();
+                if(stats.written > 0){
+                    ImGui::Text("%llu written, %zu heads %.1fs ago", (unsigned long long) stats.written, stats.heads,
+                                (double(ofGetSystemTimeMicros()) - double(stats.lastMicros)) / 1e6);
+                }
+                if(stats.failed > 0){
+                    ImGui::Text("%llu failed", (unsigned long long) stats.failed);
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Camera", mainSettings)){
+                
+                vector<const char *> profileNames;
+                for(auto & profile : streamProfiles){
+                    profileNames.push_back(profile.name);
+                }
+                int profile = pCameraStreamProfile;
+                if(ImGui::Combo("Stream Profile", &profile, profileNames.data(), int(profileNames.size()))){
+                    pCameraStreamProfile.set(profile);
+                }
+                
+                ofxImGui::AddParameter(pCameraDecimation);
+                ofxImGui::AddParameter(pCameraFusedFilter);
+                
+                ImGui::Text("Acquisition at %.0f weighed points", tracker.acquisitionArea * cloudFocalArea);
+                
+                if(floorCalibration.isRunning() || floorCalibrationRequested){
+                    ImGui::Text("Calibrating...");
+                } else if(ImGui::Button("Calibrate Floor")){
+                    floorCalibrationRequested = true;
+                }
+                if(floorCalibrationResult.valid){
+                    ImGui::SameLine();
+                    ImGui::Text("%.3fm, %.0f%% floor", floorCalibrationResult.height, floorCalibrationResult.inlierRatio * 100.0);
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
+            
+            if(ofxImGui::BeginTree("Recording", mainSettings)){
+                
+                if(recorder.isRecording()){
+                    if(ImGui::Button("Stop Recording")){
+                        stopRecording();
+                    }
+                    ImGui::SameLine();
+                    ImGui::Text("%llu frames, %.1f MB, %llu dropped",
+                                (unsigned long long) recorder.getFrameCount(),
+                                recorder.getBytesWritten() / (1024.0 * 1024.0),
+                                (unsigned long long) recorder.getDroppedCount());
+                } else if(cameraState == CAMERA_STATE::STREAMING){
+                    if(ImGui::Button("Record")){
+                        startRecording();
+                    }
+                    ImGui::SameLine();
+                    ofxImGui::AddParameter(pRecordingCompression);
+                }
+                
+                ImGui::Separator();
+                
+                string strReplay = pReplayFile.get();
+                if(ImGui::InputTextFromString("Replay File", strReplay)){
+                    pReplayFile.set(strReplay);
+                }
+                
+                if(replayOpen){
+                    if(ImGui::Button("Close Replay")){
+                        closeReplay();
+                    }
+                } else {
+                    if(ImGui::Button("Open Replay")){
+                        openReplay(pReplayFile.get());
+                    }
+                }
+                
+                if(replayOpen){
+                    int frame = int(view.replayPosition);
+                    if(ImGui::SliderInt("Frame", &frame, 0, int(replayFrameCount)-1)){
+                        std::lock_guard<std::mutex> lock(processingMutex);
+                        player.seek(frame);
+                    }
+                    ofxImGui::AddParameter(pReplayLoop);
+                    ofxImGui::AddParameter(pReplayFramesPerUpdate);
+                }
+                
                 ofxImGui::EndTree(mainSettings);
             }
             
+            if(ofxImGui::BeginTree("Processing", mainSettings)){
+                
+                ofxImGui::AddParameter(pProcessingThread);
+                ofxImGui::AddParameter(pProcessingRealtime);
+                ofxImGui::AddParameter(pProcessingCore);
+                ofxImGui::AddParameter(pProcessingPriority);
+                ofxImGui::AddParameter(pProcessingLockMemory);
+                
+                if(processing.isThreadRunning()){
+                    ImGui::TextWrapped("Thread: %s", processing.getReport().c_str());
+                } else {
+                    ImGui::Text("Processing in the render loop");
+                }
+                
+                ImGui::Separator();
+                
+                ofxImGui::AddParameter(pBenchmarkDuration);
+                if(benchmarkPhase != BENCHMARK::IDLE){
+                    ImGui::Text("%s profile, %.0fs left",
+                                benchmarkPhase == BENCHMARK::BASELINE ? "Without" : "With",
+                                pBenchmarkDuration - (ofGetElapsedTimef() - benchmarkPhaseStart));
+                } else if(replayOpen){
+                    if(ImGui::Button("Run Jitter Benchmark")){
+                        benchmarkRequested = true;
+                    }
+                } else {
+                    ImGui::TextDisabled("Open a replay to run the jitter benchmark");
+                }
+                
+                auto showStats = [](const char * label, const IntervalStats & stats){
+                    if(stats.count == 0) return;
+                    ImGui::Text("%s  p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f ms", label, stats.p50, stats.p99, stats.p999, stats.max);
+                };
+                showStats("Without", benchmarkBaseline);
+                showStats("With   ", benchmarkRealtime);
+                
+                if(kernelBenchmarkRunning){
+                    ImGui::Text("Kernel benchmark running...");
+                } else if(ImGui::Button("Run Kernel Benchmark")){
+                    startKernelBenchmark();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(kernelBenchmarkMutex);
+                    for(auto & result : kernelBenchmark){
+                        ImGui::Text("%2d heads  %.2f ns looped  %.2f ns fixed  %.2f ns tracking only  per point", result.heads, result.loopNanos, result.fixedNanos, result.claimNanos);
+                        ImGui::Text("          %.2f ns summing  %.2f ns scalar  per point", result.sumNanos, result.sumScalarNanos);
+                        ImGui::Text("          %.2f ns addVertex()  %.2f ns addPoints()", result.vertexNanos, result.pointsNanos);
+                    }
+                }
+                
+                ofxImGui::EndTree(mainSettings);
+            }
             
             /*
              for (auto pg : pgRoot){
@@ -7,14 +7,41 @@
 #include "MeshTracker.hpp"
 #include "ofxOsc.h"
 #include "qLabController.hpp"
+#include "DepthRecording.hpp"
+#include "TriggerZones.hpp"
+#include "OscRemoteControl.hpp"
+#include "OscDestinations.hpp"
+#include "FloorCalibration.hpp"
+#include "AllocationCounter.hpp"
+#include "TrackerFrameConfig.hpp"
+#include "ProcessingThread.hpp"
+#include "MetricsServer.hpp"
+#include "MonitorReceiver.hpp"
+#include "TrackingVolumes.hpp"
+#include "FusedDepthFilter.hpp"
+#include "TrackEventLog.hpp"
+#include "TrackerSnapshot.hpp"
+#include "TrackerView.hpp"
+#include "SpscQueue.hpp"
 #include <dispatch/dispatch.h>
+#include <atomic>
+#include <mutex>
+
+struct StreamProfile {
+    const char * name;
+    int width;
+    int height;
+    int fps;
+};
 
 class ofApp : public ofBaseApp{
     
 public:
     void setup();
     void update();
+    void updateScene();
     void draw();
+    void exit();
     
     void keyPressed(int key);
     void keyReleased(int key);
@@ -29,33 +56,213 @@ public:
     void gotMessage(ofMessage msg);
     void keycodePressed(ofKeyEventArgs& e);
     
+    void processFrame(rs2::frame depthFrame);
+    bool processNextFrame(bool paced);
+    
+    // Frames are processed in update() or, with pProcessingThread, on their
+    // own thread, which owns the trackers, zones, volumes, OSC destinations
+    // and the player. The GL thread keeps its own copy of the settings and
+    // hands changes over: tracking parameters in frameConfigs, everything
+    // else as edits that processing applies between frames. What it shows
+    // comes back in trackerViews and, for the cloud, displayMesh.
+    // processingMutex is held for a frame, the GL thread only takes it for
+    // commands like opening a replay or a recording, never to draw.
+    ProcessingThread processing;
+    std::mutex processingMutex;
+    SpscQueue<std::function<void()>, 256> processingEdits;
+    void editProcessing(std::function<void()> edit);
+    bool applyProcessingEdits();
+    TrackerViews trackerViews;
+    void fillTrackerView(TrackerView & view);
+    int activeProcessingMode = 0;   // 0 in update(), 1 thread, 2 thread with the real-time profile
+    uint64_t nextReplayMicros = 0;
+    void updateProcessingThread();
+    void startProcessingThread(bool realtime);
+    
+    std::mutex displayMutex;
+    ofMesh displayMesh;
+    
+    // jitter benchmark: the replay without, then with the real-time profile
+    enum class BENCHMARK {
+        IDLE,
+        BASELINE,
+        REALTIME
+    };
+    BENCHMARK benchmarkPhase = BENCHMARK::IDLE;
+    bool benchmarkRequested = false; // set from the GUI, started from update()
+    float benchmarkPhaseStart = 0;
+    IntervalRecorder sendIntervals;
+    IntervalStats benchmarkBaseline;
+    IntervalStats benchmarkRealtime;
+    void startJitterBenchmark();
+    void updateJitterBenchmark();
+    
+    // per point classification cost, looped against unrolled and against
+    // addVertex(), at 3, 5, 8 and 16 heads, measured on a queue of its own
+    void startKernelBenchmark();
+    vector<QuantisedPoints::BenchmarkResult> kernelBenchmark;   // guarded by kernelBenchmarkMutex
+    std::mutex kernelBenchmarkMutex;
+    std::atomic<bool> kernelBenchmarkRunning{false};
+    dispatch_queue_t kernelBenchmarkQueue;
+    
+    // tracking settings as processing sees them, rebuilt when a parameter changes
+    SnapshotRing<TrackerFrameConfig> frameConfigs;
+    uint64_t frameConfigVersion = 0;
+    bool trackingConfigDirty = true;
+    float cloudFocalArea = 0;
+    void publishFrameConfig();
+    void onTrackingParameterChanged(ofAbstractParameter & p);
+    
+    // per frame buffers, sized by applyIntrinsics() or, for the real-time
+    // profile, from the stream profile before the first frame
+    vector<uint8_t> vertsActive;
+    QuantisedPoints::Cloud quantisedCloud;  // cropped points, in chunks of cropChunkSize
+    vector<size_t> cropChunkCounts;         // points kept per chunk
+    static const size_t cropChunkSize = 4096;
+    size_t frameBufferSize = 0;             // points the buffers hold, processing only
+    size_t realtimeCloudSize = 0;           // of the stream the thread starts on
+    bool frameBuffersWired = false;         // with the real-time profile, wired again when they grow
+    RealtimeProfile frameBufferProfile;
+    size_t getCloudSize(int width, int height);
+    size_t reserveFrameBuffers(size_t cloudSize);
+    size_t wireFrameBuffers(bool wire);
+    
+    // more boxes, cropped in the same pass and tracked beside the main one
+    TrackingVolumes trackingVolumes;
+    vector<TrackingVolume> volumeSettings;  // the GL thread's copy, without trackers
+    vector<OscHeadSet> oscHeadSets;         // the main heads, then those of each volume
+    const string mainOscPrefix;             // the main heads stay at /tracker/N
+    
+    size_t replayFramesChecked = 0;
+    size_t allocationWarmupFrames = 120;
+    void checkFrameAllocations(size_t allocations);
+    
     //OSC
     
-    ofxOscSender oscTrackingSender;
-    //float timeSent;
-    int port = 1234;
+    OscDestinations oscDestinations;
+    vector<OscDestination> destinationSettings; // the GL thread's copy
     
     qLabController qLab;
     
+    OscRemoteControl remote;
+    
+    // METRICS
+    
+    MetricsServer metricsServer;
+    uint64_t lastFrameNumber = 0;   // of the camera, to count drops and duplicates
+    
+    // MONITOR
+    
+    MonitorStream monitorStream;
+    MonitorReceiver monitorReceiver;    // loopback only
+    MonitorFrame monitorFrame;          // filled by processing, swapped into the stream
+    bool monitorSettingsDirty = true;
+    void setupMonitor();
+    void applyMonitorSettings();
+    void onMonitorParameterChanged(ofAbstractParameter & p);
+    
+    // EVENT LOG
+    
+    TrackEventLog trackEventLog;
+    TrackEventPacket trackEventPacket;  // processing, popped into
+    bool eventLogOsc = false;           // a destination has Events on
+    void applyEventLogSettings();
+    void onEventLogParameterChanged(ofAbstractParameter & p);
+    
+    // SNAPSHOT
+    
+    TrackerSnapshotWriter snapshotWriter;
+    TrackerSnapshot trackerSnapshot;    // processing, filled and swapped into the writer
+    string getSnapshotPath();
+    void fillTrackerSnapshot();
+    void restoreTrackerSnapshot();
+    void applySnapshotSettings();
+    void onSnapshotParameterChanged(ofAbstractParameter & p);
+    
     // TRACKING
     
     dispatch_queue_t cropVerticesQueue;
     
-    rs2::pipeline pipe;
+    rs2::context ctx;
+    rs2::pipeline pipe{ctx};
     rs2::device device;
     rs2::pipeline_profile selection;
     rs2::colorizer color_map;
     rs2::frame colored_depth;
     rs2::frame colored_filtered;
-    rs2_intrinsics intrinsics;
+    rs2_intrinsics intrinsics{};
+    float depthScale = 0.001;
     
     rs2::decimation_filter dec_filter;
     rs2::spatial_filter spat_filter;
     rs2::temporal_filter temp_filter;
+    FusedDepthFilter fused_filter;          // the three above in one pass, with their options
+    bool fusedFilterActive = false;         // as of the last frame, processing only
+    size_t replayNextPosition = 0;          // where the last frame left the player, a seek or loop moves it
+    rs2::decimation_filter fine_dec_filter;
+    int activeFineDecimation = -1;
     
     rs2::points points;
     rs2::pointcloud pc;
     
+    vector<StreamProfile> streamProfiles {
+        {"480x270 @ 90", 480, 270, 90},
+        {"640x360 @ 90", 640, 360, 90},
+        {"848x480 @ 60", 848, 480, 60},
+        {"848x480 @ 90", 848, 480, 90},
+        {"1280x720 @ 30", 1280, 720, 30}
+    };
+    int activeStreamProfile = -1;
+    int activeDecimation = -1;
+    
+    // The pipeline is (re)started on cameraQueue, the GL thread only polls it.
+    // cameraMutex guards pipe, selection, intrinsics and depthScale.
+    enum class CAMERA_STATE {
+        DISCONNECTED,
+        CONNECTING,
+        STREAMING
+    };
+    std::atomic<CAMERA_STATE> cameraState{CAMERA_STATE::DISCONNECTED};
+    std::atomic<bool> cameraLost{false};
+    std::atomic<bool> cameraFound{false};
+    std::atomic<bool> cameraStarted{false};
+    std::mutex cameraMutex;
+    dispatch_queue_t cameraQueue;
+    float lastCameraAttempt = 0;
+    std::atomic<float> lastCameraFrame{0};
+    std::atomic<float> cameraLostTime{-1};
+    std::atomic<float> cameraRecoveryDuration{-1};
+    float cameraRetryInterval = 5.0;
+    float cameraStallTimeout = 2.0;
+    
+    void requestCameraStart();
+    void startCamera(StreamProfile profile);
+    void onCameraLost(string reason);
+    void applyIntrinsics(const rs2_intrinsics & intrinsics);
+    int getCloudDecimation();
+    
+    // RECORDING
+    
+    DepthRecorder recorder;
+    DepthPlayer player;
+    bool replayOpen = false;                // the GL thread's view of the player
+    size_t replayFrameCount = 0;
+    rs2_intrinsics replayIntrinsics{};
+    bool activeReplayLoop = false;
+    
+    void startRecording();
+    void stopRecording();
+    void openReplay(string path);
+    void closeReplay();
+    
+    // CALIBRATION
+    
+    FloorCalibration floorCalibration;
+    std::atomic<bool> floorCalibrationRequested{false};
+    FloorCalibration::Result floorCalibrationResult;
+    
+    void applyFloorCalibration(const FloorCalibration::Result & result);
+    
     ofNode origin;
     
     ofMesh trackingMesh;
@@ -65,6 +272,12 @@ public:
     bool resetCameraPosition = true;
     
     MeshTracker tracker;
+    ofNode trackingBox;                     // where the GL thread puts the tracker's box
+    int activeMaxHeads = 0;
+    
+    TriggerZones zones;
+    vector<TriggerZone> zoneSettings;       // the GL thread's copy
+    void onZoneEvent(TriggerZoneEvent & e);
     
     //setup of the virtual room
     
@@ -116,13 +329,26 @@ public:
     
         ofParameter<glm::vec3> pBackWallPlane{ "Back Wall Plane Position", glm::vec3(0.,0.,0.), glm::vec3(-10.,-10.,-10.), glm::vec3(10.,10.,10.)};
     
-    ofParameterGroup pgTracking {"Tracking", pTrackingVisible, pTrackingTimeout, pTrackingCameraPosition, pTrackingCameraRotation, pTrackingBoxPosition, pTrackingBoxRotation, pTrackingBoxSize, pTrackingStartPosition, pFloorPlanePosition, pWallNegXPlanePosition, pWallPosXPlanePosition, pBackWallPlane};
+    // acquisition on a coarse cloud, head centres from full resolution pixels
+    ofParameter<bool> pTrackingCoarseToFine{ "Coarse To Fine", false};
+    ofParameter<int> pTrackingCoarseDecimation{ "Coarse Decimation", 4, 2, 8};
+    ofParameter<int> pTrackingFineDecimation{ "Fine Decimation", 1, 1, 4};
     
-    ofParameter<bool> pOscTrackingEnabled{ "Sending", false};
-    ofParameter<string> pOscTrackingRemoteHost{ "Remote Host", "localhost"};
-    ofParameter<int> pOscTrackingRemotePort{ "Remote Port", 7777, 0, 65000};
-    ofParameterGroup pgOscTracking{ "Tracking", pOscTrackingEnabled, pOscTrackingRemoteHost, pOscTrackingRemotePort };
-
+    ofParameter<int> pTrackingMaxHeads{ "Max Heads", 3, 1, 16};
+    ofParameter<bool> pTrackingFixedKernels{ "Fixed Head Kernels", true};
+    ofParameterGroup pgTracking {"Tracking", pTrackingVisible, pTrackingTimeout, pTrackingCameraPosition, pTrackingCameraRotation, pTrackingBoxPosition, pTrackingBoxRotation, pTrackingBoxSize, pTrackingStartPosition, pFloorPlanePosition, pWallNegXPlanePosition, pWallPosXPlanePosition, pBackWallPlane, pTrackingCoarseToFine, pTrackingCoarseDecimation, pTrackingFineDecimation, pTrackingMaxHeads, pTrackingFixedKernels};
+    
+    ofParameter<int> pCameraStreamProfile{ "Stream Profile", 2, 0, 4};
+    ofParameter<int> pCameraDecimation{ "Decimation", 2, 1, 8};
+    ofParameter<bool> pCameraFusedFilter{ "Fused Filter", false};
+    ofParameterGroup pgCamera{ "Camera", pCameraStreamProfile, pCameraDecimation, pCameraFusedFilter };
+    
+    ofParameter<string> pRecordingFolder{ "Folder", "recordings"};
+    ofParameter<bool> pRecordingCompression{ "Compression", true};
+    ofParameter<string> pReplayFile{ "Replay File", ""};
+    ofParameter<bool> pReplayLoop{ "Replay Loop", true};
+    ofParameter<int> pReplayFramesPerUpdate{ "Replay Frames Per Update", 1, 1, 32};
+    ofParameterGroup pgRecording{ "Recording", pRecordingFolder, pRecordingCompression, pReplayFile, pReplayLoop, pReplayFramesPerUpdate };
     
     ofParameter<string> pOscQlabRemoteHost{ "Remote Address", "localhost"};
     ofParameter<int> pOscQlabRemotePort{ "Remote Port", 65000, 0, 65000};
@@ -130,8 +356,46 @@ public:
 
     ofParameterGroup pgQlab{"QLab", pOscQlabRemoteHost, pOscQlabRemotePort, pOscQlabReplyPort };
     
-    ofParameterGroup pgOsc {"OSC", pgQlab, pgOscTracking};
+    ofParameter<int> pOscRemoteControlPort{ "Listen Port", 9000, 0, 65000};
+    ofParameter<int> pOscRemoteControlReplyPort{ "Reply Port", 9001, 0, 65000};
+
+    ofParameterGroup pgOscRemoteControl{"Remote Control", pOscRemoteControlPort, pOscRemoteControlReplyPort };
+    
+    ofParameterGroup pgOsc {"OSC", pgQlab, pgOscRemoteControl};
+
+    ofParameter<bool> pProcessingThread{ "Processing Thread", false};
+    ofParameter<bool> pProcessingRealtime{ "Realtime Profile", false};
+    ofParameter<int> pProcessingCore{ "Core", -1, -1, 63};
+    ofParameter<int> pProcessingPriority{ "Priority", 80, 1, 99};
+    ofParameter<bool> pProcessingLockMemory{ "Lock Memory", true};
+    ofParameter<float> pBenchmarkDuration{ "Benchmark Duration", 20.0, 5.0, 120.0};
+    ofParameterGroup pgProcessing{ "Processing", pProcessingThread, pProcessingRealtime, pProcessingCore, pProcessingPriority, pProcessingLockMemory, pBenchmarkDuration };
+
+    ofParameter<bool> pMetricsEnabled{ "Enabled", true};
+    ofParameter<int> pMetricsPort{ "Port", 9464, 0, 65000};
+    ofParameterGroup pgMetrics{ "Metrics", pMetricsEnabled, pMetricsPort };
+
+    ofParameter<bool> pMonitorEnabled{ "Enabled", false};
+    ofParameter<string> pMonitorHost{ "Host", "localhost"};
+    ofParameter<int> pMonitorPort{ "Port", 9470, 0, 65000};
+    ofParameter<float> pMonitorRate{ "Rate", 10.0, 1.0, 30.0};
+    ofParameter<float> pMonitorBandwidth{ "Bandwidth kbps", 2000.0, 100.0, 20000.0};
+    ofParameter<int> pMonitorVoxelSize{ "Voxel Size mm", 50, 20, 200};
+    ofParameter<float> pMonitorKeyframeInterval{ "Keyframe Interval", 1.0, 0.2, 10.0};
+    ofParameter<bool> pMonitorLoopback{ "Loopback", false};
+    ofParameterGroup pgMonitor{ "Monitor", pMonitorEnabled, pMonitorHost, pMonitorPort, pMonitorRate, pMonitorBandwidth, pMonitorVoxelSize, pMonitorKeyframeInterval, pMonitorLoopback };
+
+    ofParameter<bool> pEventLogEnabled{ "Enabled", true};
+    ofParameter<bool> pEventLogConsole{ "Console", true};
+    ofParameter<int> pEventLogMaxSize{ "Max File Size MB", 10, 1, 1000};
+    ofParameter<int> pEventLogFiles{ "Rotated Files", 5, 0, 100};
+    ofParameterGroup pgEventLog{ "Event Log", pEventLogEnabled, pEventLogConsole, pEventLogMaxSize, pEventLogFiles };
+
+    ofParameter<bool> pSnapshotEnabled{ "Enabled", true};
+    ofParameter<float> pSnapshotInterval{ "Interval s", 1.0, 0.1, 10.0};
+    ofParameter<float> pSnapshotMaxAge{ "Max Age s", 30.0, 1.0, 600.0};
+    ofParameterGroup pgSnapshot{ "Snapshot", pSnapshotEnabled, pSnapshotInterval, pSnapshotMaxAge };
 
-    ofParameterGroup pgRoot{"Settings", pgOsc, pgTracking};
+    ofParameterGroup pgRoot{"Settings", pgOsc, pgCamera, pgTracking, pgRecording, pgProcessing, pgMetrics, pgMonitor, pgEventLog, pgSnapshot};
     
 };
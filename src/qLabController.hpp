@@ -10,230 +10,188 @@
 #include <iostream>
 #include <ofMain.h>
 #include "ofxOsc.h"
+#include <deque>
+#include <future>
+#include <condition_variable>
 
-class qLabController{
+// Requests to QLab are pipelined: every /new is sent right away and its
+// reply is matched to the oldest outstanding request, QLab answers in order.
+// Follow-up messages address the new cue by id (/cue_id/...) rather than
+// /cue/selected, so they can go out while later cues are still being created.
+//
+// A request that times out still gets its reply eventually, ahead of the
+// replies to everything sent after it. Those late replies are counted as
+// stragglers and dropped, and no new request goes out until they are in,
+// so a late id never ends up with the next request. If they do not come
+// within TIMEOUT of the last timeout, QLab is taken to have lost them.
+class qLabController : public ofThread {
 
 public:
     ofxOscReceiver oscReceiver;
     ofxOscSender oscSender;
-    ofJson json;
 
     float TIMEOUT = 4;
-    
+    size_t maxInFlight = 8;
+
     qLabController(){};
 
+    ~qLabController(){
+        waitForThread(true);
+    }
+
     void setup(string sendAddress = "localhost", int sendPort = 53000, int receivePort = 53001){
+        waitForThread(true);
+        stragglers = 0;
         oscSender.setup(sendAddress, sendPort);
         oscReceiver.setup(receivePort);
+        startThread();
     };
-    
-    void update(){
-        while(oscReceiver.hasWaitingMessages()) {
-            ofxOscMessage msg;
-            oscReceiver.getNextMessage(msg);
-            cout << "UPDATE" << endl;
-            cout << msg.getAddress() << endl;;
-            for(int i = 0; i < msg.getNumArgs(); i++){
-                cout << "\t" << msg.getArgAsString(i) << endl;
-            }
+
+    // resolves to the id of the new cue, or "" if QLab did not answer within TIMEOUT
+    std::shared_future<string> newCue(string type, std::function<void(const string &)> onCreated = nullptr){
+
+        std::unique_lock<std::mutex> lock(pendingMutex);
+
+        if(!isThreadRunning()){
+            ofLogError("qLabController::newCue") << "Not set up";
+            std::promise<string> failed;
+            failed.set_value("");
+            return failed.get_future().share();
         }
-    };
-    
-    string newOscCueFromString(string oscString){
-        ofxOscMessage mNewOsc;
-        mNewOsc.setAddress("/new");
-        mNewOsc.addStringArg("network");
-        oscSender.sendMessage(mNewOsc, false);
-        
-        float start = ofGetElapsedTimef();
-        while((!oscReceiver.hasWaitingMessages()) && (ofGetElapsedTimef()-start < TIMEOUT));
-        
-        while(oscReceiver.hasWaitingMessages()) {
-            
-            ofxOscMessage msg;
-            oscReceiver.getNextMessage(msg);
-            
-            vector<string> address = ofSplitString(msg.getAddress(),"/",true);
-            
-            if(address[0] == "reply" && address[address.size()-1] == "new"){
-                
-                try{
-                    json = ofJson::parse(msg.getArgAsString(0));
-                }catch(std::exception & e){
-                    ofLogError("newOscCueFromString") << "Error parsing json from " << msg.getArgAsString(0) << ": " << e.what();
-                }catch(...){
-                    ofLogError("newOscCueFromString") << "Error parsing json from " << msg.getArgAsString(0);
-                }
-                
-                if(json.find(std::string("data")) != json.end()){
-                    string newCueID = json["data"].get<string>();
-                    
-                    ofxOscMessage mMessageType;
-                    mMessageType.setAddress("/cue/selected/messageType");
-                    mMessageType.addIntArg(2);
-                    oscSender.sendMessage(mMessageType, false);
-                    
-                    ofLogVerbose("newOscCueFromString") << mMessageType << " " << newCueID;
-
-                    ofxOscMessage mCustomString;
-                    mCustomString.setAddress("/cue/selected/customString");
-                    mCustomString.addStringArg(oscString);
-                    oscSender.sendMessage(mCustomString, false);
-
-                    ofLogVerbose("newOscCueFromString") << mCustomString << " " << newCueID;
-
-                    return newCueID;
-                }
-            }
+
+        bool open = slotFree.wait_for(lock, std::chrono::milliseconds(int(TIMEOUT*1000)), [this]{
+            return pending.size() < maxInFlight && stragglers == 0;
+        });
+        if(!open){
+            ofLogError("qLabController::newCue") << "No room for another request within " << TIMEOUT << "s";
+            timeoutCount++;
+            std::promise<string> failed;
+            failed.set_value("");
+            return failed.get_future().share();
         }
 
-        return "";
-        
+        Request request;
+        request.onCreated = onCreated;
+        request.sent = ofGetElapsedTimef();
+        request.deadline = request.sent + TIMEOUT;
+        auto future = request.promise.get_future().share();
+        pending.push_back(std::move(request));
+
+        // sent while holding the lock, so the order of pending is the order QLab sees
+        ofxOscMessage mNew;
+        mNew.setAddress("/new");
+        mNew.addStringArg(type);
+        send(mNew);
+        sentCount++;
+
+        return future;
+    }
+
+    std::shared_future<string> newOscCueFromStringAsync(string oscString){
+        return newCue("network", [this, oscString](const string & newCueID){
+
+            ofxOscMessage mMessageType;
+            mMessageType.setAddress("/cue_id/" + newCueID + "/messageType");
+            mMessageType.addIntArg(2);
+            send(mMessageType);
+
+            ofLogVerbose("newOscCueFromString") << mMessageType << " " << newCueID;
+
+            ofxOscMessage mCustomString;
+            mCustomString.setAddress("/cue_id/" + newCueID + "/customString");
+            mCustomString.addStringArg(oscString);
+            send(mCustomString);
+
+            ofLogVerbose("newOscCueFromString") << mCustomString << " " << newCueID;
+        });
+    }
+
+    string newOscCueFromString(string oscString){
+        return newOscCueFromStringAsync(oscString).get();
     };
-    
-    string newOscCueFromParameter(const ofAbstractParameter& p, float fadeTime = 0){
-        
+
+    std::shared_future<string> newOscCueFromParameterAsync(const ofAbstractParameter& p, float fadeTime = 0){
+
         string oscString( findOscAddress(p) );
-        
+
         if(fadeTime > 0.0){
             oscString += " fade " + ofToString(fadeTime);
         }
-        
-        return newOscCueFromString(oscString);
-        
+
+        return newOscCueFromStringAsync(oscString);
+    };
+
+    string newOscCueFromParameter(const ofAbstractParameter& p, float fadeTime = 0){
+        return newOscCueFromParameterAsync(p, fadeTime).get();
     };
 
-    
     string newGroupWithOscCuesFromParameterGroup(const ofParameterGroup & g){
-        
-        string selectionString = "";
 
-        ////////////
-        // create a dummy cue
-        
-        string dummyID;
-        ofxOscMessage mNewDummy;
-        mNewDummy.setAddress("/new");
-        mNewDummy.addStringArg("memo");
-        oscSender.sendMessage(mNewDummy, false);
-        
+        size_t createdBefore = createdCount;
         float start = ofGetElapsedTimef();
-        while((!oscReceiver.hasWaitingMessages()) && (ofGetElapsedTimef()-start < TIMEOUT));
-        
-        while(oscReceiver.hasWaitingMessages()) {
-            ofxOscMessage msg;
-            oscReceiver.getNextMessage(msg);
-            
-            vector<string> address = ofSplitString(msg.getAddress(),"/",true);
-            
-            if(address[0] == "reply" && address[address.size()-1] == "new"){
-                
-                try{
-                     json = ofJson::parse(msg.getArgAsString(0));
-                }catch(std::exception & e){
-                    ofLogError("newGroupWithOscCuesFromParameterGroup") << "Error parsing json from " << msg.getArgAsString(0) << ": " << e.what();
-                }catch(...){
-                    ofLogError("newGroupWithOscCuesFromParameterGroup") << "Error parsing json from " << msg.getArgAsString(0);
-                }
-                
-                if(json.find(std::string("data")) != json.end()){
-                    selectionString += json["data"].get<std::string>() + ",";
-                    dummyID = json["data"].get<string>();
-                    ofLogVerbose("newGroupWithOscCuesFromParameterGroup") << selectionString << " " << dummyID;
-                }
-            }
-        }
-        
-        ////////////
-        // create cues for children recursively
 
-        for(std::size_t i=0;i<g.size();i++){
-            if(g.getType(i)==typeid(ofParameterGroup).name()){
-                selectionString += newGroupWithOscCuesFromParameterGroup(g.getGroup(i)) + ",";
-            } else {
-                if(g.get(i).getName() != "add to qlab")
-                    selectionString += newOscCueFromParameter(g.get(i)) + ",";
-            }
+        string newCueID = newGroup(g);
 
-        }
+        float duration = ofGetElapsedTimef() - start;
+        size_t created = createdCount - createdBefore;
+        ofLogNotice("qLabController") << "Created " << created << " cues in " << duration << "s"
+        << " (" << (duration > 0 ? created / duration : 0) << " cues/s)"
+        << ", latency p50 " << getLatencyPercentile(0.5) * 1000.0 << "ms"
+        << " p99 " << getLatencyPercentile(0.99) * 1000.0 << "ms"
+        << " max " << getLatencyPercentile(1.0) * 1000.0 << "ms"
+        << ", " << timeoutCount << " timeouts";
 
-        ////////////
-        // select children before creating group
+        return newCueID;
+    }
 
-        // remove trailing comma:
-        selectionString = selectionString.substr(0, selectionString.size()-1);
-        
-        ofxOscMessage mMessageType;
-        mMessageType.setAddress("/select_id/" + selectionString);
-        oscSender.sendMessage(mMessageType, false);
+    void startCue(const string & cueNumber){
+        ofxOscMessage mStart;
+        mStart.setAddress("/cue/" + cueNumber + "/start");
+        send(mStart);
+    }
 
-        ////////////
-        // create group for selected cues
+    // seconds from sending /new to its reply over the most recent requests, p in [0, 1]
+    float getLatencyPercentile(float p){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        if(latencies.empty()) return 0;
+        vector<float> sorted(latencies.begin(), latencies.end());
+        size_t i = std::min(sorted.size()-1, size_t(p * (sorted.size()-1) + 0.5));
+        std::nth_element(sorted.begin(), sorted.begin()+i, sorted.end());
+        return sorted[i];
+    }
 
-        ofxOscMessage mNewGroup;
-        mNewGroup.setAddress("/new");
-        mNewGroup.addStringArg("group");
-        oscSender.sendMessage(mNewGroup, false);
-
-        start = ofGetElapsedTimef();
-        while((!oscReceiver.hasWaitingMessages()) && (ofGetElapsedTimef()-start < TIMEOUT));
-        
-        while(oscReceiver.hasWaitingMessages()) {
-            
-            ofxOscMessage msg;
-            oscReceiver.getNextMessage(msg);
-            
-            vector<string> address = ofSplitString(msg.getAddress(),"/",true);
-
-            if(address[0] == "reply" && address[address.size()-1] == "new"){
-                try{
-                    json = ofJson::parse(msg.getArgAsString(0));
-                }catch(std::exception & e){
-                    ofLogError("newGroupWithOscCuesFromParameterGroup") << "Error parsing json from " << msg.getArgAsString(0) << ": " << e.what();
-                }catch(...){
-                    ofLogError("newGroupWithOscCuesFromParameterGroup") << "Error parsing json from " << msg.getArgAsString(0);
-                }
-                
-                if(json.find(std::string("data")) != json.end()){
-                    string newCueID = json["data"].get<std::string>();
-                    
-                    ofxOscMessage mMode;
-                    mMode.setAddress("/cue/selected/mode");
-                    mMode.addIntArg(3);
-                    oscSender.sendMessage(mMode, false);
-                    
-                    ofxOscMessage mDisplayName;
-                    mDisplayName.setAddress("/cue/selected/name");
-                    mDisplayName.addStringArg(g.getName());
-                    //mDisplayName.addStringArg(g.getName() + " " + newCueID);
-                    oscSender.sendMessage(mDisplayName, false);
-                    
-                    ofxOscMessage mColorName;
-                    mColorName.setAddress("/cue/selected/colorName");
-                    mColorName.addStringArg("grey");
-                    oscSender.sendMessage(mColorName, false);
-                    
-                    ofxOscMessage mDeleteDummy;
-                    mDeleteDummy.setAddress("/delete_id/" + dummyID);
-                    oscSender.sendMessage(mDeleteDummy, false);
-
-                    // cout << g.getName() << " " << newCueID << ": "  << selectionString << endl;
-                    
-                    return newCueID;
-                    
-                } else {
-                    ofLogNotice("qLabController::newGroup") << "Failed to parse JSON.";
-                }
-            }
-        }
-        return "";
+    size_t getCreatedCount(){
+        return createdCount;
+    }
+
+    size_t getTimeoutCount(){
+        return timeoutCount;
+    }
+
+    // /new requests that went out
+    size_t getSentCount(){
+        return sentCount;
+    }
+
+    // replies that came after their request timed out, and were dropped
+    size_t getLateReplyCount(){
+        return lateReplyCount;
+    }
+
+    void resetStats(){
+        std::lock_guard<std::mutex> lock(statsMutex);
+        latencies.clear();
+        sentCount = 0;
+        createdCount = 0;
+        timeoutCount = 0;
+        lateReplyCount = 0;
     }
-    
+
     string findOscAddress(const ofAbstractParameter& p) {
-        
+
         string a("/");
         vector<string> h = p.getGroupHierarchyNames();
-        
+
         for( auto s : h) {
             a += s;
             if (s != h.back()) a += "/";
@@ -245,5 +203,206 @@ public:
         }
         return a;
     }
-    
+
+protected:
+
+    struct Request {
+        std::promise<string> promise;
+        std::function<void(const string &)> onCreated;
+        float sent;
+        float deadline;
+    };
+
+    void threadedFunction(){
+        while(isThreadRunning()){
+            bool received = false;
+            while(oscReceiver.hasWaitingMessages()){
+                ofxOscMessage msg;
+                oscReceiver.getNextMessage(msg);
+                handleMessage(msg);
+                received = true;
+            }
+            expireRequests();
+            if(!received) sleep(1);
+        }
+        // nobody will answer anymore
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        for(auto & request : pending){
+            request.promise.set_value("");
+        }
+        pending.clear();
+        slotFree.notify_all();
+    }
+
+    void handleMessage(ofxOscMessage & msg){
+
+        vector<string> address = ofSplitString(msg.getAddress(),"/",true);
+
+        if(address.size() < 2 || address[0] != "reply" || address[address.size()-1] != "new"){
+            ofLogVerbose("qLabController") << msg.getAddress();
+            return;
+        }
+
+        Request request;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            lastReply = ofGetElapsedTimef();
+            if(stragglers > 0){
+                // the reply of a request that timed out, it comes before the others
+                stragglers--;
+                lateReplyCount++;
+                ofLogWarning("qLabController") << "Dropped a late reply " << msg.getAddress();
+                if(stragglers == 0) slotFree.notify_all();
+                return;
+            }
+            if(pending.empty()){
+                ofLogWarning("qLabController") << "Reply without request (timed out?) " << msg.getAddress();
+                return;
+            }
+            request = std::move(pending.front());
+            pending.pop_front();
+        }
+        slotFree.notify_all();
+
+        string newCueID = "";
+        try{
+            ofJson json = ofJson::parse(msg.getArgAsString(0));
+            if(json.find(std::string("data")) != json.end()){
+                newCueID = json["data"].get<string>();
+            }
+        }catch(std::exception & e){
+            ofLogError("qLabController") << "Error parsing json from " << msg.getArgAsString(0) << ": " << e.what();
+        }catch(...){
+            ofLogError("qLabController") << "Error parsing json from " << msg.getArgAsString(0);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            latencies.push_back(ofGetElapsedTimef() - request.sent);
+            if(latencies.size() > 1000) latencies.pop_front();
+        }
+
+        if(!newCueID.empty()){
+            createdCount++;
+            if(request.onCreated) request.onCreated(newCueID);
+        }
+        request.promise.set_value(newCueID);
+    }
+
+    void expireRequests(){
+        float now = ofGetElapsedTimef();
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        // deadlines grow along the queue
+        while(!pending.empty() && pending.front().deadline < now){
+            ofLogError("qLabController") << "No reply from QLab within " << TIMEOUT << "s";
+            pending.front().promise.set_value("");
+            pending.pop_front();
+            timeoutCount++;
+            stragglers++;
+            lastTimeout = now;
+        }
+        // nothing in flight and nothing heard for a while, those replies are lost
+        if(stragglers > 0 && pending.empty() && now - fmax(lastTimeout, lastReply) > TIMEOUT){
+            ofLogWarning("qLabController") << stragglers << " late replies never came";
+            stragglers = 0;
+            slotFree.notify_all();
+        }
+    }
+
+    void send(ofxOscMessage & msg){
+        std::lock_guard<std::mutex> lock(sendMutex);
+        oscSender.sendMessage(msg, false);
+    }
+
+    string newGroup(const ofParameterGroup & g){
+
+        ////////////
+        // create a dummy cue, QLab inserts new cues after the selection
+
+        string dummyID = newCue("memo").get();
+
+        ////////////
+        // create cues for children, leaf cues are all in flight at once
+
+        vector<std::shared_future<string>> children;
+
+        for(std::size_t i=0;i<g.size();i++){
+            if(g.getType(i)==typeid(ofParameterGroup).name()){
+                // a sub group selects its own children, so everything before it has to exist
+                for(auto & child : children) child.wait();
+                std::promise<string> subGroup;
+                subGroup.set_value(newGroup(g.getGroup(i)));
+                children.push_back(subGroup.get_future().share());
+            } else {
+                if(g.get(i).getName() != "add to qlab")
+                    children.push_back(newOscCueFromParameterAsync(g.get(i)));
+            }
+        }
+
+        ////////////
+        // select children before creating group
+
+        string selectionString = dummyID;
+        for(auto & child : children){
+            string id = child.get();
+            if(id.empty()) continue;
+            if(!selectionString.empty()) selectionString += ",";
+            selectionString += id;
+        }
+        ofLogVerbose("newGroupWithOscCuesFromParameterGroup") << selectionString << " " << dummyID;
+
+        ofxOscMessage mSelect;
+        mSelect.setAddress("/select_id/" + selectionString);
+        send(mSelect);
+
+        ////////////
+        // create group for selected cues
+
+        string name = g.getName();
+
+        string newCueID = newCue("group", [this, name, dummyID](const string & newCueID){
+
+            ofxOscMessage mMode;
+            mMode.setAddress("/cue_id/" + newCueID + "/mode");
+            mMode.addIntArg(3);
+            send(mMode);
+
+            ofxOscMessage mDisplayName;
+            mDisplayName.setAddress("/cue_id/" + newCueID + "/name");
+            mDisplayName.addStringArg(name);
+            send(mDisplayName);
+
+            ofxOscMessage mColorName;
+            mColorName.setAddress("/cue_id/" + newCueID + "/colorName");
+            mColorName.addStringArg("grey");
+            send(mColorName);
+
+            if(!dummyID.empty()){
+                ofxOscMessage mDeleteDummy;
+                mDeleteDummy.setAddress("/delete_id/" + dummyID);
+                send(mDeleteDummy);
+            }
+        }).get();
+
+        if(newCueID.empty()){
+            ofLogNotice("qLabController::newGroup") << "Failed to create group " << name;
+        }
+
+        return newCueID;
+    }
+
+    std::deque<Request> pending;
+    size_t stragglers = 0;              // replies still to come for requests that timed out
+    float lastTimeout = 0;
+    float lastReply = 0;
+    std::mutex pendingMutex;
+    std::condition_variable slotFree;
+    std::mutex sendMutex;
+
+    std::deque<float> latencies;
+    std::mutex statsMutex;
+    std::atomic<size_t> sentCount{0};
+    std::atomic<size_t> createdCount{0};
+    std::atomic<size_t> timeoutCount{0};
+    std::atomic<size_t> lateReplyCount{0};
 };
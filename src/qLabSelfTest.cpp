@@ -0,0 +1,6 @@
+//
+//  qLabSelfTest.cpp
+//  realsense-osc-tracker
+//
+
+#include "qLabSelfTest.hpp"
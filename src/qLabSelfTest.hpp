@@ -0,0 +1,374 @@
+//
+//  qLabSelfTest.hpp
+//  realsense-osc-tracker
+//
+//  qLabController against a mock QLab on the loopback, no QLab needed:
+//
+//  realsense-osc-tracker --qlab-selftest [--cues 200] [--port 53535]
+//
+//  qLabMock answers /new with a new cue id the way QLab does, in the order
+//  the requests came, and keeps what the follow-up messages set on every
+//  cue, so the test can tell whether each id went to its own request.
+//  The controller runs through
+//
+//  in order        replies after 1-5 ms
+//  out of order    replies to the follow-up messages and workspace updates
+//                  overtake the /new replies still waiting
+//  group           newGroupWithOscCuesFromParameterGroup() on a nested group
+//  timed out       every 40th reply held back past the timeout, the late
+//                  replies have to be dropped and the controller recover
+//
+//  and prints per scenario cues per second, reply latency p50 and p99,
+//  timeouts, late replies and cues that ended up with another request's
+//  settings. It fails if any did, or a scenario does not behave as above.
+//
+
+#pragma once
+
+#include "ofMain.h"
+#include "ofxOsc.h"
+#include "qLabController.hpp"
+#include <atomic>
+#include <mutex>
+
+class qLabMock : public ofThread {
+public:
+
+    // /new replies go out this long after the request, in request order
+    float minLatency = 0.001;
+    float maxLatency = 0.005;
+    std::atomic<bool> interleave{false};    // answer follow-ups and send updates in between
+    std::atomic<int> stallEvery{0};         // every n'th /new reply is held back by stall seconds
+    std::atomic<float> stall{0};
+
+    struct Cue {
+        string type;
+        map<string, string> properties;     // the last value set per property
+        map<string, int> writes;            // how often each was set
+        vector<string> children;            // selected when a group was made
+        bool deleted = false;
+    };
+
+    ~qLabMock(){
+        close();
+    }
+
+    void setup(int port, int replyPort){
+        close();
+        receiver.setup(port);
+        sender.setup("127.0.0.1", replyPort);
+        startThread();
+    }
+
+    void close(){
+        waitForThread(true);
+    }
+
+    map<string, Cue> getCues(){
+        std::lock_guard<std::mutex> lock(cuesMutex);
+        return cues;
+    }
+
+    // ids in the order the /new requests came
+    vector<string> getCreated(){
+        std::lock_guard<std::mutex> lock(cuesMutex);
+        return createdIds;
+    }
+
+    void clearCues(){
+        std::lock_guard<std::mutex> lock(cuesMutex);
+        cues.clear();
+        createdIds.clear();
+    }
+
+protected:
+
+    void threadedFunction(){
+        while(isThreadRunning()){
+            bool received = false;
+            while(receiver.hasWaitingMessages()){
+                ofxOscMessage msg;
+                receiver.getNextMessage(msg);
+                handleMessage(msg);
+                received = true;
+            }
+            // the multimap keeps replies due at the same time in order
+            double now = ofGetElapsedTimef();
+            while(!outgoing.empty() && outgoing.begin()->first <= now){
+                sender.sendMessage(outgoing.begin()->second, false);
+                outgoing.erase(outgoing.begin());
+            }
+            if(!received) sleep(1);
+        }
+    }
+
+    void handleMessage(const ofxOscMessage & msg){
+        double now = ofGetElapsedTimef();
+        vector<string> address = ofSplitString(msg.getAddress(), "/", true);
+        if(address.empty()) return;
+
+        if(address[0] == "new" && msg.getNumArgs() > 0){
+            string id = "MOCK-" + ofToString(++created);
+            {
+                std::lock_guard<std::mutex> lock(cuesMutex);
+                Cue & cue = cues[id];
+                cue.type = msg.getArgAsString(0);
+                createdIds.push_back(id);
+                if(cue.type == "group") cue.children = selection;
+            }
+            // QLab works through its messages one at a time
+            double due = now + ofRandom(minLatency, maxLatency);
+            if(stallEvery > 0 && created % stallEvery == 0) due += stall;
+            lastNewReply = fmax(lastNewReply, due);
+            outgoing.insert({lastNewReply, reply(msg.getAddress(), id)});
+        } else if(address[0] == "cue_id" && address.size() >= 3){
+            {
+                std::lock_guard<std::mutex> lock(cuesMutex);
+                Cue & cue = cues[address[1]];
+                string value;
+                if(msg.getNumArgs() > 0){
+                    value = msg.getArgType(0) == OFXOSC_TYPE_INT32 ? ofToString(msg.getArgAsInt32(0)) : msg.getArgAsString(0);
+                }
+                cue.properties[address[2]] = value;
+                cue.writes[address[2]]++;
+            }
+            if(interleave){
+                // ahead of /new replies that are still waiting
+                outgoing.insert({now, reply(msg.getAddress(), "")});
+                ofxOscMessage update;
+                update.setAddress("/update/workspace/MOCK/cue_id/" + address[1]);
+                outgoing.insert({now, update});
+            }
+        } else if(address[0] == "select_id" && address.size() >= 2){
+            selection = ofSplitString(address[1], ",", true, true);
+        } else if(address[0] == "delete_id" && address.size() >= 2){
+            std::lock_guard<std::mutex> lock(cuesMutex);
+            cues[address[1]].deleted = true;
+        }
+    }
+
+    static ofxOscMessage reply(const string & address, const string & data){
+        ofJson json;
+        json["workspace_id"] = "MOCK";
+        json["address"] = address;
+        json["status"] = "ok";
+        if(!data.empty()) json["data"] = data;
+        ofxOscMessage m;
+        m.setAddress("/reply" + address);
+        m.addStringArg(json.dump());
+        return m;
+    }
+
+    ofxOscReceiver receiver;
+    ofxOscSender sender;
+    std::multimap<double, ofxOscMessage> outgoing;
+    double lastNewReply = 0;
+    size_t created = 0;
+    vector<string> selection;
+
+    std::mutex cuesMutex;
+    map<string, Cue> cues;
+    vector<string> createdIds;
+};
+
+class qLabSelfTest {
+public:
+
+    // arguments after --qlab-selftest, returns the exit code
+    static int run(const vector<string> & args){
+        int count = 200;
+        int port = 53535;
+        for(size_t i = 0; i < args.size(); i++){
+            if(i + 1 >= args.size()) return usage();
+            if(args[i] == "--cues"){
+                count = ofClamp(ofToInt(args[++i]), 1, 10000);
+            } else if(args[i] == "--port"){
+                port = ofClamp(ofToInt(args[++i]), 1024, 65000);
+            } else {
+                return usage();
+            }
+        }
+
+        ofResetElapsedTimeCounter();
+        ofLogLevel logLevel = ofGetLogLevel();
+        // every timeout is logged, the scenario that provokes them would drown the results
+        ofSetLogLevel(OF_LOG_FATAL_ERROR);
+
+        qLabMock mock;
+        mock.setup(port, port + 1);
+        qLabController qLab;
+        qLab.setup("127.0.0.1", port, port + 1);
+        int failed = 0;
+
+        Result inOrder = runCues(qLab, mock, "in order", count, 0.2);
+        failed += report(inOrder, inOrder.timeouts == 0);
+
+        mock.interleave = true;
+        Result outOfOrder = runCues(qLab, mock, "out of order", count, 0.2);
+        failed += report(outOfOrder, outOfOrder.timeouts == 0);
+
+        failed += runGroup(qLab, mock);
+
+        // the held back replies come after the controller gave up on them
+        mock.interleave = false;
+        mock.stallEvery = 40;
+        mock.stall = 0.4;
+        qLab.TIMEOUT = 0.25;
+        // until every late reply is in and the window open again
+        Result late = runCues(qLab, mock, "timed out", count, qLab.TIMEOUT * 2 + mock.stall);
+        mock.stallEvery = 0;
+        bool recovered = !qLab.newOscCueFromString("/selftest recovered").empty();
+        // the mock answers every /new it got, so every one that timed out came late
+        failed += report(late, late.timeouts > 0 && late.late == late.sent - late.created && recovered);
+        if(!recovered) std::cout << "  no cue after the late replies" << std::endl;
+
+        ofSetLogLevel(logLevel);
+        return failed > 0 ? 1 : 0;
+    }
+
+private:
+
+    struct Result {
+        string name;
+        size_t cues = 0;
+        size_t sent = 0;            // /new requests that went out
+        size_t created = 0;
+        size_t timeouts = 0;
+        size_t late = 0;
+        size_t mismatched = 0;      // ids with the settings of another request
+        double seconds = 0;
+        float p50 = 0;
+        float p99 = 0;
+    };
+
+    static int usage(){
+        std::cerr << "usage: realsense-osc-tracker --qlab-selftest [--cues 200] [--port 53535]" << std::endl;
+        return 2;
+    }
+
+    // count network cues in flight at once, each has to end up with its own string
+    static Result runCues(qLabController & qLab, qLabMock & mock, const string & name, int count, float settle){
+        Result r;
+        r.name = name;
+        r.cues = count;
+        qLab.resetStats();
+        mock.clearCues();
+
+        vector<std::shared_future<string>> futures;
+        vector<string> strings;
+        vector<int> sentAs;         // the how many'th /new, -1 if it never went out
+        uint64_t start = ofGetElapsedTimeMicros();
+        for(int i = 0; i < count; i++){
+            strings.push_back("/selftest " + ofToString(i));
+            size_t before = qLab.getSentCount();
+            futures.push_back(qLab.newOscCueFromStringAsync(strings.back()));
+            sentAs.push_back(qLab.getSentCount() > before ? int(before) : -1);
+        }
+        vector<string> ids;
+        for(auto & f : futures){
+            ids.push_back(f.get());
+        }
+        r.seconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+        r.created = qLab.getCreatedCount();
+        r.timeouts = qLab.getTimeoutCount();
+        r.p50 = qLab.getLatencyPercentile(0.5);
+        r.p99 = qLab.getLatencyPercentile(0.99);
+
+        // the follow-ups, and late replies, are on their way
+        ofSleepMillis(int(settle * 1000));
+        r.late = qLab.getLateReplyCount();
+        r.sent = qLab.getSentCount();
+        auto cues = mock.getCues();
+        auto created = mock.getCreated();
+        set<string> answered;
+        for(int i = 0; i < count; i++){
+            if(ids[i].empty()) continue;
+            answered.insert(ids[i]);
+            // the id of the cue this request made, not one made for another
+            bool own = sentAs[i] >= 0 && sentAs[i] < int(created.size()) && created[sentAs[i]] == ids[i];
+            auto it = cues.find(ids[i]);
+            if(!own || it == cues.end() || it->second.type != "network" ||
+               it->second.properties["customString"] != strings[i] ||
+               it->second.properties["messageType"] != "2" ||
+               it->second.writes["customString"] != 1){
+                r.mismatched++;
+            }
+        }
+        // settings sent to a cue whose request timed out went to the wrong one
+        for(auto & cue : cues){
+            if(!answered.count(cue.first) && !cue.second.properties.empty()) r.mismatched++;
+        }
+        return r;
+    }
+
+    static int report(const Result & r, bool expected){
+        bool ok = expected && r.mismatched == 0;
+        std::cout << r.name << ": " << r.cues << " cues, " << r.created << " created in " << ofToString(r.seconds, 2) << "s, "
+        << ofToString(r.created / fmax(r.seconds, 1e-6), 0) << " cues/s, latency p50 " << ofToString(r.p50 * 1000.0, 2)
+        << " ms p99 " << ofToString(r.p99 * 1000.0, 2) << " ms, " << r.timeouts << " timeouts, "
+        << r.late << " late replies, " << r.mismatched << " mismatched" << (ok ? "" : "  FAILED") << std::endl;
+        return ok ? 0 : 1;
+    }
+
+    // a group with a nested group, checked cue by cue against the parameters
+    static int runGroup(qLabController & qLab, qLabMock & mock){
+        ofParameterGroup nested;
+        nested.setName("Nested");
+        vector<ofParameter<float>> nestedParameters(10);
+        for(size_t i = 0; i < nestedParameters.size(); i++){
+            nested.add(nestedParameters[i].set("Nested " + ofToString(i), i * 0.5f, 0.0f, 10.0f));
+        }
+        ofParameterGroup group;
+        group.setName("Selftest");
+        vector<ofParameter<float>> parameters(20);
+        for(size_t i = 0; i < parameters.size(); i++){
+            group.add(parameters[i].set("Value " + ofToString(i), i * 0.25f, 0.0f, 10.0f));
+            if(i == 9) group.add(nested);
+        }
+
+        qLab.resetStats();
+        mock.clearCues();
+        Result r;
+        r.name = "group";
+        // a dummy and the group cue for each of the two
+        r.cues = 2 + parameters.size() + 2 + nestedParameters.size();
+        uint64_t start = ofGetElapsedTimeMicros();
+        string id = qLab.newGroupWithOscCuesFromParameterGroup(group);
+        r.seconds = (ofGetElapsedTimeMicros() - start) / 1e6;
+        r.created = qLab.getCreatedCount();
+        r.timeouts = qLab.getTimeoutCount();
+        r.late = qLab.getLateReplyCount();
+        r.p50 = qLab.getLatencyPercentile(0.5);
+        r.p99 = qLab.getLatencyPercentile(0.99);
+
+        ofSleepMillis(200);
+        auto cues = mock.getCues();
+        bool ok = !id.empty() && checkGroup(qLab, cues, id, group, r.mismatched);
+        return report(r, ok);
+    }
+
+    static bool checkGroup(qLabController & qLab, map<string, qLabMock::Cue> & cues, const string & id, const ofParameterGroup & g, size_t & mismatched){
+        auto it = cues.find(id);
+        if(it == cues.end()) return false;
+        auto & cue = it->second;
+        if(cue.type != "group" || cue.properties["mode"] != "3" || cue.properties["name"] != g.getName()){
+            mismatched++;
+        }
+        // the dummy first, then the children in parameter order
+        if(cue.children.size() != g.size() + 1) return false;
+        auto & dummy = cues[cue.children[0]];
+        if(dummy.type != "memo" || !dummy.deleted){
+            mismatched++;
+        }
+        bool ok = true;
+        for(size_t i = 0; i < g.size(); i++){
+            const string & childId = cue.children[i + 1];
+            if(g.getType(i) == typeid(ofParameterGroup).name()){
+                ok = checkGroup(qLab, cues, childId, g.getGroup(i), mismatched) && ok;
+            } else if(cues[childId].properties["customString"] != qLab.findOscAddress(g.get(i))){
+                mismatched++;
+            }
+        }
+        return ok;
+    }
+};